@@ -69,8 +69,74 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define SLACK_TEST_TIMERS 64
+
+struct slack_test_timer {
+    timer_t timer;
+    lk_time_t deadline;
+    lk_time_t fired;
+};
+
+static volatile int slack_test_pending;
+
+static enum handler_return slack_test_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    struct slack_test_timer* t = (struct slack_test_timer*)arg;
+    t->fired = now;
+    __atomic_fetch_sub(&slack_test_pending, 1, __ATOMIC_RELEASE);
+
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_slack(void)
+{
+    static struct slack_test_timer timers[SLACK_TEST_TIMERS];
+    lk_time_t base = current_time() + LK_MSEC(10);
+
+    // Queue the timers in a scrambled order with a mix of slack, then cancel
+    // every fourth one, to churn the heap.
+    thread_set_pinned_cpu(get_current_thread(), 0);
+    thread_yield();
+    slack_test_pending = SLACK_TEST_TIMERS - SLACK_TEST_TIMERS / 4;
+    for (uint i = 0; i < SLACK_TEST_TIMERS; i++) {
+        uint n = (i * 37) % SLACK_TEST_TIMERS;
+        struct slack_test_timer* t = &timers[n];
+        timer_init(&t->timer);
+        t->deadline = base + LK_USEC(500) * n;
+        t->fired = 0;
+        timer_set(&t->timer, t->deadline, (n % 3) ? LK_MSEC(n % 3) : 0, slack_test_cb, t);
+    }
+    for (uint i = 0; i < SLACK_TEST_TIMERS; i += 4) {
+        if (!timer_cancel(&timers[i].timer))
+            printf("timer %u could not be canceled\n", i);
+    }
+
+    while (__atomic_load_n(&slack_test_pending, __ATOMIC_ACQUIRE) > 0)
+        thread_sleep_relative(LK_MSEC(5));
+
+    uint bad = 0;
+    for (uint i = 0; i < SLACK_TEST_TIMERS; i++) {
+        struct slack_test_timer* t = &timers[i];
+        if (i % 4 == 0) {
+            if (t->fired != 0) {
+                printf("canceled timer %u fired\n", i);
+                bad++;
+            }
+        } else if (t->fired < t->deadline) {
+            printf("timer %u fired %" PRIu64 " ns early\n", i, t->deadline - t->fired);
+            bad++;
+        }
+    }
+    thread_set_pinned_cpu(get_current_thread(), -1);
+    printf("slack test: %u timers fired, %u bad\n",
+           SLACK_TEST_TIMERS - SLACK_TEST_TIMERS / 4, bad);
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
     timer_test_all_cpus();
+
+    // timers with slack fire in their window and cancel cleanly
+    timer_test_slack();
 }
@@ -26,4 +26,11 @@ status_t _arm64_copy_to_user(
         size_t len,
         void **fault_return);
 
+status_t _arm64_cmpxchg_user(
+        int *ptr,
+        int expected,
+        int desired,
+        int *actual,
+        void **fault_return);
+
 __END_CDECLS
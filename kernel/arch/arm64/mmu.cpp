@@ -354,6 +354,62 @@ static bool page_table_is_clear(volatile pte_t* page_table, uint page_size_shift
     return true;
 }
 
+// Replaces the block descriptor at |page_table|[|index|], which maps the block
+// starting at |block_vaddr|, with a page table of the next level down that maps
+// the same memory with the same attributes, so that part of the block can be
+// unmapped or have its permissions changed.
+static status_t arm64_mmu_split_block(arch_aspace_t* aspace, vaddr_t block_vaddr,
+                                      uint index_shift, uint page_size_shift,
+                                      volatile pte_t* page_table, vaddr_t index, uint asid) {
+    pte_t pte = page_table[index];
+
+    DEBUG_ASSERT(index_shift > page_size_shift);
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    paddr_t page_table_paddr;
+    status_t ret = alloc_page_table(aspace, &page_table_paddr, page_size_shift);
+    if (ret) {
+        TRACEF("failed to allocate page table\n");
+        return ret;
+    }
+    volatile pte_t* next_page_table =
+        static_cast<volatile pte_t*>(paddr_to_kvaddr(page_table_paddr));
+
+    const uint next_index_shift = index_shift - (page_size_shift - 3);
+    const paddr_t block_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    if (next_index_shift > page_size_shift)
+        attrs |= MMU_PTE_L012_DESCRIPTOR_BLOCK;
+    else
+        attrs |= MMU_PTE_L3_DESCRIPTOR_PAGE;
+
+    const size_t count = 1UL << (page_size_shift - 3);
+    for (size_t i = 0; i < count; i++) {
+        next_page_table[i] = (block_paddr + (i << next_index_shift)) | attrs;
+    }
+
+    __asm__ volatile("dmb ishst" ::
+                         : "memory");
+
+    // Changing the size of a mapping requires break-before-make: the block has
+    // to be gone from every tlb before the table can take its place.
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    DSB;
+    if (asid == MMU_ARM64_GLOBAL_ASID)
+        ARM64_TLBI(vaae1is, block_vaddr >> 12);
+    else
+        ARM64_TLBI(vae1is, block_vaddr >> 12 | (vaddr_t)asid << 48);
+    DSB;
+
+    page_table[index] = page_table_paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+    LTRACEF("split block at %#" PRIxPTR ", pte %p[%#" PRIxPTR "] = %#" PRIx64 "\n",
+            block_vaddr, page_table, index, page_table[index]);
+    __asm__ volatile("dmb ishst" ::
+                         : "memory");
+
+    return MX_OK;
+}
+
 static ssize_t arm64_mmu_unmap_pt(arch_aspace_t* aspace, vaddr_t vaddr,
                                   vaddr_t vaddr_rel, size_t size,
                                   uint index_shift, uint page_size_shift,
@@ -367,6 +423,7 @@ static ssize_t arm64_mmu_unmap_pt(arch_aspace_t* aspace, vaddr_t vaddr,
     pte_t pte;
     paddr_t page_table_paddr;
     size_t unmap_size;
+    ssize_t ret;
 
     LTRACEF("vaddr 0x%lx, vaddr_rel 0x%lx, size 0x%lx, index shift %u, page_size_shift %u, page_table %p\n",
             vaddr, vaddr_rel, size, index_shift, page_size_shift, page_table);
@@ -381,14 +438,30 @@ static ssize_t arm64_mmu_unmap_pt(arch_aspace_t* aspace, vaddr_t vaddr,
 
         pte = page_table[index];
 
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            // Only part of the block is being unmapped, so split it first.
+            // Unmapping the whole block instead would drop pages that are
+            // not being unmapped, which not every mapping can fault back in.
+            ret = arm64_mmu_split_block(aspace, vaddr - vaddr_rem, index_shift, page_size_shift,
+                                        page_table, index, asid);
+            if (ret != 0) {
+                return ret;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = static_cast<volatile pte_t*>(paddr_to_kvaddr(page_table_paddr));
-            arm64_mmu_unmap_pt(aspace, vaddr, vaddr_rem, chunk_size,
-                               index_shift - (page_size_shift - 3),
-                               page_size_shift,
-                               next_page_table, asid);
+            ret = arm64_mmu_unmap_pt(aspace, vaddr, vaddr_rem, chunk_size,
+                                     index_shift - (page_size_shift - 3),
+                                     page_size_shift,
+                                     next_page_table, asid);
+            if (ret < 0) {
+                return ret;
+            }
             if (chunk_size == block_size ||
                 page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
@@ -503,7 +576,7 @@ err:
     return MX_ERR_INTERNAL;
 }
 
-static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
+static int arm64_mmu_protect_pt(arch_aspace_t* aspace, vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                 size_t size_in, pte_t attrs,
                                 uint index_shift, uint page_size_shift,
                                 volatile pte_t* page_table, uint asid) {
@@ -539,11 +612,22 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            // Only part of the block is changing, so split it first.
+            ret = arm64_mmu_split_block(aspace, vaddr - vaddr_rem, index_shift, page_size_shift,
+                                        page_table, index, asid);
+            if (ret != 0) {
+                goto err;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = static_cast<volatile pte_t*>(paddr_to_kvaddr(page_table_paddr));
-            ret = arm64_mmu_protect_pt(vaddr, vaddr_rem, chunk_size,
+            ret = arm64_mmu_protect_pt(aspace, vaddr, vaddr_rem, chunk_size,
                                        attrs,
                                        index_shift - (page_size_shift - 3),
                                        page_size_shift,
@@ -638,7 +722,7 @@ static ssize_t arm64_mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, size_t size
     return ret;
 }
 
-static status_t arm64_mmu_protect(vaddr_t vaddr, size_t size, pte_t attrs,
+static status_t arm64_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t size, pte_t attrs,
                              vaddr_t vaddr_base, uint top_size_shift,
                              uint top_index_shift, uint page_size_shift,
                              volatile pte_t* top_page_table, uint asid) {
@@ -660,7 +744,7 @@ static status_t arm64_mmu_protect(vaddr_t vaddr, size_t size, pte_t attrs,
         return MX_ERR_INVALID_ARGS;
     }
 
-    status_t ret = arm64_mmu_protect_pt(vaddr, vaddr_rel, size, attrs,
+    status_t ret = arm64_mmu_protect_pt(aspace, vaddr, vaddr_rel, size, attrs,
                            top_index_shift, page_size_shift, top_page_table, asid);
     DSB;
     return ret;
@@ -767,14 +851,14 @@ static status_t arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t co
 
     int ret;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
-        ret = arm64_mmu_protect(vaddr, count * PAGE_SIZE,
+        ret = arm64_mmu_protect(aspace, vaddr, count * PAGE_SIZE,
                                 mmu_flags_to_pte_attr(flags),
                                 ~0UL << MMU_KERNEL_SIZE_SHIFT, MMU_KERNEL_SIZE_SHIFT,
                                 MMU_KERNEL_TOP_SHIFT, MMU_KERNEL_PAGE_SIZE_SHIFT,
                                 aspace->tt_virt,
                                 MMU_ARM64_GLOBAL_ASID);
     } else {
-        ret = arm64_mmu_protect(vaddr, count * PAGE_SIZE,
+        ret = arm64_mmu_protect(aspace, vaddr, count * PAGE_SIZE,
                                 mmu_flags_to_pte_attr(flags),
                                 0, MMU_USER_SIZE_SHIFT,
                                 MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
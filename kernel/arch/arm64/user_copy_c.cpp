@@ -46,3 +46,15 @@ status_t arch_copy_to_user(void *dst, const void *src, size_t len)
             _arm64_copy_to_user(dst, src, len, &thr->arch.data_fault_resume);
     return status;
 }
+
+status_t arch_cmpxchg_user(int *ptr, int expected, int desired, int *actual)
+{
+    if (!IS_ALIGNED(ptr, sizeof(int)) || !is_user_address_range((vaddr_t)ptr, sizeof(int))) {
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    thread_t *thr = get_current_thread();
+    status_t status = _arm64_cmpxchg_user(ptr, expected, desired, actual,
+                                          &thr->arch.data_fault_resume);
+    return status;
+}
@@ -7,6 +7,7 @@
 #include <arch/ops.h>
 #include <arch/x86/cpu_topology.h>
 #include <arch/x86/feature.h>
+#include <kernel/mp.h>
 #include <pow2.h>
 #include <bits.h>
 #include <stdio.h>
@@ -25,11 +26,17 @@ static uint32_t core_shift = 0;
 static uint32_t package_mask = ~0;
 static uint32_t package_shift = 0;
 
+// Apic ids that only differ below this bit share a last level cache. If the
+// caches can't be enumerated, each package is assumed to share one.
+static uint32_t cache_shift = 0;
+static bool cache_shift_valid = false;
+
 static int initialized;
 
 static void legacy_topology_init(void);
 static void modern_intel_topology_init(void);
 static void extended_amd_topology_init(void);
+static void cache_topology_init(void);
 
 void x86_cpu_topology_init(void)
 {
@@ -44,6 +51,8 @@ void x86_cpu_topology_init(void)
     } else {
         legacy_topology_init();
     }
+
+    cache_topology_init();
 }
 
 static void modern_intel_topology_init(void)
@@ -144,6 +153,47 @@ static void legacy_topology_init(void)
     core_mask = ~package_mask ^ smt_mask;
 }
 
+static void cache_topology_init(void)
+{
+    // Intel's deterministic cache parameters leaf and AMD's cache properties
+    // leaf share a layout: one subleaf per cache, each with the number of
+    // logical processors sharing that cache.
+    enum x86_cpuid_leaf_num leaf_num;
+    if (x86_vendor == X86_VENDOR_INTEL) {
+        leaf_num = X86_CPUID_CACHE_V2;
+    } else if (x86_vendor == X86_VENDOR_AMD && x86_feature_test(X86_FEATURE_AMD_TOPO)) {
+        leaf_num = X86_CPUID_AMD_CACHE;
+    } else {
+        return;
+    }
+
+    uint32_t max_level = 0;
+    uint32_t max_sharing = 0;
+    struct cpuid_leaf leaf;
+    for (uint32_t i = 0; i < 16 && x86_get_cpuid_subleaf(leaf_num, i, &leaf); ++i) {
+        uint32_t type = BITS(leaf.a, 4, 0);
+        if (type == 0) {
+            // no more caches
+            break;
+        }
+        uint32_t level = BITS_SHIFT(leaf.a, 7, 5);
+        if (level >= max_level) {
+            max_level = level;
+            max_sharing = BITS_SHIFT(leaf.a, 25, 14) + 1;
+        }
+    }
+
+    if (max_level == 0) {
+        return;
+    }
+
+    cache_shift = log2_uint_ceil(max_sharing);
+    cache_shift_valid = true;
+
+    LTRACEF("last level cache L%u shared by %u, cache_shift %u\n",
+            max_level, max_sharing, cache_shift);
+}
+
 void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t *topo) {
     memset(topo, 0, sizeof(*topo));
 
@@ -153,4 +203,29 @@ void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t *topo) {
     topo->package_id = (apic_id & package_mask) >> package_shift;
     topo->core_id = (apic_id & core_mask) >> core_shift;
     topo->smt_id = apic_id & smt_mask;
+    topo->cache_id = cache_shift_valid ? (apic_id >> cache_shift) : topo->package_id;
+}
+
+void x86_cpu_topology_publish(const uint32_t *apic_ids, uint num_cpus)
+{
+    DEBUG_ASSERT(num_cpus <= SMP_MAX_CPUS);
+
+    x86_cpu_topology_t topo[SMP_MAX_CPUS];
+    for (uint i = 0; i < num_cpus; ++i) {
+        x86_cpu_topology_decode(apic_ids[i], &topo[i]);
+    }
+
+    for (uint i = 0; i < num_cpus; ++i) {
+        mp_cpu_mask_t core_siblings = 0;
+        mp_cpu_mask_t cache_siblings = 0;
+        for (uint j = 0; j < num_cpus; ++j) {
+            if (topo[j].package_id == topo[i].package_id && topo[j].core_id == topo[i].core_id) {
+                core_siblings |= (1u << j);
+            }
+            if (topo[j].cache_id == topo[i].cache_id) {
+                cache_siblings |= (1u << j);
+            }
+        }
+        mp_set_cpu_topology(i, core_siblings, cache_siblings);
+    }
 }
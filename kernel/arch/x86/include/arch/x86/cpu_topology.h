@@ -16,9 +16,15 @@ typedef struct {
     uint32_t package_id;
     uint32_t core_id;
     uint32_t smt_id;
+    // cpus with the same cache_id share a last level cache
+    uint32_t cache_id;
 } x86_cpu_topology_t;
 
 void x86_cpu_topology_init(void);
 void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t *topo);
 
+// Tells the scheduler which cpus share a core and a last level cache.
+// |apic_ids| is indexed by cpu number.
+void x86_cpu_topology_publish(const uint32_t *apic_ids, uint num_cpus);
+
 __END_CDECLS
@@ -28,4 +28,12 @@ status_t _x86_copy_to_user(
         bool smap_avail,
         void **fault_return);
 
+status_t _x86_cmpxchg_user(
+        int *ptr,
+        int expected,
+        int desired,
+        int *actual,
+        bool smap_avail,
+        void **fault_return);
+
 __END_CDECLS
@@ -17,6 +17,7 @@
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
 #include <kernel/mp.h>
+#include <kernel/stats.h>
 #include <kernel/vm.h>
 #include <kernel/vm/arch_vm_aspace.h>
 #include <kernel/vm/pmm.h>
@@ -124,69 +125,139 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+/* Maximum number of pages a single shootdown will invalidate one at a time.
+ * Beyond this it is cheaper for each target CPU to flush its entire TLB. */
+static const size_t kMaxPendingTlbInvalidations = 32;
+
+/**
+ * @brief A batch of TLB invalidations for one page table operation
+ *
+ * Invalidations are queued while the page tables are being modified and
+ * issued together by x86_tlb_invalidate() once the operation is done, so that
+ * unmapping or protecting a large range costs a single round of IPIs rather
+ * than one per page.  Page tables unlinked by the operation are held here as
+ * well, since other CPUs may keep walking them until the flush completes.
+ */
+struct PendingTlbInvalidation {
+    PendingTlbInvalidation() {
+        list_initialize(&freed_tables);
+    }
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(count == 0 && !full_shootdown);
+        DEBUG_ASSERT(list_is_empty(&freed_tables));
+    }
+
+    void enqueue(vaddr_t vaddr, enum page_table_levels level, bool is_global) {
+        /* A top level entry may have global pages beneath it */
+        if (is_global || level == PML4_L)
+            contains_global = true;
+
+        if (full_shootdown)
+            return;
+        if (level == PML4_L || count == kMaxPendingTlbInvalidations) {
+            full_shootdown = true;
+            return;
+        }
+        vaddrs[count++] = vaddr;
+    }
+
+    void free_table(volatile pt_entry_t* table) {
+        vm_page_t* page = paddr_to_vm_page(X86_VIRT_TO_PHYS(table));
+        list_add_tail(&freed_tables, &page->free.node);
+    }
+
+    bool empty() const {
+        return count == 0 && !full_shootdown;
+    }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+    }
+
+    vaddr_t vaddrs[kMaxPendingTlbInvalidations];
+    size_t count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+    struct list_node freed_tables;
+};
+
+/* Task used for invalidating a batch of TLB entries on each CPU */
+struct tlb_invalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    tlb_invalidate_context* context = (tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    if (context->target_cr3 != cr3 && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            x86_set_cr3(cr3);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pending->count; ++i) {
+        const vaddr_t vaddr = pending->vaddrs[i];
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)vaddr));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of queued TLB invalidations
  *
- * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * Issues a single cross-CPU call covering every entry in |pending|, then frees
+ * any page tables the batch was holding and empties it.
  *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
+ * @param pending The invalidations to perform
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static void x86_tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+    if (!pending->empty()) {
+        ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
+        struct tlb_invalidate_context task_context = {
+            .target_cr3 = cr3, .pending = pending,
+        };
+
+        /* Target only CPUs this aspace is active on.  It may be the case that some
+         * other CPU will become active in it after this load, or will have left it
+         * just before this load.  In the former case, it is becoming active after
+         * the write to the page table, so it will see the change.  In the latter
+         * case, it will get a spurious request to flush. */
+        mp_cpu_mask_t targets;
+        if (pending->contains_global || aspace == nullptr) {
+            targets = MP_CPU_ALL;
+        } else {
+            targets = atomic_load(&aspace->active_cpus);
+            static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        }
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == nullptr) {
-        targets = MP_CPU_ALL;
-    } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        CPU_STATS_INC(tlb_shootdowns);
+        if (pending->full_shootdown) {
+            CPU_STATS_INC(tlb_full_flushes);
+        } else {
+            __atomic_fetch_add(&get_local_percpu()->stats.tlb_shootdown_pages, pending->count,
+                               __ATOMIC_RELAXED);
+        }
+
+        mp_sync_exec(targets, tlb_invalidate_task, &task_context);
     }
 
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+    if (!list_is_empty(&pending->freed_tables)) {
+        pmm_free(&pending->freed_tables);
+    }
+    pending->clear();
 }
 
 template <int Level>
@@ -374,10 +445,11 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue the invalidation of a single page at a given page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate_page(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                    vaddr_t vaddr, bool global_page) {
+        pending->enqueue(vaddr, Base::level, global_page);
     }
 };
 
@@ -425,9 +497,10 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue the invalidation of a single page at a given page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate_page(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                    vaddr_t vaddr, bool global_page) {
         // TODO(abdulla): Implement this.
     }
 };
@@ -505,8 +578,8 @@ struct MappingCursor {
 };
 
 template <typename PageTable>
-static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte,
-                         paddr_t paddr, arch_flags_t flags) {
+static void update_entry(arch_aspace_t* aspace, PendingTlbInvalidation* pending, vaddr_t vaddr,
+                         volatile pt_entry_t* pte, paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -515,23 +588,24 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry
     /* set the new entry */
     *pte = paddr | flags | X86_MMU_PG_P;
 
-    /* attempt to invalidate the page */
+    /* queue an invalidation of the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(aspace, pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
 template <typename PageTable>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte) {
+static void unmap_entry(arch_aspace_t* aspace, PendingTlbInvalidation* pending, vaddr_t vaddr,
+                        volatile pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
 
     *pte = 0;
 
-    /* attempt to invalidate the page */
+    /* queue an invalidation of the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(aspace, pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
@@ -555,7 +629,8 @@ static volatile pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_entry_t* pte) {
+static status_t x86_mmu_split(arch_aspace_t* aspace, PendingTlbInvalidation* pending, vaddr_t vaddr,
+                              volatile pt_entry_t* pte) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -576,14 +651,15 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, volatile pt_
         volatile pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<typename PageTable::LowerTable>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<typename PageTable::LowerTable>(aspace, pending, new_vaddr, e, new_paddr,
+                                                     flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    update_entry<PageTable>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<PageTable>(aspace, pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     aspace->pt_pages++;
     return MX_OK;
 }
@@ -700,7 +776,8 @@ static void x86_skip_entry(MappingCursor* cursor) {
  * @return true if at least one page was unmapped at this level
  */
 template <typename PageTable>
-static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
+static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                   volatile pt_entry_t* table,
                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
@@ -726,7 +803,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(aspace, pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -736,11 +813,11 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<PageTable>(aspace, pending, page_vaddr, e);
             if (status != MX_OK) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(aspace, pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 x86_skip_entry<PageTable>(new_cursor);
@@ -752,7 +829,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         bool lower_unmapped = x86_mmu_remove_mapping<typename PageTable::LowerTable>(
-            aspace, next_table, *new_cursor, &cursor);
+            aspace, pending, next_table, *new_cursor, &cursor);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -772,8 +849,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
             }
         }
         if (unmap_page_table) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<PageTable>(aspace, pending, new_cursor->vaddr, e);
+            pending->free_table(next_table);
             aspace->pt_pages--;
             unmapped = true;
         }
@@ -788,7 +865,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, volatile pt_entry_t* t
 
 // Base case of x86_remove_mapping for smallest page size
 template <typename PageTable>
-static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
+static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                      volatile pt_entry_t* table,
                                       const MappingCursor& start_cursor,
                                       MappingCursor* new_cursor) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
@@ -802,7 +880,7 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         volatile pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+            unmap_entry<PageTable>(aspace, pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -814,18 +892,22 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t
 }
 
 template <>
-bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
+bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace,
+                                             PendingTlbInvalidation* pending,
+                                             volatile pt_entry_t* table,
                                              const MappingCursor& start_cursor,
                                              MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor);
+    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, pending, table, start_cursor,
+                                                      new_cursor);
 }
 
 template <>
 bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
+                                                     PendingTlbInvalidation* pending,
                                                      volatile pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
                                                      MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, start_cursor,
+    return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, pending, table, start_cursor,
                                                               new_cursor);
 }
 
@@ -846,8 +928,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
  * @return MX_ERR_NO_MEMORY if intermediate page tables could not be allocated
  */
 template <typename PageTable>
-static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
-                                    uint mmu_flags,
+static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                    volatile pt_entry_t* table, uint mmu_flags,
                                     const MappingCursor& start_cursor, MappingCursor* new_cursor) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
@@ -877,8 +959,8 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t*
         if (level_supports_large_pages && !IS_PAGE_PRESENT(pt_val) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
-                                    arch_flags | X86_MMU_PG_PS);
+            update_entry<PageTable>(aspace, pending, new_cursor->vaddr, table + index,
+                                    new_cursor->paddr, arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
             new_cursor->vaddr += ps;
@@ -895,15 +977,16 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, volatile pt_entry_t*
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
-                                        interm_arch_flags);
+                update_entry<PageTable>(aspace, pending, new_cursor->vaddr, e,
+                                        X86_VIRT_TO_PHYS(m), interm_arch_flags);
                 pt_val = *e;
                 aspace->pt_pages++;
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<typename PageTable::LowerTable>(
-                aspace, get_next_table_from_entry(pt_val), mmu_flags, *new_cursor, &cursor);
+                aspace, pending, get_next_table_from_entry(pt_val), mmu_flags, *new_cursor,
+                &cursor);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != MX_OK) {
@@ -919,7 +1002,8 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, pending, table, cursor,
+                                                                 &result);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -928,8 +1012,9 @@ err:
 
 // Base case of x86_mmu_add_mapping for smallest page size
 template <typename PageTable>
-static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
-                                       uint mmu_flags, const MappingCursor& start_cursor,
+static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                       volatile pt_entry_t* table, uint mmu_flags,
+                                       const MappingCursor& start_cursor,
                                        MappingCursor* new_cursor) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -945,7 +1030,8 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_
             return MX_ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PageTable>(aspace, new_cursor->vaddr, e, new_cursor->paddr, arch_flags);
+        update_entry<PageTable>(aspace, pending, new_cursor->vaddr, e, new_cursor->paddr,
+                                arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
         new_cursor->vaddr += PAGE_SIZE;
@@ -957,21 +1043,24 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_
 }
 
 template <>
-status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
+status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace,
+                                              PendingTlbInvalidation* pending,
+                                              volatile pt_entry_t* table,
                                               uint mmu_flags, const MappingCursor& start_cursor,
                                               MappingCursor* new_cursor) {
-    return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                   new_cursor);
+    return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, pending, table, mmu_flags,
+                                                   start_cursor, new_cursor);
 }
 
 template <>
 status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
+                                                      PendingTlbInvalidation* pending,
                                                       volatile pt_entry_t* table,
                                                       uint mmu_flags,
                                                       const MappingCursor& start_cursor,
                                                       MappingCursor* new_cursor) {
-    return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                           new_cursor);
+    return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, pending, table, mmu_flags,
+                                                           start_cursor, new_cursor);
 }
 
 /**
@@ -987,8 +1076,8 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
  * completed.  Must be non-null.
  */
 template <typename PageTable>
-static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_t* table,
-                                       uint mmu_flags,
+static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                       volatile pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
                                        MappingCursor* new_cursor) {
     DEBUG_ASSERT(table);
@@ -1017,7 +1106,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e,
+                update_entry<PageTable>(aspace, pending, new_cursor->vaddr, e,
                                         PageTable::paddr_from_pte(pt_val),
                                         arch_flags | X86_MMU_PG_PS);
 
@@ -1028,7 +1117,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<PageTable>(aspace, pending, page_vaddr, e);
             if (ret != MX_OK) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -1037,7 +1126,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor);
+                x86_mmu_remove_mapping<PageTable>(aspace, pending, table, cursor, &tmp_cursor);
 
                 x86_skip_entry<PageTable>(new_cursor);
             }
@@ -1046,8 +1135,8 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, volatile pt_entry_
 
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
-        ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(aspace, next_table, mmu_flags,
-                                                                     *new_cursor, &cursor);
+        ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(
+            aspace, pending, next_table, mmu_flags, *new_cursor, &cursor);
         *new_cursor = cursor;
         if (ret != MX_OK) {
             // Currently this can't happen
@@ -1066,8 +1155,9 @@ err:
 
 // Base case of x86_update_mapping for smallest page size
 template <typename PageTable>
-static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_entry_t* table,
-                                          uint mmu_flags, const MappingCursor& start_cursor,
+static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, PendingTlbInvalidation* pending,
+                                          volatile pt_entry_t* table, uint mmu_flags,
+                                          const MappingCursor& start_cursor,
                                           MappingCursor* new_cursor) {
     static_assert(PageTable::level == PT_L, "x86_mmu_update_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
@@ -1083,8 +1173,8 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_ent
         pt_entry_t pt_val = *e;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(pt_val)) {
-            update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(pt_val),
-                                    arch_flags);
+            update_entry<PageTable>(aspace, pending, new_cursor->vaddr, e,
+                                    PageTable::paddr_from_pte(pt_val), arch_flags);
         }
 
         new_cursor->vaddr += PAGE_SIZE;
@@ -1096,19 +1186,22 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, volatile pt_ent
 }
 
 template <>
-status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, volatile pt_entry_t* table,
+status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace,
+                                                 PendingTlbInvalidation* pending,
+                                                 volatile pt_entry_t* table,
                                                  uint mmu_flags, const MappingCursor& start_cursor,
                                                  MappingCursor* new_cursor) {
-    return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                      new_cursor);
+    return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, pending, table, mmu_flags,
+                                                      start_cursor, new_cursor);
 }
 
 template <>
 status_t x86_mmu_update_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace,
+                                                         PendingTlbInvalidation* pending,
                                                          volatile pt_entry_t* table, uint mmu_flags,
                                                          const MappingCursor& start_cursor,
                                                          MappingCursor* new_cursor) {
-    return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags,
+    return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, pending, table, mmu_flags,
                                                               start_cursor, new_cursor);
 }
 
@@ -1133,8 +1226,11 @@ static status_t mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t cou
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
 
+    PendingTlbInvalidation pending;
     MappingCursor result;
-    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result);
+    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, &pending, aspace->pt_virt, start,
+                                                        &result);
+    x86_tlb_invalidate(aspace, &pending);
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1178,9 +1274,11 @@ static status_t mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, con
     MappingCursor start = {
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    PendingTlbInvalidation pending;
     MappingCursor result;
-    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt,
-                                                                       mmu_flags, start, &result);
+    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(
+        aspace, &pending, aspace->pt_virt, mmu_flags, start, &result);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != MX_OK) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1227,9 +1325,11 @@ static status_t mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count,
     MappingCursor start = {
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    PendingTlbInvalidation pending;
     MappingCursor result;
     status_t status = x86_mmu_update_mapping<PageTable<MAX_PAGING_LEVEL>>(
-        aspace, aspace->pt_virt, mmu_flags, start, &result);
+        aspace, &pending, aspace->pt_virt, mmu_flags, start, &result);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != MX_OK) {
         return status;
     }
@@ -1252,7 +1352,9 @@ void x86_mmu_early_init() {
     x86_mmu_percpu_init();
 
     /* unmap the lower identity mapping */
-    unmap_entry<PageTable<PML4_L>>(nullptr, 0, &pml4[0]);
+    PendingTlbInvalidation pending;
+    unmap_entry<PageTable<PML4_L>>(nullptr, &pending, 0, &pml4[0]);
+    x86_tlb_invalidate(nullptr, &pending);
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
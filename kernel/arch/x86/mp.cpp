@@ -74,6 +74,16 @@ status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count)
     }
 
     x86_num_cpus = cpu_count;
+
+    // let the scheduler know which cpus share cores and caches
+    uint32_t cpu_apic_ids[SMP_MAX_CPUS];
+    DEBUG_ASSERT(cpu_count <= SMP_MAX_CPUS);
+    cpu_apic_ids[0] = bootstrap_ap;
+    for (uint i = 0; i < (uint)cpu_count - 1; ++i) {
+        cpu_apic_ids[i + 1] = ap_percpus[i].apic_id;
+    }
+    x86_cpu_topology_publish(cpu_apic_ids, cpu_count);
+
     return MX_OK;
 }
 
@@ -21,6 +21,8 @@
 extern "C" bool _x86_usercopy_can_read(const void *base, size_t len);
 extern "C" bool _x86_usercopy_can_write(const void *base, size_t len);
 
+static bool can_access(const void *base, size_t len, bool for_write);
+
 static inline bool ac_flag(void)
 {
     return x86_save_flags() & X86_FLAGS_AC;
@@ -52,6 +54,22 @@ status_t arch_copy_to_user(void *dst, const void *src, size_t len)
     return status;
 }
 
+status_t arch_cmpxchg_user(int *ptr, int expected, int desired, int *actual)
+{
+    DEBUG_ASSERT(!ac_flag());
+
+    if (!IS_ALIGNED(ptr, sizeof(int)) || !can_access(ptr, sizeof(int), true))
+        return MX_ERR_INVALID_ARGS;
+
+    bool smap_avail = x86_feature_test(X86_FEATURE_SMAP);
+    thread_t *thr = get_current_thread();
+    status_t status = _x86_cmpxchg_user(ptr, expected, desired, actual, smap_avail,
+                                        &thr->arch.page_fault_resume);
+
+    DEBUG_ASSERT(!ac_flag());
+    return status;
+}
+
 static bool can_access(const void *base, size_t len, bool for_write)
 {
     LTRACEF("can_access: base %p, len %zu\n", base, len);
@@ -39,4 +39,20 @@ status_t arch_copy_from_user(void *dst, const void *src, size_t len);
  */
 status_t arch_copy_to_user(void *dst, const void *src, size_t len);
 
+/*
+ * @brief Atomically compare and exchange an int in userspace
+ *
+ * If *ptr equals expected, replace it with desired.  Either way the value
+ * found at ptr is returned in *actual.  This function validates that
+ * usermode has access to ptr before touching it.
+ *
+ * @param ptr The user address of the value.
+ * @param expected The value ptr must hold for the exchange to happen.
+ * @param desired The value to store.
+ * @param actual Receives the value found at ptr.
+ *
+ * @return MX_OK on success, whether or not the exchange happened
+ */
+status_t arch_cmpxchg_user(int *ptr, int expected, int desired, int *actual);
+
 __END_CDECLS
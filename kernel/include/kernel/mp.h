@@ -78,6 +78,12 @@ struct mp_state {
 
     /* lock for serializing CPU hotplug/unplug operations */
     mutex_t hotplug_lock;
+
+    /* for each cpu, the cpus sharing a core with it and the cpus sharing its
+     * last level cache, both including the cpu itself. set up by the arch
+     * code before the secondary cpus start, read only after that */
+    mp_cpu_mask_t core_siblings[SMP_MAX_CPUS];
+    mp_cpu_mask_t cache_siblings[SMP_MAX_CPUS];
 };
 
 extern struct mp_state mp;
@@ -138,4 +144,17 @@ static inline mp_cpu_mask_t mp_get_realtime_mask(void)
     return mp.realtime_cpus;
 }
 
+/* by default every cpu is a core of its own, and all of them share a cache */
+void mp_set_cpu_topology(uint cpu, mp_cpu_mask_t core_siblings, mp_cpu_mask_t cache_siblings);
+
+static inline mp_cpu_mask_t mp_get_core_siblings(uint cpu)
+{
+    return mp.core_siblings[cpu];
+}
+
+static inline mp_cpu_mask_t mp_get_cache_siblings(uint cpu)
+{
+    return mp.cache_siblings[cpu];
+}
+
 __END_CDECLS;
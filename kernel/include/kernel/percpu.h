@@ -16,12 +16,32 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
-    struct list_node timer_queue;
+    /* per cpu timer queue, a heap ordered by latest firing time */
+    struct timer *timer_heap;
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
 
+    /* per cpu run queue and bitmap of which priorities have threads in them,
+     * protected by the thread lock */
+    struct list_node run_queue[NUM_PRIORITIES];
+    uint32_t run_queue_bitmap;
+
+    /* runnable threads of the deadline class with budget left, earliest
+     * deadline first, protected by the thread lock */
+    struct list_node deadline_queue;
+
+    /* number of threads in this cpu's run queue, including the deadline queue */
+    uint run_queue_len;
+
+    /* share of this cpu reserved by the deadline threads placed on it, in
+     * parts per million, protected by the thread lock */
+    uint64_t deadline_reserved;
+
+    /* the preemption timer is enforcing the budget of a deadline thread
+     * rather than ticking */
+    bool preempt_timer_budget;
+
     /* thread/cpu level statistics */
     struct cpu_stats stats;
 
@@ -21,6 +21,14 @@ void sched_yield(void);
 void sched_preempt(void);
 void sched_reschedule(void);
 
+int sched_effective_priority(const thread_t *t);
+void sched_inherit_priority(thread_t *t, int priority);
+
+status_t sched_set_deadline(thread_t *t, lk_time_t budget, lk_time_t period);
+
+/* move runnable threads off of a cpu that is no longer schedulable */
+void sched_transition_off_cpu(uint old_cpu);
+
 /* the low level reschedule routine, called from the scheduler */
 void _thread_resched_internal(void);
 
@@ -18,11 +18,14 @@ struct cpu_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong migrations; /* threads run here that last ran on another cpu */
+    ulong cache_migrations; /* migrations from a cpu not sharing our last level cache */
 
     /* cpu level interrupts and exceptions */
     ulong interrupts; /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
     ulong timer_ints; /* timer interrupts */
     ulong timers; /* timer callbacks */
+    ulong timers_coalesced; /* timer callbacks run early to share another timer's wakeup */
     ulong page_faults; /* page faults */
     ulong exceptions; /* exceptions such as undefined opcode */
     ulong syscalls;
@@ -30,6 +33,11 @@ struct cpu_stats {
     /* inter-processor interrupts */
     ulong reschedule_ipis;
     ulong generic_ipis;
+
+    /* tlb shootdowns issued by this cpu */
+    ulong tlb_shootdowns;
+    ulong tlb_shootdown_pages; /* pages invalidated individually by a shootdown */
+    ulong tlb_full_flushes; /* shootdowns that flushed the entire tlb instead */
 };
 
 __END_CDECLS
@@ -14,6 +14,7 @@
 #include <arch/defines.h>
 #include <arch/ops.h>
 #include <arch/thread.h>
+#include <kernel/timer.h>
 #include <kernel/wait.h>
 #include <kernel/spinlock.h>
 #include <debug.h>
@@ -84,9 +85,11 @@ typedef struct thread {
 
     int base_priority;
     int priority_boost;
+    int inherited_priority; /* lent by threads blocked on us, -1 if none */
 
     uint last_cpu; /* last/current cpu the thread is running on */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
+    uint queued_cpu; /* cpu whose run queue the thread is in, while it is queued */
 
     /* pointer to the kernel address space this thread is associated with */
     struct vmm_aspace *aspace;
@@ -104,6 +107,21 @@ typedef struct thread {
      * left the scheduler. */
     lk_time_t runtime_ns;
 
+    /* how late the timer of a sleep or a wait with a deadline may fire, so
+     * that it can share a wakeup with other timers */
+    lk_time_t timer_slack;
+
+    /* deadline scheduling class, see sched.c. the thread is in the class while
+     * deadline_budget is nonzero, and runs ahead of every priority while it has
+     * budget left in the current period */
+    lk_time_t deadline_budget;
+    lk_time_t deadline_period;
+    lk_time_t deadline_abs;       /* end of the current period */
+    lk_time_t deadline_remaining; /* budget left in the current period, 0 if throttled */
+    lk_time_t deadline_charged;   /* run time before this has been charged */
+    timer_t deadline_timer;       /* replenishes the budget of a throttled thread */
+    uint deadline_cpu;            /* cpu the budget is reserved on, and which it wakes on */
+
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
 
@@ -190,6 +208,11 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t deadline);
 status_t thread_detach_and_resume(thread_t *t);
 status_t thread_set_real_time(thread_t *t);
 
+/* move a thread into the deadline scheduling class, guaranteeing it budget ns
+ * of cpu time every period ns, or back out of it if budget and period are 0 */
+status_t thread_set_deadline(thread_t *t, lk_time_t budget, lk_time_t period);
+void thread_get_deadline(thread_t *t, lk_time_t *budget, lk_time_t *period);
+
 /* scheduler routines to be used by regular kernel code */
 void thread_yield(void);      /* give up the cpu and time slice voluntarily */
 void thread_preempt(void);    /* get preempted at irq time */
@@ -198,6 +221,13 @@ void thread_reschedule(void); /* revaluate the run queue on the current cpu,
 
 void thread_owner_name(thread_t *t, char out_name[THREAD_NAME_LENGTH]);
 
+/* priority inheritance, thread_lock must be held.
+ * thread_set_inherited_priority raises the effective priority of t to at
+ * least priority, or drops any inherited priority if priority is -1,
+ * requeueing t if it is waiting to run. */
+int thread_effective_priority(const thread_t *t);
+void thread_set_inherited_priority(thread_t *t, int priority);
+
 #define THREAD_BACKTRACE_DEPTH 10
 typedef struct thread_backtrace {
     void* pc[THREAD_BACKTRACE_DEPTH];
@@ -260,6 +290,11 @@ static inline bool thread_is_real_time_or_idle(thread_t *t)
     return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
 }
 
+static inline bool thread_is_deadline(const thread_t *t)
+{
+    return t->deadline_budget != 0;
+}
+
 /* the current thread */
 #include <arch/current_thread.h>
 thread_t *get_current_thread(void);
@@ -24,9 +24,15 @@ typedef enum handler_return (*timer_callback)(struct timer *, lk_time_t now, voi
 
 typedef struct timer {
     int magic;
-    struct list_node node;
+
+    /* links in the per cpu timer heap, see timer.c */
+    struct timer *heap_child;
+    struct timer *heap_next;
+    struct timer *heap_prev;
+    int queue_cpu;           // <0 if not queued
 
     lk_time_t scheduled_time;
+    lk_time_t slack;         // may fire this long after scheduled_time
 
     timer_callback callback;
     void *arg;
@@ -38,8 +44,12 @@ typedef struct timer {
 #define TIMER_INITIAL_VALUE(t) \
 { \
     .magic = TIMER_MAGIC, \
-    .node = LIST_INITIAL_CLEARED_VALUE, \
+    .heap_child = NULL, \
+    .heap_next = NULL, \
+    .heap_prev = NULL, \
+    .queue_cpu = -1, \
     .scheduled_time = 0, \
+    .slack = 0, \
     .callback = NULL, \
     .arg = NULL, \
     .active_cpu = -1, \
@@ -55,6 +65,9 @@ typedef struct timer {
 */
 void timer_init(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t deadline, timer_callback, void *arg);
+/* like timer_set_oneshot(), but the callback may run as late as deadline + slack
+ * so that its wakeup can be shared with other timers */
+void timer_set(timer_t *, lk_time_t deadline, lk_time_t slack, timer_callback, void *arg);
 bool timer_cancel(timer_t *);
 
 void timer_transition_off_cpu(uint old_cpu);
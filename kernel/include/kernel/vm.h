@@ -19,6 +19,12 @@
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+// The span of a single last level page table. Ranges aligned to and as large
+// as this, both virtually and physically, are mapped by the arch mmu code with
+// one large page (x86) or block (arm64) descriptor instead of a page table.
+#define LARGE_PAGE_SIZE_SHIFT (PAGE_SIZE_SHIFT + PAGE_SIZE_SHIFT - 3)
+#define LARGE_PAGE_SIZE (1UL << LARGE_PAGE_SIZE_SHIFT)
+
 // kernel address space
 #ifndef KERNEL_ASPACE_BASE
 #define KERNEL_ASPACE_BASE ((vaddr_t)0x80000000UL)
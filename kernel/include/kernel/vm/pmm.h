@@ -30,6 +30,7 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 // flags for allocation routines below
 #define PMM_ALLOC_FLAG_ANY (0x0)  // no restrictions on which arena to allocate from
 #define PMM_ALLOC_FLAG_KMAP (0x1) // allocate only from arenas marked KMAP
+#define PMM_ALLOC_FLAG_ZERO (0x2) // return a zero filled page, pmm_alloc_page only
 
 // Allocate count pages of physical memory, adding to the tail of the passed list.
 // The list must be initialized.
@@ -37,6 +38,8 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) __NONNULL((3));
 
 // Allocate a single page of physical memory.
+// Single pages are served from a per-cpu cache when possible, and with
+// PMM_ALLOC_FLAG_ZERO from a per-cpu pool of pages zeroed in the background.
 vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa);
 
 // Allocate a specific range of physical pages, adding to the tail of the passed list.
@@ -53,7 +56,7 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t align_log2,
 // Returns the number of pages freed.
 size_t pmm_free(struct list_node* list) __NONNULL((1));
 
-// Helper routine for the above.
+// Free a single page, going through the per-cpu cache.
 size_t pmm_free_page(vm_page_t* page) __NONNULL((1));
 
 // Return count of unallocated physical pages in system
@@ -62,6 +65,26 @@ size_t pmm_count_free_pages(void);
 // Return amount of physical memory in system, in bytes.
 size_t pmm_count_total_bytes(void);
 
+// Memory pressure, from the number of free pages measured against watermarks
+// set at boot. Each level is entered when the free pages drop below its
+// watermark, and left once they climb back a little above it.
+enum pmm_pressure_level {
+    PMM_PRESSURE_NORMAL = 0,
+    PMM_PRESSURE_WARNING,
+    PMM_PRESSURE_CRITICAL,
+};
+
+// Returns the current memory pressure level.
+pmm_pressure_level pmm_get_pressure_level(void);
+
+// Registers the function the pmm-pressure thread calls, with no locks held,
+// each time the pressure level changes. By the time it is called, the
+// contents of unlocked discardable VMOs have already been reclaimed, so the
+// level reported is what that could not relieve. Only one callback can be
+// registered; it is called with the current level soon after registration.
+typedef void (*pmm_pressure_callback_t)(pmm_pressure_level level);
+void pmm_set_pressure_callback(pmm_pressure_callback_t callback);
+
 // Counts the number of pages in every state. For every page in every arena,
 // increments the corresponding VM_PAGE_STATE_*-indexed entry of
 // |state_count|. Does not zero out the entries first.
@@ -476,6 +476,21 @@ private:
     // in Clang around capability aliasing, we need to relax the analysis.
     void ActivateLocked();
 
+    // Called by PageFault() once the page at |va| is present. If the vmo has
+    // the whole naturally aligned large page around |va| and this mapping
+    // covers it, maps it with a single large page, replacing any small pages
+    // already mapped there. Returns whether it did.
+    bool MapLargePageLocked(vaddr_t va, uint64_t vmo_offset);
+
+    // Returns whether this mapping covers the whole naturally aligned large
+    // page around |va|, and lines up with the vmo's large pages there.
+    bool CanMapLargePage(vaddr_t va, uint64_t vmo_offset) const;
+
+    // Called after PageFault() has mapped the page at |va|. Maps pages the
+    // vmo already has in the fault-around window around |va| and, if faults
+    // on this mapping look sequential, faults in the pages ahead of it.
+    void FaultAroundLocked(vaddr_t va, uint pf_flags, uint mmu_flags);
+
     // pointer and region of the object we are mapping
     mxtl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
@@ -485,4 +500,8 @@ private:
 
     // used to detect recursions through the vmo fault path
     bool currently_faulting_ = false;
+
+    // address a sequential stream of faults on this mapping would hit next,
+    // used to decide whether to read ahead
+    vaddr_t next_sequential_va_ = 0;
 };
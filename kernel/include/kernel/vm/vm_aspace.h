@@ -109,6 +109,22 @@ public:
     // Counts memory usage under the VmAspace.
     status_t GetMemoryUsage(vm_usage_t* usage);
 
+    // Page fault counts.
+    struct vm_fault_stats_t {
+        // Faults resolved by a VmMapping in this address space.
+        uint64_t faults;
+
+        // Pages mapped alongside a fault because the VmObject already had
+        // them, each of which would otherwise have taken its own fault.
+        uint64_t fault_around_pages;
+
+        // Pages faulted in ahead of a sequential stream of faults.
+        uint64_t read_ahead_pages;
+    };
+
+    // Returns the page fault counts of the VmAspace.
+    void GetFaultStats(vm_fault_stats_t* stats) const;
+
     size_t AllocatedPages() const;
 
     // Convenience method for traversing the tree of VMARs to find the deepest
@@ -193,6 +209,9 @@ private:
     // Access to this reference is guarded by lock_.
     mxtl::RefPtr<VmAddressRegion> root_vmar_;
 
+    // page fault counts, updated by VmMapping::PageFault() under lock_
+    vm_fault_stats_t fault_stats_ = {};
+
     // PRNG used by VMARs for address choices.  We record the seed to enable
     // reproducible debugging.
     crypto::PRNG aslr_prng_;
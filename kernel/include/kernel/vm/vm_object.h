@@ -162,6 +162,44 @@ public:
         return MX_ERR_NOT_SUPPORTED;
     }
 
+    // Moves the pages backing the page aligned range [offset, offset + len)
+    // out of the vmo and onto the tail of |pages| in offset order, leaving the
+    // range uncommitted. Uncommitted pages in the range are handed out as zero
+    // filled pages. The pages on the list are in the VM_PAGE_STATE_ALLOC state.
+    virtual status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    // Replaces the pages backing the page aligned range [offset, offset + len)
+    // with pages removed from the head of |pages|, which must be in the
+    // VM_PAGE_STATE_ALLOC state. The old pages are freed.
+    virtual status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    // Puts pages that TakePages() moved out of the page aligned range
+    // [offset, offset + len) back, in order, but only at offsets that are
+    // still uncommitted: anything committed since, such as by a write, is
+    // newer than the page taken from there. Pages that do not go back, and
+    // those past the current end of the object, are left on |pages|.
+    virtual status_t RestorePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    // Keeps the kernel from discarding the contents of a discardable object
+    // until a matching UnlockDiscardable(). Locks nest. Sets |*discarded| if
+    // the contents were discarded since the object was last locked, in which
+    // case it now reads as zeroes.
+    virtual status_t LockDiscardable(bool* discarded) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    // Drops a lock taken by LockDiscardable(). Once no locks are left, the
+    // contents may be discarded under memory pressure.
+    virtual status_t UnlockDiscardable() {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
     // Returns true if this VMO was created via CloneCOW().
     // TODO: If more types of clones appear, replace this with a method that
     // returns an enum rather than adding a new method for each clone type.
@@ -174,6 +212,22 @@ public:
         return MX_ERR_NOT_SUPPORTED;
     }
 
+    // If the naturally aligned LARGE_PAGE_SIZE range of the object containing
+    // |offset| is backed by physically contiguous, suitably aligned memory
+    // that may be mapped with the object's full permissions, returns the
+    // physical address of its start so it can be mapped as one large page.
+    virtual status_t GetLargePageLocked(uint64_t offset, paddr_t* pa) TA_REQ(lock_) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
+    // Commits the naturally aligned LARGE_PAGE_SIZE range of the object
+    // containing |offset| as one physically contiguous run, if the object
+    // supports that and has no pages in the range yet. Must be called without
+    // the object's lock, which is not held while the memory is zeroed.
+    virtual status_t CommitLargePage(uint64_t offset) {
+        return MX_ERR_NOT_SUPPORTED;
+    }
+
     Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
@@ -26,7 +26,21 @@
 // the main VM object type, holding a list of pages
 class VmObjectPaged final : public VmObject {
 public:
-    static status_t Create(uint32_t pmm_alloc_flags, uint64_t size, mxtl::RefPtr<VmObject>* vmo);
+    // Create() options.
+    // Commit memory in naturally aligned, physically contiguous runs of
+    // LARGE_PAGE_SIZE where possible, so mappings of the object can use large
+    // pages.
+    static constexpr uint32_t kLargePages = (1u << 0);
+    // While not locked with LockDiscardable(), the kernel may throw away all
+    // of the object's pages to relieve memory pressure. Objects start out
+    // unlocked, and can't be cloned.
+    static constexpr uint32_t kDiscardable = (1u << 1);
+
+    static status_t Create(uint32_t pmm_alloc_flags, uint64_t size, mxtl::RefPtr<VmObject>* vmo) {
+        return Create(pmm_alloc_flags, 0u, size, vmo);
+    }
+    static status_t Create(uint32_t pmm_alloc_flags, uint32_t options, uint64_t size,
+                           mxtl::RefPtr<VmObject>* vmo);
 
     static status_t CreateFromROData(const void* data, size_t size, mxtl::RefPtr<VmObject>* vmo);
 
@@ -44,10 +58,23 @@ public:
     status_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
                                    uint8_t alignment_log2) override;
     status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
+    status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) override;
+    status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) override;
+    status_t RestorePages(uint64_t offset, uint64_t len, list_node* pages) override;
 
     status_t Pin(uint64_t offset, uint64_t len) override;
     void Unpin(uint64_t offset, uint64_t len) override;
 
+    status_t LockDiscardable(bool* discarded) override;
+    status_t UnlockDiscardable() override;
+
+    // Discards the contents of unlocked discardable objects, least recently
+    // unlocked first, until at least |target_pages| pages have been freed or
+    // there is nothing left to discard. Returns the number of pages freed.
+    static size_t ReclaimDiscardable(size_t target_pages)
+        // Takes the locks of other objects, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
     status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
@@ -73,6 +100,10 @@ public:
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    status_t GetLargePageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
+
+    status_t CommitLargePage(uint64_t offset) override;
+
     status_t CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
                       mxtl::RefPtr<VmObject>* clone_vmo) override
         // Calls a Locked method of the child, which confuses analysis.
@@ -84,7 +115,7 @@ public:
 
 private:
     // private constructor (use Create())
-    explicit VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent);
+    VmObjectPaged(uint32_t options, uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent);
 
     // private destructor, only called from refptr
     ~VmObjectPaged() override;
@@ -106,12 +137,25 @@ private:
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
+    // check that the naturally aligned LARGE_PAGE_SIZE range at |start| can be
+    // committed as a large page: the object was created with kLargePages, is
+    // not a clone and has no pages in the range yet
+    status_t CanCommitLargePageLocked(uint64_t start) TA_REQ(lock_);
+
+    // add the zeroed, physically contiguous |pages| at |start|, leaving them on
+    // the list if the range can no longer be committed as a large page
+    status_t AddLargePageLocked(uint64_t start, list_node* pages) TA_REQ(lock_);
+
     status_t PinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
     void UnpinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
 
     // internal check if any pages in a range are pinned
     bool AnyPagesPinnedLocked(uint64_t offset, size_t len) TA_REQ(lock_);
 
+    // frees every page of an unlocked discardable object, unless some are
+    // pinned. Returns the number of pages freed.
+    size_t DiscardLocked() TA_REQ(lock_);
+
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
     status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
@@ -124,10 +168,31 @@ private:
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
     // members
+    const uint32_t options_;
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // outstanding LockDiscardable() calls, and whether the pages were
+    // discarded since the object was last locked
+    uint32_t discardable_lock_count_ TA_GUARDED(lock_) = 0;
+    bool discarded_ TA_GUARDED(lock_) = false;
+
+    // Per-node state for the list of unlocked discardable objects.
+    using DiscardableNodeState = mxtl::DoublyLinkedListNodeState<VmObjectPaged*>;
+    DiscardableNodeState discardable_list_state_;
+
+    // Unlocked discardable objects, least recently unlocked first. The lock
+    // is taken before the lock of any object on the list.
+    struct DiscardableListTraits {
+        static DiscardableNodeState& node_state(VmObjectPaged& vmo) {
+            return vmo.discardable_list_state_;
+        }
+    };
+    using DiscardableList = mxtl::DoublyLinkedList<VmObjectPaged*, DiscardableListTraits>;
+    static Mutex discardable_lock_;
+    static DiscardableList discardable_list_ TA_GUARDED(discardable_lock_);
 };
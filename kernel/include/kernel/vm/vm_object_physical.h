@@ -38,6 +38,7 @@ public:
 
     status_t GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
                            vm_page_t**, paddr_t* pa) override TA_REQ(lock_);
+    status_t GetLargePageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
 
     status_t GetMappingCachePolicy(uint32_t* cache_policy) override;
     status_t SetMappingCachePolicy(const uint32_t cache_policy) override;
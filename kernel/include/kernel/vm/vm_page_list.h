@@ -8,25 +8,26 @@
 
 #include <err.h>
 #include <kernel/vm.h>
+#include <list.h>
 #include <mxtl/canary.h>
-#include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/macros.h>
-#include <mxtl/unique_ptr.h>
 
 struct vm_page;
 
-class VmPageListNode final : public mxtl::WAVLTreeContainable<mxtl::unique_ptr<VmPageListNode>> {
+// Leaf of the VmPageList radix tree, holding the pages for kPageFanOut
+// consecutive page offsets starting at offset().
+class VmPageListNode final {
 public:
     explicit VmPageListNode(uint64_t offset);
     ~VmPageListNode();
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageListNode);
 
-    static const size_t kPageFanOut = 16;
+    static const size_t kPageFanOutShift = 6;
+    static const size_t kPageFanOut = 1u << kPageFanOutShift;
 
     // accessors
     uint64_t offset() const { return obj_offset_; }
-    uint64_t GetKey() const { return obj_offset_; }
 
     // for every valid page in the node call the passed in function
     template <typename T>
@@ -84,21 +85,28 @@ public:
     vm_page* RemovePage(size_t index);
     status_t AddPage(vm_page* p, size_t index);
 
-    bool IsEmpty() const {
-        for (const auto p : pages_) {
-            if (p)
-                return false;
-        }
-        return true;
-    }
+    bool IsEmpty() const { return count_ == 0; }
 
 private:
     mxtl::Canary<mxtl::magic("PLST")> canary_;
 
     uint64_t obj_offset_ = 0;
+    size_t count_ = 0;
     vm_page* pages_[kPageFanOut] = {};
 };
 
+// Sparse array of the pages of a VMO, indexed by offset.
+//
+// Pages are kept in a radix tree of VmPageListNode leaves under interior nodes
+// of kFanOut slots, whose height grows with the highest offset added, so a
+// lookup costs one step per level no matter how many pages the VMO holds.
+// Range walks only visit the parts of the tree that overlap the range.
+//
+// The per page callbacks return MX_ERR_NEXT to keep going, MX_ERR_STOP to
+// stop the walk early and return MX_OK, or any other status to stop the walk
+// and return that status. They must not add or remove pages; a caller that
+// needs to commit pages has to stop the walk, commit them, and start a new
+// walk past them.
 class VmPageList final {
 public:
     VmPageList();
@@ -106,91 +114,170 @@ public:
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageList);
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page
     template <typename T>
     status_t ForEveryPage(T per_page_func) {
-        for (auto& pl : list_) {
-            status_t status = pl.ForEveryPage(per_page_func, pl.offset(),
-                                              pl.offset() + pl.kPageFanOut * PAGE_SIZE);
-            if (unlikely(status != MX_ERR_NEXT)) {
-                if (status == MX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return MX_OK;
+        return ForEveryPageInRange(per_page_func, 0, kMaxOffset);
     }
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page
     template <typename T>
     status_t ForEveryPage(T per_page_func) const {
-        for (auto& pl : list_) {
-            status_t status = pl.ForEveryPage(per_page_func, pl.offset(),
-                                              pl.offset() + pl.kPageFanOut * PAGE_SIZE);
-            if (unlikely(status != MX_ERR_NEXT)) {
-                if (status == MX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return MX_OK;
+        return ForEveryPageInRange(per_page_func, 0, kMaxOffset);
     }
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page in
+    // [start_offset, end_offset)
     template <typename T>
     status_t ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) {
         DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        // Find the first node with a start after start_offset; if start_offset
-        // is in a node, it'll be in the one before it.
-        auto start = --list_.upper_bound(start_offset);
-        if (!start.IsValid()) {
-            start = list_.begin();
-        }
-        const auto end = list_.lower_bound(end_offset);
-        for (auto itr = start; itr != end; ++itr) {
-            auto& pl = *itr;
-            status_t status = pl.ForEveryPage(per_page_func, start_offset, end_offset);
-            if (unlikely(status != MX_ERR_NEXT)) {
-                if (status == MX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
+        if (start_offset >= end_offset) {
+            return MX_OK;
         }
-        return MX_OK;
+        auto per_leaf_func = [&per_page_func, start_offset, end_offset](VmPageListNode* pl) {
+            return pl->ForEveryPage(per_page_func, start_offset, end_offset);
+        };
+        return WalkResult(ForEveryLeaf(per_leaf_func, LeafIndex(start_offset),
+                                       LeafIndex(end_offset - 1)));
     }
 
     template <typename T>
     status_t ForEveryPageInRange(T per_page_func, uint64_t start_offset,
                                  uint64_t end_offset) const {
         DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        // Find the first node with a start after start_offset; if start_offset
-        // is in a node, it'll be in the one before it.
-        auto start = --list_.upper_bound(start_offset);
-        if (!start.IsValid()) {
-            start = list_.begin();
+        if (start_offset >= end_offset) {
+            return MX_OK;
         }
-        const auto end = list_.lower_bound(end_offset);
-        for (auto itr = start; itr != end; ++itr) {
-            auto& pl = *itr;
-            status_t status = pl.ForEveryPage(per_page_func, start_offset, end_offset);
-            if (unlikely(status != MX_ERR_NEXT)) {
-                if (status == MX_ERR_STOP) {
-                    break;
+        auto per_leaf_func = [&per_page_func, start_offset, end_offset](const VmPageListNode* pl) {
+            return pl->ForEveryPage(per_page_func, start_offset, end_offset);
+        };
+        // The walk itself does not modify the tree.
+        return WalkResult(const_cast<VmPageList*>(this)->ForEveryLeaf(
+            per_leaf_func, LeafIndex(start_offset), LeafIndex(end_offset - 1)));
+    }
+
+    // Like ForEveryPageInRange, but also calls per_gap_func(gap_start, gap_end)
+    // for every run of offsets in [start_offset, end_offset) that has no page,
+    // in offset order with the pages, so that callers can process the missing
+    // runs in bulk.
+    template <typename P, typename G>
+    status_t ForEveryPageAndGapInRange(P per_page_func, G per_gap_func, uint64_t start_offset,
+                                       uint64_t end_offset) {
+        uint64_t expected_next_off = start_offset;
+        bool stopped = false;
+        status_t status = ForEveryPageInRange(
+            [&](vm_page*& p, uint64_t off) {
+                if (off > expected_next_off) {
+                    status_t gap_status = per_gap_func(expected_next_off, off);
+                    if (gap_status != MX_ERR_NEXT) {
+                        stopped = true;
+                        return gap_status;
+                    }
                 }
-                return status;
-            }
+                expected_next_off = off + PAGE_SIZE;
+                status_t page_status = per_page_func(p, off);
+                if (page_status != MX_ERR_NEXT) {
+                    stopped = true;
+                }
+                return page_status;
+            },
+            start_offset, end_offset);
+        if (stopped || status != MX_OK || expected_next_off >= end_offset) {
+            return status;
         }
-        return MX_OK;
+        return WalkResult(per_gap_func(expected_next_off, end_offset));
     }
 
     status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
+
+    // Removes the page at offset and returns it to the pmm. Returns
+    // MX_ERR_NOT_FOUND if there was no page there.
     status_t FreePage(uint64_t offset);
+
+    // Removes every page in [start_offset, end_offset), appending them to
+    // |free_list| so the caller can return them to the pmm in one go.
+    // Returns the number of pages removed.
+    size_t RemovePages(uint64_t start_offset, uint64_t end_offset, list_node* free_list);
+
     size_t FreeAllPages();
 
+    bool IsEmpty() const { return root_ == nullptr; }
+
 private:
-    mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmPageListNode>> list_;
+    // Interior node of the tree. At height 1 the slots point at
+    // VmPageListNodes, above that at other interior nodes.
+    struct Interior {
+        static const size_t kFanOutShift = 6;
+        static const size_t kFanOut = 1u << kFanOutShift;
+
+        void* slots[kFanOut] = {};
+        size_t count = 0;
+    };
+
+    static const uint64_t kMaxOffset = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
+
+    // Enough levels to cover the leaf index of kMaxOffset.
+    static const uint kMaxHeight = 8;
+
+    static uint64_t LeafIndex(uint64_t offset) {
+        return offset >> (PAGE_SIZE_SHIFT + VmPageListNode::kPageFanOutShift);
+    }
+
+    static uint ChildShift(uint height) {
+        return static_cast<uint>(Interior::kFanOutShift * (height - 1));
+    }
+
+    static status_t WalkResult(status_t status) {
+        return (status == MX_ERR_NEXT || status == MX_ERR_STOP) ? MX_OK : status;
+    }
+
+    // Calls func on every leaf whose index is in [first, last], returning
+    // MX_ERR_NEXT if all of them were visited.
+    template <typename F>
+    status_t ForEveryLeaf(F& func, uint64_t first, uint64_t last) {
+        if (root_ == nullptr) {
+            return MX_ERR_NEXT;
+        }
+        return ForEveryLeafInNode(func, root_, height_, 0, first, last);
+    }
+
+    template <typename F>
+    static status_t ForEveryLeafInNode(F& func, void* node, uint height, uint64_t base,
+                                       uint64_t first, uint64_t last) {
+        if (height == 0) {
+            return (first <= base && base <= last) ? func(static_cast<VmPageListNode*>(node))
+                                                   : MX_ERR_NEXT;
+        }
+
+        auto interior = static_cast<Interior*>(node);
+        const uint shift = ChildShift(height);
+        const uint64_t start = (first > base) ? (first - base) >> shift : 0;
+        if (last < base || start >= Interior::kFanOut) {
+            return MX_ERR_NEXT;
+        }
+        const uint64_t end = MIN((last - base) >> shift, Interior::kFanOut - 1);
+        for (uint64_t i = start; i <= end; i++) {
+            if (interior->slots[i] == nullptr) {
+                continue;
+            }
+            status_t status = ForEveryLeafInNode(func, interior->slots[i], height - 1,
+                                                 base + (i << shift), first, last);
+            if (status != MX_ERR_NEXT) {
+                return status;
+            }
+        }
+        return MX_ERR_NEXT;
+    }
+
+    VmPageListNode* LookupLeaf(uint64_t leaf_index);
+    VmPageListNode* GetOrCreateLeaf(uint64_t leaf_index);
+    bool RemovePagesInNode(void* node, uint height, uint64_t base, uint64_t start_offset,
+                           uint64_t end_offset, list_node* free_list, size_t* count);
+    static void DestroyNode(void* node, uint height);
+
+    // A leaf if height_ is 0, otherwise an Interior covering leaf indexes
+    // below kFanOut^height_.
+    void* root_ = nullptr;
+    uint height_ = 0;
 };
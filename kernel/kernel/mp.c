@@ -18,6 +18,7 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/sched.h>
 #include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/timer.h>
@@ -40,6 +41,26 @@ void mp_init(void)
     for (uint i = 0; i < countof(mp.ipi_task_list); ++i) {
         list_initialize(&mp.ipi_task_list[i]);
     }
+
+    // until the platform says otherwise, every cpu shares a cache with every
+    // other one; a shift by the full width of the mask is undefined
+    const mp_cpu_mask_t all_cpus = SMP_MAX_CPUS >= 32 ? ~0u : (1u << SMP_MAX_CPUS) - 1;
+    for (uint i = 0; i < SMP_MAX_CPUS; ++i) {
+        mp.core_siblings[i] = (1u << i);
+        mp.cache_siblings[i] = all_cpus;
+    }
+}
+
+void mp_set_cpu_topology(uint cpu, mp_cpu_mask_t core_siblings, mp_cpu_mask_t cache_siblings)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(core_siblings & (1u << cpu));
+    DEBUG_ASSERT(cache_siblings & (1u << cpu));
+
+    LTRACEF("cpu %u: core 0x%x, cache 0x%x\n", cpu, core_siblings, cache_siblings);
+
+    mp.core_siblings[cpu] = core_siblings;
+    mp.cache_siblings[cpu] = cache_siblings;
 }
 
 void mp_reschedule(mp_cpu_mask_t target, uint flags)
@@ -312,6 +333,11 @@ status_t mp_unplug_cpu(uint cpu_id) {
     /* Now that the CPU is no longer processing tasks, move all of its timers */
     timer_transition_off_cpu(cpu_id);
 
+    /* and hand any threads still waiting in its run queue to the other cpus */
+    THREAD_LOCK(state);
+    sched_transition_off_cpu(cpu_id);
+    THREAD_UNLOCK(state);
+
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != MX_OK) {
         /* Do not cleanup the unplug thread in this case.  We have successfully
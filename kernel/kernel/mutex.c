@@ -23,10 +23,16 @@
 #include <inttypes.h>
 #include <kernel/thread.h>
 #include <kernel/sched.h>
+#include <lib/ktrace.h>
+#include <platform.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
+/* how long a thread may spin on a mutex whose holder is running before it
+ * gives up and blocks, roughly the cost of blocking and being woken */
+#define MUTEX_SPIN_MAX_TIME LK_USEC(10)
+
 /**
  * @brief  Initialize a mutex_t
  */
@@ -62,6 +68,44 @@ void mutex_destroy(mutex_t *m)
     THREAD_UNLOCK(state);
 }
 
+// Spin waiting for the mutex while its holder is running on another cpu, on
+// the bet that it will release the mutex sooner than we could block and be
+// woken. Returns true if the mutex was acquired.
+static bool mutex_spin(mutex_t *m, thread_t *ct)
+{
+    lk_time_t deadline = 0;
+
+    for (;;) {
+        uintptr_t val = mutex_val(m);
+        if (val == 0) {
+            if (atomic_cmpxchg_u64(&m->val, &val, (uintptr_t)ct))
+                return true;
+            continue;
+        }
+
+        // a release hands the mutex straight to a queued waiter, so there
+        // is nothing to gain from spinning behind one
+        if (val & MUTEX_FLAG_QUEUED)
+            return false;
+
+        // The holder may release the mutex and exit while we look at it.
+        // Threads live in the heap or in static storage, which both stay
+        // mapped, so a stale read only costs us a spin until the deadline.
+        thread_t *holder = (thread_t *)val;
+        if (__atomic_load_n(&holder->state, __ATOMIC_RELAXED) != THREAD_RUNNING)
+            return false;
+
+        lk_time_t now = current_time();
+        if (deadline == 0) {
+            deadline = now + MUTEX_SPIN_MAX_TIME;
+        } else if (now >= deadline) {
+            return false;
+        }
+
+        arch_spinloop_pause();
+    }
+}
+
 /**
  * @brief  Acquire the mutex
  */
@@ -72,6 +116,7 @@ void mutex_acquire(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
 
     thread_t *ct = get_current_thread();
     uintptr_t oldval;
+    lk_time_t contended_at = 0;
 
 retry:
     // fast path: assume its unheld, try to grab it
@@ -87,6 +132,17 @@ retry:
               ct, ct->name, m);
 #endif
 
+    if (contended_at == 0)
+        contended_at = current_time();
+
+    // the holder may be just about to release it
+    if (mutex_spin(m, ct)) {
+        // The probes are keyed by the caller, which identifies the lock.
+        ktrace_probe2("mutex_spin", (uint32_t)(current_time() - contended_at),
+                      (uint32_t)(uintptr_t)__GET_CALLER());
+        return;
+    }
+
     // we contended with someone else, will probably need to block
     THREAD_LOCK(state);
 
@@ -117,6 +173,9 @@ retry:
     DEBUG_ASSERT(ct == mutex_holder(m));
 
     THREAD_UNLOCK(state);
+
+    ktrace_probe2("mutex_block", (uint32_t)(current_time() - contended_at),
+                  (uint32_t)(uintptr_t)__GET_CALLER());
 }
 
 // shared implementation of release
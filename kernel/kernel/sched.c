@@ -17,6 +17,8 @@
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <platform.h>
 
 /* legacy implementation that just broadcast ipis for every reschedule */
 #define BROADCAST_RESCHEDULE 0
@@ -37,17 +39,29 @@
 #define LOCAL_KTRACE2(probe, x, y)
 #endif
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* make sure the per cpu bitmap is large enough to cover our number of priorities */
+static_assert(NUM_PRIORITIES <= sizeof(((struct percpu *)0)->run_queue_bitmap) * CHAR_BIT, "");
 
-/* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+/* how many more threads a cpu's run queue may hold than the shortest one before
+ * a waking thread gives up on its cache affinity and is placed elsewhere */
+#define AFFINITY_IMBALANCE 2
+
+/* bounds on the parameters of a deadline thread */
+#define DEADLINE_MIN_PERIOD LK_USEC(100)
+#define DEADLINE_MAX_PERIOD LK_SEC(1)
+#define DEADLINE_MIN_BUDGET LK_USEC(10)
+
+/* the share of each cpu, in parts per thousand, that deadline threads may
+ * reserve between them, so that the priority based threads are never starved
+ * completely */
+#define DEADLINE_MAX_SHARE 800
 
 /* compute the effective priority of a thread */
 static int effec_priority(const thread_t *t)
 {
     int ep = t->base_priority + t->priority_boost;
+    if (t->inherited_priority > ep)
+        ep = t->inherited_priority;
     DEBUG_ASSERT(ep >= LOWEST_PRIORITY && ep <= HIGHEST_PRIORITY);
     return ep;
 }
@@ -101,134 +115,506 @@ static void deboost_thread(thread_t *t, bool quantum_expiration)
     t->priority_boost--;
 }
 
-/* pick a 'random' cpu */
-static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
+/* find the highest priority queue with a thread in it, or -1 if none */
+static int highest_run_queue(uint32_t bitmap)
+{
+    if (bitmap == 0)
+        return -1;
+
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
+
+/* the set of cpus a non pinned thread may be placed on */
+static mp_cpu_mask_t schedulable_cpus(void)
 {
+    mp_cpu_mask_t mask = mp_get_active_mask() & mp_get_online_mask();
+
+    /* early in boot, before the scheduler is running on every cpu, only the
+     * current cpu is usable */
     if (unlikely(mask == 0))
-        return 0;
+        mask = (1u << arch_curr_cpu_num());
 
-    /* check that the mask passed in has at least one bit set in the online mask */
-    mp_cpu_mask_t online = mp_get_online_mask();
-    if (unlikely((mask & online) == 0))
-        return 0;
+    return mask;
+}
+
+/* pick the cpu in the mask with the fewest queued threads, preferring the
+ * lowest numbered cpu on a tie */
+static uint least_loaded_cpu(mp_cpu_mask_t mask)
+{
+    DEBUG_ASSERT(mask != 0);
 
-    /* compute the highest online cpu */
-    uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(online);
+    uint best_cpu = __builtin_ctz(mask);
+    uint best_len = percpu[best_cpu].run_queue_len;
 
-    /* not very random, round robins a bit through the mask until it gets a hit */
-    for (;;) {
-        /* protected by THREAD_LOCK, safe to use non atomically */
-        static uint rot = 0;
+    for (mask &= ~(1u << best_cpu); mask; mask &= mask - 1) {
+        uint cpu = __builtin_ctz(mask);
+        if (percpu[cpu].run_queue_len < best_len) {
+            best_cpu = cpu;
+            best_len = percpu[cpu].run_queue_len;
+        }
+    }
+
+    return best_cpu;
+}
 
-        if (++rot > highest_cpu)
-            rot = 0;
+/* the cpus in the mask whose core has no busy cpu in the mask */
+static mp_cpu_mask_t idle_core_cpus(mp_cpu_mask_t mask, mp_cpu_mask_t idle)
+{
+    mp_cpu_mask_t result = 0;
 
-        if ((1u << rot) & mask)
-            return (1u << rot);
+    for (mp_cpu_mask_t m = idle & mask; m; m &= m - 1) {
+        uint cpu = __builtin_ctz(m);
+        if ((mp_get_core_siblings(cpu) & mask & ~idle) == 0)
+            result |= (1u << cpu);
     }
+
+    return result;
 }
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* pick a cpu out of a non empty set of idle ones, preferring the cpu the thread
+ * last ran on, then the waking cpu */
+static uint pick_idle_cpu(mp_cpu_mask_t idle, uint last_cpu, uint curr_cpu)
 {
+    if (idle & (1u << last_cpu))
+        return last_cpu;
+
+    if (idle & (1u << curr_cpu))
+        return curr_cpu;
+
+    return least_loaded_cpu(idle);
+}
+
+/* decide which cpu's run queue a waking thread should go into */
+static uint find_target_cpu(thread_t *t)
+{
+    if (unlikely(t->pinned_cpu >= 0))
+        return (uint)t->pinned_cpu;
+
+    /* a deadline thread goes back to the cpu its budget is reserved on, where
+     * admission control made sure it fits. only a cpu that went away sends it
+     * elsewhere */
+    if (thread_is_deadline(t) && (schedulable_cpus() & (1u << t->deadline_cpu)))
+        return t->deadline_cpu;
+
+    /* a cpu running a realtime thread is not sent reschedule ipis, so a thread
+     * queued there would wait for the realtime thread to block. leave those
+     * cpus out unless there is nowhere else to go */
+    mp_cpu_mask_t candidates = schedulable_cpus();
+    if (candidates & ~mp_get_realtime_mask())
+        candidates &= ~mp_get_realtime_mask();
+    uint curr_cpu = arch_curr_cpu_num();
+    uint last_cpu = thread_last_cpu(t);
+    mp_cpu_mask_t last_cpu_mask = (1u << last_cpu) & candidates;
+
     if (BROADCAST_RESCHEDULE)
-        return MP_CPU_ALL_BUT_LOCAL;
+        return last_cpu_mask ? last_cpu : curr_cpu;
+
+    /* keep the thread within the last level cache of the thread waking it, so
+     * that the data they pass back and forth stays in cache. a wakeup from an
+     * interrupt handler has no such partner, use the thread's own cache */
+    uint cache_cpu = (last_cpu_mask && arch_in_int_handler()) ? last_cpu : curr_cpu;
+    mp_cpu_mask_t cache = mp_get_cache_siblings(cache_cpu) & candidates;
+    if (cache == 0)
+        cache = candidates;
+
+    /* prefer an idle cpu, starting with the one the thread last ran on since it
+     * is most likely to still have the thread's working set in cache. a cpu
+     * whose smt siblings are idle as well gets the core to itself, so take
+     * those first */
+    mp_cpu_mask_t idle = mp_get_idle_mask() & candidates;
+    if (idle != 0) {
+        mp_cpu_mask_t idle_cores = idle_core_cpus(candidates, idle);
+
+        if (idle_cores & cache)
+            return pick_idle_cpu(idle_cores & cache, last_cpu, curr_cpu);
+
+        if (idle & cache)
+            return pick_idle_cpu(idle & cache, last_cpu, curr_cpu);
+
+        if (idle_cores)
+            return pick_idle_cpu(idle_cores, last_cpu, curr_cpu);
+
+        return pick_idle_cpu(idle, last_cpu, curr_cpu);
+    }
 
-    /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+    /* no idle cpus, stick with the last cpu if it shares the cache and its
+     * queue is not noticeably longer than the least loaded one. failing that,
+     * stay in the cache unless it is noticeably busier than the rest */
+    uint least = least_loaded_cpu(candidates);
+    uint limit = percpu[least].run_queue_len + AFFINITY_IMBALANCE;
+    if ((last_cpu_mask & cache) && percpu[last_cpu].run_queue_len <= limit)
+        return last_cpu;
 
-    /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    uint least_in_cache = least_loaded_cpu(cache);
+    if (percpu[least_in_cache].run_queue_len <= limit)
+        return least_in_cache;
 
-    /* get a list of idle cpus */
-    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
-    if (idle_cpu_mask != 0) {
-        if (idle_cpu_mask & curr_cpu_mask) {
-            /* the current cpu is idle, so run it here */
-            return 0;
-        }
+    return least;
+}
 
-        if (last_ran_cpu_mask & idle_cpu_mask) {
-            /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
-        }
+/* a thread in the deadline class runs ahead of the priority based threads
+ * until its budget for the current period is used up */
+static bool deadline_eligible(const thread_t *t)
+{
+    return thread_is_deadline(t) && t->deadline_remaining > 0;
+}
 
-        /* pick an idle_cpu */
-        return rand_cpu(idle_cpu_mask);
+/* insert an eligible deadline thread into a cpu's deadline queue, ordered by
+ * deadline, and ahead of or behind the threads with the same deadline */
+static void insert_in_deadline_queue(thread_t *t, uint cpu, bool head)
+{
+    DEBUG_ASSERT(!list_in_list(&t->queue_node));
+    DEBUG_ASSERT(deadline_eligible(t));
+
+    t->queued_cpu = cpu;
+
+    thread_t *queued;
+    list_for_every_entry(&percpu[cpu].deadline_queue, queued, thread_t, queue_node) {
+        if (queued->deadline_abs > t->deadline_abs ||
+            (head && queued->deadline_abs == t->deadline_abs)) {
+            /* adding to the tail of a node inserts just before it */
+            list_add_tail(&queued->queue_node, &t->queue_node);
+            percpu[cpu].run_queue_len++;
+            return;
+        }
     }
 
-    /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
-        /* the last cpu it ran on is us */
-        /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
-    } else {
-        /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
-    }
+    list_add_tail(&percpu[cpu].deadline_queue, &t->queue_node);
+    percpu[cpu].run_queue_len++;
+}
+
+static void remove_from_deadline_queue(thread_t *t, uint cpu)
+{
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+    list_delete(&t->queue_node);
+    percpu[cpu].run_queue_len--;
 }
 
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head(thread_t *t, uint cpu)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    if (deadline_eligible(t)) {
+        insert_in_deadline_queue(t, cpu, true);
+        return;
+    }
+
     int ep = effec_priority(t);
 
-    list_add_head(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    t->queued_cpu = cpu;
+    list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
+    percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail(thread_t *t, uint cpu)
 {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    if (deadline_eligible(t)) {
+        insert_in_deadline_queue(t, cpu, false);
+        return;
+    }
+
     int ep = effec_priority(t);
 
-    list_add_tail(&run_queue[ep], &t->queue_node);
-    run_queue_bitmap |= (1u << ep);
+    t->queued_cpu = cpu;
+    list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
+    percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+static void remove_from_run_queue(thread_t *t, uint cpu, uint queue)
 {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+    list_delete(&t->queue_node);
+    percpu[cpu].run_queue_len--;
+
+    if (list_is_empty(&percpu[cpu].run_queue[queue]))
+        percpu[cpu].run_queue_bitmap &= ~(1u << queue);
+}
+
+/* the cpu whose run queue a ready thread is waiting in, queued threads are
+ * not tied to last_cpu */
+static uint find_queued_cpu(const thread_t *t)
+{
+    DEBUG_ASSERT(t->state == THREAD_READY && list_in_list(&t->queue_node));
+    DEBUG_ASSERT(t->queued_cpu < SMP_MAX_CPUS);
+
+    return t->queued_cpu;
+}
+
+static void remove_queued_thread(thread_t *t, uint cpu)
+{
+    if (deadline_eligible(t)) {
+        remove_from_deadline_queue(t, cpu);
+    } else {
+        remove_from_run_queue(t, cpu, effec_priority(t));
+    }
+}
+
+/* start a new period with a full budget. hard CBS: a throttled thread waits
+ * for the end of its current period rather than postponing its deadline */
+static void deadline_replenish(thread_t *t, lk_time_t now)
+{
+    t->deadline_abs += t->deadline_period;
+    if (t->deadline_abs <= now)
+        t->deadline_abs = now + t->deadline_period;
+    t->deadline_remaining = t->deadline_budget;
+    t->deadline_charged = now;
+}
+
+/* timer callback moving a throttled deadline thread back ahead of the
+ * priority based threads once its next period starts */
+static enum handler_return deadline_replenish_handler(timer_t *timer, lk_time_t now, void *arg)
+{
+    thread_t *t = (thread_t *)arg;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    /* sched_set_deadline() and deadline_charge() may be cancelling this timer
+     * with the thread lock held */
+    if (timer_trylock_or_cancel(timer, &thread_lock))
+        return INT_NO_RESCHEDULE;
+
+    if (!thread_is_deadline(t) || t->deadline_remaining > 0) {
+        spin_unlock(&thread_lock);
+        return INT_NO_RESCHEDULE;
+    }
+
+    LOCAL_KTRACE2("sched_replenish", (uint32_t)t->user_tid, t->state);
+
+    mp_cpu_mask_t resched_mask = 0;
+    if (t->state == THREAD_READY && list_in_list(&t->queue_node)) {
+        /* move it from its priority queue, where it may have been stolen to
+         * another cpu, to the deadline queue of the cpu it is reserved on */
+        remove_queued_thread(t, find_queued_cpu(t));
+        deadline_replenish(t, now);
+        uint cpu = find_target_cpu(t);
+        insert_in_run_queue_head(t, cpu);
+        resched_mask = (1u << cpu);
+    } else {
+        deadline_replenish(t, now);
+        if (t->state == THREAD_RUNNING)
+            resched_mask = (1u << thread_last_cpu(t));
+    }
+
+    bool local = resched_mask & (1u << arch_curr_cpu_num());
+    mp_reschedule(resched_mask, 0);
+
+    spin_unlock(&thread_lock);
+
+    return local ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+/* charge the time the current thread has run since it was last charged
+ * against its budget, throttling it once the budget is used up */
+static void deadline_charge(thread_t *t)
+{
+    if (!deadline_eligible(t))
+        return;
+
+    lk_time_t now = current_time();
+    lk_time_t since = MAX(t->deadline_charged, t->last_started_running);
+    lk_time_t ran = (now > since) ? now - since : 0;
+    t->deadline_charged = now;
+
+    if (ran < t->deadline_remaining) {
+        t->deadline_remaining -= ran;
+        return;
+    }
+
+    LOCAL_KTRACE2("sched_throttle", (uint32_t)t->user_tid, (uint32_t)(now - t->deadline_abs));
+
+    /* run as a priority based thread until the next period. the replenish
+     * callback of the last period may still be on its way out on another
+     * cpu, cancelling waits for it */
+    t->deadline_remaining = 0;
+    timer_cancel(&t->deadline_timer);
+    timer_set_oneshot(&t->deadline_timer, t->deadline_abs, deadline_replenish_handler, t);
+}
+
+/* a waking deadline thread keeps its deadline and the rest of its budget only
+ * if running that budget by the deadline stays within its share of the cpu,
+ * otherwise it starts a new period now (the CBS wakeup rule) */
+static void deadline_wake(thread_t *t)
+{
+    /* a throttled thread waits for its replenish timer */
+    if (!deadline_eligible(t))
+        return;
+
+    lk_time_t now = current_time();
+    if (now < t->deadline_abs &&
+        t->deadline_remaining * t->deadline_period <= (t->deadline_abs - now) * t->deadline_budget)
+        return;
+
+    t->deadline_abs = now + t->deadline_period;
+    t->deadline_remaining = t->deadline_budget;
+    t->deadline_charged = now;
+}
+
+static uint64_t deadline_share(lk_time_t budget, lk_time_t period)
+{
+    return (period != 0) ? (budget * 1000000u) / period : 0u;
+}
+
+/* admission control, pick the cpu to reserve a share of for a deadline
+ * thread. the reservations on each cpu have to fit in its DEADLINE_MAX_SHARE,
+ * and of the cpus that fit the least reserved one is taken, to spread the
+ * deadline threads out */
+static status_t deadline_place(const thread_t *t, uint64_t share, uint *cpu_out)
+{
+    const uint64_t limit = DEADLINE_MAX_SHARE * 1000u;
+    uint64_t old_share = deadline_share(t->deadline_budget, t->deadline_period);
+
+    mp_cpu_mask_t candidates = (t->pinned_cpu >= 0) ? (1u << t->pinned_cpu)
+                                                    : schedulable_cpus();
+    uint64_t best_reserved = UINT64_MAX;
+    for (; candidates; candidates &= candidates - 1) {
+        uint cpu = __builtin_ctz(candidates);
+
+        /* the thread's current reservation makes way for the new one */
+        uint64_t reserved = percpu[cpu].deadline_reserved;
+        if (old_share != 0 && cpu == t->deadline_cpu)
+            reserved -= old_share;
+
+        if (reserved + share <= limit && reserved < best_reserved) {
+            best_reserved = reserved;
+            *cpu_out = cpu;
+        }
+    }
+
+    return (best_reserved != UINT64_MAX) ? MX_OK : MX_ERR_NO_RESOURCES;
+}
+
+/* place a waking thread on a cpu's run queue, returning the mask of the cpu
+ * that needs to reschedule, if any */
+static mp_cpu_mask_t insert_waking_thread(thread_t *t)
+{
+    uint cpu = find_target_cpu(t);
+
+    insert_in_run_queue_head(t, cpu);
+
+    /* the local cpu picks the thread up on its next reschedule */
+    if (cpu == arch_curr_cpu_num())
+        return 0;
+
+    /* the thread had nowhere else to go, so a cpu running a realtime thread
+     * has to be kicked as well or the thread waits until it blocks */
+    if (mp_get_realtime_mask() & (1u << cpu)) {
+        mp_reschedule(1u << cpu, MP_RESCHEDULE_FLAG_REALTIME);
+        return 0;
+    }
+
+    return (1u << cpu);
+}
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+/* pull the highest priority migratable thread off of one of the victim cpus'
+ * run queues, picking the cpu with the most queued threads */
+static thread_t *steal_thread_from(uint cpu, mp_cpu_mask_t victims)
+{
+    while (victims) {
+        uint victim = __builtin_ctz(victims);
+        for (mp_cpu_mask_t m = victims & (victims - 1); m; m &= m - 1) {
+            uint c = __builtin_ctz(m);
+            if (percpu[c].run_queue_len > percpu[victim].run_queue_len)
+                victim = c;
+        }
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-            if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu) {
-                list_delete(&newthread->queue_node);
+        if (percpu[victim].run_queue_len == 0)
+            return NULL;
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+        /* the deadline queue is left alone: its threads' budgets are only
+         * reserved on the cpu they are queued on, running them elsewhere
+         * could make that cpu's own deadline threads miss theirs */
+        thread_t *t;
+        uint32_t bitmap = percpu[victim].run_queue_bitmap;
+        int queue;
+        while ((queue = highest_run_queue(bitmap)) >= 0) {
+            list_for_every_entry(&percpu[victim].run_queue[queue], t, thread_t, queue_node) {
+                if (likely(t->pinned_cpu < 0)) {
+                    remove_from_run_queue(t, victim, queue);
 
-                LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+                    LOCAL_KTRACE2("sched_steal", victim, cpu);
 
-                return newthread;
+                    return t;
+                }
             }
+            bitmap &= ~(1u << queue);
         }
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+        /* everything queued there is pinned, try the next busiest cpu */
+        victims &= ~(1u << victim);
     }
+
+    return NULL;
+}
+
+/* find a thread for an otherwise idle cpu, looking at the cpus sharing its last
+ * level cache before going further afield */
+static thread_t *steal_thread(uint cpu)
+{
+    mp_cpu_mask_t victims = schedulable_cpus() & ~(1u << cpu);
+    mp_cpu_mask_t near = victims & mp_get_cache_siblings(cpu);
+
+    thread_t *t = steal_thread_from(cpu, near);
+    if (t)
+        return t;
+
+    return steal_thread_from(cpu, victims & ~near);
+}
+
+thread_t *sched_get_top_thread(uint cpu)
+{
+    struct percpu *c = &percpu[cpu];
+    thread_t *newthread;
+
+    /* deadline threads with budget left run first, earliest deadline first */
+    newthread = list_peek_head_type(&c->deadline_queue, thread_t, queue_node);
+    if (newthread) {
+        remove_from_deadline_queue(newthread, cpu);
+
+        LOCAL_KTRACE2("sched_get_top_deadline", (uint32_t)newthread->user_tid, cpu);
+
+        return newthread;
+    }
+
+    int queue = highest_run_queue(c->run_queue_bitmap);
+    if (queue >= 0) {
+        newthread = list_peek_head_type(&c->run_queue[queue], thread_t, queue_node);
+        remove_from_run_queue(newthread, cpu, queue);
+
+        LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
+
+        return newthread;
+    }
+
+    /* nothing local to run, try to take work from a busier cpu before going idle */
+    newthread = steal_thread(cpu);
+    if (newthread)
+        return newthread;
+
     /* no threads to run, select the idle thread for this cpu */
-    return &percpu[cpu].idle_thread;
+    return &c->idle_thread;
 }
 
 void sched_block(void)
 {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    __UNUSED thread_t *current_thread = get_current_thread();
+    thread_t *current_thread = get_current_thread();
 
     DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
     DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
 
     LOCAL_KTRACE0("sched_block");
 
+    deadline_charge(current_thread);
+
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
     _thread_resched_internal();
 }
@@ -243,12 +629,11 @@ void sched_unblock(thread_t *t)
 
     /* thread is being woken up, boost its priority */
     boost_thread(t);
+    deadline_wake(t);
 
     /* stuff the new thread in the run queue */
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    mp_reschedule(find_cpu(t), 0);
+    mp_reschedule(insert_waking_thread(t), 0);
 }
 
 void sched_unblock_list(struct list_node *list)
@@ -258,7 +643,9 @@ void sched_unblock_list(struct list_node *list)
 
     LOCAL_KTRACE0("sched_unblock_list");
 
-    /* pop the list of threads and shove into the scheduler */
+    /* pop the list of threads and shove into the scheduler, collecting the
+     * cpus to kick so that each one only gets a single ipi */
+    mp_cpu_mask_t resched_mask = 0;
     thread_t *t;
     while ((t = list_remove_tail_type(list, thread_t, queue_node))) {
         DEBUG_ASSERT(t->magic == THREAD_MAGIC);
@@ -266,13 +653,14 @@ void sched_unblock_list(struct list_node *list)
 
         /* thread is being woken up, boost its priority */
         boost_thread(t);
+        deadline_wake(t);
 
         /* stuff the new thread in the run queue */
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
-
-        mp_reschedule(find_cpu(t), 0);
+        resched_mask |= insert_waking_thread(t);
     }
+
+    mp_reschedule(resched_mask, 0);
 }
 
 void sched_yield(void)
@@ -284,12 +672,13 @@ void sched_yield(void)
 
     LOCAL_KTRACE0("sched_yield");
 
+    deadline_charge(current_thread);
     current_thread->state = THREAD_READY;
 
     /* consume the rest of the time slice, deboost ourself, and go to the end of the queue */
     current_thread->remaining_time_slice = 0;
     deboost_thread(current_thread, false);
-    insert_in_run_queue_tail(current_thread);
+    insert_in_run_queue_tail(current_thread, arch_curr_cpu_num());
 
     _thread_resched_internal();
 }
@@ -307,12 +696,14 @@ void sched_preempt(void)
 
     /* idle thread doesn't go in the run queue */
     if (likely(!thread_is_idle(current_thread))) {
+        deadline_charge(current_thread);
+
         if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(current_thread, arch_curr_cpu_num());
         } else {
             /* if we're out of quantum, deboost the thread and put it at the tail of the queue */
             deboost_thread(current_thread, true);
-            insert_in_run_queue_tail(current_thread);
+            insert_in_run_queue_tail(current_thread, arch_curr_cpu_num());
         }
     }
 
@@ -332,24 +723,176 @@ void sched_reschedule(void)
 
     /* idle thread doesn't go in the run queue */
     if (likely(!thread_is_idle(current_thread))) {
+        deadline_charge(current_thread);
 
         /* deboost the current thread */
         deboost_thread(current_thread, false);
 
         if (current_thread->remaining_time_slice > 0) {
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(current_thread, arch_curr_cpu_num());
         } else {
-            insert_in_run_queue_tail(current_thread);
+            insert_in_run_queue_tail(current_thread, arch_curr_cpu_num());
         }
     }
 
     _thread_resched_internal();
 }
 
+int sched_effective_priority(const thread_t *t)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    return effec_priority(t);
+}
+
+void sched_inherit_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(priority >= -1 && priority <= HIGHEST_PRIORITY);
+
+    int old_ep = effec_priority(t);
+    t->inherited_priority = priority;
+    int new_ep = effec_priority(t);
+    if (new_ep == old_ep)
+        return;
+
+    LOCAL_KTRACE2("sched_inherit", old_ep, new_ep);
+
+    switch (t->state) {
+        case THREAD_READY: {
+            /* the current thread is marked ready while it reschedules, but is
+             * only on a run queue if it was put there */
+            if (!list_in_list(&t->queue_node))
+                return;
+
+            /* the deadline queue is not ordered by priority */
+            if (deadline_eligible(t))
+                return;
+
+            /* move it to the run queue for its new priority on the same cpu */
+            uint cpu = find_queued_cpu(t);
+            remove_from_run_queue(t, cpu, old_ep);
+            insert_in_run_queue_head(t, cpu);
+            if (new_ep > old_ep && cpu != arch_curr_cpu_num())
+                mp_reschedule(1u << cpu, 0);
+            return;
+        }
+        case THREAD_RUNNING:
+            /* a thread losing priority on another cpu may now be outranked by
+             * something queued there; the local cpu checks at its next
+             * reschedule */
+            if (new_ep < old_ep && thread_last_cpu(t) != arch_curr_cpu_num())
+                mp_reschedule(1u << thread_last_cpu(t), 0);
+            return;
+        default:
+            /* picked up the next time the thread is queued */
+            return;
+    }
+}
+
+/* move all of the migratable threads off of a cpu that is going offline */
+void sched_transition_off_cpu(uint old_cpu)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(old_cpu != arch_curr_cpu_num());
+
+    mp_cpu_mask_t resched_mask = 0;
+    thread_t *t;
+    thread_t *temp;
+    list_for_every_entry_safe(&percpu[old_cpu].deadline_queue, t, temp, thread_t, queue_node) {
+        if (t->pinned_cpu >= 0)
+            continue;
+
+        remove_from_deadline_queue(t, old_cpu);
+        resched_mask |= insert_waking_thread(t);
+    }
+
+    uint32_t bitmap = percpu[old_cpu].run_queue_bitmap;
+    int queue;
+    while ((queue = highest_run_queue(bitmap)) >= 0) {
+        list_for_every_entry_safe(&percpu[old_cpu].run_queue[queue], t, temp, thread_t, queue_node) {
+            if (t->pinned_cpu >= 0)
+                continue;
+
+            remove_from_run_queue(t, old_cpu, queue);
+            resched_mask |= insert_waking_thread(t);
+        }
+        bitmap &= ~(1u << queue);
+    }
+
+    mp_reschedule(resched_mask, 0);
+}
+
+status_t sched_set_deadline(thread_t *t, lk_time_t budget, lk_time_t period)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (budget == 0) {
+        if (period != 0)
+            return MX_ERR_INVALID_ARGS;
+    } else if (budget < DEADLINE_MIN_BUDGET || budget > period ||
+               period < DEADLINE_MIN_PERIOD || period > DEADLINE_MAX_PERIOD) {
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    if (thread_is_idle(t) || t->state == THREAD_DEATH)
+        return MX_ERR_BAD_STATE;
+
+    uint64_t old_share = deadline_share(t->deadline_budget, t->deadline_period);
+    uint64_t new_share = deadline_share(budget, period);
+    uint new_cpu = 0;
+    if (budget != 0) {
+        status_t status = deadline_place(t, new_share, &new_cpu);
+        if (status != MX_OK)
+            return status;
+    }
+
+    LOCAL_KTRACE2("sched_set_deadline", (uint32_t)budget, (uint32_t)period);
+
+    /* a queued thread may change queues */
+    bool queued = (t->state == THREAD_READY && list_in_list(&t->queue_node));
+    uint cpu = queued ? find_queued_cpu(t) : 0;
+    if (queued)
+        remove_queued_thread(t, cpu);
+
+    timer_cancel(&t->deadline_timer);
+    if (old_share != 0)
+        percpu[t->deadline_cpu].deadline_reserved -= old_share;
+    if (budget != 0) {
+        percpu[new_cpu].deadline_reserved += new_share;
+        t->deadline_cpu = new_cpu;
+    }
+
+    /* start a period with a full budget */
+    lk_time_t now = current_time();
+    t->deadline_budget = budget;
+    t->deadline_period = period;
+    t->deadline_abs = (budget != 0) ? now + period : 0;
+    t->deadline_remaining = budget;
+    t->deadline_charged = now;
+
+    if (queued) {
+        /* a deadline thread moves to the cpu it is now reserved on */
+        if (budget != 0)
+            cpu = find_target_cpu(t);
+        insert_in_run_queue_head(t, cpu);
+        if (cpu != arch_curr_cpu_num())
+            mp_reschedule(1u << cpu, 0);
+    } else if (t->state == THREAD_RUNNING && thread_last_cpu(t) != arch_curr_cpu_num()) {
+        mp_reschedule(1u << thread_last_cpu(t), 0);
+    }
+
+    return MX_OK;
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (unsigned int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
+            list_initialize(&percpu[cpu].run_queue[i]);
+        list_initialize(&percpu[cpu].deadline_queue);
+    }
 }
-
@@ -63,6 +63,7 @@ static int idle_thread_routine(void *) __NO_RETURN;
 static void thread_exit_locked(thread_t *current_thread, int retcode) __NO_RETURN;
 static void thread_do_suspend(void);
 static enum handler_return thread_timer_tick(struct timer *t, lk_time_t now, void *arg);
+static enum handler_return thread_budget_expired(struct timer *t, lk_time_t now, void *arg);
 
 static void init_thread_struct(thread_t *t, const char *name)
 {
@@ -71,6 +72,7 @@ static void init_thread_struct(thread_t *t, const char *name)
     thread_set_pinned_cpu(t, -1);
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    timer_init(&t->deadline_timer);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
@@ -140,12 +142,15 @@ thread_t *thread_create_etc(
     t->arg = arg;
     t->base_priority = priority;
     t->priority_boost = 0;
+    t->inherited_priority = -1;
     t->state = THREAD_INITIAL;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
     t->blocked_status = MX_OK;
     t->interruptable = false;
+    t->timer_slack = 0;
     thread_set_last_cpu(t, 0);
+    t->queued_cpu = 0;
 
     t->retcode = 0;
     wait_queue_init(&t->retcode_wait_queue);
@@ -253,6 +258,7 @@ status_t thread_set_real_time(thread_t *t)
     if (t == get_current_thread()) {
         /* if we're currently running, cancel the preemption timer. */
         timer_cancel(&percpu[arch_curr_cpu_num()].preempt_timer);
+        percpu[arch_curr_cpu_num()].preempt_timer_budget = false;
     }
     t->flags |= THREAD_FLAG_REAL_TIME;
     THREAD_UNLOCK(state);
@@ -260,6 +266,47 @@ status_t thread_set_real_time(thread_t *t)
     return MX_OK;
 }
 
+/**
+ * @brief Move a thread into or out of the deadline scheduling class
+ *
+ * A thread in the deadline class is guaranteed budget ns of cpu time in every
+ * period ns, ahead of the threads scheduled by priority. Once it has used up
+ * its budget it runs at its regular priority until its next period starts.
+ * A budget and period of 0 move the thread back to scheduling by priority.
+ *
+ * @param t Thread to change
+ * @param budget Run time per period, in ns
+ * @param period Length of a period, in ns
+ *
+ * @return MX_OK on success, MX_ERR_INVALID_ARGS if the parameters are out
+ * of range, or MX_ERR_NO_RESOURCES if the cpus do not have enough time left
+ * to guarantee the budget.
+ */
+status_t thread_set_deadline(thread_t *t, lk_time_t budget, lk_time_t period)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    THREAD_LOCK(state);
+    status_t status = sched_set_deadline(t, budget, period);
+    if (status == MX_OK && t == get_current_thread()) {
+        /* move ourself to the right queue and preemption timer */
+        sched_reschedule();
+    }
+    THREAD_UNLOCK(state);
+
+    return status;
+}
+
+void thread_get_deadline(thread_t *t, lk_time_t *budget, lk_time_t *period)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    THREAD_LOCK(state);
+    *budget = t->deadline_budget;
+    *period = t->deadline_period;
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief  Make a suspended thread executable.
  *
@@ -473,6 +520,10 @@ __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode
      */
     dpc_t free_dpc;
 
+    /* give back our share of the cpus and stop any replenish timer */
+    if (thread_is_deadline(current_thread))
+        sched_set_deadline(current_thread, 0, 0);
+
     /* enter the dead state */
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
@@ -724,6 +775,45 @@ __NO_RETURN static int idle_thread_routine(void *arg)
         arch_idle();
 }
 
+/* program this cpu's preemption timer for newthread, which is about to run
+ * in place of oldthread. Threads scheduled by priority get a periodic tick
+ * unless they are real time, while deadline threads with budget left get a
+ * oneshot for when their budget runs out. */
+static void thread_set_preempt_timer(uint cpu, thread_t *oldthread, thread_t *newthread,
+                                     lk_time_t now)
+{
+    struct percpu *c = &percpu[cpu];
+
+    bool ticking = !thread_is_real_time_or_idle(oldthread);
+    if (c->preempt_timer_budget) {
+        timer_cancel(&c->preempt_timer);
+        c->preempt_timer_budget = false;
+        ticking = false;
+    }
+
+    if (thread_is_deadline(newthread) && newthread->deadline_remaining > 0) {
+        if (ticking)
+            timer_cancel(&c->preempt_timer);
+        timer_set_oneshot(&c->preempt_timer, now + newthread->deadline_remaining,
+                          thread_budget_expired, NULL);
+        c->preempt_timer_budget = true;
+    } else if (thread_is_real_time_or_idle(newthread)) {
+        if (ticking) {
+            /* if we're switching from a non real time to a real time, cancel
+             * the preemption timer. */
+            TRACE_CONTEXT_SWITCH("stop preempt, cpu %u, old %p (%s), new %p (%s)\n",
+                    cpu, oldthread, oldthread->name, newthread, newthread->name);
+            timer_cancel(&c->preempt_timer);
+        }
+    } else if (!ticking) {
+        /* if we're switching from a real time (or idle thread) to a regular one,
+         * set up a periodic timer to run our preemption tick. */
+        TRACE_CONTEXT_SWITCH("start preempt, cpu %u, old %p (%s), new %p (%s)\n",
+                cpu, oldthread, oldthread->name, newthread, newthread->name);
+        timer_set_oneshot(&c->preempt_timer, now + THREAD_TICK_RATE, thread_timer_tick, NULL);
+    }
+}
+
 // On ARM64 with safe-stack, it's no longer possible to use the unsafe-sp
 // after set_current_thread (we'd now see newthread's unsafe-sp instead!).
 // Hence this function and everything it calls between this point and the
@@ -766,11 +856,23 @@ void _thread_resched_internal(void)
     thread_t *oldthread = current_thread;
 
     /* if it's the same thread as we're already running, exit */
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        /* a deadline thread may have been throttled or replenished */
+        if (thread_is_deadline(newthread) || percpu[cpu].preempt_timer_budget)
+            thread_set_preempt_timer(cpu, oldthread, newthread, current_time());
         return;
+    }
 
     lk_time_t now = current_time();
     oldthread->runtime_ns += now - oldthread->last_started_running;
+
+    /* count threads that ran somewhere else last time */
+    uint last_cpu = thread_last_cpu(newthread);
+    if (last_cpu != cpu && newthread->last_started_running != 0) {
+        percpu[cpu].stats.migrations++;
+        if (!(mp_get_cache_siblings(last_cpu) & (1u << cpu)))
+            percpu[cpu].stats.cache_migrations++;
+    }
     newthread->last_started_running = now;
 
     /* set up quantum for the new thread if it was consumed */
@@ -803,21 +905,7 @@ void _thread_resched_internal(void)
     ktrace(TAG_CONTEXT_SWITCH, (uint32_t)newthread->user_tid, cpu | (oldthread->state << 16),
            (uint32_t)(uintptr_t)oldthread, (uint32_t)(uintptr_t)newthread);
 
-    if (thread_is_real_time_or_idle(newthread)) {
-        if (!thread_is_real_time_or_idle(oldthread)) {
-            /* if we're switching from a non real time to a real time, cancel
-             * the preemption timer. */
-            TRACE_CONTEXT_SWITCH("stop preempt, cpu %u, old %p (%s), new %p (%s)\n",
-                    cpu, oldthread, oldthread->name, newthread, newthread->name);
-            timer_cancel(&percpu[cpu].preempt_timer);
-        }
-    } else if (thread_is_real_time_or_idle(oldthread)) {
-        /* if we're switching from a real time (or idle thread) to a regular one,
-         * set up a periodic timer to run our preemption tick. */
-        TRACE_CONTEXT_SWITCH("start preempt, cpu %u, old %p (%s), new %p (%s)\n",
-                cpu, oldthread, oldthread->name, newthread, newthread->name);
-        timer_set_oneshot(&percpu[cpu].preempt_timer, now + THREAD_TICK_RATE, thread_timer_tick, NULL);
-    }
+    thread_set_preempt_timer(cpu, oldthread, newthread, now);
 
     /* set some optional target debug leds */
     target_set_debug_led(0, !thread_is_idle(newthread));
@@ -956,6 +1044,13 @@ static enum handler_return thread_timer_tick(struct timer *t, lk_time_t now, voi
     }
 }
 
+/* the deadline thread running on this cpu has used up its budget */
+static enum handler_return thread_budget_expired(struct timer *t, lk_time_t now, void *arg)
+{
+    /* the budget is charged, and the thread throttled, as it is preempted */
+    return INT_RESCHEDULE;
+}
+
 /* timer callback to wake up a sleeping thread */
 static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, void *arg)
 {
@@ -1024,7 +1119,8 @@ status_t thread_sleep_etc(lk_time_t deadline, bool interruptable)
 
     if (deadline != INFINITE_TIME) {
         /* set a one shot timer to wake us up and reschedule */
-        timer_set_oneshot(&timer, deadline, thread_sleep_handler, (void *)current_thread);
+        timer_set(&timer, deadline, current_thread->timer_slack,
+                  thread_sleep_handler, (void *)current_thread);
     }
     current_thread->state = THREAD_SLEEPING;
     current_thread->blocked_status = MX_OK;
@@ -1090,6 +1186,7 @@ void thread_construct_first(thread_t *t, const char *name)
     init_thread_struct(t, name);
     t->base_priority = HIGHEST_PRIORITY;
     t->priority_boost = 0;
+    t->inherited_priority = -1;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1174,6 +1271,16 @@ void thread_set_priority(int priority)
     THREAD_UNLOCK(state);
 }
 
+int thread_effective_priority(const thread_t *t)
+{
+    return sched_effective_priority(t);
+}
+
+void thread_set_inherited_priority(thread_t *t, int priority)
+{
+    sched_inherit_priority(t, priority);
+}
+
 /**
  * @brief  Become an idle thread
  *
@@ -1320,6 +1427,11 @@ void dump_thread(thread_t *t, bool full_dump)
                 t->priority_boost, t->remaining_time_slice);
         dprintf(INFO, "\truntime_ns %" PRIu64 ", runtime_s %" PRIu64 "\n",
                 runtime, runtime / 1000000000);
+        if (thread_is_deadline(t)) {
+            dprintf(INFO, "\tdeadline budget %" PRIu64 ", period %" PRIu64 ", remaining %" PRIu64
+                    ", deadline %" PRIu64 "\n", t->deadline_budget, t->deadline_period,
+                    t->deadline_remaining, t->deadline_abs);
+        }
         dprintf(INFO, "\tstack %p, stack_size %zu\n", t->stack, t->stack_size);
         dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
                 (t->flags & THREAD_FLAG_DETACHED) ? "Dt" :"",
@@ -1462,7 +1574,8 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
     /* if the deadline is nonzero or noninfinite, set a callback to yank us out of the queue */
     if (deadline != INFINITE_TIME) {
         timer_init(&timer);
-        timer_set_oneshot(&timer, deadline, wait_queue_timeout_handler, (void *)current_thread);
+        timer_set(&timer, deadline, current_thread->timer_slack,
+                  wait_queue_timeout_handler, (void *)current_thread);
     }
 
     sched_block();
@@ -39,40 +39,156 @@
 
 static spin_lock_t timer_lock;
 
-/**
- * @brief  Initialize a timer object
+/*
+ * Each cpu keeps its pending timers in a pairing heap, ordered by the
+ * latest time each may fire: its deadline plus its slack. Inserting and
+ * removing a timer is cheap no matter how many are queued, which matters
+ * since both happen with interrupts disabled.
+ *
+ * The hardware timer is programmed for the latest time of the head of
+ * the heap. When it fires, timers keep being taken off the head for as
+ * long as the head's deadline has passed, so a timer shares the wakeup
+ * if its deadline has passed and it sorts ahead of every timer whose
+ * deadline has not. A timer with a passed deadline but a large slack can
+ * sit behind one whose deadline is still to come and then waits for a
+ * wakeup of its own, no later than its latest time. Finding it would
+ * mean walking the whole heap with interrupts disabled.
+ *
+ * A node's heap_prev points at its parent if it is the first child,
+ * otherwise at its previous sibling.
  */
-void timer_init(timer_t *timer)
+
+static inline lk_time_t timer_latest(const timer_t *timer)
 {
-    *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
+    lk_time_t latest = timer->scheduled_time + timer->slack;
+    return (latest < timer->scheduled_time) ? INFINITE_TIME : latest;
+}
+
+/* join two heaps, returning the new root */
+static timer_t *timer_heap_meld(timer_t *a, timer_t *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (TIME_LT(timer_latest(b), timer_latest(a))) {
+        timer_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    /* b becomes the first child of a */
+    b->heap_prev = a;
+    b->heap_next = a->heap_child;
+    if (a->heap_child)
+        a->heap_child->heap_prev = b;
+    a->heap_child = b;
+    return a;
+}
+
+/* join a list of sibling heaps into one, pairing them up left to right
+ * and then melding the pairs right to left */
+static timer_t *timer_heap_merge_siblings(timer_t *first)
+{
+    if (first == NULL)
+        return NULL;
+
+    /* first pass, the pairs are chained in reverse through heap_prev */
+    timer_t *pairs = NULL;
+    while (first) {
+        timer_t *a = first;
+        timer_t *b = a->heap_next;
+        first = b ? b->heap_next : NULL;
+
+        a->heap_prev = a->heap_next = NULL;
+        if (b)
+            b->heap_prev = b->heap_next = NULL;
+
+        timer_t *pair = timer_heap_meld(a, b);
+        pair->heap_prev = pairs;
+        pairs = pair;
+    }
+
+    /* second pass */
+    timer_t *root = NULL;
+    while (pairs) {
+        timer_t *next = pairs->heap_prev;
+        pairs->heap_prev = NULL;
+        root = timer_heap_meld(root, pairs);
+        pairs = next;
+    }
+    return root;
 }
 
 static void insert_timer_in_queue(uint cpu, timer_t *timer)
 {
-    timer_t *entry;
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(timer->queue_cpu < 0);
+
+    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 " slack %" PRIu64 "\n", timer, cpu,
+            timer->scheduled_time, timer->slack);
 
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+    timer->queue_cpu = cpu;
+    percpu[cpu].timer_heap = timer_heap_meld(percpu[cpu].timer_heap, timer);
+}
+
+static void remove_timer_from_queue(timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(timer->queue_cpu >= 0);
 
-    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 "\n", timer, cpu, timer->scheduled_time);
+    struct percpu *c = &percpu[timer->queue_cpu];
+    timer_t *children = timer->heap_child;
 
-    list_for_every_entry(&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
+    if (c->timer_heap == timer) {
+        c->timer_heap = timer_heap_merge_siblings(children);
+    } else {
+        /* cut the timer and its subtree out of the heap */
+        timer_t *prev = timer->heap_prev;
+        if (prev->heap_child == timer)
+            prev->heap_child = timer->heap_next;
+        else
+            prev->heap_next = timer->heap_next;
+        if (timer->heap_next)
+            timer->heap_next->heap_prev = prev;
+
+        c->timer_heap = timer_heap_meld(c->timer_heap, timer_heap_merge_siblings(children));
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+    timer->queue_cpu = -1;
+}
+
+static inline timer_t *timer_queue_head(uint cpu)
+{
+    return percpu[cpu].timer_heap;
+}
+
+/**
+ * @brief  Initialize a timer object
+ */
+void timer_init(timer_t *timer)
+{
+    *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
+/**
+ * @brief  Set up a timer that executes once, within a window
+ *
+ * Like timer_set_oneshot(), except that the callback may be delayed by
+ * up to |slack| past the deadline so that it can share a wakeup with
+ * other timers.
+ */
+void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t slack,
+               timer_callback callback, void *arg)
 {
-    LTRACEF("timer %p, deadline %" PRIu64 ", callback %p, arg %p\n", timer, deadline, callback, arg);
+    LTRACEF("timer %p, deadline %" PRIu64 ", slack %" PRIu64 ", callback %p, arg %p\n",
+            timer, deadline, slack, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    if (list_in_list(&timer->node)) {
+    if (timer->queue_cpu >= 0) {
         panic("timer %p already in list\n", timer);
     }
 
@@ -92,6 +208,7 @@ static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callbac
 
     /* set up the structure */
     timer->scheduled_time = deadline;
+    timer->slack = slack;
     timer->callback = callback;
     timer->arg = arg;
     timer->cancel = false;
@@ -104,10 +221,10 @@ static void timer_set(timer_t *timer, lk_time_t deadline, timer_callback callbac
 
     insert_timer_in_queue(cpu, timer);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (timer_queue_head(cpu) == timer) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(deadline);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(timer));
+        platform_set_oneshot_timer(timer_latest(timer));
     }
 
 out:
@@ -130,7 +247,7 @@ out:
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
 {
-    timer_set(timer, deadline, callback, arg);
+    timer_set(timer, deadline, 0, callback, arg);
 }
 
 /**
@@ -171,22 +288,22 @@ bool timer_cancel(timer_t *timer)
     bool callback_not_running;
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
+    if (timer->queue_cpu >= 0) {
         callback_not_running = true;
 
         /* save a copy of the old head of the queue */
-        timer_t *oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer_t *oldhead = timer_queue_head(cpu);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        remove_timer_from_queue(timer);
 
         /* see if we've just modified the head of this cpu's timer queue */
         /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
         if (unlikely(oldhead == timer)) {
-            timer_t *newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+            timer_t *newhead = timer_queue_head(cpu);
             if (newhead) {
-                LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-                platform_set_oneshot_timer(newhead->scheduled_time);
+                LTRACEF("setting new timer to %" PRIu64 "\n", timer_latest(newhead));
+                platform_set_oneshot_timer(timer_latest(newhead));
             } else {
                 LTRACEF("clearing old hw timer, nothing in the queue\n");
                 platform_stop_timer();
@@ -227,8 +344,9 @@ enum handler_return timer_tick(lk_time_t now)
     spin_lock(&timer_lock);
 
     for (;;) {
-        /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        /* see if there's an event to process, a head timer past its
+         * deadline runs now rather than taking a wakeup of its own later */
+        timer = timer_queue_head(cpu);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
@@ -240,7 +358,11 @@ enum handler_return timer_tick(lk_time_t now)
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        remove_timer_from_queue(timer);
+
+        /* it could have waited longer, it is riding along with another timer */
+        if (TIME_LT(now, timer_latest(timer)))
+            CPU_STATS_INC(timers_coalesced);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -270,14 +392,14 @@ enum handler_return timer_tick(lk_time_t now)
     }
 
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer = timer_queue_head(cpu);
     if (timer) {
         /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
+        DEBUG_ASSERT(TIME_GT(timer_latest(timer), now));
 
-        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer->scheduled_time,
+        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer_latest(timer),
                 timer);
-        platform_set_oneshot_timer(timer->scheduled_time);
+        platform_set_oneshot_timer(timer_latest(timer));
     }
 
     /* we're done manipulating the timer queue */
@@ -310,20 +432,20 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&percpu[old_cpu].timer_queue, timer_t, node);
+    timer_t *old_head = timer_queue_head(cpu);
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    timer_t *entry;
+    while ((entry = timer_queue_head(old_cpu)) != NULL) {
+        remove_timer_from_queue(entry);
         insert_timer_in_queue(cpu, entry);
     }
 
-    timer_t *new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t *new_head = timer_queue_head(cpu);
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
-        platform_set_oneshot_timer(new_head->scheduled_time);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(new_head));
+        platform_set_oneshot_timer(timer_latest(new_head));
     }
 
     spin_unlock_irqrestore(&timer_lock, state);
@@ -338,10 +460,10 @@ void timer_thaw_percpu(void)
 
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t *t = timer_queue_head(cpu);
     if (t) {
-        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
-        platform_set_oneshot_timer(t->scheduled_time);
+        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", timer_latest(t));
+        platform_set_oneshot_timer(timer_latest(t));
     }
 
     spin_unlock(&timer_lock);
@@ -351,11 +473,30 @@ void timer_queue_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        percpu[i].timer_heap = NULL;
     }
 }
 
 // print a timer queue dump into the passed in buffer
+/* preorder walk of a timer heap, returns the node after |t| */
+static timer_t *timer_heap_walk_next(timer_t *t)
+{
+    if (t->heap_child)
+        return t->heap_child;
+
+    for (;;) {
+        if (t->heap_next)
+            return t->heap_next;
+
+        /* back up to the parent, which is reached from the first child */
+        while (t->heap_prev && t->heap_prev->heap_child != t)
+            t = t->heap_prev;
+        t = t->heap_prev;
+        if (t == NULL)
+            return NULL;
+    }
+}
+
 static void dump_timer_queues(char *buf, size_t len)
 {
     size_t ptr = 0;
@@ -368,15 +509,12 @@ static void dump_timer_queues(char *buf, size_t len)
         if (mp_is_cpu_online(i)) {
             ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
 
-            timer_t *t;
-            lk_time_t last = now;
-            list_for_every_entry(&percpu[i].timer_queue, t, timer_t, node) {
+            /* heap order, only the first entry is known to be the next to fire */
+            for (timer_t *t = timer_queue_head(i); t; t = timer_heap_walk_next(t)) {
                 lk_time_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
-                lk_time_t delta_last = (t->scheduled_time > last) ? (t->scheduled_time - last) : 0;
                 ptr += snprintf(buf + ptr, len - ptr,
-                        "\ttime %" PRIu64 " delta_now %" PRIu64 " delta_last %" PRIu64 " func %p arg %p\n",
-                        t->scheduled_time, delta_now, delta_last, t->callback, t->arg);
-                last = t->scheduled_time;
+                        "\ttime %" PRIu64 " delta_now %" PRIu64 " slack %" PRIu64 " func %p arg %p\n",
+                        t->scheduled_time, delta_now, t->slack, t->callback, t->arg);
             }
         }
     }
@@ -10,11 +10,17 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_object_paged.h>
 #include <lib/console.h>
 #include <list.h>
 #include <lk/init.h>
@@ -38,6 +44,75 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+namespace {
+
+// Number of free pages each cpu may cache, and how many are moved between a
+// cache and the arenas at a time.
+constexpr size_t kPageCacheSize = 64;
+constexpr size_t kPageCacheBatch = kPageCacheSize / 2;
+
+// Upper bound and default for the number of pre-zeroed pages kept per cpu.
+constexpr size_t kMaxZeroedPages = 64;
+constexpr uint32_t kDefaultZeroedPages = 32;
+
+// Per-cpu cache of free pages in front of the arenas, so that allocating and
+// freeing single pages usually does not touch arena_lock. A second stack holds
+// pages already zeroed by the pmm-zero thread, for PMM_ALLOC_FLAG_ZERO callers.
+//
+// Cached pages only ever come from KMAP arenas, so they can satisfy any
+// request. As far as the arenas are concerned they are allocated, but they
+// are reported as free. The lock is only contended by the zeroing thread.
+struct PageCache {
+    spin_lock_t lock;
+
+    vm_page_t* free_pages[kPageCacheSize];
+    size_t free_count;
+
+    vm_page_t* zeroed_pages[kMaxZeroedPages];
+    size_t zeroed_count;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t zeroed_hits;
+    uint64_t zeroed_misses;
+} __CPU_ALIGN;
+
+PageCache page_caches[SMP_MAX_CPUS];
+
+// Target number of zeroed pages per cpu, 0 if the pool is disabled.
+size_t zeroed_target = 0;
+event_t zero_event = EVENT_INITIAL_VALUE(zero_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Default free page watermarks of the pressure levels, and how far above a
+// watermark the free pages have to climb before its level is left, all as a
+// fraction of physical memory.
+constexpr size_t kDefaultWarningDivisor = 10;
+constexpr size_t kDefaultCriticalDivisor = 20;
+constexpr size_t kWatermarkMarginDivisor = 100;
+
+// In pages, set once when the pmm-pressure thread starts. Until then the
+// level stays at normal.
+size_t warning_watermark = 0;
+size_t critical_watermark = 0;
+size_t watermark_margin = 0;
+
+// Only written with arena_lock held, read without it.
+int pressure_level = PMM_PRESSURE_NORMAL;
+
+// Wakes up the pmm-pressure thread when the level changes.
+event_t pressure_event = EVENT_INITIAL_VALUE(pressure_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Pages freed by discarding unlocked discardable VMOs.
+size_t reclaimed_pages = 0;
+
+} // namespace
+
+static Mutex pressure_lock;
+static pmm_pressure_callback_t pressure_callback TA_GUARDED(pressure_lock) = nullptr;
+static int reported_level TA_GUARDED(pressure_lock) = -1;
+
+static void pmm_update_pressure_locked() TA_REQ(arena_lock);
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -108,7 +183,7 @@ done_add:
     return MX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+static vm_page_t* pmm_alloc_page_arena(uint alloc_flags, paddr_t* pa) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -121,14 +196,217 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
 
         // try to allocate the page out of the arena
         vm_page_t* page = a.AllocPage(pa);
-        if (page)
+        if (page) {
+            pmm_update_pressure_locked();
             return page;
+        }
     }
 
     LTRACEF("failed to allocate page\n");
+
+    // see if anything can be reclaimed for the next attempt
+    event_signal(&pressure_event, false);
     return nullptr;
 }
 
+// Arenas are only added during early boot, so they can be walked without the
+// arena lock.
+static bool page_is_kmap(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+    }
+    return false;
+}
+
+static void zero_vm_page(vm_page_t* page) {
+    arch_zero_page(paddr_to_kvaddr(vm_page_to_paddr(page)));
+}
+
+static vm_page_t* page_cache_alloc() {
+    spin_lock_saved_state_t state;
+    PageCache* cache = &page_caches[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, state);
+    if (likely(cache->free_count > 0)) {
+        vm_page_t* page = cache->free_pages[--cache->free_count];
+        cache->hits++;
+        spin_unlock_irqrestore(&cache->lock, state);
+        return page;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    // The cache is empty, refill it from the arenas. We may have migrated to
+    // another cpu by the time the batch is put back, so leftovers that no
+    // longer fit go straight back to the arenas.
+    list_node batch = LIST_INITIAL_VALUE(batch);
+    if (pmm_alloc_pages(kPageCacheBatch, PMM_ALLOC_FLAG_KMAP, &batch) == 0)
+        return nullptr;
+
+    vm_page_t* page = list_remove_head_type(&batch, vm_page_t, free.node);
+
+    cache = &page_caches[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, state);
+    cache->misses++;
+    while (cache->free_count < kPageCacheSize && !list_is_empty(&batch)) {
+        cache->free_pages[cache->free_count++] =
+            list_remove_head_type(&batch, vm_page_t, free.node);
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (!list_is_empty(&batch))
+        pmm_free(&batch);
+
+    return page;
+}
+
+static vm_page_t* page_cache_alloc_zeroed() {
+    spin_lock_saved_state_t state;
+    PageCache* cache = &page_caches[arch_curr_cpu_num()];
+    vm_page_t* page = nullptr;
+
+    spin_lock_irqsave(&cache->lock, state);
+    if (likely(cache->zeroed_count > 0)) {
+        page = cache->zeroed_pages[--cache->zeroed_count];
+        cache->zeroed_hits++;
+    } else {
+        cache->zeroed_misses++;
+    }
+    bool low = cache->zeroed_count < zeroed_target / 2;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (low && zeroed_target > 0)
+        event_signal(&zero_event, false);
+
+    return page;
+}
+
+static void page_cache_free(vm_page_t* page) {
+    page->state = VM_PAGE_STATE_ALLOC;
+
+    list_node batch = LIST_INITIAL_VALUE(batch);
+
+    spin_lock_saved_state_t state;
+    PageCache* cache = &page_caches[arch_curr_cpu_num()];
+    spin_lock_irqsave(&cache->lock, state);
+    if (unlikely(cache->free_count == kPageCacheSize)) {
+        // Full cache, move half of it back to the arenas so that a subsequent
+        // burst of frees does not immediately overflow again.
+        for (size_t i = 0; i < kPageCacheBatch; i++) {
+            list_add_tail(&batch, &cache->free_pages[--cache->free_count]->free.node);
+        }
+    }
+    cache->free_pages[cache->free_count++] = page;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (!list_is_empty(&batch))
+        pmm_free(&batch);
+}
+
+// Tops up the zeroed page pool of |cpu|. The pages are zeroed without holding
+// any lock.
+static void page_cache_fill_zeroed(uint cpu) {
+    PageCache* cache = &page_caches[cpu];
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        size_t want = zeroed_target - MIN(cache->zeroed_count, zeroed_target);
+        spin_unlock_irqrestore(&cache->lock, state);
+
+        // Under memory pressure the pages are better left to the arenas.
+        if (want == 0 || pmm_get_pressure_level() != PMM_PRESSURE_NORMAL)
+            return;
+
+        list_node batch = LIST_INITIAL_VALUE(batch);
+        if (pmm_alloc_pages(MIN(want, kPageCacheBatch), PMM_ALLOC_FLAG_KMAP, &batch) == 0)
+            return;
+
+        vm_page_t* page;
+        list_for_every_entry (&batch, page, vm_page_t, free.node) {
+            zero_vm_page(page);
+        }
+
+        spin_lock_irqsave(&cache->lock, state);
+        while (cache->zeroed_count < zeroed_target && !list_is_empty(&batch)) {
+            cache->zeroed_pages[cache->zeroed_count++] =
+                list_remove_head_type(&batch, vm_page_t, free.node);
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+
+        if (!list_is_empty(&batch)) {
+            pmm_free(&batch);
+            return;
+        }
+    }
+}
+
+// Moves every page held by the per-cpu caches, zeroed or not, back to the
+// arenas, where any cpu and contiguous allocations can get at them. Returns
+// how many pages were moved.
+static size_t page_cache_drain() {
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        PageCache* cache = &page_caches[cpu];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        while (cache->free_count > 0)
+            list_add_tail(&pages, &cache->free_pages[--cache->free_count]->free.node);
+        while (cache->zeroed_count > 0)
+            list_add_tail(&pages, &cache->zeroed_pages[--cache->zeroed_count]->free.node);
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+    return list_is_empty(&pages) ? 0u : pmm_free(&pages);
+}
+
+static int pmm_zero_thread(void*) {
+    for (;;) {
+        event_wait(&zero_event);
+
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            page_cache_fill_zeroed(cpu);
+        }
+    }
+    return 0;
+}
+
+static void pmm_page_cache_init(uint level) {
+    uint32_t pages = cmdline_get_uint32("pmm.zeroed_pages", kDefaultZeroedPages);
+    zeroed_target = MIN(pages, kMaxZeroedPages);
+    if (zeroed_target == 0)
+        return;
+
+    thread_t* t = thread_create("pmm-zero", &pmm_zero_thread, nullptr, LOW_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+    event_signal(&zero_event, false);
+}
+
+LK_INIT_HOOK(pmm_page_cache, &pmm_page_cache_init, LK_INIT_LEVEL_THREADING);
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    bool zeroed = false;
+    vm_page_t* page = nullptr;
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZERO) {
+        page = page_cache_alloc_zeroed();
+        zeroed = page != nullptr;
+    }
+    if (!page)
+        page = page_cache_alloc();
+    if (page) {
+        if (pa)
+            *pa = vm_page_to_paddr(page);
+    } else {
+        page = pmm_alloc_page_arena(alloc_flags, pa);
+        if (!page)
+            return nullptr;
+    }
+
+    if ((alloc_flags & PMM_ALLOC_FLAG_ZERO) && !zeroed)
+        zero_vm_page(page);
+
+    return page;
+}
+
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     LTRACEF("count %zu\n", count);
 
@@ -158,6 +436,8 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
             break;
     }
 
+    pmm_update_pressure_locked();
+
     return allocated;
 }
 
@@ -190,6 +470,8 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             break;
     }
 
+    pmm_update_pressure_locked();
+
     return allocated;
 }
 
@@ -214,6 +496,7 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
         if (allocated > 0) {
             DEBUG_ASSERT(allocated == count);
+            pmm_update_pressure_locked();
             return allocated;
         }
     }
@@ -313,12 +596,21 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
+    pmm_update_pressure_locked();
+
     LTRACEF("returning count %u\n", count);
 
     return count;
 }
 
 size_t pmm_free_page(vm_page_t* page) {
+    DEBUG_ASSERT(!page_is_free(page));
+
+    if (page_is_kmap(page)) {
+        page_cache_free(page);
+        return 1;
+    }
+
     struct list_node list;
     list_initialize(&list);
 
@@ -327,8 +619,17 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
+// Racy, but each count is word sized so the worst case is a slightly stale sum.
+static size_t pmm_count_cached_pages() {
+    size_t cached = 0u;
+    for (const auto& cache : page_caches) {
+        cached += cache.free_count + cache.zeroed_count;
+    }
+    return cached;
+}
+
 static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
-    size_t free = 0u;
+    size_t free = pmm_count_cached_pages();
     for (const auto& a : arena_list) {
         free += a.free_count();
     }
@@ -340,6 +641,120 @@ size_t pmm_count_free_pages() {
     return pmm_count_free_pages_locked();
 }
 
+// Works out the pressure level with |free| pages left, coming from |level|.
+static pmm_pressure_level pressure_level_for(size_t free, pmm_pressure_level level) {
+    if (free < critical_watermark ||
+        (level == PMM_PRESSURE_CRITICAL && free < critical_watermark + watermark_margin))
+        return PMM_PRESSURE_CRITICAL;
+
+    if (free < warning_watermark ||
+        (level != PMM_PRESSURE_NORMAL && free < warning_watermark + watermark_margin))
+        return PMM_PRESSURE_WARNING;
+
+    return PMM_PRESSURE_NORMAL;
+}
+
+// Called whenever the arenas hand out or take back pages. Pages going in and
+// out of the per-cpu caches don't count, which lets the level lag behind by at
+// most the size of the caches.
+static void pmm_update_pressure_locked() {
+    // not set up yet
+    if (warning_watermark == 0)
+        return;
+
+    auto level = static_cast<pmm_pressure_level>(
+        __atomic_load_n(&pressure_level, __ATOMIC_RELAXED));
+    auto new_level = pressure_level_for(pmm_count_free_pages_locked(), level);
+    if (new_level != level) {
+        __atomic_store_n(&pressure_level, new_level, __ATOMIC_RELAXED);
+        event_signal(&pressure_event, false);
+    }
+}
+
+pmm_pressure_level pmm_get_pressure_level() {
+    return static_cast<pmm_pressure_level>(__atomic_load_n(&pressure_level, __ATOMIC_RELAXED));
+}
+
+void pmm_set_pressure_callback(pmm_pressure_callback_t callback) {
+    AutoLock al(&pressure_lock);
+    pressure_callback = callback;
+    reported_level = -1;
+    event_signal(&pressure_event, true);
+}
+
+static int pmm_pressure_thread(void*) {
+    for (;;) {
+        event_wait(&pressure_event);
+
+        // Throw away the contents of discardable VMOs until the free pages
+        // are back above the warning level. Freeing them updates the level.
+        // The pages in the per-cpu caches already count as free, but only
+        // their own cpu can use them, so hand those back to the arenas first.
+        size_t free = pmm_count_free_pages();
+        size_t target = warning_watermark + watermark_margin;
+        if (free < target) {
+            __UNUSED size_t drained = page_cache_drain();
+            LTRACEF("drained %zu pages from the per-cpu caches\n", drained);
+            size_t reclaimed = VmObjectPaged::ReclaimDiscardable(target - free);
+            __atomic_fetch_add(&reclaimed_pages, reclaimed, __ATOMIC_RELAXED);
+            LTRACEF("reclaimed %zu pages with %zu free\n", reclaimed, free);
+        }
+
+        // Call back without the lock, so that the callback can register a new
+        // one. Should it do so, the event is signaled again and the new
+        // callback gets the current level on the next pass.
+        pmm_pressure_callback_t callback = nullptr;
+        int level = pmm_get_pressure_level();
+        {
+            AutoLock al(&pressure_lock);
+            if (pressure_callback && level != reported_level) {
+                reported_level = level;
+                callback = pressure_callback;
+            }
+        }
+        if (callback)
+            callback(static_cast<pmm_pressure_level>(level));
+    }
+    return 0;
+}
+
+static void pmm_pressure_init(uint level) {
+    size_t total_pages = pmm_count_total_bytes() / PAGE_SIZE;
+    const size_t pages_per_mb = MB / PAGE_SIZE;
+
+    size_t warning = cmdline_get_uint32("pmm.watermark_warning_mb", 0) * pages_per_mb;
+    if (warning == 0)
+        warning = total_pages / kDefaultWarningDivisor;
+    size_t critical = cmdline_get_uint32("pmm.watermark_critical_mb", 0) * pages_per_mb;
+    if (critical == 0 || critical > warning)
+        critical = MIN(warning, total_pages / kDefaultCriticalDivisor);
+
+    watermark_margin = MAX(total_pages / kWatermarkMarginDivisor, 1u);
+    critical_watermark = critical;
+
+    {
+        AutoLock al(&arena_lock);
+        warning_watermark = MAX(warning, 1u);
+        pmm_update_pressure_locked();
+    }
+
+    thread_t* t = thread_create("pmm-pressure", &pmm_pressure_thread, nullptr, HIGH_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(pmm_pressure, &pmm_pressure_init, LK_INIT_LEVEL_THREADING);
+
+static void pressure_dump() {
+    static const char* const names[] = {"normal", "warning", "critical"};
+    printf("pressure %s, %zu pages free\n", names[pmm_get_pressure_level()],
+           pmm_count_free_pages());
+    printf("watermarks: warning %zu critical %zu margin %zu pages\n",
+           warning_watermark, critical_watermark, watermark_margin);
+    printf("%zu pages reclaimed from discardable vmos\n",
+           __atomic_load_n(&reclaimed_pages, __ATOMIC_RELAXED));
+}
+
 static void pmm_dump_free() TA_REQ(arena_lock) {
     auto megabytes_free = pmm_count_free_pages_locked() / 256u;
     printf(" %zu free MBs\n", megabytes_free);
@@ -358,9 +773,16 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     // TODO(MG-833): This is extremely expensive, holding a global lock
     // and touching every page/arena. We should keep a running count instead.
     AutoLock al(&arena_lock);
+    size_t alloc_before = state_count[VM_PAGE_STATE_ALLOC];
     for (auto& a : arena_list) {
         a.CountStates(state_count);
     }
+
+    // Pages sitting in the per-cpu caches look allocated to the arenas.
+    size_t cached = MIN(pmm_count_cached_pages(),
+                        state_count[VM_PAGE_STATE_ALLOC] - alloc_before);
+    state_count[VM_PAGE_STATE_ALLOC] -= cached;
+    state_count[VM_PAGE_STATE_FREE] += cached;
 }
 
 extern "C" enum handler_return pmm_dump_timer(struct timer* t, lk_time_t now, void*) TA_REQ(arena_lock) {
@@ -382,6 +804,17 @@ static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     }
 }
 
+static void page_cache_dump() {
+    printf("zeroed page target %zu\n", zeroed_target);
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        const PageCache& cache = page_caches[cpu];
+        printf("cpu %u: %zu free (%" PRIu64 " hits, %" PRIu64 " misses), "
+               "%zu zeroed (%" PRIu64 " hits, %" PRIu64 " misses)\n",
+               cpu, cache.free_count, cache.hits, cache.misses,
+               cache.zeroed_count, cache.zeroed_hits, cache.zeroed_misses);
+    }
+}
+
 static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     bool is_panic = flags & CMD_FLAG_PANIC;
 
@@ -391,7 +824,9 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     usage:
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
+        printf("%s caches\n", argv[0].str);
         if (!is_panic) {
+            printf("%s pressure\n", argv[0].str);
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
             printf("%s alloc_kpages <count>\n", argv[0].str);
@@ -407,10 +842,15 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
 
     if (!strcmp(argv[1].str, "arenas")) {
         arena_dump(is_panic);
+    } else if (!strcmp(argv[1].str, "caches")) {
+        page_cache_dump();
+
     } else if (is_panic) {
         // No other operations will work during a panic.
         printf("Only the \"arenas\" command is available during a panic.\n");
         goto usage;
+    } else if (!strcmp(argv[1].str, "pressure")) {
+        pressure_dump();
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
         static timer_t timer;
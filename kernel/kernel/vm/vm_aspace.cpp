@@ -585,6 +585,13 @@ VmAspace* VmAspace::vaddr_to_aspace(uintptr_t address) {
     }
 }
 
+void VmAspace::GetFaultStats(vm_fault_stats_t* stats) const {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+    *stats = fault_stats_;
+}
+
 // TODO(dbort): Use GetMemoryUsage()
 size_t VmAspace::AllocatedPages() const {
     canary_.Assert();
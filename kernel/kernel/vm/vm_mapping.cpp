@@ -10,10 +10,12 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/vm.h>
 #include <kernel/vm/fault.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lk/init.h>
 #include <mxalloc/new.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
@@ -22,6 +24,31 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+namespace {
+
+// Size in pages of the naturally aligned window around a faulting address
+// whose already present pages are mapped along with the faulting one. Must be
+// a power of two, 1 disables fault-around.
+constexpr uint32_t kDefaultFaultAroundPages = 16;
+
+// Number of pages faulted in ahead of a sequential stream of faults. Unlike
+// fault-around this commits memory, so it is off by default.
+constexpr uint32_t kDefaultReadAheadPages = 0;
+
+size_t fault_around_pages = kDefaultFaultAroundPages;
+size_t read_ahead_pages = kDefaultReadAheadPages;
+
+void vm_fault_around_init(uint level) {
+    uint32_t pages = cmdline_get_uint32("vm.fault_around_pages", kDefaultFaultAroundPages);
+    // round down to a power of two so the window stays naturally aligned
+    fault_around_pages = pages ? (1u << (31 - __builtin_clz(pages))) : 1;
+    read_ahead_pages = cmdline_get_uint32("vm.read_ahead_pages", kDefaultReadAheadPages);
+}
+
+} // namespace
+
+LK_INIT_HOOK(vm_fault_around, &vm_fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -404,7 +431,30 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
     // iterate through the range, grabbing a page from the underlying object and
-    // mapping it in
+    // mapping it in. Pages that are contiguous both virtually and physically
+    // are collected into runs and mapped with one call, which lets the arch
+    // layer use large pages for runs that are big and aligned enough.
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_pages = 0;
+
+    auto map_run = [&]() {
+        if (run_pages == 0)
+            return;
+        LTRACEF_LEVEL(2, "mapping %zu pages at pa %#" PRIxPTR " to va %#" PRIxPTR "\n",
+                      run_pages, run_pa, run_va);
+
+        size_t mapped;
+        auto ret = aspace_->arch_aspace().Map(run_va, run_pa, run_pages, arch_mmu_flags_, &mapped);
+        if (ret < 0) {
+            TRACEF("error %d mapping %zu pages at va %#" PRIxPTR " pa %#" PRIxPTR "\n",
+                   ret, run_pages, run_va, run_pa);
+        }
+
+        DEBUG_ASSERT(mapped == run_pages);
+        run_pages = 0;
+    };
+
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
@@ -416,24 +466,28 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
             // no page to map
             if (commit) {
                 // fail when we can't commit every requested page
+                map_run();
                 return status;
             } else {
                 // skip ahead
+                map_run();
                 continue;
             }
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        size_t mapped;
-        auto ret = aspace_->arch_aspace().Map(va, pa, 1, arch_mmu_flags_, &mapped);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_pages > 0 && va == run_va + run_pages * PAGE_SIZE &&
+            pa == run_pa + run_pages * PAGE_SIZE) {
+            run_pages++;
+            continue;
         }
 
-        DEBUG_ASSERT(mapped == 1);
+        map_run();
+        run_va = va;
+        run_pa = pa;
+        run_pages = 1;
     }
+    map_run();
 
     return MX_OK;
 }
@@ -537,6 +591,15 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return MX_ERR_ACCESS_DENIED;
     }
 
+    aspace_->fault_stats_.faults++;
+
+    // on a write fault, try to back the whole large page around the fault at
+    // once. This is done before we take the vmo lock and mark ourselves as
+    // faulting, so the vmo zeroes the memory unlocked and the small pages we
+    // may already map in the range get unmapped like everyone else's.
+    if ((pf_flags & VMM_PF_FLAG_WRITE) && CanMapLargePage(va, vmo_offset))
+        object_->CommitLargePage(vmo_offset);
+
     // grab the lock for the vmo
     AutoLock al(object_->lock());
 
@@ -558,6 +621,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return status;
     }
 
+    // see if the page can be mapped as part of a large page instead
+    if (MapLargePageLocked(va, vmo_offset))
+        return MX_OK;
+
     // if we read faulted, make sure we map or modify the page without any write permissions
     // this ensures we will fault again if a write is attempted so we can potentially
     // replace this page with a copy or a new one
@@ -632,6 +699,8 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return MX_ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        FaultAroundLocked(va, pf_flags, mmu_flags);
     }
 
 // TODO: figure out what to do with this
@@ -642,6 +711,181 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return MX_OK;
 }
 
+bool VmMapping::CanMapLargePage(vaddr_t va, uint64_t vmo_offset) const {
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    if (size_ < LARGE_PAGE_SIZE || large_va < base_ ||
+        large_va - base_ > size_ - LARGE_PAGE_SIZE)
+        return false;
+
+    // the mapping has to line up with the vmo's large pages
+    const uint64_t large_offset = vmo_offset - (va - large_va);
+    return IS_ALIGNED(large_offset, LARGE_PAGE_SIZE);
+}
+
+// Like PageFault(), this is only ever called with the aspace lock and the vmo
+// lock held, which the analysis cannot see through object_->lock().
+bool VmMapping::MapLargePageLocked(vaddr_t va, uint64_t vmo_offset) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(currently_faulting_);
+
+    if (!CanMapLargePage(va, vmo_offset))
+        return false;
+
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    const uint64_t large_offset = vmo_offset - (va - large_va);
+    paddr_t pa;
+    if (object_->GetLargePageLocked(large_offset, &pa) != MX_OK)
+        return false;
+
+    // Promote whatever small pages are mapped in the range. The vmo only
+    // reports pages it owns outright, so unlike the single page path the
+    // large page can get the mapping's full permissions right away; a write
+    // fault that later had to upgrade it would split it again.
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    status_t status = aspace_->arch_aspace().Unmap(large_va, count, nullptr);
+    if (status < 0) {
+        TRACEF("failed to unmap range for large page at va %#" PRIxPTR "\n", large_va);
+        return false;
+    }
+
+    size_t mapped;
+    status = aspace_->arch_aspace().Map(large_va, pa, count, arch_mmu_flags_, &mapped);
+    if (status < 0) {
+        // fall back to mapping the single page
+        TRACEF("failed to map large page at va %#" PRIxPTR "\n", large_va);
+        return false;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+    LTRACEF("mapped large page pa %#" PRIxPTR " at va %#" PRIxPTR "\n", pa, large_va);
+
+#if ARCH_ARM64
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+        arch_sync_cache_range(large_va, LARGE_PAGE_SIZE);
+#endif
+    return true;
+}
+
+// Like PageFault(), this is only ever called with the aspace lock and the vmo
+// lock held, which the analysis cannot see through object_->lock().
+void VmMapping::FaultAroundLocked(vaddr_t va, uint pf_flags,
+                                  uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(currently_faulting_);
+
+    const bool sequential = (va == next_sequential_va_);
+    const vaddr_t end = base_ + size_;
+
+    // A run of pages that are contiguous both virtually and physically, so
+    // that it can be handed to the arch layer in a single Map() call.
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_pages = 0;
+    uint64_t* run_stat = nullptr;
+    uint run_mmu_flags = 0;
+
+    auto flush_run = [&]() {
+        if (run_pages == 0)
+            return;
+        size_t mapped = 0;
+        status_t status = aspace_->arch_aspace().Map(run_va, run_pa, run_pages,
+                                                     run_mmu_flags, &mapped);
+        if (status < 0) {
+            // only an optimization, the pages will be faulted in on demand
+            LTRACEF("failed to map %zu pages at va %#" PRIxPTR ": %d\n", run_pages, run_va, status);
+        }
+        *run_stat += mapped;
+#if ARCH_ARM64
+        if (mapped > 0 && (run_mmu_flags & ARCH_MMU_FLAG_PERM_EXECUTE))
+            arch_sync_cache_range(run_va, mapped * PAGE_SIZE);
+#endif
+        run_pages = 0;
+    };
+
+    auto add_to_run = [&](vaddr_t page_va, paddr_t pa, uint flags, uint64_t* stat) {
+        if (run_pages > 0 && run_mmu_flags == flags &&
+            page_va == run_va + run_pages * PAGE_SIZE &&
+            pa == run_pa + run_pages * PAGE_SIZE) {
+            run_pages++;
+            return;
+        }
+        flush_run();
+        run_va = page_va;
+        run_pa = pa;
+        run_pages = 1;
+        run_mmu_flags = flags;
+        run_stat = stat;
+    };
+
+    // The first address past |va| that is not mapped once we are done, which
+    // is where the next fault of a sequential scan will land.
+    vaddr_t next_va = va + PAGE_SIZE;
+
+    // Map whatever the vmo already has in the window around the fault. This
+    // never allocates or copies, so neighbours are always mapped read-only: a
+    // page may belong to a parent we would have to copy on write.
+    const size_t window = fault_around_pages * PAGE_SIZE;
+    if (fault_around_pages > 1) {
+        vaddr_t window_start = MAX(ROUNDDOWN(va, window), base_);
+        vaddr_t window_end = ROUNDDOWN(va, window) + window;
+        if (window_end < va || window_end > end)
+            window_end = end;
+
+        const uint around_mmu_flags = arch_mmu_flags_ & ~ARCH_MMU_FLAG_PERM_WRITE;
+        for (vaddr_t addr = window_start; addr < window_end; addr += PAGE_SIZE) {
+            if (addr == va) {
+                flush_run();
+                continue;
+            }
+
+            paddr_t pa;
+            bool present = aspace_->arch_aspace().Query(addr, nullptr, nullptr) >= 0;
+            if (!present) {
+                uint64_t vmo_offset = addr - base_ + object_offset_;
+                if (object_->GetPageLocked(vmo_offset, 0, nullptr, nullptr, &pa) == MX_OK) {
+                    add_to_run(addr, pa, around_mmu_flags, &aspace_->fault_stats_.fault_around_pages);
+                    present = true;
+                }
+            }
+            if (!present) {
+                flush_run();
+            } else if (addr == next_va) {
+                next_va += PAGE_SIZE;
+            }
+        }
+        flush_run();
+    }
+
+    // If this fault landed right where the last one left off, fault in the
+    // pages ahead of the stream the same way the faulting page was, so a
+    // sequential scan of memory the vmo does not have yet takes one fault per
+    // read-ahead window instead of one per page.
+    if (sequential && read_ahead_pages > 0 && next_va < end) {
+        vaddr_t ahead_end = next_va + read_ahead_pages * PAGE_SIZE;
+        if (ahead_end < next_va || ahead_end > end)
+            ahead_end = end;
+
+        for (vaddr_t addr = next_va; addr < ahead_end; addr += PAGE_SIZE) {
+            // Stop at the first page that is already mapped, replacing
+            // existing mappings is left to the real fault path.
+            if (aspace_->arch_aspace().Query(addr, nullptr, nullptr) >= 0)
+                break;
+
+            paddr_t pa;
+            uint64_t vmo_offset = addr - base_ + object_offset_;
+            if (object_->GetPageLocked(vmo_offset, pf_flags, nullptr, nullptr, &pa) != MX_OK)
+                break;
+
+            // assert that we're not accidentally mapping the zero page writable
+            DEBUG_ASSERT((pa != vm_get_zero_page_paddr()) || !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
+
+            add_to_run(addr, pa, mmu_flags, &aspace_->fault_stats_.read_ahead_pages);
+            next_va = addr + PAGE_SIZE;
+        }
+        flush_run();
+    }
+
+    next_sequential_va_ = next_va;
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
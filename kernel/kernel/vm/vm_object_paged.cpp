@@ -49,8 +49,12 @@ void InitializeVmPage(vm_page_t* p) {
 
 } // namespace
 
-VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent)
-    : VmObject(mxtl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags) {
+Mutex VmObjectPaged::discardable_lock_ = {};
+VmObjectPaged::DiscardableList VmObjectPaged::discardable_list_ = {};
+
+VmObjectPaged::VmObjectPaged(uint32_t options, uint32_t pmm_alloc_flags,
+                             mxtl::RefPtr<VmObject> parent)
+    : VmObject(mxtl::move(parent)), options_(options), pmm_alloc_flags_(pmm_alloc_flags) {
     LTRACEF("%p\n", this);
 }
 
@@ -59,6 +63,13 @@ VmObjectPaged::~VmObjectPaged() {
 
     LTRACEF("%p\n", this);
 
+    // make sure the reclaimer is done with us before the pages go away
+    if (options_ & kDiscardable) {
+        AutoLock dl(&discardable_lock_);
+        if (discardable_list_state_.InContainer())
+            discardable_list_.erase(*this);
+    }
+
     page_list_.ForEveryPage(
             [](const auto p, uint64_t off) {
                 if (p->object.contiguous_pin) {
@@ -72,13 +83,17 @@ VmObjectPaged::~VmObjectPaged() {
     page_list_.FreeAllPages();
 }
 
-mx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, mxtl::RefPtr<VmObject>* obj) {
+mx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint32_t options, uint64_t size,
+                                  mxtl::RefPtr<VmObject>* obj) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return MX_ERR_INVALID_ARGS;
 
+    if (options & ~(kLargePages | kDiscardable))
+        return MX_ERR_INVALID_ARGS;
+
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr));
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(options, pmm_alloc_flags, nullptr));
     if (!ac.check())
         return MX_ERR_NO_MEMORY;
 
@@ -86,6 +101,12 @@ mx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, mxtl:
     if (err != MX_OK)
         return err;
 
+    // discardable objects start out unlocked
+    if (options & kDiscardable) {
+        AutoLock dl(&discardable_lock_);
+        discardable_list_.push_back(vmo.get());
+    }
+
     *obj = mxtl::move(vmo);
 
     return MX_OK;
@@ -96,8 +117,12 @@ status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
 
     canary_.Assert();
 
+    // a clone would see its parent's pages vanish out from under it
+    if (options_ & kDiscardable)
+        return MX_ERR_NOT_SUPPORTED;
+
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, mxtl::WrapRefPtr(this)));
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(0u, pmm_alloc_flags_, mxtl::WrapRefPtr(this)));
     if (!ac.check())
         return MX_ERR_NO_MEMORY;
 
@@ -167,13 +192,13 @@ size_t VmObjectPaged::AllocatedPagesInRange(uint64_t offset, uint64_t len) const
     size_t count = 0;
     // TODO: Figure out what to do with our parent's pages. If we're a clone,
     // page_list_ only contains pages that we've made copies of.
-    page_list_.ForEveryPage(
+    page_list_.ForEveryPageInRange(
         [&count, offset, new_len](const auto p, uint64_t off) {
             if (off >= offset && off < offset + new_len) {
                 count++;
             }
             return MX_ERR_NEXT;
-        });
+        }, ROUNDDOWN(offset, PAGE_SIZE), ROUNDUP_PAGE_SIZE(offset + new_len));
     return count;
 }
 
@@ -373,15 +398,16 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_node*
         return MX_OK;
     }
 
-    // allocate a page
+    // allocate a page, pages from the pmm come back zeroed
     if (free_list) {
         p = list_remove_head_type(free_list, vm_page_t, free.node);
         if (p) {
             pa = vm_page_to_paddr(p);
+            ZeroPage(pa);
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, &pa);
     }
     if (!p) {
         return MX_ERR_NO_MEMORY;
@@ -389,9 +415,6 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_node*
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == MX_OK);
 
@@ -408,6 +431,141 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_node*
     return MX_OK;
 }
 
+status_t VmObjectPaged::CanCommitLargePageLocked(uint64_t start) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_ALIGNED(start, LARGE_PAGE_SIZE));
+
+    if (!(options_ & kLargePages) || parent_)
+        return MX_ERR_NOT_SUPPORTED;
+
+    if (start >= size_ || size_ - start < LARGE_PAGE_SIZE)
+        return MX_ERR_OUT_OF_RANGE;
+
+    // only commit into a completely empty range
+    bool empty = true;
+    page_list_.ForEveryPageInRange(
+        [&empty](const auto p, uint64_t off) {
+            empty = false;
+            return MX_ERR_STOP;
+        },
+        start, start + LARGE_PAGE_SIZE);
+    if (!empty)
+        return MX_ERR_ALREADY_EXISTS;
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::AddLargePageLocked(uint64_t start, list_node* pages) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // the object may have been resized or had pages added while the caller
+    // was allocating without the lock
+    status_t status = CanCommitLargePageLocked(start);
+    if (status != MX_OK)
+        return status;
+
+    const uint64_t end = start + LARGE_PAGE_SIZE;
+    for (uint64_t o = start; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        ASSERT(p);
+
+        InitializeVmPage(p);
+
+        status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == MX_OK);
+    }
+
+    // other mappings may have covered this range of the vmo, so unmap those ranges
+    RangeChangeUpdateLocked(start, LARGE_PAGE_SIZE);
+
+    LTRACEF("committed large page at offset %#" PRIx64 "\n", start);
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::CommitLargePage(uint64_t offset) {
+    canary_.Assert();
+
+    uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+
+    // cheap check before allocating and zeroing a whole large page
+    {
+        AutoLock a(&lock_);
+        status_t status = CanCommitLargePageLocked(start);
+        if (status != MX_OK)
+            return status;
+    }
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, LARGE_PAGE_SIZE_SHIFT,
+                                            nullptr, &page_list);
+    if (allocated < count) {
+        LTRACEF("failed to allocate a large page (got %zu pages)\n", allocated);
+        pmm_free(&page_list);
+        return MX_ERR_NO_MEMORY;
+    }
+
+    // pmm_alloc_contiguous cannot hand back zeroed pages, so zero them here,
+    // before taking the lock
+    vm_page_t* p;
+    list_for_every_entry (&page_list, p, vm_page_t, free.node) {
+        ZeroPage(p);
+    }
+
+    status_t status;
+    {
+        AutoLock a(&lock_);
+        status = AddLargePageLocked(start, &page_list);
+    }
+
+    if (status != MX_OK)
+        pmm_free(&page_list);
+
+    return status;
+}
+
+status_t VmObjectPaged::GetLargePageLocked(uint64_t offset, paddr_t* pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // only objects that commit memory in large runs are worth checking, and
+    // a parent's pages would have to be mapped read-only
+    if (!(options_ & kLargePages) || parent_)
+        return MX_ERR_NOT_SUPPORTED;
+
+    uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+    if (start >= size_ || size_ - start < LARGE_PAGE_SIZE)
+        return MX_ERR_OUT_OF_RANGE;
+
+    paddr_t start_pa = 0;
+    uint64_t expected_next_off = start;
+    page_list_.ForEveryPageInRange(
+        [&start_pa, &expected_next_off, start](const auto p, uint64_t off) {
+            paddr_t page_pa = vm_page_to_paddr(p);
+            if (off != expected_next_off)
+                return MX_ERR_STOP;
+            if (off == start) {
+                if (!IS_ALIGNED(page_pa, LARGE_PAGE_SIZE))
+                    return MX_ERR_STOP;
+                start_pa = page_pa;
+            } else if (page_pa != start_pa + (off - start)) {
+                return MX_ERR_STOP;
+            }
+            expected_next_off = off + PAGE_SIZE;
+            return MX_ERR_NEXT;
+        },
+        start, start + LARGE_PAGE_SIZE);
+
+    if (expected_next_off != start + LARGE_PAGE_SIZE)
+        return MX_ERR_NOT_FOUND;
+
+    *pa = start_pa;
+    return MX_OK;
+}
+
 status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
@@ -415,6 +573,21 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     if (committed)
         *committed = 0;
 
+    // commit whole large pages first, without holding the lock while they are
+    // zeroed, leaving the rest of the range, and any large page that could not
+    // be allocated contiguously, to the pass below
+    uint64_t large_committed = 0;
+    if (options_ & kLargePages) {
+        for (uint64_t o = ROUNDUP(offset, LARGE_PAGE_SIZE);
+             o >= offset && o - offset < len && len - (o - offset) >= LARGE_PAGE_SIZE;
+             o += LARGE_PAGE_SIZE) {
+            if (CommitLargePage(o) == MX_OK)
+                large_committed += LARGE_PAGE_SIZE;
+        }
+        if (committed)
+            *committed = large_committed;
+    }
+
     AutoLock a(&lock_);
 
     // trim the size
@@ -433,19 +606,14 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
 
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
-    uint64_t expected_next_off = offset;
-    page_list_.ForEveryPageInRange(
-            [&count, &expected_next_off](const auto p, uint64_t off) {
-
-                count += (off - expected_next_off) / PAGE_SIZE;
-                expected_next_off = off + PAGE_SIZE;
+    page_list_.ForEveryPageAndGapInRange(
+            [](const auto p, uint64_t off) {
                 return MX_ERR_NEXT;
-            }, expected_next_off, end);
-
-    // If expected_next_off isn't at the end of the range, there was a gap at
-    // the end.  Add it back in
-    DEBUG_ASSERT(end >= expected_next_off);
-    count += (end - expected_next_off) / PAGE_SIZE;
+            },
+            [&count](uint64_t gap_start, uint64_t gap_end) {
+                count += (gap_end - gap_start) / PAGE_SIZE;
+                return MX_ERR_NEXT;
+            }, offset, end);
     if (count == 0)
         return MX_OK;
 
@@ -463,30 +631,41 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(offset, end - offset);
 
-    // add them to the appropriate range of the object
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        // Don't commit if we already have this page
-        vm_page_t* p = page_list_.GetPage(o);
-        if (p) {
-            continue;
+    // add them to the appropriate range of the object, skipping over the runs
+    // of pages we already have. The page list can't be modified while it is
+    // being walked, so find one gap at a time and fill it in.
+    for (uint64_t o = offset; o < end;) {
+        uint64_t gap_start = end;
+        uint64_t gap_end = end;
+        page_list_.ForEveryPageAndGapInRange(
+                [](const auto p, uint64_t off) {
+                    return MX_ERR_NEXT;
+                },
+                [&gap_start, &gap_end](uint64_t start, uint64_t stop) {
+                    gap_start = start;
+                    gap_end = stop;
+                    return MX_ERR_STOP;
+                }, o, end);
+
+        for (o = gap_start; o < gap_end; o += PAGE_SIZE) {
+            // Check if our parent has the page
+            vm_page_t* p;
+            paddr_t pa;
+            const uint flags = VMM_PF_FLAG_SW_FAULT | VMM_PF_FLAG_WRITE;
+            // Should not be able to fail, since we're providing it memory and the
+            // range should be valid.
+            status_t status = GetPageLocked(o, flags, &page_list, &p, &pa);
+            ASSERT(status == MX_OK);
+
+            if (committed)
+                *committed += PAGE_SIZE;
         }
-
-        // Check if our parent has the page
-        paddr_t pa;
-        const uint flags = VMM_PF_FLAG_SW_FAULT | VMM_PF_FLAG_WRITE;
-        // Should not be able to fail, since we're providing it memory and the
-        // range should be valid.
-        status_t status = GetPageLocked(o, flags, &page_list, &p, &pa);
-        ASSERT(status == MX_OK);
-
-        if (committed)
-            *committed += PAGE_SIZE;
     }
 
     DEBUG_ASSERT(list_is_empty(&page_list));
 
     // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed == large_committed + count * PAGE_SIZE);
 
     return MX_OK;
 }
@@ -521,10 +700,14 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
     // make a pass through the list, making sure we have an empty run on the object
     size_t count = 0;
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        if (!page_list_.GetPage(o))
-            count++;
-    }
+    page_list_.ForEveryPageAndGapInRange(
+            [](const auto p, uint64_t off) {
+                return MX_ERR_NEXT;
+            },
+            [&count](uint64_t gap_start, uint64_t gap_end) {
+                count += (gap_end - gap_start) / PAGE_SIZE;
+                return MX_ERR_NEXT;
+            }, offset, end);
 
     DEBUG_ASSERT(count == new_len / PAGE_SIZE);
     if (count != new_len / PAGE_SIZE) {
@@ -613,13 +796,199 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
-    // iterate through the pages, freeing them
-    while (start < end) {
-        auto status = page_list_.FreePage(start);
-        if (status == MX_OK && decommitted) {
-            *decommitted += PAGE_SIZE;
+    // pull the pages out of the list and return them to the pmm in one batch
+    list_node list;
+    list_initialize(&list);
+    size_t count = page_list_.RemovePages(start, end, &list);
+    pmm_free(&list);
+
+    if (decommitted) {
+        *decommitted = count * PAGE_SIZE;
+    }
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return MX_ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    uint64_t new_len;
+    if (!TrimRange(offset, len, size_, &new_len) || new_len != len)
+        return MX_ERR_OUT_OF_RANGE;
+
+    if (len == 0)
+        return MX_OK;
+
+    // The pages a clone has not copied yet belong to its parent.
+    if (parent_)
+        return MX_ERR_NOT_SUPPORTED;
+
+    if (AnyPagesPinnedLocked(offset, len))
+        return MX_ERR_BAD_STATE;
+
+    const uint64_t end = offset + len;
+
+    // allocate zero pages for the holes up front, so that failing leaves the
+    // vmo untouched
+    size_t count = 0;
+    page_list_.ForEveryPageAndGapInRange(
+            [](const auto p, uint64_t off) {
+                return MX_ERR_NEXT;
+            },
+            [&count](uint64_t gap_start, uint64_t gap_end) {
+                count += (gap_end - gap_start) / PAGE_SIZE;
+                return MX_ERR_NEXT;
+            }, offset, end);
+
+    list_node zero_pages;
+    list_initialize(&zero_pages);
+    for (size_t i = 0; i < count; i++) {
+        vm_page_t* p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, nullptr);
+        if (!p) {
+            pmm_free(&zero_pages);
+            return MX_ERR_NO_MEMORY;
+        }
+        list_add_tail(&zero_pages, &p->free.node);
+    }
+
+    // commit the holes with the zero pages, so that the whole range can be
+    // pulled out in order. Should this fail part way the pages that did get
+    // added read back as zero, just as the holes did.
+    for (uint64_t o = offset; o < end;) {
+        uint64_t gap_start = end;
+        uint64_t gap_end = end;
+        page_list_.ForEveryPageAndGapInRange(
+                [](const auto p, uint64_t off) {
+                    return MX_ERR_NEXT;
+                },
+                [&gap_start, &gap_end](uint64_t start, uint64_t stop) {
+                    gap_start = start;
+                    gap_end = stop;
+                    return MX_ERR_STOP;
+                }, o, end);
+
+        for (o = gap_start; o < gap_end; o += PAGE_SIZE) {
+            vm_page_t* p = list_remove_head_type(&zero_pages, vm_page_t, free.node);
+            DEBUG_ASSERT(p);
+            InitializeVmPage(p);
+            status_t status = page_list_.AddPage(p, o);
+            if (status != MX_OK) {
+                list_add_head(&zero_pages, &p->free.node);
+                pmm_free(&zero_pages);
+                return status;
+            }
+        }
+    }
+    DEBUG_ASSERT(list_is_empty(&zero_pages));
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    list_node taken;
+    list_initialize(&taken);
+    __UNUSED size_t taken_count = page_list_.RemovePages(offset, end, &taken);
+    DEBUG_ASSERT(taken_count == len / PAGE_SIZE);
+
+    vm_page_t* p;
+    while ((p = list_remove_head_type(&taken, vm_page_t, free.node)) != nullptr) {
+        p->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(pages, &p->free.node);
+    }
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return MX_ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    uint64_t new_len;
+    if (!TrimRange(offset, len, size_, &new_len) || new_len != len)
+        return MX_ERR_OUT_OF_RANGE;
+
+    if (len == 0)
+        return MX_OK;
+
+    if (AnyPagesPinnedLocked(offset, len))
+        return MX_ERR_BAD_STATE;
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    // drop the pages currently backing the range
+    list_node old_pages;
+    list_initialize(&old_pages);
+    page_list_.RemovePages(offset, offset + len, &old_pages);
+    pmm_free(&old_pages);
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+
+        InitializeVmPage(p);
+
+        status_t status = page_list_.AddPage(p, o);
+        if (status != MX_OK) {
+            // put the page back for the caller to free
+            p->state = VM_PAGE_STATE_ALLOC;
+            list_add_head(pages, &p->free.node);
+            return status;
+        }
+    }
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::RestorePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return MX_ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    // the object may have shrunk since the pages were taken
+    uint64_t new_len;
+    if (!TrimRange(offset, len, size_, &new_len))
+        return MX_ERR_OUT_OF_RANGE;
+
+    if (new_len == 0)
+        return MX_OK;
+
+    // the holes may be mapped to the zero page, so unmap the range on all the
+    // mapping regions
+    RangeChangeUpdateLocked(offset, new_len);
+
+    const uint64_t end = offset + new_len;
+    vm_page_t* p = list_peek_head_type(pages, vm_page_t, free.node);
+    for (uint64_t o = offset; o < end && p; o += PAGE_SIZE) {
+        vm_page_t* next = list_next_type(pages, &p->free.node, vm_page_t, free.node);
+
+        if (!page_list_.GetPage(o)) {
+            list_delete(&p->free.node);
+            InitializeVmPage(p);
+
+            status_t status = page_list_.AddPage(p, o);
+            if (status != MX_OK) {
+                // put the page back for the caller to free
+                p->state = VM_PAGE_STATE_ALLOC;
+                list_add_head(pages, &p->free.node);
+                return status;
+            }
         }
-        start += PAGE_SIZE;
+        p = next;
     }
 
     return MX_OK;
@@ -732,6 +1101,95 @@ bool VmObjectPaged::AnyPagesPinnedLocked(uint64_t offset, size_t len) {
     return found_pinned;
 }
 
+status_t VmObjectPaged::LockDiscardable(bool* discarded) {
+    canary_.Assert();
+
+    if (!(options_ & kDiscardable))
+        return MX_ERR_NOT_SUPPORTED;
+
+    AutoLock dl(&discardable_lock_);
+    AutoLock a(&lock_);
+
+    if (discardable_lock_count_ == UINT32_MAX)
+        return MX_ERR_OUT_OF_RANGE;
+
+    if (discardable_lock_count_++ == 0) {
+        DEBUG_ASSERT(discardable_list_state_.InContainer());
+        discardable_list_.erase(*this);
+    }
+
+    *discarded = discarded_;
+    discarded_ = false;
+
+    return MX_OK;
+}
+
+status_t VmObjectPaged::UnlockDiscardable() {
+    canary_.Assert();
+
+    if (!(options_ & kDiscardable))
+        return MX_ERR_NOT_SUPPORTED;
+
+    AutoLock dl(&discardable_lock_);
+    AutoLock a(&lock_);
+
+    if (discardable_lock_count_ == 0)
+        return MX_ERR_BAD_STATE;
+
+    // the most recently unlocked objects are discarded last
+    if (--discardable_lock_count_ == 0)
+        discardable_list_.push_back(this);
+
+    return MX_OK;
+}
+
+size_t VmObjectPaged::DiscardLocked() {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(discardable_lock_count_ == 0);
+
+    if (page_list_.IsEmpty())
+        return 0;
+
+    uint64_t end = ROUNDUP_PAGE_SIZE(size_);
+    if (AnyPagesPinnedLocked(0, end))
+        return 0;
+
+    // unmap all of the pages on all the mapping regions
+    RangeChangeUpdateLocked(0, end);
+
+    list_node list;
+    list_initialize(&list);
+    size_t count = page_list_.RemovePages(0, end, &list);
+    pmm_free(&list);
+
+    discarded_ = true;
+
+    LTRACEF("vmo %p discarded %zu pages\n", this, count);
+
+    return count;
+}
+
+size_t VmObjectPaged::ReclaimDiscardable(size_t target_pages) {
+    size_t freed = 0;
+
+    AutoLock dl(&discardable_lock_);
+
+    // Objects stay on the list while discarded, so the pages of an object
+    // written to without being locked again can still be reclaimed. An
+    // object whose last reference is dropped meanwhile waits in its
+    // destructor for the list lock, so it is safe to use until then.
+    for (auto& vmo : discardable_list_) {
+        if (freed >= target_pages)
+            break;
+
+        AutoLock a(&vmo.lock_);
+        freed += vmo.DiscardLocked();
+    }
+
+    return freed;
+}
+
 status_t VmObjectPaged::ResizeLocked(uint64_t s) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -758,11 +1216,11 @@ status_t VmObjectPaged::ResizeLocked(uint64_t s) {
             // unmap all of the pages in this range on all the mapping regions
             RangeChangeUpdateLocked(start, page_aligned_len);
 
-            // iterate through the pages, freeing them
-            while (start < end) {
-                page_list_.FreePage(start);
-                start += PAGE_SIZE;
-            }
+            // pull the pages out of the list and return them to the pmm
+            list_node list;
+            list_initialize(&list);
+            page_list_.RemovePages(start, end, &list);
+            pmm_free(&list);
         }
     } else if (s > size_) {
         // expanding
@@ -914,61 +1372,51 @@ status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
-    uint64_t expected_next_off = start_page_offset;
-    status_t status = page_list_.ForEveryPageInRange(
-            [&expected_next_off, this, pf_flags, lookup_fn, context,
-            start_page_offset](const auto p, uint64_t off) {
-
-                // If some page was missing from our list, run the more expensive
-                // GetPageLocked to see if our parent has it.
-                for (uint64_t missing_off = expected_next_off; missing_off < off;
-                     missing_off += PAGE_SIZE) {
-
-                    paddr_t pa;
-                    status_t status = this->GetPageLocked(missing_off, pf_flags, nullptr,
-                                                          nullptr, &pa);
-                    if (status != MX_OK) {
-                        return MX_ERR_NO_MEMORY;
+    // GetPageLocked may add pages to page_list_, which the page walk does not
+    // allow, so hand out the present pages until the walk reaches a gap, fill
+    // the gap outside of the walk and then pick the walk back up after it.
+    uint64_t off = start_page_offset;
+    while (off < end_page_offset) {
+        uint64_t gap_end = end_page_offset;
+        status_t status = page_list_.ForEveryPageInRange(
+                [&off, &gap_end, lookup_fn, context, start_page_offset](const auto p,
+                                                                       uint64_t page_off) {
+                    if (page_off != off) {
+                        gap_end = page_off;
+                        return MX_ERR_STOP;
                     }
-                    const size_t index = (off - start_page_offset) / PAGE_SIZE;
-                    status = lookup_fn(context, missing_off, index, pa);
+
+                    const size_t index = (page_off - start_page_offset) / PAGE_SIZE;
+                    paddr_t pa = vm_page_to_paddr(p);
+                    status_t status = lookup_fn(context, page_off, index, pa);
                     if (status != MX_OK) {
                         if (unlikely(status == MX_ERR_NEXT || status == MX_ERR_STOP)) {
                             status = MX_ERR_INTERNAL;
                         }
                         return status;
                     }
-                }
-
-                const size_t index = (off - start_page_offset) / PAGE_SIZE;
-                paddr_t pa = vm_page_to_paddr(p);
-                status_t status = lookup_fn(context, off, index, pa);
-                if (status != MX_OK) {
-                    if (unlikely(status == MX_ERR_NEXT || status == MX_ERR_STOP)) {
-                        status = MX_ERR_INTERNAL;
-                    }
-                    return status;
-                }
 
-                expected_next_off = off + PAGE_SIZE;
-                return MX_ERR_NEXT;
-            }, start_page_offset, end_page_offset);
-    if (status != MX_OK) {
-        return status;
-    }
-
-    // If expected_next_off isn't at the end, there's a gap to process
-    for (uint64_t off = expected_next_off; off < end_page_offset; off += PAGE_SIZE) {
-        paddr_t pa;
-        status_t status = GetPageLocked(off, pf_flags, nullptr, nullptr, &pa);
-        if (status != MX_OK) {
-            return MX_ERR_NO_MEMORY;
-        }
-        const size_t index = (off - start_page_offset) / PAGE_SIZE;
-        status = lookup_fn(context, off, index, pa);
+                    off = page_off + PAGE_SIZE;
+                    return MX_ERR_NEXT;
+                }, off, end_page_offset);
         if (status != MX_OK) {
             return status;
         }
+
+        // [off, gap_end) is missing from our list, run the more expensive
+        // GetPageLocked to see if our parent has it.
+        for (; off < gap_end; off += PAGE_SIZE) {
+            paddr_t pa;
+            status = GetPageLocked(off, pf_flags, nullptr, nullptr, &pa);
+            if (status != MX_OK) {
+                return MX_ERR_NO_MEMORY;
+            }
+            const size_t index = (off - start_page_offset) / PAGE_SIZE;
+            status = lookup_fn(context, off, index, pa);
+            if (status != MX_OK) {
+                return status;
+            }
+        }
     }
 
     return MX_OK;
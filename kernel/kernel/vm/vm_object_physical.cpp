@@ -86,6 +86,22 @@ status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     return MX_OK;
 }
 
+status_t VmObjectPhysical::GetLargePageLocked(uint64_t offset, paddr_t* pa) {
+    canary_.Assert();
+
+    uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+    if (start >= size_ || size_ - start < LARGE_PAGE_SIZE)
+        return MX_ERR_OUT_OF_RANGE;
+
+    uint64_t large_pa = base_ + start;
+    if (!IS_ALIGNED(large_pa, LARGE_PAGE_SIZE) || large_pa > UINTPTR_MAX)
+        return MX_ERR_NOT_FOUND;
+
+    *pa = (paddr_t)large_pa;
+
+    return MX_OK;
+}
+
 status_t VmObjectPhysical::LookupUser(uint64_t offset, uint64_t len, user_ptr<paddr_t> buffer,
                                       size_t buffer_size) {
     canary_.Assert();
@@ -46,6 +46,7 @@ vm_page* VmPageListNode::RemovePage(size_t index) {
         return nullptr;
 
     pages_[index] = nullptr;
+    count_--;
 
     return p;
 }
@@ -56,6 +57,7 @@ status_t VmPageListNode::AddPage(vm_page* p, size_t index) {
     if (pages_[index])
         return MX_ERR_ALREADY_EXISTS;
     pages_[index] = p;
+    count_++;
     return MX_OK;
 }
 
@@ -65,78 +67,210 @@ VmPageList::VmPageList() {
 
 VmPageList::~VmPageList() {
     LTRACEF("%p\n", this);
-    DEBUG_ASSERT(list_.is_empty());
+    DEBUG_ASSERT(root_ == nullptr);
 }
 
-status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+VmPageListNode* VmPageList::LookupLeaf(uint64_t leaf_index) {
+    if (root_ == nullptr || (leaf_index >> ChildShift(height_ + 1)) != 0) {
+        return nullptr;
+    }
 
-    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, p, offset,
-                  node_offset, index);
+    void* node = root_;
+    for (uint h = height_; h > 0 && node; h--) {
+        size_t slot = (leaf_index >> ChildShift(h)) % Interior::kFanOut;
+        node = static_cast<Interior*>(node)->slots[slot];
+    }
+    return static_cast<VmPageListNode*>(node);
+}
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        AllocChecker ac;
-        mxtl::unique_ptr<VmPageListNode> pl =
-            mxtl::unique_ptr<VmPageListNode>(new (&ac) VmPageListNode(node_offset));
-        if (!ac.check())
-            return MX_ERR_NO_MEMORY;
+VmPageListNode* VmPageList::GetOrCreateLeaf(uint64_t leaf_index) {
+    // grow the tree until it covers the leaf index, pushing the current root
+    // down into slot 0 of a new one
+    while ((leaf_index >> ChildShift(height_ + 1)) != 0) {
+        if (root_ != nullptr) {
+            AllocChecker ac;
+            auto interior = new (&ac) Interior;
+            if (!ac.check())
+                return nullptr;
+            interior->slots[0] = root_;
+            interior->count = 1;
+            root_ = interior;
+        }
+        height_++;
+        LTRACEF("%p height now %u\n", this, height_);
+    }
 
-        LTRACEF("allocating new inner node %p\n", pl.get());
-        __UNUSED auto status = pl->AddPage(p, index);
-        DEBUG_ASSERT(status == MX_OK);
+    // find the nodes missing on the way down and allocate them up front, so
+    // that running out of memory does not leave empty nodes in the tree
+    void* missing[kMaxHeight + 1] = {};
+    size_t num_missing = 0;
+    {
+        void* node = root_;
+        for (uint h = height_; h > 0 && node; h--) {
+            size_t slot = (leaf_index >> ChildShift(h)) % Interior::kFanOut;
+            node = static_cast<Interior*>(node)->slots[slot];
+            if (node == nullptr)
+                num_missing = h;
+        }
+        if (root_ == nullptr)
+            num_missing = height_ + 1;
+    }
+    for (size_t i = 0; i < num_missing; i++) {
+        AllocChecker ac;
+        if (i == 0) {
+            missing[i] = new (&ac) VmPageListNode(leaf_index << (PAGE_SIZE_SHIFT +
+                                                                 VmPageListNode::kPageFanOutShift));
+        } else {
+            missing[i] = new (&ac) Interior;
+        }
+        if (!ac.check()) {
+            for (size_t j = 0; j < i; j++) {
+                DestroyNode(missing[j], static_cast<uint>(j));
+            }
+            return nullptr;
+        }
+    }
 
-        list_.insert(mxtl::move(pl));
-    } else {
-        pln->AddPage(p, index);
+    // link them in, missing[h] being the node at height h
+    void** slot = &root_;
+    Interior* parent = nullptr;
+    for (uint h = height_;; h--) {
+        if (*slot == nullptr) {
+            DEBUG_ASSERT(h < num_missing);
+            *slot = missing[h];
+            if (parent)
+                parent->count++;
+        }
+        if (h == 0)
+            break;
+        parent = static_cast<Interior*>(*slot);
+        slot = &parent->slots[(leaf_index >> ChildShift(h)) % Interior::kFanOut];
     }
+    return static_cast<VmPageListNode*>(*slot);
+}
 
-    return MX_OK;
+status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
+    uint64_t leaf_index = LeafIndex(offset);
+    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+
+    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " leaf %#" PRIx64 " index %zu\n", this, p, offset,
+                  leaf_index, index);
+
+    // lookup the leaf that holds this page, creating the path to it if needed
+    auto pl = GetOrCreateLeaf(leaf_index);
+    if (!pl)
+        return MX_ERR_NO_MEMORY;
+
+    return pl->AddPage(p, index);
 }
 
 vm_page* VmPageList::GetPage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+    uint64_t leaf_index = LeafIndex(offset);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
+    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " leaf %#" PRIx64 " index %zu\n", this, offset, leaf_index,
                   index);
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
+    auto pl = LookupLeaf(leaf_index);
+    if (!pl) {
         return nullptr;
     }
 
-    return pln->GetPage(index);
+    return pl->GetPage(index);
 }
 
-status_t VmPageList::FreePage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+// Removes the pages in [start_offset, end_offset) below |node|, freeing any
+// nodes that become empty. Returns true if |node| itself is now empty.
+bool VmPageList::RemovePagesInNode(void* node, uint height, uint64_t base, uint64_t start_offset,
+                                   uint64_t end_offset, list_node* free_list, size_t* count) {
+    if (height == 0) {
+        auto pl = static_cast<VmPageListNode*>(node);
+        size_t start = 0;
+        size_t end = VmPageListNode::kPageFanOut;
+        if (start_offset > pl->offset()) {
+            start = (start_offset - pl->offset()) / PAGE_SIZE;
+        }
+        if (end_offset < pl->offset() + VmPageListNode::kPageFanOut * PAGE_SIZE) {
+            end = (end_offset - pl->offset()) / PAGE_SIZE;
+        }
+        for (size_t i = start; i < end; i++) {
+            auto p = pl->RemovePage(i);
+            if (p) {
+                list_add_tail(free_list, &p->free.node);
+                (*count)++;
+            }
+        }
+        return pl->IsEmpty();
+    }
 
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
-                  index);
+    auto interior = static_cast<Interior*>(node);
+    const uint shift = ChildShift(height);
+    const uint64_t first = LeafIndex(start_offset);
+    const uint64_t last = LeafIndex(end_offset - 1);
+    const uint64_t start = (first > base) ? (first - base) >> shift : 0;
+    if (last < base || start >= Interior::kFanOut) {
+        return interior->count == 0;
+    }
+    const uint64_t end = MIN((last - base) >> shift, Interior::kFanOut - 1);
+    for (uint64_t i = start; i <= end; i++) {
+        void* child = interior->slots[i];
+        if (child == nullptr) {
+            continue;
+        }
+        if (RemovePagesInNode(child, height - 1, base + (i << shift), start_offset, end_offset,
+                              free_list, count)) {
+            DestroyNode(child, height - 1);
+            interior->slots[i] = nullptr;
+            interior->count--;
+        }
+    }
+    return interior->count == 0;
+}
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        return MX_ERR_NOT_FOUND;
+void VmPageList::DestroyNode(void* node, uint height) {
+    if (height == 0) {
+        delete static_cast<VmPageListNode*>(node);
+        return;
     }
 
-    // free this page
-    auto page = pln->RemovePage(index);
-    if (page) {
-        // if it was the last page in the node, remove the node from the tree
-        if (pln->IsEmpty()) {
-            LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
-            list_.erase(*pln);
-        }
+    auto interior = static_cast<Interior*>(node);
+    for (auto child : interior->slots) {
+        if (child)
+            DestroyNode(child, height - 1);
+    }
+    delete interior;
+}
+
+size_t VmPageList::RemovePages(uint64_t start_offset, uint64_t end_offset, list_node* free_list) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
+
+    LTRACEF_LEVEL(2, "%p range [%#" PRIx64 ", %#" PRIx64 ")\n", this, start_offset, end_offset);
+
+    size_t count = 0;
+    if (root_ == nullptr || start_offset >= end_offset) {
+        return count;
+    }
+
+    if (RemovePagesInNode(root_, height_, 0, start_offset, end_offset, free_list, &count)) {
+        LTRACEF_LEVEL(2, "%p tree now empty\n", this);
+        DestroyNode(root_, height_);
+        root_ = nullptr;
+        height_ = 0;
+    }
+
+    return count;
+}
 
-        pmm_free_page(page);
+status_t VmPageList::FreePage(uint64_t offset) {
+    list_node list;
+    list_initialize(&list);
+
+    if (RemovePages(offset, offset + PAGE_SIZE, &list) == 0) {
+        return MX_ERR_NOT_FOUND;
     }
 
+    pmm_free(&list);
+
     return MX_OK;
 }
 
@@ -165,7 +299,11 @@ size_t VmPageList::FreeAllPages() {
     DEBUG_ASSERT(freed == count);
 
     // empty the tree
-    list_.clear();
+    if (root_) {
+        DestroyNode(root_, height_);
+        root_ = nullptr;
+        height_ = 0;
+    }
 
     return count;
 }
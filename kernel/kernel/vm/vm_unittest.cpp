@@ -12,6 +12,7 @@
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_object_paged.h>
 #include <kernel/vm/vm_object_physical.h>
+#include <kernel/vm/vm_page_list.h>
 #include <mxalloc/new.h>
 #include <mxtl/array.h>
 #include <unittest.h>
@@ -885,6 +886,58 @@ static bool vmo_lookup_test(void* context) {
     END_TEST;
 }
 
+// Scatters pages across a very sparse page list and checks lookups, range
+// walks and range removal.
+static bool vm_page_list_sparse_test(void* context) {
+    BEGIN_TEST;
+
+    static const uint64_t offsets[] = {
+        0, PAGE_SIZE, 1ull << 30, (1ull << 50) + 3 * PAGE_SIZE,
+    };
+    static const size_t count = countof(offsets);
+
+    list_node list;
+    list_initialize(&list);
+    REQUIRE_EQ(count, pmm_alloc_pages(count, 0, &list), "allocating pages\n");
+
+    VmPageList pl;
+    EXPECT_TRUE(pl.IsEmpty(), "new list is empty\n");
+    for (auto o : offsets) {
+        vm_page_t* p = list_remove_head_type(&list, vm_page_t, free.node);
+        EXPECT_EQ(MX_OK, pl.AddPage(p, o), "adding page\n");
+        EXPECT_EQ(p, pl.GetPage(o), "looking up added page\n");
+    }
+    EXPECT_EQ(nullptr, pl.GetPage(2 * PAGE_SIZE), "looking up missing page\n");
+    EXPECT_EQ(nullptr, pl.GetPage(1ull << 40), "looking up missing page\n");
+
+    size_t pages = 0;
+    size_t gap_pages = 0;
+    auto status = pl.ForEveryPageAndGapInRange(
+        [&pages](const auto p, uint64_t off) {
+            pages++;
+            return MX_ERR_NEXT;
+        },
+        [&gap_pages](uint64_t gap_start, uint64_t gap_end) {
+            gap_pages += (gap_end - gap_start) / PAGE_SIZE;
+            return MX_ERR_NEXT;
+        }, 0, (1ull << 30) + 2 * PAGE_SIZE);
+    EXPECT_EQ(MX_OK, status, "walking pages and gaps\n");
+    EXPECT_EQ(3u, pages, "pages in range\n");
+    EXPECT_EQ((1ull << 30) / PAGE_SIZE - 1, gap_pages, "gap pages in range\n");
+
+    EXPECT_EQ(2u, pl.RemovePages(PAGE_SIZE, (1ull << 40), &list), "removing a range\n");
+    EXPECT_EQ(MX_ERR_NOT_FOUND, pl.FreePage(PAGE_SIZE), "freeing a removed page\n");
+    EXPECT_NEQ(nullptr, pl.GetPage(0), "page before the removed range\n");
+    EXPECT_EQ(MX_OK, pl.FreePage(0), "freeing a page\n");
+    EXPECT_FALSE(pl.IsEmpty(), "list with a page left\n");
+
+    EXPECT_EQ(1u, pl.FreeAllPages(), "freeing the remaining page\n");
+    EXPECT_TRUE(pl.IsEmpty(), "list is empty again\n");
+    pmm_free(&list);
+
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -915,6 +968,7 @@ VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
 VM_UNITTEST(vmo_cache_test)
 VM_UNITTEST(vmo_lookup_test)
+VM_UNITTEST(vm_page_list_sparse_test)
 // Uncomment for debugging
 // VM_UNITTEST(dump_all_aspaces)  // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
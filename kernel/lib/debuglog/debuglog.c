@@ -7,7 +7,9 @@
 #include <lib/debuglog.h>
 
 #include <err.h>
+#include <arch/ops.h>
 #include <dev/udisplay.h>
+#include <kernel/mp.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <lib/user_copy.h>
@@ -17,54 +19,92 @@
 #include <platform.h>
 #include <string.h>
 
-#define DLOG_SIZE (128u * 1024u)
-#define DLOG_MASK (DLOG_SIZE - 1u)
+// Each record in a ring is preceded by its sequence number.
+#define DLOG_SEQ_SIZE sizeof(uint64_t)
 
-static_assert((DLOG_SIZE & DLOG_MASK) == 0u, "must be power of two");
-static_assert(DLOG_MAX_RECORD <= DLOG_SIZE, "wat");
-static_assert((DLOG_MAX_RECORD & 3) == 0, "E_DONT_DO_THAT");
+static_assert((DLOG_BOOT_CPU_SIZE & (DLOG_BOOT_CPU_SIZE - 1u)) == 0u, "must be power of two");
+static_assert((DLOG_CPU_SIZE & (DLOG_CPU_SIZE - 1u)) == 0u, "must be power of two");
+static_assert(DLOG_SEQ_SIZE + DLOG_MAX_RECORD <= DLOG_CPU_SIZE, "wat");
+static_assert((DLOG_MAX_RECORD & 7) == 0, "E_DONT_DO_THAT");
 
-static uint8_t DLOG_DATA[DLOG_SIZE];
+static uint8_t DLOG_BOOT_DATA[DLOG_BOOT_CPU_SIZE] __ALIGNED(8);
+static uint8_t DLOG_DATA[SMP_MAX_CPUS - 1][DLOG_CPU_SIZE] __ALIGNED(8);
 
 static dlog_t DLOG = {
-    .lock = SPIN_LOCK_INITIAL_VALUE,
-    .head = 0,
-    .tail = 0,
-    .data = DLOG_DATA,
+    .seq = 1,
     .event = EVENT_INITIAL_VALUE(DLOG.event, 0, EVENT_FLAG_AUTOUNSIGNAL),
 
     .readers_lock = MUTEX_INITIAL_VALUE(DLOG.readers_lock),
     .readers = LIST_INITIAL_VALUE(DLOG.readers),
 };
 
-// The debug log maintains a circular buffer of debug log records,
-// consisting of a common header (dlog_header_t) followed by up
-// to 224 bytes of textual log message.  Records are aligned on
-// uint32_t boundaries, so the header word which indicates the
-// true size of the record and the space it takes in the fifo
-// can always be read with a single uint32_t* read (the header
-// or body may wrap but the initial header word never does).
+// The debug log keeps a circular buffer of debug log records for each
+// cpu. A record consists of a sequence number, a common header
+// (dlog_header_t) and up to 224 bytes of textual log message. Records
+// take a multiple of 8 bytes in the ring, so the sequence number and
+// the header word which indicates the true size of the record and the
+// space it takes in the ring never wrap. The rest of the header or the
+// body may.
 //
-// The ring buffer position is maintained by continuously incrementing
-// head and tail pointers (type size_t, so uint64_t on 64bit systems),
+// Only the cpu a ring belongs to writes to it, with interrupts disabled,
+// so writers never wait for each other. Sequence numbers come from a
+// single counter and give the order of the records across rings.
 //
-// This allows readers to trivial compute if their local tail
-// pointer has "fallen out" of the fifo (an entire fifo's worth
-// of messages were written since they last tried to read) and then
-// they can snap their tail to the global tail and restart
+// The ring positions are maintained by continuously incrementing head
+// and tail pointers (type size_t, so uint64_t on 64bit systems).
 //
+// This allows readers to trivially compute if their local tail
+// pointer has "fallen out" of a ring (an entire ring's worth of
+// messages were written since they last tried to read) and then
+// they can snap their tail to the ring's tail and restart.
 //
-// Tail indicates the oldest message in the debug log to read
-// from, Head indicates the next space in the debug log to write
-// a new message to.  They are clipped to the actual buffer by
-// DLOG_MASK.
+// Tail indicates the oldest message in a ring to read from, Head
+// indicates the next space in the ring to write a new message to.
+// They are clipped to the actual buffer by RING_MASK().
 //
 //       T                     T
 //  [....XXXX....]  [XX........XX]
 //           H         H
+//
+// Readers do not lock out writers. A writer moves the tail past the
+// records it is about to overwrite before touching them, so a reader
+// checks the tail again after copying a record to know that the copy
+// is intact.
+
+
+#define ALIGN8(n) (((n) + 7) & (~7))
+
+// The boot cpu (cpu 0) gets the larger DLOG_BOOT_DATA ring.
+#define RING_DATA(ring) \
+    ((ring) == DLOG.rings ? DLOG_BOOT_DATA : DLOG_DATA[(ring) - DLOG.rings - 1])
+#define RING_SIZE(ring) ((ring) == DLOG.rings ? DLOG_BOOT_CPU_SIZE : DLOG_CPU_SIZE)
+#define RING_MASK(ring) (RING_SIZE(ring) - 1u)
 
+// Copies |len| bytes out of the ring starting at position |pos|.
+static void dlog_ring_read(const dlog_ring_t* ring, size_t pos, void* ptr, size_t len) {
+    size_t offset = (pos & RING_MASK(ring));
+    size_t fifospace = RING_SIZE(ring) - offset;
 
-#define ALIGN4(n) (((n) + 3) & (~3))
+    if (fifospace >= len) {
+        memcpy(ptr, RING_DATA(ring) + offset, len);
+    } else {
+        memcpy(ptr, RING_DATA(ring) + offset, fifospace);
+        memcpy(ptr + fifospace, RING_DATA(ring), len - fifospace);
+    }
+}
+
+// Copies |len| bytes into the ring starting at position |pos|.
+static void dlog_ring_write(dlog_ring_t* ring, size_t pos, const void* ptr, size_t len) {
+    size_t offset = (pos & RING_MASK(ring));
+    size_t fifospace = RING_SIZE(ring) - offset;
+
+    if (fifospace >= len) {
+        memcpy(RING_DATA(ring) + offset, ptr, len);
+    } else {
+        memcpy(RING_DATA(ring) + offset, ptr, fifospace);
+        memcpy(RING_DATA(ring), ptr + fifospace, len - fifospace);
+    }
+}
 
 status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     dlog_t* log = &DLOG;
@@ -77,17 +117,16 @@ status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
         return MX_ERR_BAD_STATE;
     }
 
-    // Our size "on the wire" must be a multiple of 4, so we know
-    // that worst case there will be room for a header skipping
-    // the last n bytes when the fifo wraps
-    size_t wiresize = DLOG_MIN_RECORD + ALIGN4(len);
+    // Our size "on the wire" must be a multiple of 8, so we know
+    // that worst case there will be room for the sequence number
+    // and header word skipping the last n bytes when the ring wraps
+    size_t wiresize = DLOG_SEQ_SIZE + DLOG_MIN_RECORD + ALIGN8(len);
 
-    // Prepare the record header before taking the lock
+    // Prepare the record header before disabling interrupts
     dlog_header_t hdr;
     hdr.header = DLOG_HDR_SET(wiresize, DLOG_MIN_RECORD + len);
     hdr.datalen = len;
     hdr.flags = flags;
-    hdr.timestamp = current_time();
     thread_t *t = get_current_thread();
     if (t) {
         hdr.pid = t->user_pid;
@@ -98,51 +137,83 @@ status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     }
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    dlog_ring_t* ring = &log->rings[arch_curr_cpu_num()];
+
+    // Announce the write before taking a sequence number, so that a
+    // reader that sees a later record also sees this one coming.
+    __atomic_store_n(&ring->writing_seq, __atomic_load_n(&log->seq, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    uint64_t seq = __atomic_fetch_add(&log->seq, 1, __ATOMIC_SEQ_CST);
+    hdr.timestamp = current_time();
 
     // Discard records at tail until there is enough
     // space for the new record.
-    while ((log->head - log->tail) > (DLOG_SIZE - wiresize)) {
-        uint32_t header = *((uint32_t*) (log->data + (log->tail & DLOG_MASK)));
-        log->tail += DLOG_HDR_GET_FIFOLEN(header);
+    size_t head = ring->head;
+    size_t tail = ring->tail;
+    while ((head - tail) > (RING_SIZE(ring) - wiresize)) {
+        uint32_t header = *((uint32_t*) (RING_DATA(ring) + ((tail + DLOG_SEQ_SIZE) & RING_MASK(ring))));
+        tail += DLOG_HDR_GET_FIFOLEN(header);
+    }
+    if (tail != ring->tail) {
+        // readers must see the records discarded before they are overwritten
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
     }
 
-    size_t offset = (log->head & DLOG_MASK);
+    *((uint64_t*) (RING_DATA(ring) + (head & RING_MASK(ring)))) = seq;
+    dlog_ring_write(ring, head + DLOG_SEQ_SIZE, &hdr, sizeof(hdr));
+    dlog_ring_write(ring, head + DLOG_SEQ_SIZE + sizeof(hdr), ptr, len);
 
-    size_t fifospace = DLOG_SIZE - offset;
+    __atomic_store_n(&ring->head, head + wiresize, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->writing_seq, 0, __ATOMIC_RELEASE);
 
-    if (fifospace >= wiresize) {
-        // everything fits in one write, simple case!
-        memcpy(log->data + offset, &hdr, sizeof(hdr));
-        memcpy(log->data + offset + sizeof(hdr), ptr, len);
-    } else if (fifospace < sizeof(hdr)) {
-        // the wrap happens in the header
-        memcpy(log->data + offset, &hdr, fifospace);
-        memcpy(log->data, ((void*) &hdr) + fifospace, sizeof(hdr) - fifospace);
-        memcpy(log->data + (sizeof(hdr) - fifospace), ptr, len);
-    } else {
-        // the wrap happens in the data
-        memcpy(log->data + offset, &hdr, sizeof(hdr));
-        offset += sizeof(hdr);
-        fifospace -= sizeof(hdr);
-        memcpy(log->data + offset, ptr, fifospace);
-        memcpy(log->data, ptr + fifospace, len - fifospace);
-    }
-    log->head += wiresize;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    // if we happen to be called from within the global thread lock, use a
-    // special version of event signal
-    if (spin_lock_holder_cpu(&thread_lock) == arch_curr_cpu_num()) {
-        event_signal_thread_locked(&log->event);
-    } else {
-        event_signal(&log->event, false);
+    // Wake up the notifier, unless it already has a wakeup coming. If we
+    // happen to be called from within the global thread lock, use a
+    // special version of event signal.
+    if (atomic_swap(&log->notify_pending, 1) == 0) {
+        if (spin_lock_holder_cpu(&thread_lock) == arch_curr_cpu_num()) {
+            event_signal_thread_locked(&log->event);
+        } else {
+            event_signal(&log->event, false);
+        }
     }
 
-    spin_unlock_irqrestore(&log->lock, state);
-
     return MX_OK;
 }
 
+// Finds the next record in a ring at or after the reader's position
+// |*rtail|, snapping the position forward if the reader was lapped.
+// Returns false if the reader has seen every record in the ring.
+static bool dlog_ring_peek(const dlog_ring_t* ring, size_t* rtail, uint64_t* seq) {
+    for (;;) {
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        // If the read-tail is not within the range of tail..head
+        // this reader has been lapped by the writer and we reset
+        // our read-tail to the current tail.
+        if ((head - tail) < (head - *rtail)) {
+            *rtail = tail;
+        }
+        if (*rtail == head) {
+            return false;
+        }
+
+        uint64_t s = *((volatile uint64_t*) (RING_DATA(ring) + (*rtail & RING_MASK(ring))));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) > *rtail) {
+            // discarded while we looked, try again
+            continue;
+        }
+        *seq = s;
+        return true;
+    }
+}
+
 // TODO: support reading multiple messages at a time
 // TODO: filter with flags
 status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, size_t* _actual) {
@@ -152,46 +223,75 @@ status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, si
     }
 
     dlog_t* log = rdr->log;
-    status_t status = MX_ERR_SHOULD_WAIT;
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
+    for (;;) {
+        // Records numbered from limit on may have been started after the
+        // writers were checked below, so they have to wait for the next
+        // round.
+        uint64_t limit = __atomic_load_n(&log->seq, __ATOMIC_SEQ_CST);
+
+        // lowest sequence number that might still be being written
+        uint64_t writing = UINT64_MAX;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            uint64_t s = __atomic_load_n(&log->rings[cpu].writing_seq, __ATOMIC_SEQ_CST);
+            if (s != 0 && s < writing) {
+                writing = s;
+            }
+        }
 
-    size_t rtail = rdr->tail;
+        // oldest record across the rings
+        dlog_ring_t* ring = NULL;
+        uint64_t seq = UINT64_MAX;
+        uint next_cpu = 0;
+        bool newer = false;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            uint64_t s;
+            if (!dlog_ring_peek(&log->rings[cpu], &rdr->tail[cpu], &s)) {
+                continue;
+            }
+            if (s >= limit) {
+                newer = true;
+            } else if (s < seq) {
+                ring = &log->rings[cpu];
+                seq = s;
+                next_cpu = cpu;
+            }
+        }
 
-    // If the read-tail is not within the range of log-tail..log-head
-    // this reader has been lapped by a writer and we reset our read-tail
-    // to the current log-tail.
-    //
-    if ((log->head - log->tail) < (log->head - rtail)) {
-        rtail = log->tail;
-    }
+        if (ring == NULL) {
+            if (newer) {
+                continue;
+            }
+            return MX_ERR_SHOULD_WAIT;
+        }
 
-    if (rtail != log->head) {
-        size_t offset = (rtail & DLOG_MASK);
-        uint32_t header = *((uint32_t*) (log->data + offset));
+        if (writing <= seq) {
+            // An older record is still being written, it will only take a
+            // moment since its writer has interrupts disabled.
+            arch_spinloop_pause();
+            continue;
+        }
 
+        size_t rtail = rdr->tail[next_cpu];
+        uint32_t header = *((volatile uint32_t*) (RING_DATA(ring) +
+                                                  ((rtail + DLOG_SEQ_SIZE) & RING_MASK(ring))));
         size_t actual = DLOG_HDR_GET_READLEN(header);
-        size_t fifospace = DLOG_SIZE - offset;
+        if (actual > DLOG_MAX_RECORD) {
+            // torn by a writer that lapped us, dlog_ring_peek will notice
+            continue;
+        }
+        dlog_ring_read(ring, rtail + DLOG_SEQ_SIZE, ptr, actual);
 
-        if (fifospace >= actual) {
-            memcpy(ptr, log->data + offset, actual);
-        } else {
-            memcpy(ptr, log->data + offset, fifospace);
-            memcpy(ptr + fifospace, log->data, actual - fifospace);
+        // make sure the writer did not lap us while we were copying
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) > rtail) {
+            continue;
         }
 
+        rdr->tail[next_cpu] = rtail + DLOG_HDR_GET_FIFOLEN(header);
         *_actual = actual;
-        status = MX_OK;
-
-        rtail += DLOG_HDR_GET_FIFOLEN(header);
+        return MX_OK;
     }
-
-    rdr->tail = rtail;
-
-    spin_unlock_irqrestore(&log->lock, state);
-
-    return status;
 }
 
 void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
@@ -206,11 +306,11 @@ void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie) {
 
     bool do_notify = false;
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&log->lock, state);
-    rdr->tail = log->tail;
-    do_notify = (log->tail != log->head);
-    spin_unlock_irqrestore(&log->lock, state);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        dlog_ring_t* ring = &log->rings[cpu];
+        rdr->tail[cpu] = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        do_notify |= (rdr->tail[cpu] != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    }
 
     // simulate notify callback for events that arrived
     // before we were initialized
@@ -238,6 +338,7 @@ static int debuglog_notifier(void* arg) {
 
     for (;;) {
         event_wait(&log->event);
+        atomic_store(&log->notify_pending, 0);
 
         // notify readers that new log items were posted
         mutex_acquire(&log->readers_lock);
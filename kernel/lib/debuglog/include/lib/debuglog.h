@@ -7,6 +7,7 @@
 #pragma once
 
 #include <magenta/compiler.h>
+#include <arch/ops.h>
 #include <kernel/event.h>
 #include <kernel/mutex.h>
 #include <list.h>
@@ -35,16 +36,36 @@ typedef struct dlog_header dlog_header_t;
 typedef struct dlog_record dlog_record_t;
 typedef struct dlog_reader dlog_reader_t;
 
-struct dlog {
-    spin_lock_t lock;
-
+// Size of the boot cpu's log ring, which keeps as much history as the old
+// single log did since early boot only logs there, and of the ring of each
+// of the other cpus. Must be powers of two.
+#define DLOG_BOOT_CPU_SIZE (128u * 1024u)
+#define DLOG_CPU_SIZE (32u * 1024u)
+
+typedef struct dlog_ring {
+    // Only written by the owning cpu, with interrupts disabled. head and
+    // tail are the positions of the next record to be written and of the
+    // oldest record still in the ring. They grow continuously and are
+    // clipped to the ring when used.
     size_t head;
     size_t tail;
 
-    void* data;
+    // While a record is being written, a lower bound on its sequence
+    // number, 0 otherwise. Lets readers tell a record that is late from
+    // one that was lost.
+    uint64_t writing_seq;
+} __CPU_ALIGN dlog_ring_t;
+
+struct dlog {
+    // sequence number of the next record, orders records across cpus
+    uint64_t seq;
+
+    dlog_ring_t rings[SMP_MAX_CPUS];
 
     bool panic;
 
+    // the notifier has been signaled and has not run yet
+    int notify_pending;
     event_t event;
 
     mutex_t readers_lock;
@@ -55,7 +76,9 @@ struct dlog_reader {
     struct list_node node;
 
     dlog_t* log;
-    size_t tail;
+
+    // read position in each cpu's ring
+    size_t tail[SMP_MAX_CPUS];
 
     void (*notify)(void* cookie);
     void *cookie;
@@ -91,6 +114,10 @@ static_assert(sizeof(dlog_record_t) == DLOG_MAX_RECORD, "");
 void dlog_reader_init(dlog_reader_t* rdr, void (*notify)(void*), void* cookie);
 void dlog_reader_destroy(dlog_reader_t* rdr);
 status_t dlog_write(uint32_t flags, const void* ptr, size_t len);
+
+// Reads the oldest record the reader has not seen yet. Records from all cpus
+// are returned in the order they were written. Calls for the same reader must
+// be serialized by the caller.
 status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, size_t* actual);
 
 // bluescreen_init should be called at the "start" of a fatal fault or
@@ -747,18 +747,19 @@ void cmpct_trim(void)
     unlock();
 }
 
-void *cmpct_alloc(size_t size)
+static bool is_large_alloc(size_t size)
 {
-    if (size == 0u) return NULL;
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
+    return size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS);
+}
 
+// Allocates a non-zero size that is not a large allocation.
+static void *small_alloc_locked(size_t size) TA_REQ(theheap.lock)
+{
     size_t rounded_up;
     int start_bucket = size_to_index_allocating(size, &rounded_up);
 
     rounded_up += sizeof(header_t);
 
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
         // Grow heap by at least 12% if we can.
@@ -767,7 +768,6 @@ void *cmpct_alloc(size_t size)
                                 MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -798,10 +798,35 @@ void *cmpct_alloc(size_t size)
     memset(result, ALLOC_FILL, size);
     memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
 #endif
+    return result;
+}
+
+void *cmpct_alloc(size_t size)
+{
+    if (size == 0u) return NULL;
+
+    if (is_large_alloc(size)) return large_alloc(size);
+
+    lock();
+    void *result = small_alloc_locked(size);
     unlock();
     return result;
 }
 
+size_t cmpct_alloc_batch(size_t size, void **ptrs, size_t count)
+{
+    if (size == 0u || is_large_alloc(size)) return 0;
+
+    size_t i = 0;
+    lock();
+    for (; i < count; i++) {
+        ptrs[i] = small_alloc_locked(size);
+        if (ptrs[i] == NULL) break;
+    }
+    unlock();
+    return i;
+}
+
 void *cmpct_memalign(size_t size, size_t alignment)
 {
     if (alignment < 8) return cmpct_alloc(size);
@@ -831,13 +856,11 @@ void *cmpct_memalign(size_t size, size_t alignment)
     return payload;
 }
 
-void cmpct_free(void *payload)
+static void free_locked(void *payload) TA_REQ(theheap.lock)
 {
-    if (payload == NULL) return;
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
     size_t size = header->size;
-    lock();
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -866,9 +889,48 @@ void cmpct_free(void *payload)
             free_memory(header, left, size);
         }
     }
+}
+
+void cmpct_free(void *payload)
+{
+    if (payload == NULL) return;
+    lock();
+    free_locked(payload);
     unlock();
 }
 
+void cmpct_free_batch(void **ptrs, size_t count)
+{
+    lock();
+    for (size_t i = 0; i < count; i++) {
+        free_locked(ptrs[i]);
+    }
+    unlock();
+}
+
+size_t cmpct_usable_size(const void *payload)
+{
+    const header_t *header = (const header_t *)payload - 1;
+    return header->size - sizeof(header_t);
+}
+
+void cmpct_cache_park(void *payload)
+{
+#ifdef CMPCT_DEBUG
+    memset(payload, FREE_FILL, cmpct_usable_size(payload));
+#endif
+}
+
+void cmpct_cache_unpark(void *payload, size_t size)
+{
+#ifdef CMPCT_DEBUG
+    size_t usable = cmpct_usable_size(payload);
+    check_free_fill(payload, usable);
+    memset(payload, ALLOC_FILL, size);
+    memset((char *)payload + size, PADDING_FILL, usable - size);
+#endif
+}
+
 void *cmpct_realloc(void *payload, size_t size)
 {
     if (payload == NULL) return cmpct_alloc(size);
@@ -16,6 +16,21 @@ void *cmpct_realloc(void *, size_t);
 void cmpct_free(void *);
 void *cmpct_memalign(size_t size, size_t alignment);
 
+// Allocate or free several objects while taking the heap lock only once.
+// cmpct_alloc_batch returns how many of the |count| allocations succeeded.
+size_t cmpct_alloc_batch(size_t size, void **ptrs, size_t count);
+void cmpct_free_batch(void **ptrs, size_t count);
+
+// Number of bytes usable at |payload|, at least the size it was allocated with.
+size_t cmpct_usable_size(const void *payload);
+
+// Debug fill checks for allocations parked in a cache in front of the heap.
+// cmpct_cache_park fills a parked object as if it had been freed, and
+// cmpct_cache_unpark checks that fill before the object is handed out again
+// for |size| bytes. Both do nothing unless the heap is built with debugging.
+void cmpct_cache_park(void *payload);
+void cmpct_cache_unpark(void *payload, size_t size);
+
 void cmpct_init(void);
 void cmpct_dump(bool panic_time);
 void cmpct_get_info(size_t *size_bytes, size_t *free_bytes);
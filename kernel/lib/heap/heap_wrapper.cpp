@@ -14,6 +14,7 @@
 #include <string.h>
 #include <err.h>
 #include <list.h>
+#include <inttypes.h>
 #include <arch/ops.h>
 #include <kernel/spinlock.h>
 #include <kernel/vm.h>
@@ -38,6 +39,181 @@ static bool heap_trace = false;
 #define heap_trace (false)
 #endif
 
+/* per-cpu front end
+ *
+ * Small allocations are served from per-cpu magazines of free objects, one per
+ * size class, so that the common case only disables interrupts on the local
+ * cpu instead of taking the cmpctmalloc lock. Magazines are refilled from and
+ * drained to cmpctmalloc in batches. Larger and aligned allocations go
+ * straight to cmpctmalloc, and any object freed back to a magazine is still a
+ * regular cmpctmalloc allocation.
+ */
+#define HEAP_CACHE_CLASSES 8
+#define HEAP_CACHE_MAGAZINE_SIZE 32
+#define HEAP_CACHE_BATCH (HEAP_CACHE_MAGAZINE_SIZE / 2)
+
+static const size_t heap_cache_class_sizes[HEAP_CACHE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256,
+};
+
+/* only touched by its own cpu with interrupts disabled, the counters are read
+ * racily by the heap command */
+struct heap_magazine {
+    void *objects[HEAP_CACHE_MAGAZINE_SIZE];
+    size_t count;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct heap_cpu_cache {
+    struct heap_magazine classes[HEAP_CACHE_CLASSES];
+} __CPU_ALIGN;
+
+static struct heap_cpu_cache heap_caches[SMP_MAX_CPUS];
+
+static int heap_cache_alloc_class(size_t size)
+{
+    for (int i = 0; i < HEAP_CACHE_CLASSES; i++) {
+        if (size <= heap_cache_class_sizes[i])
+            return i;
+    }
+    return -1;
+}
+
+/* the class an object of |usable| bytes can be recycled into, if it is not
+ * so much larger than the class that caching it would waste memory */
+static int heap_cache_free_class(size_t usable)
+{
+    for (int i = HEAP_CACHE_CLASSES - 1; i >= 0; i--) {
+        if (usable >= heap_cache_class_sizes[i])
+            return (usable < heap_cache_class_sizes[i] * 2) ? i : -1;
+    }
+    return -1;
+}
+
+static void *heap_cache_alloc(int cls, size_t size)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct heap_magazine *mag = &heap_caches[arch_curr_cpu_num()].classes[cls];
+    if (likely(mag->count > 0)) {
+        void *ptr = mag->objects[--mag->count];
+        mag->hits++;
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        cmpct_cache_unpark(ptr, size);
+        return ptr;
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    /* the magazine is empty, refill it from the heap. We may have migrated to
+     * another cpu by the time we put the batch back, so leftovers that no
+     * longer fit go straight back to the heap. */
+    void *batch[HEAP_CACHE_BATCH];
+    size_t got = cmpct_alloc_batch(heap_cache_class_sizes[cls], batch, HEAP_CACHE_BATCH);
+    if (got == 0)
+        return NULL;
+
+    /* objects parked in the magazine carry the free fill, like those freed
+     * into it */
+    for (size_t i = 0; i < got; i++)
+        cmpct_cache_park(batch[i]);
+
+    void *ptr = batch[--got];
+    cmpct_cache_unpark(ptr, size);
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    mag = &heap_caches[arch_curr_cpu_num()].classes[cls];
+    mag->misses++;
+    while (got > 0 && mag->count < HEAP_CACHE_MAGAZINE_SIZE) {
+        mag->objects[mag->count++] = batch[--got];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (got > 0)
+        cmpct_free_batch(batch, got);
+
+    return ptr;
+}
+
+static void heap_cache_free(int cls, void *ptr)
+{
+    void *batch[HEAP_CACHE_BATCH];
+    size_t drained = 0;
+
+    cmpct_cache_park(ptr);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct heap_magazine *mag = &heap_caches[arch_curr_cpu_num()].classes[cls];
+    if (unlikely(mag->count == HEAP_CACHE_MAGAZINE_SIZE)) {
+        /* full magazine, move half of it back to the heap so that a
+         * subsequent burst of frees does not immediately overflow again */
+        while (drained < HEAP_CACHE_BATCH) {
+            batch[drained++] = mag->objects[--mag->count];
+        }
+    }
+    mag->objects[mag->count++] = ptr;
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (drained > 0)
+        cmpct_free_batch(batch, drained);
+}
+
+static void *heap_alloc(size_t size)
+{
+    int cls = heap_cache_alloc_class(size);
+    if (cls >= 0 && size > 0)
+        return heap_cache_alloc(cls, size);
+    return cmpct_alloc(size);
+}
+
+static void heap_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    int cls = heap_cache_free_class(cmpct_usable_size(ptr));
+    if (cls >= 0) {
+        heap_cache_free(cls, ptr);
+        return;
+    }
+    cmpct_free(ptr);
+}
+
+/* racy, but each field is word sized so the worst case is a slightly stale
+ * snapshot */
+static size_t heap_cache_bytes(void)
+{
+    size_t bytes = 0;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int i = 0; i < HEAP_CACHE_CLASSES; i++) {
+            bytes += heap_caches[cpu].classes[i].count * heap_cache_class_sizes[i];
+        }
+    }
+    return bytes;
+}
+
+static void heap_cache_dump(void)
+{
+    printf("\tper-cpu cache, %zu bytes cached\n", heap_cache_bytes());
+    for (int i = 0; i < HEAP_CACHE_CLASSES; i++) {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t cached = 0;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const struct heap_magazine *mag = &heap_caches[cpu].classes[i];
+            hits += mag->hits;
+            misses += mag->misses;
+            cached += mag->count;
+        }
+        printf("\t\t%3zu bytes: %8" PRIu64 " hits %8" PRIu64 " misses %4zu cached\n",
+               heap_cache_class_sizes[i], hits, misses, cached);
+    }
+}
+
 void heap_init(void)
 {
     cmpct_init();
@@ -54,7 +230,7 @@ void *malloc(size_t size)
 
     LTRACEF("size %zu\n", size);
 
-    void *ptr = cmpct_alloc(size);
+    void *ptr = heap_alloc(size);
     if (unlikely(heap_trace))
         printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
 
@@ -90,7 +266,7 @@ void *calloc(size_t count, size_t size)
 
     size_t realsize = count * size;
 
-    void *ptr = cmpct_alloc(realsize);
+    void *ptr = heap_alloc(realsize);
     if (likely(ptr))
         memset(ptr, 0, realsize);
     if (unlikely(heap_trace))
@@ -104,11 +280,17 @@ void *realloc(void *ptr, size_t size)
 
     LTRACEF("ptr %p, size %zu\n", ptr, size);
 
-    void *ptr2 = cmpct_realloc(ptr, size);
+    /* like cmpct_realloc, shrinking to nothing frees the old allocation */
+    void *ptr2 = heap_alloc(size);
+    if (ptr && (likely(ptr2) || size == 0)) {
+        if (ptr2)
+            memcpy(ptr2, ptr, MIN(size, cmpct_usable_size(ptr)));
+        heap_free(ptr);
+    }
     if (unlikely(heap_trace))
         printf("caller %p realloc %p, %zu -> %p\n", __GET_CALLER(), ptr, size, ptr2);
 
-    if (HEAP_PANIC_ON_ALLOC_FAIL && unlikely(!ptr2)) {
+    if (HEAP_PANIC_ON_ALLOC_FAIL && unlikely(!ptr2) && size > 0) {
         panic("realloc of size %zu old ptr %p failed\n", size, ptr);
     }
 
@@ -123,16 +305,18 @@ void free(void *ptr)
     if (unlikely(heap_trace))
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
-    cmpct_free(ptr);
+    heap_free(ptr);
 }
 
 static void heap_dump(bool panic_time)
 {
     cmpct_dump(panic_time);
+    heap_cache_dump();
 }
 
 void heap_get_info(size_t *size_bytes, size_t *free_bytes) {
     cmpct_get_info(size_bytes, free_bytes);
+    *free_bytes += heap_cache_bytes();
 }
 
 static void heap_test(void)
@@ -6,6 +6,7 @@
 
 #include <debug.h>
 #include <err.h>
+#include <limits.h>
 #include <platform.h>
 #include <string.h>
 
@@ -17,6 +18,7 @@
 #include <lk/init.h>
 #include <magenta/thread_annotations.h>
 #include <magenta/user_thread.h>
+#include <mxtl/atomic.h>
 
 #if __x86_64__
 #define ktrace_timestamp() rdtsc();
@@ -82,86 +84,563 @@ static void ktrace_report_probes(void) {
     mutex_release(&probe_list_lock);
 }
 
+// Each cpu appends records to its own buffer, so tracing an event costs no
+// shared cache line traffic. Readers merge the buffers by timestamp.
+//
+// In the default snapshot mode every buffer fills linearly and tracing stops
+// as soon as one of them is full, as the single global buffer used to. In
+// streaming mode the buffers are rings drained by a userspace reader, and a
+// cpu whose ring is full drops its records and counts them instead of
+// stopping the trace.
+typedef struct ktrace_cpu_buffer {
+    // Only written by the owning cpu, with interrupts disabled. head is the
+    // number of bytes ever written, including the padding skipped when a
+    // record would wrap around the end of the ring.
+    mxtl::atomic<uint64_t> head;
+    mxtl::atomic<uint64_t> dropped;
+
+    // Generation of the trace the buffer holds. A cpu that finds it behind
+    // the current generation empties its buffer before writing.
+    mxtl::atomic<uint32_t> gen;
+
+    // Only written by the reader, which holds the state lock. tail is how
+    // far the ring has been drained in streaming mode and is what frees up
+    // space for the writer.
+    mxtl::atomic<uint64_t> tail;
+    uint64_t rpos;
+    uint64_t rlimit;
+    uint64_t reported_dropped;
+
+    // head when tracing was stopped, bounds snapshot reads
+    uint64_t marker;
+
+    uint8_t* data;
+} __CPU_ALIGN ktrace_cpu_buffer_t;
+
+// A record whose tag is 0 pads out the end of a ring, the next record
+// starts at the beginning of it.
+#define KTRACE_TAG_WRAP 0
+
+// Largest record the size bits of a tag can describe.
+#define KTRACE_MAX_RECSIZE KTRACE_LEN(0xF)
+
 typedef struct ktrace_state {
-    // where the next record will be written
-    int offset;
+    // protects the reader and control state below
+    mutex_t lock;
 
     // mask of groups we allow, 0 == tracing disabled
     int grpmask;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
+    // size of each cpu's buffer, 0 if ktrace is disabled
+    uint32_t cpu_bufsize;
 
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+    // generation of the trace being written, bumped whenever the buffers
+    // are emptied for a new trace
+    mxtl::atomic<uint32_t> gen;
 
-    // raw trace buffer
-    uint8_t* buffer;
+    // the buffers are rings drained by mx_ktrace_read()
+    int streaming;
+
+    // tracing was stopped, marker is valid in every buffer
+    bool stopped;
+
+    // the next start begins a new trace instead of appending to this one
+    bool rewind_pending;
+
+    // the version and timebase records still need to be read out, for
+    // streaming mode
+    bool meta_pending;
+
+    // snapshot reads: generation and offset in the merged trace of the
+    // records at the buffers' rpos
+    uint32_t read_gen;
+    uint32_t read_off;
+
+    // version and timebase records, which lead every trace
+    ktrace_rec_32b_t meta[2];
+
+    // reads are staged here so that they can be copied out in bulk
+    uint8_t* staging;
 } ktrace_state_t;
 
-static ktrace_state_t KTRACE_STATE;
+static ktrace_state_t KTRACE_STATE = {
+    .lock = MUTEX_INITIAL_VALUE(KTRACE_STATE.lock),
+};
+static ktrace_cpu_buffer_t ktrace_cpus[SMP_MAX_CPUS];
+
+static inline bool ktrace_is_meta(uint32_t tag) {
+    return (KTRACE_GROUP(tag) & KTRACE_GRP_META) != 0;
+}
 
-int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+// Finds room for a |len| byte record in the current cpu's buffer, returning
+// where to write it and the head to publish once it has been written. Must
+// be called with interrupts disabled.
+static uint8_t* ktrace_reserve(ktrace_state_t* ks, ktrace_cpu_buffer_t* cb, uint32_t len,
+                               uint64_t* next_head) {
+    uint32_t gen = ks->gen.load(mxtl::memory_order_acquire);
+    if (cb->gen.load(mxtl::memory_order_relaxed) != gen) {
+        // Only this cpu and the reader touch the buffer, and the reader
+        // ignores it until it has caught up with gen.
+        cb->head.store(0, mxtl::memory_order_relaxed);
+        cb->tail.store(0, mxtl::memory_order_relaxed);
+        cb->dropped.store(0, mxtl::memory_order_relaxed);
+        cb->gen.store(gen, mxtl::memory_order_release);
+    }
+
+    const uint64_t size = ks->cpu_bufsize;
+    uint64_t head = cb->head.load(mxtl::memory_order_relaxed);
+    uint64_t tail = cb->tail.load(mxtl::memory_order_acquire);
+    uint64_t off = head % size;
+    uint64_t pad = 0;
+    bool streaming = atomic_load(&ks->streaming);
+    if (off + len > size) {
+        pad = size - off;
+    }
+
+    if ((!streaming && head + len > size) || (head + pad + len - tail > size)) {
+        cb->dropped.store(cb->dropped.load(mxtl::memory_order_relaxed) + 1,
+                          mxtl::memory_order_relaxed);
+        if (!streaming) {
+            // if we arrive at the end, stop
+            atomic_store(&ks->grpmask, 0);
+        }
+        return nullptr;
+    }
+
+    if (pad) {
+        *reinterpret_cast<uint32_t*>(cb->data + off) = KTRACE_TAG_WRAP;
+        off = 0;
+    }
+    *next_head = head + pad + len;
+    return cb->data + off;
+}
+
+static inline void ktrace_commit(ktrace_cpu_buffer_t* cb, uint64_t next_head) {
+    cb->head.store(next_head, mxtl::memory_order_release);
+}
+
+bool ktrace_emit(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
     ktrace_state_t* ks = &KTRACE_STATE;
+    if (!(tag & atomic_load(&ks->grpmask))) {
+        return false;
+    }
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
-    } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
+    uint32_t len = KTRACE_LEN(tag);
+    if (len < KTRACE_HDRSIZE) {
+        return false;
+    }
+
+    bool written = false;
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    ktrace_cpu_buffer_t* cb = &ktrace_cpus[arch_curr_cpu_num()];
+    uint64_t next_head;
+    uint8_t* rec = ktrace_reserve(ks, cb, len, &next_head);
+    if (rec) {
+        ktrace_header_t* hdr = reinterpret_cast<ktrace_header_t*>(rec);
+        hdr->ts = ktrace_timestamp();
+        hdr->tag = tag;
+        hdr->tid = (uint32_t)get_current_thread()->user_tid;
+
+        // records carry at most four words of payload
+        const uint32_t args[4] = {a, b, c, d};
+        memcpy(hdr + 1, args, MIN(len - KTRACE_HDRSIZE, sizeof(args)));
+
+        ktrace_commit(cb, next_head);
+        written = true;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return written;
+}
+
+void ktrace_tiny(uint32_t tag, uint32_t arg) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (!(tag & atomic_load(&ks->grpmask))) {
+        return;
+    }
+
+    tag = (tag & 0xFFFFFFF0) | 2;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    ktrace_cpu_buffer_t* cb = &ktrace_cpus[arch_curr_cpu_num()];
+    uint64_t next_head;
+    uint8_t* rec = ktrace_reserve(ks, cb, KTRACE_HDRSIZE, &next_head);
+    if (rec) {
+        ktrace_header_t* hdr = reinterpret_cast<ktrace_header_t*>(rec);
+        hdr->ts = ktrace_timestamp();
+        hdr->tag = tag;
+        hdr->tid = arg;
+        ktrace_commit(cb, next_head);
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (ks->cpu_bufsize == 0) {
+        return;
+    }
+    if (!(tag & atomic_load(&ks->grpmask)) && !always) {
+        return;
+    }
+
+    uint32_t len = static_cast<uint32_t>(strnlen(name, 31));
+
+    // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
+    tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    ktrace_cpu_buffer_t* cb = &ktrace_cpus[arch_curr_cpu_num()];
+    uint64_t next_head;
+    uint8_t* buf = ktrace_reserve(ks, cb, KTRACE_LEN(tag), &next_head);
+    if (buf) {
+        ktrace_rec_name_t* rec = reinterpret_cast<ktrace_rec_name_t*>(buf);
+        rec->tag = tag;
+        rec->id = id;
+        rec->arg = arg;
+        memcpy(rec->name, name, len);
+        rec->name[len] = 0;
+        ktrace_commit(cb, next_head);
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name) {
+    ktrace_name_etc(tag, id, arg, name, false);
+}
+
+// Picks the buffer holding the next record of the merged trace, or returns
+// nullptr when every buffer has been read up to its rlimit. Metadata records
+// have no timestamp and are taken as soon as they come up, so names still
+// precede the events that use them. The others are taken oldest first.
+static ktrace_cpu_buffer_t* ktrace_next_record(ktrace_state_t* ks, uint32_t gen,
+                                               const uint8_t** rec_out) TA_REQ(ks->lock) {
+    const uint64_t size = ks->cpu_bufsize;
+    ktrace_cpu_buffer_t* best = nullptr;
+    const uint8_t* best_rec = nullptr;
+    uint64_t best_ts = 0;
+
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        ktrace_cpu_buffer_t* cb = &ktrace_cpus[cpu];
+        if (cb->gen.load(mxtl::memory_order_acquire) != gen) {
+            continue;
+        }
+        if (cb->rpos < cb->rlimit &&
+            *reinterpret_cast<const uint32_t*>(cb->data + cb->rpos % size) == KTRACE_TAG_WRAP) {
+            cb->rpos += size - cb->rpos % size;
+        }
+        if (cb->rpos >= cb->rlimit) {
+            continue;
+        }
+
+        const uint8_t* rec = cb->data + cb->rpos % size;
+        uint32_t tag = *reinterpret_cast<const uint32_t*>(rec);
+        if (ktrace_is_meta(tag)) {
+            *rec_out = rec;
+            return cb;
+        }
+        uint64_t ts = reinterpret_cast<const ktrace_header_t*>(rec)->ts;
+        if (best == nullptr || ts < best_ts) {
+            best = cb;
+            best_rec = rec;
+            best_ts = ts;
+        }
+    }
+
+    *rec_out = best_rec;
+    return best;
+}
+
+// Sets the limit each buffer is read up to: everything published so far, or
+// where tracing was stopped for a snapshot of a stopped trace.
+static void ktrace_set_read_limits(ktrace_state_t* ks, uint32_t gen) TA_REQ(ks->lock) {
+    bool frozen = ks->stopped && !atomic_load(&ks->streaming);
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        ktrace_cpu_buffer_t* cb = &ktrace_cpus[cpu];
+        if (cb->gen.load(mxtl::memory_order_acquire) != gen) {
+            cb->rlimit = 0;
+            continue;
+        }
+        cb->rlimit = frozen ? cb->marker : cb->head.load(mxtl::memory_order_acquire);
+    }
+}
+
+typedef struct ktrace_copier {
+    uint8_t* user;
+    uint32_t copied;
+    uint32_t staged;
+    uint8_t* staging;
+} ktrace_copier_t;
+
+static status_t ktrace_flush(ktrace_copier_t* cp) {
+    if (cp->staged == 0) {
+        return MX_OK;
+    }
+    if (arch_copy_to_user(cp->user + cp->copied, cp->staging, cp->staged) != MX_OK) {
+        return MX_ERR_INVALID_ARGS;
+    }
+    cp->copied += cp->staged;
+    cp->staged = 0;
+    return MX_OK;
+}
+
+static status_t ktrace_stage(ktrace_copier_t* cp, const void* data, uint32_t len) {
+    if (cp->staged + len > PAGE_SIZE) {
+        status_t status = ktrace_flush(cp);
+        if (status != MX_OK) {
+            return status;
         }
     }
+    memcpy(cp->staging + cp->staged, data, len);
+    cp->staged += len;
+    return MX_OK;
+}
+
+// Reads [off, off + len) of the merged trace. Sequential reads pick up where
+// the previous one left off, reading at an earlier offset merges the buffers
+// again from the start.
+static int ktrace_read_snapshot(ktrace_state_t* ks, void* ptr, uint32_t off, uint32_t len)
+    TA_REQ(ks->lock) {
+    uint32_t gen = ks->gen.load(mxtl::memory_order_relaxed);
+    ktrace_set_read_limits(ks, gen);
 
     // null read is a query for trace buffer size
     if (ptr == nullptr) {
-        return max;
+        uint64_t size = sizeof(ks->meta);
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            size += ktrace_cpus[cpu].rlimit;
+        }
+        return static_cast<int>(size);
     }
 
-    // constrain read to available buffer
-    if (off >= max) {
-        return 0;
+    if (ks->read_gen != gen || off < ks->read_off) {
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            ktrace_cpus[cpu].rpos = 0;
+        }
+        ks->read_gen = gen;
+        ks->read_off = sizeof(ks->meta);
     }
-    if (len > (max - off)) {
-        len = max - off;
+
+    ktrace_copier_t cp = {static_cast<uint8_t*>(ptr), 0, 0, ks->staging};
+    status_t status;
+    uint32_t done = 0;
+    if (off < sizeof(ks->meta)) {
+        done = MIN(len, static_cast<uint32_t>(sizeof(ks->meta)) - off);
+        if ((status = ktrace_stage(&cp, reinterpret_cast<uint8_t*>(ks->meta) + off, done)) < 0) {
+            return status;
+        }
     }
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != MX_OK) {
-        return MX_ERR_INVALID_ARGS;
+    const uint8_t* rec;
+    ktrace_cpu_buffer_t* cb;
+    while (done < len && (cb = ktrace_next_record(ks, gen, &rec)) != nullptr) {
+        uint32_t rec_len = KTRACE_LEN(*reinterpret_cast<const uint32_t*>(rec));
+        if (rec_len == 0) {
+            break;
+        }
+
+        // records entirely before the requested range are skipped, the ones
+        // straddling either end are copied in part
+        uint32_t pos = off + done;
+        if (ks->read_off + rec_len <= pos) {
+            cb->rpos += rec_len;
+            ks->read_off += rec_len;
+            continue;
+        }
+        uint32_t start = pos - ks->read_off;
+        uint32_t n = MIN(rec_len - start, len - done);
+        if ((status = ktrace_stage(&cp, rec + start, n)) < 0) {
+            return status;
+        }
+        done += n;
+        if (start + n < rec_len) {
+            break;
+        }
+        cb->rpos += rec_len;
+        ks->read_off += rec_len;
+    }
+
+    if ((status = ktrace_flush(&cp)) < 0) {
+        return status;
     }
-    return len;
+    return cp.copied;
+}
+
+// Drains whole records into ptr, freeing up their space for the writers.
+// Drops since the last read are reported with a TAG_RECORDS_DROPPED record
+// for each cpu that had any.
+static int ktrace_read_stream(ktrace_state_t* ks, void* ptr, uint32_t len) TA_REQ(ks->lock) {
+    uint32_t gen = ks->gen.load(mxtl::memory_order_relaxed);
+    if (ks->read_gen != gen) {
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            ktrace_cpus[cpu].rpos = 0;
+            ktrace_cpus[cpu].reported_dropped = 0;
+        }
+        ks->read_gen = gen;
+    }
+    ktrace_set_read_limits(ks, gen);
+
+    // null read is a query for how much can be drained, give or take the
+    // padding at the end of the rings
+    if (ptr == nullptr) {
+        uint64_t size = ks->meta_pending ? sizeof(ks->meta) : 0;
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            size += ktrace_cpus[cpu].rlimit - ktrace_cpus[cpu].rpos;
+        }
+        return static_cast<int>(MIN(size, static_cast<uint64_t>(INT_MAX)));
+    }
+
+    // only whole records are returned
+    if (len < KTRACE_MAX_RECSIZE) {
+        return MX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    ktrace_copier_t cp = {static_cast<uint8_t*>(ptr), 0, 0, ks->staging};
+    status_t status;
+    uint32_t done = 0;
+    if (ks->meta_pending) {
+        if ((status = ktrace_stage(&cp, ks->meta, sizeof(ks->meta))) < 0) {
+            return status;
+        }
+        done += sizeof(ks->meta);
+        ks->meta_pending = false;
+    }
+
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        ktrace_cpu_buffer_t* cb = &ktrace_cpus[cpu];
+        if (cb->gen.load(mxtl::memory_order_acquire) != gen) {
+            continue;
+        }
+        uint64_t dropped = cb->dropped.load(mxtl::memory_order_relaxed);
+        if (dropped == cb->reported_dropped || done + KTRACE_RECSIZE > len) {
+            continue;
+        }
+        uint64_t n = dropped - cb->reported_dropped;
+        ktrace_rec_32b_t rec = {};
+        rec.tag = TAG_RECORDS_DROPPED;
+        rec.ts = ktrace_timestamp();
+        rec.a = cpu;
+        rec.b = static_cast<uint32_t>(n);
+        rec.c = static_cast<uint32_t>(n >> 32);
+        if ((status = ktrace_stage(&cp, &rec, sizeof(rec))) < 0) {
+            return status;
+        }
+        done += sizeof(rec);
+        cb->reported_dropped = dropped;
+    }
+
+    const uint8_t* rec;
+    ktrace_cpu_buffer_t* cb;
+    while ((cb = ktrace_next_record(ks, gen, &rec)) != nullptr) {
+        uint32_t rec_len = KTRACE_LEN(*reinterpret_cast<const uint32_t*>(rec));
+        if (rec_len == 0 || done + rec_len > len) {
+            break;
+        }
+        if ((status = ktrace_stage(&cp, rec, rec_len)) < 0) {
+            return status;
+        }
+        done += rec_len;
+        cb->rpos += rec_len;
+    }
+
+    status = ktrace_flush(&cp);
+
+    // the records have been copied out of the rings even if copying them to
+    // the user failed, hand the space back either way
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        ktrace_cpu_buffer_t* cb = &ktrace_cpus[cpu];
+        if (cb->gen.load(mxtl::memory_order_acquire) == gen) {
+            cb->tail.store(cb->rpos, mxtl::memory_order_release);
+        }
+    }
+
+    if (status < 0) {
+        return status;
+    }
+    return cp.copied;
+}
+
+int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (ks->cpu_bufsize == 0) {
+        return (ptr == nullptr) ? 0 : MX_ERR_BAD_STATE;
+    }
+
+    mutex_acquire(&ks->lock);
+    int result;
+    if (atomic_load(&ks->streaming)) {
+        // the offset has no meaning for a stream, every read takes what
+        // comes next
+        result = ktrace_read_stream(ks, ptr, len);
+    } else {
+        result = ktrace_read_snapshot(ks, ptr, off, len);
+    }
+    mutex_release(&ks->lock);
+    return result;
+}
+
+// Starts a new trace: the buffers are emptied lazily, by each cpu on its
+// next write, and the names of the syscalls and probes begin the trace.
+static void ktrace_restart(ktrace_state_t* ks, bool streaming) TA_REQ(ks->lock) {
+    atomic_store(&ks->streaming, streaming);
+    ks->gen.fetch_add(1, mxtl::memory_order_release);
+    ks->rewind_pending = false;
+    ks->meta_pending = streaming;
+    ktrace_report_syscalls(kt_syscall_info);
+    ktrace_report_probes();
+}
+
+static void ktrace_start(ktrace_state_t* ks, uint32_t options) TA_REQ(ks->lock) {
+    options = KTRACE_GRP_TO_MASK(options);
+    ks->stopped = false;
+    atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
+    ktrace_report_live_processes();
+    ktrace_report_live_threads();
 }
 
 status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
     case KTRACE_ACTION_START:
-        options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
-        atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
-        ktrace_report_live_processes();
-        ktrace_report_live_threads();
+    case KTRACE_ACTION_START_STREAMING: {
+        if (ks->cpu_bufsize == 0) {
+            return MX_ERR_BAD_STATE;
+        }
+        bool streaming = (action == KTRACE_ACTION_START_STREAMING);
+        mutex_acquire(&ks->lock);
+        if (streaming || ks->rewind_pending || atomic_load(&ks->streaming)) {
+            ktrace_restart(ks, streaming);
+        }
+        ktrace_start(ks, options);
+        mutex_release(&ks->lock);
         break;
-    case KTRACE_ACTION_STOP: {
+    }
+    case KTRACE_ACTION_STOP:
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
-        } else {
-            ks->marker = n;
+        mutex_acquire(&ks->lock);
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            ktrace_cpus[cpu].marker = ktrace_cpus[cpu].head.load(mxtl::memory_order_acquire);
         }
+        ks->stopped = true;
+        mutex_release(&ks->lock);
         break;
-    }
     case KTRACE_ACTION_REWIND:
-        // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
-        ktrace_report_syscalls(kt_syscall_info);
-        ktrace_report_probes();
+        // A stopped trace stays readable until tracing is started again.
+        mutex_acquire(&ks->lock);
+        if (ks->stopped) {
+            ks->rewind_pending = true;
+        } else {
+            ktrace_restart(ks, atomic_load(&ks->streaming));
+        }
+        mutex_release(&ks->lock);
         break;
     case KTRACE_ACTION_NEW_PROBE: {
         ktrace_probe_info_t* probe;
@@ -202,19 +681,47 @@ void ktrace_init(unsigned level) {
 
     mb *= (1024*1024);
 
+    // the buffer is split evenly between the cpus
+    uint num_cpus = arch_max_num_cpus();
+    uint32_t cpu_bufsize = ROUNDDOWN(mb / num_cpus, PAGE_SIZE);
+    if (cpu_bufsize == 0) {
+        dprintf(INFO, "ktrace: buffer too small for %u cpus\n", num_cpus);
+        return;
+    }
+
     status_t status;
+    uint8_t* buffer;
     VmAspace* aspace = VmAspace::kernel_aspace();
-    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VmAspace::VMM_FLAG_COMMIT,
+    if ((status = aspace->Alloc("ktrace", mb, (void**)&buffer, 0, VmAspace::VMM_FLAG_COMMIT,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
+    ks->staging = static_cast<uint8_t*>(malloc(PAGE_SIZE));
+    if (ks->staging == nullptr) {
+        dprintf(INFO, "ktrace: cannot alloc staging buffer\n");
+        aspace->FreeRegion(reinterpret_cast<vaddr_t>(buffer));
+        return;
+    }
 
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    for (uint cpu = 0; cpu < num_cpus; cpu++) {
+        ktrace_cpus[cpu].data = buffer + cpu * cpu_bufsize;
+    }
+
+    dprintf(INFO, "ktrace: buffer at %p (%u bytes, %u per cpu)\n", buffer, mb, cpu_bufsize);
+
+    // metadata leads every trace
+    uint64_t n = ktrace_ticks_per_ms();
+    ks->meta[0].tag = TAG_VERSION;
+    ks->meta[0].a = KTRACE_VERSION;
+    ks->meta[1].tag = TAG_TICKS_PER_MS;
+    ks->meta[1].a = (uint32_t)n;
+    ks->meta[1].b = (uint32_t)(n >> 32);
+
+    // writers empty their buffer the first time they see a new generation
+    ks->gen.store(1);
+    ks->cpu_bufsize = cpu_bufsize;
 
     // register all static probes
     ktrace_probe_info_t *probe;
@@ -224,87 +731,12 @@ void ktrace_init(unsigned level) {
     }
     mutex_release(&probe_list_lock);
 
-    // write metadata to the first two event slots
-    uint64_t n = ktrace_ticks_per_ms();
-    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
-    rec[0].tag = TAG_VERSION;
-    rec[0].a = KTRACE_VERSION;
-    rec[1].tag = TAG_TICKS_PER_MS;
-    rec[1].a = (uint32_t)n;
-    rec[1].b = (uint32_t)(n >> 32);
-
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
     ktrace_report_syscalls(kt_syscall_info);
-    ktrace_report_probes();
     atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
 
     // report names of existing threads
     ktrace_report_live_threads();
 }
 
-void ktrace_tiny(uint32_t tag, uint32_t arg) {
-    ktrace_state_t* ks = &KTRACE_STATE;
-    if (tag & atomic_load(&ks->grpmask)) {
-        tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-            hdr->ts = ktrace_timestamp();
-            hdr->tag = tag;
-            hdr->tid = arg;
-        }
-    }
-}
-
-void* ktrace_open(uint32_t tag) {
-    ktrace_state_t* ks = &KTRACE_STATE;
-    if (!(tag & atomic_load(&ks->grpmask))) {
-        return nullptr;
-    }
-
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return nullptr;
-    }
-
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ktrace_timestamp();
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
-}
-
-static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
-    ktrace_state_t* ks = &KTRACE_STATE;
-    if ((tag & atomic_load(&ks->grpmask)) || always) {
-        uint32_t len = static_cast<uint32_t>(strnlen(name, 31));
-
-        // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
-        tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
-
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
-            rec->tag = tag;
-            rec->id = id;
-            rec->arg = arg;
-            memcpy(rec->name, name, len);
-            rec->name[len] = 0;
-        }
-    }
-}
-
-void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name) {
-    ktrace_name_etc(tag, id, arg, name, false);
-}
-
 LK_INIT_HOOK(ktrace, ktrace_init, LK_INIT_LEVEL_APPS - 1);
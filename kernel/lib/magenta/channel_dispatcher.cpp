@@ -152,7 +152,7 @@ status_t ChannelDispatcher::Read(uint32_t* msg_size,
         rv = MX_ERR_BUFFER_TOO_SMALL;
     }
 
-    *msg = messages_.pop_front();
+    *msg = PopMessageLocked();
 
     if (messages_.is_empty())
         state_tracker_.UpdateState(MX_CHANNEL_READABLE, 0u);
@@ -160,19 +160,68 @@ status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+status_t ChannelDispatcher::ReadMany(uint32_t max_msgs, uint32_t max_bytes, uint32_t max_handles,
+                                     MessageList* msgs, uint32_t* next_size,
+                                     uint32_t* next_handle_count) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? MX_ERR_SHOULD_WAIT : MX_ERR_PEER_CLOSED;
+
+    uint32_t count = 0;
+    while (count < max_msgs && !messages_.is_empty()) {
+        const auto& front = messages_.front();
+        if (front.data_size() > max_bytes || front.num_handles() > max_handles)
+            break;
+        max_bytes -= front.data_size();
+        max_handles -= front.num_handles();
+        msgs->push_back(PopMessageLocked());
+        ++count;
+    }
+
+    if (count == 0) {
+        *next_size = messages_.front().data_size();
+        *next_handle_count = messages_.front().num_handles();
+        return MX_ERR_BUFFER_TOO_SMALL;
+    }
+
+    if (messages_.is_empty())
+        state_tracker_.UpdateState(MX_CHANNEL_READABLE, 0u);
+
+    return MX_OK;
+}
+
 status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
     mxtl::RefPtr<ChannelDispatcher> other;
     {
         AutoLock lock(&lock_);
-        if (!other_) {
-            // |msg| will be destroyed but we want to keep the handles alive since
-            // the caller should put them back into the process table.
+        other = other_;
+    }
+    if (!other) {
+        // |msg| will be destroyed but we want to keep the handles alive since
+        // the caller should put them back into the process table. Pages moved
+        // out of the sender's vmo go back into it.
+        msg->set_owns_handles(false);
+        msg->ReturnPages();
+        return MX_ERR_PEER_CLOSED;
+    }
+
+    if (unlikely(msg->paged())) {
+        int woken;
+        status_t status = other->WritePagedSelf(&msg, &woken);
+        if (status != MX_OK) {
+            // As above, the handles and pages go back to the caller.
             msg->set_owns_handles(false);
-            return MX_ERR_PEER_CLOSED;
+            msg->ReturnPages();
+            return status;
         }
-        other = other_;
+        if (woken > 0)
+            thread_reschedule();
+        return MX_OK;
     }
 
     if (other->WriteSelf(mxtl::move(msg)) > 0)
@@ -181,6 +230,23 @@ status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     return MX_OK;
 }
 
+status_t ChannelDispatcher::WriteMany(MessageList* msgs) {
+    canary_.Assert();
+
+    mxtl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return MX_ERR_PEER_CLOSED;
+        other = other_;
+    }
+
+    if (other->WriteSelfMany(msgs) > 0)
+        thread_reschedule();
+
+    return MX_OK;
+}
+
 status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
                                  mx_time_t deadline, bool* return_handles,
                                  mxtl::unique_ptr<MessagePacket>* reply) {
@@ -262,6 +328,55 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
 
     AutoLock lock(&lock_);
 
+    bool queued;
+    int woken = DeliverLocked(mxtl::move(msg), &queued);
+    if (queued)
+        state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    return woken;
+}
+
+// Like WriteSelf(), but leaves |msg| with the caller if it would take the data
+// queued in paged messages past kMaxPagedBytes.
+status_t ChannelDispatcher::WritePagedSelf(mxtl::unique_ptr<MessagePacket>* msg, int* woken) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if ((*msg)->data_size() > kMaxPagedBytes - paged_bytes_)
+        return MX_ERR_NO_RESOURCES;
+
+    // Once queued the move out of the sender's vmo is final.
+    (*msg)->ClearPageSource();
+
+    bool queued;
+    *woken = DeliverLocked(mxtl::move(*msg), &queued);
+    if (queued)
+        state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    return MX_OK;
+}
+
+int ChannelDispatcher::WriteSelfMany(MessageList* msgs) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    int woken = 0;
+    bool any_queued = false;
+    while (!msgs->is_empty()) {
+        bool queued;
+        woken += DeliverLocked(msgs->pop_front(), &queued);
+        any_queued |= queued;
+    }
+    if (any_queued)
+        state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    return woken;
+}
+
+// Hands |msg| to a caller waiting on its txid, if there is one, and otherwise
+// appends it to the message queue. Returns how many threads have been woken up.
+int ChannelDispatcher::DeliverLocked(mxtl::unique_ptr<MessagePacket> msg, bool* queued) {
+    *queued = false;
+
     if (!waiters_.is_empty()) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
@@ -277,12 +392,20 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
             }
         }
     }
+    if (msg->paged())
+        paged_bytes_ += msg->data_size();
     messages_.push_back(mxtl::move(msg));
-
-    state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
+    *queued = true;
     return 0;
 }
 
+mxtl::unique_ptr<MessagePacket> ChannelDispatcher::PopMessageLocked() {
+    auto msg = messages_.pop_front();
+    if (msg->paged())
+        paged_bytes_ -= msg->data_size();
+    return msg;
+}
+
 status_t ChannelDispatcher::user_signal(uint32_t clear_mask, uint32_t set_mask, bool peer) {
     canary_.Assert();
 
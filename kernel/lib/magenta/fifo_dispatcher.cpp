@@ -7,12 +7,20 @@
 #include <string.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_object_paged.h>
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/fifo_dispatcher.h>
 #include <magenta/handle.h>
 #include <magenta/rights.h>
+#include <magenta/vm_object_dispatcher.h>
 #include <mxalloc/new.h>
 
+// The ring can be mapped and its entries read and written, but not resized
+// or executed.
+constexpr mx_rights_t kRingVmoRights =
+    MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_MAP | MX_RIGHT_TRANSFER;
+
 // static
 status_t FifoDispatcher::Create(uint32_t count, uint32_t elemsize, uint32_t options,
                                 mxtl::RefPtr<Dispatcher>* dispatcher0,
@@ -26,6 +34,16 @@ status_t FifoDispatcher::Create(uint32_t count, uint32_t elemsize, uint32_t opti
         ((count * elemsize) > kMaxSizeBytes)) {
         return MX_ERR_OUT_OF_RANGE;
     }
+    if (options & ~MX_FIFO_SHARED_RING)
+        return MX_ERR_INVALID_ARGS;
+
+    mxtl::RefPtr<Ring> ring;
+    if (options & MX_FIFO_SHARED_RING) {
+        mx_status_t status = CreateRing(count, elemsize, &ring);
+        if (status != MX_OK)
+            return status;
+    }
+
     AllocChecker ac;
     auto fifo0 = mxtl::AdoptRef(new (&ac) FifoDispatcher(count, elemsize, options));
     if (!ac.check())
@@ -36,9 +54,9 @@ status_t FifoDispatcher::Create(uint32_t count, uint32_t elemsize, uint32_t opti
         return MX_ERR_NO_MEMORY;
 
     mx_status_t status;
-    if ((status = fifo0->Init(fifo1)) != MX_OK)
+    if ((status = fifo0->Init(fifo1, ring, 0u)) != MX_OK)
         return status;
-    if ((status = fifo1->Init(fifo0)) != MX_OK)
+    if ((status = fifo1->Init(fifo0, ring, 1u)) != MX_OK)
         return status;
 
     *rights = MX_DEFAULT_FIFO_RIGHTS;
@@ -47,10 +65,57 @@ status_t FifoDispatcher::Create(uint32_t count, uint32_t elemsize, uint32_t opti
     return MX_OK;
 }
 
+// The vmo holds a header page followed by one page for each direction, the
+// largest a fifo may be.
+// static
+mx_status_t FifoDispatcher::CreateRing(uint32_t count, uint32_t elemsize,
+                                       mxtl::RefPtr<Ring>* out) {
+    static_assert(sizeof(mx_fifo_ring_header_t) <= PAGE_SIZE, "");
+    static_assert(kMaxSizeBytes <= PAGE_SIZE, "");
+
+    AllocChecker ac;
+    auto ring = mxtl::AdoptRef(new (&ac) Ring());
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+
+    const uint64_t size = 3 * PAGE_SIZE;
+    mx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, size, &ring->vmo);
+    if (status != MX_OK)
+        return status;
+
+    // Commit up front so that neither side takes faults in steady state.
+    uint64_t committed;
+    status = ring->vmo->CommitRange(0, size, &committed);
+    if (status != MX_OK)
+        return status;
+
+    mx_fifo_ring_header_t header = {};
+    header.elem_count = count;
+    header.elem_size = elemsize;
+    header.ring_offset[0] = PAGE_SIZE;
+    header.ring_offset[1] = 2 * PAGE_SIZE;
+    size_t written;
+    status = ring->vmo->Write(&header, 0, sizeof(header), &written);
+    if (status != MX_OK)
+        return status;
+
+    ring->vmo->set_name("fifo-ring", sizeof("fifo-ring"));
+
+    // Every handle to the ring refers to one dispatcher, made here so that
+    // fetching the ring does not allocate.
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(ring->vmo, &ring->vmo_dispatcher, &rights);
+    if (status != MX_OK)
+        return status;
+
+    *out = mxtl::move(ring);
+    return MX_OK;
+}
+
 FifoDispatcher::FifoDispatcher(uint32_t count, uint32_t elem_size, uint32_t /*options*/)
     : elem_count_(count), elem_size_(elem_size), mask_(count - 1),
       peer_koid_(0u), state_tracker_(MX_FIFO_WRITABLE),
-      head_(0u), tail_(0u) {
+      head_(0u), tail_(0u), data_(nullptr), ring_index_(0u) {
 }
 
 FifoDispatcher::~FifoDispatcher() {
@@ -59,9 +124,16 @@ FifoDispatcher::~FifoDispatcher() {
 
 // Thread safety analysis disabled as this happens during creation only,
 // when no other thread could be accessing the object.
-mx_status_t FifoDispatcher::Init(mxtl::RefPtr<FifoDispatcher> other) TA_NO_THREAD_SAFETY_ANALYSIS {
+mx_status_t FifoDispatcher::Init(mxtl::RefPtr<FifoDispatcher> other, mxtl::RefPtr<Ring> ring,
+                                 uint32_t ring_index) TA_NO_THREAD_SAFETY_ANALYSIS {
     other_ = mxtl::move(other);
     peer_koid_ = other_->get_koid();
+    if (ring) {
+        // The entries live in the ring, there is no kernel buffer.
+        ring_ = mxtl::move(ring);
+        ring_index_ = ring_index;
+        return MX_OK;
+    }
     if ((data_ = (uint8_t*) calloc(elem_count_, elem_size_)) == nullptr)
         return MX_ERR_NO_MEMORY;
     return MX_OK;
@@ -149,6 +221,9 @@ mx_status_t FifoDispatcher::Write(const uint8_t* ptr, size_t len, uint32_t* actu
                                   fifo_copy_from_fn_t copy_from_fn) {
     canary_.Assert();
 
+    if (ring_)
+        return MX_ERR_NOT_SUPPORTED;
+
     mxtl::RefPtr<FifoDispatcher> other;
     {
         AutoLock lock(&lock_);
@@ -222,6 +297,9 @@ mx_status_t FifoDispatcher::Read(uint8_t* ptr, size_t bytelen, uint32_t* actual,
                                  fifo_copy_to_fn_t copy_to_fn) {
     canary_.Assert();
 
+    if (ring_)
+        return MX_ERR_NOT_SUPPORTED;
+
     size_t count = bytelen / elem_size_;
     if (count == 0)
         return MX_ERR_OUT_OF_RANGE;
@@ -276,3 +354,62 @@ mx_status_t FifoDispatcher::Read(uint8_t* ptr, size_t bytelen, uint32_t* actual,
     *actual = (tail_ - old_tail);
     return MX_OK;
 }
+
+mx_status_t FifoDispatcher::GetRing(mxtl::RefPtr<Dispatcher>* dispatcher,
+                                    mx_rights_t* rights) {
+    canary_.Assert();
+
+    if (!ring_)
+        return MX_ERR_NOT_SUPPORTED;
+    *dispatcher = ring_->vmo_dispatcher;
+    *rights = kRingVmoRights;
+    return MX_OK;
+}
+
+mx_status_t FifoDispatcher::Notify() {
+    canary_.Assert();
+
+    if (!ring_)
+        return MX_ERR_NOT_SUPPORTED;
+
+    mxtl::RefPtr<FifoDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        other = other_;
+    }
+
+    AutoLock lock(&ring_->lock);
+
+    // The indices are written by userspace, so they are only trusted as far
+    // as the signals go. The vmo may also have been decommitted under us, in
+    // which case the header reads as zeros.
+    mx_fifo_ring_header_t header;
+    size_t bytes_read;
+    mx_status_t status = ring_->vmo->Read(&header, 0, sizeof(header), &bytes_read);
+    if (status != MX_OK)
+        return status;
+
+    auto update = [&header, this](FifoDispatcher* fifo, bool peer_alive) {
+        const mx_fifo_ring_index_t& rx = header.ring[fifo->ring_index_];
+        const mx_fifo_ring_index_t& tx = header.ring[fifo->ring_index_ ^ 1];
+
+        mx_signals_t set = 0u;
+        mx_signals_t clear = 0u;
+        if (rx.head != rx.tail) {
+            set |= MX_FIFO_READABLE;
+        } else {
+            clear |= MX_FIFO_READABLE;
+        }
+        if (peer_alive && (tx.head - tx.tail) < elem_count_) {
+            set |= MX_FIFO_WRITABLE;
+        } else {
+            clear |= MX_FIFO_WRITABLE;
+        }
+        fifo->state_tracker_.UpdateState(clear, set);
+    };
+
+    update(this, other != nullptr);
+    if (other)
+        update(other.get(), true);
+    return MX_OK;
+}
@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/user_copy.h>
 #include <assert.h>
 #include <kernel/auto_lock.h>
 #include <lib/user_copy.h>
@@ -15,26 +16,112 @@
 
 #define LOCAL_TRACE 0
 
+// Holds the locks of one or two buckets, ordered by address so that two
+// operations on the same pair of futexes cannot deadlock.
+class FutexContext::BucketPairLock {
+public:
+    BucketPairLock(Bucket* a, Bucket* b) TA_NO_THREAD_SAFETY_ANALYSIS
+        : first_(a < b ? a : b), second_(a < b ? b : a) {
+        first_->lock.Acquire();
+        if (second_ != first_)
+            second_->lock.Acquire();
+    }
+
+    ~BucketPairLock() TA_NO_THREAD_SAFETY_ANALYSIS {
+        if (second_ != first_)
+            second_->lock.Release();
+        first_->lock.Release();
+    }
+
+private:
+    BucketPairLock(const BucketPairLock&) = delete;
+    BucketPairLock& operator=(const BucketPairLock&) = delete;
+
+    Bucket* const first_;
+    Bucket* const second_;
+};
+
+// Decode the fields of an MX_FUTEX_OP value.
+static int FutexOpArg(uint32_t op, uint32_t shift) {
+    // The arguments are signed 12 bit fields.
+    return static_cast<int>((op >> shift) << 20) >> 20;
+}
+
+static bool FutexOpApply(uint32_t op, int old_value, int* new_value) {
+    uint32_t arg = static_cast<uint32_t>(FutexOpArg(op, 12));
+    uint32_t old_bits = static_cast<uint32_t>(old_value);
+    uint32_t new_bits;
+    switch (op >> 28) {
+    case MX_FUTEX_OP_SET: new_bits = arg; break;
+    case MX_FUTEX_OP_ADD: new_bits = old_bits + arg; break;
+    case MX_FUTEX_OP_OR: new_bits = old_bits | arg; break;
+    case MX_FUTEX_OP_ANDN: new_bits = old_bits & ~arg; break;
+    case MX_FUTEX_OP_XOR: new_bits = old_bits ^ arg; break;
+    default: return false;
+    }
+    *new_value = static_cast<int>(new_bits);
+    return true;
+}
+
+static bool FutexOpCompare(uint32_t op, int old_value, bool* result) {
+    int arg = FutexOpArg(op, 0);
+    switch ((op >> 24) & 0xfu) {
+    case MX_FUTEX_CMP_EQ: *result = old_value == arg; break;
+    case MX_FUTEX_CMP_NE: *result = old_value != arg; break;
+    case MX_FUTEX_CMP_LT: *result = old_value < arg; break;
+    case MX_FUTEX_CMP_LE: *result = old_value <= arg; break;
+    case MX_FUTEX_CMP_GT: *result = old_value > arg; break;
+    case MX_FUTEX_CMP_GE: *result = old_value >= arg; break;
+    default: return false;
+    }
+    return true;
+}
+
 FutexContext::FutexContext() {
     LTRACE_ENTRY;
 }
 
-FutexContext::~FutexContext() {
+FutexContext::~FutexContext() TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (const auto& bucket : buckets_) {
+        DEBUG_ASSERT(bucket.heads.is_empty());
+    }
+}
+
+FutexContext::Bucket* FutexContext::BucketFor(uintptr_t futex_key) {
+    // Futexes are ints, and are often packed together in one struct or
+    // spread out one per page, so fold in bits from both ranges.
+    return &buckets_[((futex_key >> 2) ^ (futex_key >> 12)) % kNumBuckets];
 }
 
 status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
     LTRACE_ENTRY;
 
+    return WaitInternal(value_ptr, current_value, nullptr, deadline);
+}
+
+status_t FutexContext::FutexWaitPi(user_ptr<int> value_ptr, int current_value,
+                                   UserThread* owner, mx_time_t deadline) {
+    LTRACE_ENTRY;
+
+    if (owner == UserThread::GetCurrent())
+        return MX_ERR_INVALID_ARGS;
+
+    return WaitInternal(value_ptr, current_value, owner ? owner->futex_node() : nullptr,
+                        deadline);
+}
+
+status_t FutexContext::WaitInternal(user_ptr<int> value_ptr, int current_value,
+                                    FutexNode* pi_owner, mx_time_t deadline) {
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
     FutexNode* node;
+    Bucket* bucket = BucketFor(futex_key);
 
     // FutexWait() checks that the address value_ptr still contains
     // current_value, and if so it sleeps awaiting a FutexWake() on value_ptr.
@@ -42,16 +129,16 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    bucket->lock.Acquire();
 
     int value;
     status_t result = value_ptr.copy_from_user(&value);
     if (result != MX_OK) {
-        lock_.Release();
+        bucket->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        bucket->lock.Release();
         return MX_ERR_BAD_STATE;
     }
 
@@ -60,19 +147,21 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(bucket, node);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    // Block current thread.  This releases the bucket lock and does not
+    // reacquire it.
+    result = node->BlockThread(&bucket->lock, deadline, pi_owner);
     if (result == MX_OK) {
         // Fix/workaround for MG-624:
         // We must re-acquire the lock here to force this thread to wait until
         // the WakeThreads() marks this thread as not in the queue anymore.
         // Otherwise, this thread can exit before it does that, causing
-        // WakeThreads() to scribble on memory.
-        AutoLock lock(&lock_);
+        // WakeThreads() to scribble on memory.  The waker leaves our key
+        // alone, so it still names the bucket the waker has locked.
+        AutoLock lock(&BucketFor(node->GetKey())->lock);
         DEBUG_ASSERT(!node->IsInQueue());
-        // All the work necessary for removing us from the hash table was done by FutexWake()
+        // All the work necessary for removing us from the bucket was done by FutexWake()
         return MX_OK;
     }
 
@@ -82,8 +171,10 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     //
     // We need to ensure that the thread's node is removed from the wait
     // queue, because FutexWake() probably didn't do that.
-    AutoLock lock(&lock_);
-    if (UnqueueNodeLocked(node)) {
+    Bucket* node_bucket = LockNodeBucket(node);
+    bool unqueued = UnqueueNodeLocked(node_bucket, node);
+    node_bucket->lock.Release();
+    if (unqueued) {
         return result;
     }
     // The current thread was not found on the wait queue.  This means
@@ -118,57 +209,47 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
-
-    FutexNode* node = futex_table_.erase(futex_key);
-    if (!node) {
-        // nothing blocked on this futex if we can't find it
-        return MX_OK;
-    }
-    DEBUG_ASSERT(node->GetKey() == futex_key);
-
-    FutexNode* wake_head = node;
-    node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
-    // node is now the new blocked thread list head
-
-    if (node != nullptr) {
-        DEBUG_ASSERT(node->GetKey() == futex_key);
-        futex_table_.insert(node);
-    }
+    Bucket* bucket = BucketFor(futex_key);
+    AutoLock lock(&bucket->lock);
 
     // Traversing this list of threads must be done while holding the
     // lock, because any of these threads might wake up from a timeout
     // and call FutexWait(), which would clobber the "next" pointer in
     // the thread's FutexNode.
-    FutexNode::WakeThreads(wake_head);
+    FutexNode::WakeThreads(DequeueNodesLocked(bucket, futex_key, count));
 
     return MX_OK;
 }
 
+// Both bucket locks are held by the BucketPairLock, which the analysis
+// cannot see through.
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return MX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
-
-    int value;
-    status_t result = wake_ptr.copy_from_user(&value);
-    if (result != MX_OK) return result;
-    if (value != current_value) return MX_ERR_BAD_STATE;
-
     uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
     uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return MX_ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return MX_ERR_INVALID_ARGS;
 
+    Bucket* wake_bucket = BucketFor(wake_key);
+    Bucket* requeue_bucket = BucketFor(requeue_key);
+    BucketPairLock lock(wake_bucket, requeue_bucket);
+
+    int value;
+    status_t result = wake_ptr.copy_from_user(&value);
+    if (result != MX_OK) return result;
+    if (value != current_value) return MX_ERR_BAD_STATE;
+
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
-    // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    // nodes below, because the bucket lookups look at the GetKey field of
+    // the list head nodes for wake_key and requeue_key.
+    FutexNode* node = EraseHeadLocked(wake_bucket, wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return MX_OK;
@@ -179,7 +260,7 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -192,38 +273,138 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_bucket, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_bucket->heads.push_front(node);
     }
 
     FutexNode::WakeThreads(wake_head);
     return MX_OK;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+// Both bucket locks are held by the BucketPairLock, which the analysis
+// cannot see through.
+status_t FutexContext::FutexWakeOp(user_ptr<const int> wake_ptr, uint32_t wake_count,
+                                   user_ptr<int> op_ptr, uint32_t op_count, uint32_t op)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    LTRACE_ENTRY;
+
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t op_key = reinterpret_cast<uintptr_t>(op_ptr.get());
+    if (wake_key % sizeof(int) || op_key % sizeof(int))
+        return MX_ERR_INVALID_ARGS;
 
-    FutexNode::HashTable::iterator iter;
+    // Validate the encoding before touching anything.
+    int new_value;
+    bool cmp_result;
+    if (!FutexOpApply(op, 0, &new_value) || !FutexOpCompare(op, 0, &cmp_result))
+        return MX_ERR_INVALID_ARGS;
+
+    Bucket* wake_bucket = BucketFor(wake_key);
+    Bucket* op_bucket = BucketFor(op_key);
+    BucketPairLock lock(wake_bucket, op_bucket);
+
+    // Holding the op_ptr bucket lock makes the update atomic with respect to
+    // FutexWait() on op_ptr, but other userspace threads may be modifying the
+    // value directly, so it still has to be a compare and exchange loop.
+    int old_value;
+    status_t result = op_ptr.copy_from_user(&old_value);
+    if (result != MX_OK) return result;
+    for (;;) {
+        FutexOpApply(op, old_value, &new_value);
+        int actual;
+        result = arch_cmpxchg_user(op_ptr.get(), old_value, new_value, &actual);
+        if (result != MX_OK) return result;
+        if (actual == old_value)
+            break;
+        old_value = actual;
+    }
+    FutexOpCompare(op, old_value, &cmp_result);
+
+    FutexNode::WakeThreads(DequeueNodesLocked(wake_bucket, wake_key, wake_count));
+    if (cmp_result)
+        FutexNode::WakeThreads(DequeueNodesLocked(op_bucket, op_key, op_count));
+
+    return MX_OK;
+}
+
+FutexContext::Bucket* FutexContext::LockNodeBucket(FutexNode* node) {
+    for (;;) {
+        // FutexRequeue() only changes the key of a queued node while holding
+        // the lock of the bucket it is moving from, so once we hold the lock
+        // for the key we read, the key is stable if it has not changed.
+        uintptr_t futex_key = node->GetKey();
+        Bucket* bucket = BucketFor(futex_key);
+        bucket->lock.Acquire();
+        if (node->GetKey() == futex_key)
+            return bucket;
+        bucket->lock.Release();
+    }
+}
 
-    // Attempt to insert this FutexNode into the hash table.  If the insert
-    // succeeds, then the current thread is first to block on this futex and we
-    // are finished.  If the insert fails, then there is already a thread
-    // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+// Removes the wait queue for |futex_key| from |bucket|, returning its head.
+FutexNode* FutexContext::EraseHeadLocked(Bucket* bucket, uintptr_t futex_key) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
+
+    return bucket->heads.erase_if([futex_key](const FutexNode& head) {
+        return head.GetKey() == futex_key;
+    });
+}
+
+// Removes up to |count| nodes from the head of the wait queue for
+// |futex_key|, returning them as a list for WakeThreads().
+FutexNode* FutexContext::DequeueNodesLocked(Bucket* bucket, uintptr_t futex_key,
+                                            uint32_t count) {
+    if (count == 0)
+        return nullptr;
+
+    FutexNode* node = EraseHeadLocked(bucket, futex_key);
+    if (!node) {
+        // nothing blocked on this futex if we can't find it
+        return nullptr;
+    }
+    DEBUG_ASSERT(node->GetKey() == futex_key);
+
+    FutexNode* wake_head = node;
+    node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key);
+    // node is now the new blocked thread list head
+
+    if (node != nullptr) {
+        DEBUG_ASSERT(node->GetKey() == futex_key);
+        bucket->heads.push_front(node);
+    }
+
+    return wake_head;
+}
+
+void FutexContext::QueueNodesLocked(Bucket* bucket, FutexNode* head) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
+
+    uintptr_t futex_key = head->GetKey();
+
+    // If there is already a thread waiting on this futex, add ourselves to
+    // that thread's list.  Otherwise, the current thread is first to block
+    // on this futex and becomes the head of its queue.
+    auto iter = bucket->heads.find_if([futex_key](const FutexNode& node) {
+        return node.GetKey() == futex_key;
+    });
+    if (iter.IsValid()) {
         iter->AppendList(head);
+    } else {
+        bucket->heads.push_front(head);
+    }
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Bucket* bucket, FutexNode* node) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -231,13 +412,14 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // Note: When UnqueueNode() is called from FutexWait(), it might be
     // tempting to reuse the futex key that was passed to FutexWait().
     // However, that could be out of date if the thread was requeued by
-    // FutexRequeue(), so we need to re-get the hash table key here.
+    // FutexRequeue(), so we need to re-get the key here.
     uintptr_t futex_key = node->GetKey();
+    DEBUG_ASSERT(BucketFor(futex_key) == bucket);
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = EraseHeadLocked(bucket, futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        bucket->heads.push_front(new_head);
     return true;
 }
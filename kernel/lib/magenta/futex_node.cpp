@@ -17,12 +17,17 @@ FutexNode::FutexNode() {
     LTRACE_ENTRY;
 
     wait_queue_ = WAIT_QUEUE_INITIAL_VALUE(wait_queue_);
+    list_initialize(&pi_waiters_);
 }
 
 FutexNode::~FutexNode() {
     LTRACE_ENTRY;
 
     DEBUG_ASSERT(!IsInQueue());
+    DEBUG_ASSERT(!list_in_list(&pi_link_.node));
+    // Waiters hold a reference to the owner's thread while lending it
+    // their priority, so none can be left.
+    DEBUG_ASSERT(list_is_empty(&pi_waiters_));
 
     THREAD_LOCK(state);
     wait_queue_destroy(&wait_queue_);
@@ -105,9 +110,13 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
 // This blocks the current thread.  This releases the given mutex (which
 // must be held when BlockThread() is called).  To reduce contention, it
 // does not reclaim the mutex on return.
-status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_SAFETY_ANALYSIS {
+status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline,
+                                FutexNode* pi_owner) TA_NO_THREAD_SAFETY_ANALYSIS {
     THREAD_LOCK(state);
 
+    if (pi_owner)
+        LinkPiLocked(pi_owner);
+
     // We specifically want reschedule=false here, otherwise the
     // combination of releasing the mutex and enqueuing the current thread
     // would not be atomic, which would mean that we could miss wakeups.
@@ -122,6 +131,9 @@ status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_S
     result = wait_queue_block(&wait_queue_, deadline);
     current_thread->interruptable = false;
 
+    // A wake unlinks us before waking us, but a timeout or kill does not.
+    UnlinkPiLocked();
+
     THREAD_UNLOCK(state);
 
     return result;
@@ -134,6 +146,9 @@ void FutexNode::WakeThreads(FutexNode* head) {
     do {
         FutexNode* next = node->queue_next_;
         THREAD_LOCK(state);
+        // Return the borrowed priority before the waiter can run, so that
+        // the waker does not keep it past handing the lock over.
+        node->UnlinkPiLocked();
         wait_queue_wake_one(&node->wait_queue_, true, MX_OK);
         THREAD_UNLOCK(state);
         node->MarkAsNotInQueue();
@@ -166,3 +181,44 @@ void FutexNode::MarkAsNotInQueue() {
     // only required by the assertion in IsInQueue().
     queue_prev_ = nullptr;
 }
+
+// Lend the current thread's priority to |owner|.  Inheritance is a single
+// level: if the owner is itself blocked on another PI futex, the priority it
+// lent was fixed when it blocked.
+void FutexNode::LinkPiLocked(FutexNode* owner) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(owner != this);
+    DEBUG_ASSERT(!list_in_list(&pi_link_.node));
+
+    pi_link_.owner = owner;
+    pi_link_.priority = thread_effective_priority(get_current_thread());
+    list_add_tail(&owner->pi_waiters_, &pi_link_.node);
+    owner->UpdateInheritedPriorityLocked();
+}
+
+void FutexNode::UnlinkPiLocked() {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (!list_in_list(&pi_link_.node))
+        return;
+
+    list_delete(&pi_link_.node);
+    FutexNode* owner = pi_link_.owner;
+    pi_link_.owner = nullptr;
+    pi_link_.priority = -1;
+    owner->UpdateInheritedPriorityLocked();
+}
+
+// Set our thread's inherited priority to the highest one lent by a waiter.
+void FutexNode::UpdateInheritedPriorityLocked() {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(thread_);
+
+    int priority = -1;
+    PiLink* waiter;
+    list_for_every_entry (&pi_waiters_, waiter, PiLink, node) {
+        if (waiter->priority > priority)
+            priority = waiter->priority;
+    }
+    thread_set_inherited_priority(thread_, priority);
+}
@@ -21,6 +21,8 @@
 
 class ChannelDispatcher final : public Dispatcher {
 public:
+    using MessageList = mxtl::DoublyLinkedList<mxtl::unique_ptr<MessagePacket>>;
+
     static status_t Create(uint32_t flags, mxtl::RefPtr<Dispatcher>* dispatcher0,
                            mxtl::RefPtr<Dispatcher>* dispatcher1, mx_rights_t* rights);
 
@@ -43,8 +45,20 @@ public:
                   mxtl::unique_ptr<MessagePacket>* msg,
                   bool may_disard);
 
+    // Read up to |max_msgs| messages from this endpoint's message queue into |msgs|, stopping at
+    // the first message that does not fit in what remains of |max_bytes| and |max_handles|.
+    // Returns MX_ERR_BUFFER_TOO_SMALL if not even the first message fits, in which case its size
+    // and handle count are returned in |next_size| and |next_handle_count| and it stays queued.
+    status_t ReadMany(uint32_t max_msgs, uint32_t max_bytes, uint32_t max_handles,
+                      MessageList* msgs, uint32_t* next_size, uint32_t* next_handle_count);
+
     // Write to the opposing endpoint's message queue.
     status_t Write(mxtl::unique_ptr<MessagePacket> msg);
+
+    // Write all of |msgs| to the opposing endpoint's message queue, in order, taking its lock
+    // once. On failure, no message has been written and |msgs| is left untouched.
+    status_t WriteMany(MessageList* msgs);
+
     status_t Call(mxtl::unique_ptr<MessagePacket> msg,
                   mx_time_t deadline, bool* return_handles,
                   mxtl::unique_ptr<MessagePacket>* reply);
@@ -129,7 +143,6 @@ public:
     };
 
 private:
-    using MessageList = mxtl::DoublyLinkedList<mxtl::unique_ptr<MessagePacket>>;
     using WaiterList = mxtl::DoublyLinkedList<MessageWaiter*>;
 
     void RemoveWaiter(MessageWaiter* waiter);
@@ -137,6 +150,10 @@ private:
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    status_t WritePagedSelf(mxtl::unique_ptr<MessagePacket>* msg, int* woken);
+    int WriteSelfMany(MessageList* msgs);
+    int DeliverLocked(mxtl::unique_ptr<MessagePacket> msg, bool* queued) TA_REQ(lock_);
+    mxtl::unique_ptr<MessagePacket> PopMessageLocked() TA_REQ(lock_);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -144,8 +161,13 @@ private:
 
     Mutex lock_;
     MessageList messages_ TA_GUARDED(lock_);
+    // Bytes of data held by the paged messages in |messages_|, which writes
+    // may not take past kMaxPagedBytes.
+    uint64_t paged_bytes_ TA_GUARDED(lock_) = 0u;
     WaiterList waiters_ TA_GUARDED(lock_);
     StateTracker state_tracker_;
     mxtl::RefPtr<ChannelDispatcher> other_ TA_GUARDED(lock_);
     mx_koid_t other_koid_ TA_GUARDED(lock_);
+
+    static constexpr uint64_t kMaxPagedBytes = 4u * kMaxPagedMessageSize;
 };
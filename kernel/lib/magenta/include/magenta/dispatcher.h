@@ -45,6 +45,7 @@ DECLARE_DISPTAG(FifoDispatcher, MX_OBJ_TYPE_FIFO)
 DECLARE_DISPTAG(HypervisorDispatcher, MX_OBJ_TYPE_HYPERVISOR)
 DECLARE_DISPTAG(GuestDispatcher, MX_OBJ_TYPE_GUEST)
 DECLARE_DISPTAG(TimerDispatcher, MX_OBJ_TYPE_TIMER)
+DECLARE_DISPTAG(WaitSetDispatcher, MX_OBJ_TYPE_WAIT_SET)
 
 
 #undef DECLARE_DISPTAG
@@ -60,7 +61,8 @@ public:
 
     mx_koid_t get_koid() const { return koid_; }
 
-    // Updating |handle_count_| is done at the magenta handle management layer.
+    // Updating |handle_count_| is done at the magenta handle management layer,
+    // with atomic operations.
     uint32_t* get_handle_count_ptr() { return &handle_count_; }
 
     // Interface for derived classes.
@@ -16,6 +16,9 @@
 
 #include <mxtl/canary.h>
 #include <mxtl/ref_counted.h>
+#include <mxtl/ref_ptr.h>
+
+class VmObject;
 
 typedef mx_status_t (*fifo_copy_from_fn_t)(const uint8_t* ptr, uint8_t* data, size_t len);
 typedef mx_status_t (*fifo_copy_to_fn_t)(uint8_t* ptr, const uint8_t* data, size_t len);
@@ -41,9 +44,29 @@ public:
     mx_status_t WriteFromUser(const uint8_t* src, size_t len, uint32_t* actual);
     mx_status_t ReadToUser(uint8_t* dst, size_t len, uint32_t* actual);
 
+    // For MX_FIFO_SHARED_RING fifos, where the entries live in a vmo mapped
+    // by both sides and the kernel only tracks signals. GetRing() returns the
+    // dispatcher of the vmo, shared by both endpoints, and the rights handles
+    // to it get. Notify() updates the signals of both endpoints from its
+    // indices.
+    mx_status_t GetRing(mxtl::RefPtr<Dispatcher>* dispatcher, mx_rights_t* rights);
+    mx_status_t Notify();
+
 private:
+    // State shared by the endpoints of a MX_FIFO_SHARED_RING fifo.
+    struct Ring : public mxtl::RefCounted<Ring> {
+        // Serializes signal updates from the two sides, so that a stale view
+        // of the indices can never overwrite a newer one.
+        Mutex lock;
+        mxtl::RefPtr<VmObject> vmo;
+        mxtl::RefPtr<Dispatcher> vmo_dispatcher;
+    };
+
     FifoDispatcher(uint32_t elem_count, uint32_t elem_size, uint32_t options);
-    mx_status_t Init(mxtl::RefPtr<FifoDispatcher> other);
+    mx_status_t Init(mxtl::RefPtr<FifoDispatcher> other, mxtl::RefPtr<Ring> ring,
+                     uint32_t ring_index);
+    static mx_status_t CreateRing(uint32_t elem_count, uint32_t elem_size,
+                                  mxtl::RefPtr<Ring>* ring);
     mx_status_t Write(const uint8_t* ptr, size_t len, uint32_t* actual,
                       fifo_copy_from_fn_t copy_from_fn);
     mx_status_t WriteSelf(const uint8_t* ptr, size_t len, uint32_t* actual,
@@ -67,5 +90,10 @@ private:
     uint32_t tail_ TA_GUARDED(lock_);
     uint8_t* data_ TA_GUARDED(lock_);
 
+    // Set only in MX_FIFO_SHARED_RING mode, fixed after Init().
+    mxtl::RefPtr<Ring> ring_;
+    // Index of the ring in the shared header that this endpoint reads.
+    uint32_t ring_index_;
+
     static constexpr uint32_t kMaxSizeBytes = PAGE_SIZE;
 };
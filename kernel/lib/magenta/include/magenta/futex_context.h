@@ -10,19 +10,24 @@
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
+#include <mxtl/intrusive_single_list.h>
+
+class UserThread;
 
 // FutexContext is a class that encapsulates support for futex operations.
-// FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
-// to contain all active futexes.
+// FutexContext hashes the futex address (a pointer to integer in userspace)
+// into one of a fixed number of buckets, each with its own lock and its own
+// list of active futexes, so that operations on unrelated futexes do not
+// contend with each other.
 // A futex is considered active if there is one or more threads blocked on the futex.
-// After no threads are left blocked on a futex it is removed from the hash table.
-// The value in the futex hash table is the FutexNode object associated with the head
+// After no threads are left blocked on a futex it is removed from its bucket.
+// The entry in the bucket is the FutexNode object associated with the head
 // of the list of threads blocked on the futex.
 // To avoid memory allocation at futex operation time, a FutexNode is embedded in each
 // UserThread object.
 // When the thread at the head of the futex's blocked thread list is resumed,
-// The FutexNode for the new head of the blocked thread list is set as the hash table value
-// for the futex.
+// The FutexNode for the new head of the blocked thread list takes its place
+// in the bucket.
 class FutexContext {
 public:
     FutexContext();
@@ -35,6 +40,13 @@ public:
     // on the same |value_ptr| futex.
     status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline);
 
+    // FutexWaitPi is FutexWait for a futex that implements a lock held by
+    // |owner|. While the current thread is blocked, |owner| runs at no lower
+    // than the current thread's priority. A null |owner| makes this a plain
+    // FutexWait.
+    status_t FutexWaitPi(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                         mx_time_t deadline);
+
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
     status_t FutexWake(user_ptr<const int> value_ptr, uint32_t count);
 
@@ -47,18 +59,50 @@ public:
     status_t FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
                           user_ptr<int> requeue_ptr, uint32_t requeue_count);
 
+    // FutexWakeOp atomically applies the operation encoded in |op| (see
+    // MX_FUTEX_OP) to the integer pointed to by |op_ptr|. It then wakes up to
+    // |wake_count| threads blocked on the |wake_ptr| futex and, if the old
+    // value of |op_ptr| passes the comparison encoded in |op|, up to
+    // |op_count| threads blocked on the |op_ptr| futex.
+    status_t FutexWakeOp(user_ptr<const int> wake_ptr, uint32_t wake_count,
+                         user_ptr<int> op_ptr, uint32_t op_count, uint32_t op);
+
 private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kNumBuckets = 64;
+
+    struct Bucket {
+        // protects heads
+        Mutex lock;
+
+        // Key is futex address, value is the FutexNode for the head of
+        // futex's blocked thread list.
+        mxtl::SinglyLinkedList<FutexNode*> heads TA_GUARDED(lock);
+    };
+
+    // Holds the locks of the buckets of two futexes, which may be the same
+    // bucket, taking them in a consistent order.
+    class BucketPairLock;
+
+    Bucket* BucketFor(uintptr_t futex_key);
+
+    // Acquires the lock of the bucket of the futex |node| is queued on,
+    // which a concurrent FutexRequeue may be changing.
+    Bucket* LockNodeBucket(FutexNode* node) TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    status_t WaitInternal(user_ptr<int> value_ptr, int current_value, FutexNode* pi_owner,
+                          mx_time_t deadline);
+
+    FutexNode* EraseHeadLocked(Bucket* bucket, uintptr_t futex_key) TA_REQ(bucket->lock);
+
+    FutexNode* DequeueNodesLocked(Bucket* bucket, uintptr_t futex_key, uint32_t count)
+        TA_REQ(bucket->lock);
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    void QueueNodesLocked(Bucket* bucket, FutexNode* head) TA_REQ(bucket->lock);
 
-    // protects futex_table_
-    Mutex lock_;
+    bool UnqueueNodeLocked(Bucket* bucket, FutexNode* node) TA_REQ(bucket->lock);
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    Bucket buckets_[kNumBuckets];
 };
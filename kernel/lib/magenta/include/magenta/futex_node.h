@@ -11,14 +11,12 @@
 #include <kernel/wait.h>
 #include <list.h>
 #include <magenta/types.h>
-#include <mxtl/intrusive_hash_table.h>
+#include <mxtl/intrusive_single_list.h>
 
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a UserThread Instance
 class FutexNode : public mxtl::SinglyLinkedListable<FutexNode*> {
 public:
-    using HashTable = mxtl::HashTable<uintptr_t, FutexNode*>;
-
     FutexNode();
     ~FutexNode();
 
@@ -39,7 +37,9 @@ public:
                                      uintptr_t new_hash_key);
 
     // This must be called with |mutex| held and returns without |mutex| held.
-    status_t BlockThread(Mutex* mutex, mx_time_t deadline) TA_REL(mutex);
+    // If |pi_owner| is not null, the owner inherits the priority of the
+    // current thread for as long as it stays blocked here.
+    status_t BlockThread(Mutex* mutex, mx_time_t deadline, FutexNode* pi_owner) TA_REL(mutex);
 
     // wakes the list of threads starting with node |head|
     static void WakeThreads(FutexNode* head);
@@ -48,9 +48,11 @@ public:
         hash_key_ = key;
     }
 
-    // Trait implementation for mxtl::HashTable
+    // The futex address this node is waiting on, or last waited on.
     uintptr_t GetKey() const { return hash_key_; }
-    static size_t GetHash(uintptr_t key) { return (key >> 3); }
+
+    // Which thread this node belongs to, for priority inheritance.
+    void set_thread(thread_t* thread) { thread_ = thread; }
 
 private:
     static void RelinkAsAdjacent(FutexNode* node1, FutexNode* node2);
@@ -58,13 +60,18 @@ private:
 
     void MarkAsNotInQueue();
 
+    // Priority inheritance. These must be called with the thread lock held.
+    void LinkPiLocked(FutexNode* owner);
+    void UnlinkPiLocked();
+    void UpdateInheritedPriorityLocked();
+
     // hash_key_ contains the futex address.  This field has two roles:
     //  * It is used by FutexWait() to determine which queue to remove the
-    //    thread from when a wait operation times out.
+    //    thread from when a wait operation times out, and which bucket
+    //    lock to take to synchronize with the thread that woke it.
     //  * Additionally, when this FutexNode is the head of a futex wait
-    //    queue, this field is used by the HashTable (because it uses
-    //    intrusive SinglyLinkedLists).
-    uintptr_t hash_key_;
+    //    queue, it is used to find the queue in its FutexContext bucket.
+    uintptr_t hash_key_ = 0u;
 
     // Used for waking the thread corresponding to the FutexNode.
     wait_queue_t wait_queue_;
@@ -76,4 +83,20 @@ private:
     //  * When the thread is not waiting on a futex, queue_next_ is null.
     FutexNode* queue_prev_ = nullptr;
     FutexNode* queue_next_ = nullptr;
+
+    // The thread this node is embedded alongside.
+    thread_t* thread_ = nullptr;
+
+    // While blocked in a priority inheritance wait, pi_link_ sits in the
+    // pi_waiters_ list of the owner's node.  Kept in its own struct so that
+    // the list can be walked with containerof().  Guarded by the thread lock.
+    struct PiLink {
+        list_node node = LIST_INITIAL_CLEARED_VALUE;
+        // the node of the thread being lent our priority
+        FutexNode* owner = nullptr;
+        // the priority we lent
+        int priority = -1;
+    };
+    PiLink pi_link_;
+    list_node pi_waiters_;
 };
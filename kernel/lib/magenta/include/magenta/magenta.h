@@ -8,6 +8,8 @@
 
 #include <stdint.h>
 
+#include <kernel/spinlock.h>
+
 #include <magenta/handle.h>
 #include <magenta/syscalls/resource.h>
 #include <magenta/types.h>
@@ -36,6 +38,20 @@ void DeleteHandle(Handle* handle);
 // Maps an integer obtained by Handle->base_value() back to a Handle.
 Handle* MapU32ToHandle(uint32_t value);
 
+// Brackets a lookup that uses a Handle without holding the handle table lock
+// of the process that owns it. Handles found through MapU32ToHandle() whose
+// process_id() matches can be used in between: DeleteHandle() only tears a
+// handle down once all such lookups in progress have finished. Interrupts are
+// disabled in between, so the lookup must be short and must not block.
+// The section ends on the cpu it was begun on, even if the thread faults and
+// moves in between.
+struct HandleReadState {
+    spin_lock_saved_state_t irq_state;
+    uint cpu;
+};
+HandleReadState BeginHandleRead();
+void EndHandleRead(HandleReadState state);
+
 // Set/get the system exception port.
 mx_status_t SetSystemExceptionPort(mxtl::RefPtr<ExceptionPort> eport);
 // Returns true if a port had been set.
@@ -44,6 +60,11 @@ mxtl::RefPtr<ExceptionPort> GetSystemExceptionPort();
 
 mxtl::RefPtr<JobDispatcher> GetRootJobDispatcher();
 
+// Returns the event asserting MX_EVENT_SIGNALED while the memory pressure is
+// at or above the level named by |kind|, one of MX_SYSTEM_EVENT_*, or null
+// for any other |kind|.
+mxtl::RefPtr<Dispatcher> GetMemoryPressureEvent(uint32_t kind);
+
 PolicyManager* GetSystemPolicyManager();
 
 bool magenta_rights_check(const Handle* handle, mx_rights_t desired);
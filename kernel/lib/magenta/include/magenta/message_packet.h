@@ -6,22 +6,28 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdint.h>
 
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/types.h>
 #include <mxtl/intrusive_double_list.h>
+#include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 64u;
+constexpr uint32_t kMaxPagedMessageSize = 16u * 1024u * 1024u;
 
 // ensure public constants are aligned
 static_assert(MX_CHANNEL_MAX_MSG_BYTES == kMaxMessageSize, "");
 static_assert(MX_CHANNEL_MAX_MSG_HANDLES == kMaxMessageHandles, "");
+static_assert(MX_CHANNEL_MAX_PAGED_MSG_BYTES == kMaxPagedMessageSize, "");
 
 class Handle;
 
+class VmObject;
+
 class MessagePacket : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<MessagePacket>> {
 public:
     // Creates a message packet containing the provided data and space for
@@ -34,11 +40,35 @@ public:
                               uint32_t num_handles,
                               mxtl::unique_ptr<MessagePacket>* msg);
 
+    // Creates a message packet whose data is held in whole pages rather than
+    // copied into the packet. |data| and |data_size| must be page aligned.
+    // When the range is backed by a single writable mapping of a vmo, its
+    // pages are moved out of the vmo, leaving the range reading back as
+    // zeros unless ReturnPages() puts them back;
+    // otherwise the data is copied into newly allocated pages.
+    static mx_status_t CreatePaged(user_ptr<const void> data, uint32_t data_size,
+                                   uint32_t num_handles,
+                                   mxtl::unique_ptr<MessagePacket>* msg);
+
     uint32_t data_size() const { return data_size_; }
+    bool paged() const { return paged_; }
+
+    // Moves pages that CreatePaged() took from the sender's vmo back into the
+    // parts of it that have not been committed again since. Used when the
+    // packet could not be written.
+    void ReturnPages();
+
+    // Drops the record of where the pages came from, once the packet has been
+    // queued and the move is final.
+    void ClearPageSource();
 
-    // Copies the packet's |data_size()| bytes to |buf|.
+    // Copies the packet's |data_size()| bytes to |buf|. The pages of a paged
+    // packet are instead moved into the vmo backing |buf| when possible, so
+    // this may only be called once.
     // Returns an error if |buf| points to a bad user address.
-    mx_status_t CopyDataTo(user_ptr<void> buf) const {
+    mx_status_t CopyDataTo(user_ptr<void> buf) {
+        if (unlikely(paged_))
+            return CopyPagesTo(buf);
         return buf.copy_array_to_user(data(), data_size_);
     }
 
@@ -53,24 +83,28 @@ public:
     mx_txid_t get_txid() const {
         if (data_size_ < sizeof(mx_txid_t)) {
             return 0;
+        } else if (unlikely(paged_)) {
+            return paged_txid();
         } else {
             return *(reinterpret_cast<const mx_txid_t*>(data()));
         }
     }
 
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles,
+                  bool paged);
     ~MessagePacket();
 
     // Allocates a new packet that can hold the specified amount of
-    // data/handles.
-    static mx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
+    // data/handles. The data of a |paged| packet lives in |pages_| instead.
+    static mx_status_t NewPacket(uint32_t data_size, uint32_t num_handles, bool paged,
                                  mxtl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    mx_status_t CopyPagesTo(user_ptr<void> buf);
+    mx_txid_t paged_txid() const;
+
+    // Create() uses MessagePacketAllocator, so we must delete through it.
+    static void operator delete(void* ptr);
     friend class mxtl::unique_ptr<MessagePacket>;
 
     // Handles and data are stored in the same buffer: num_handles_ Handle*
@@ -81,4 +115,13 @@ private:
     const uint32_t data_size_;
     const uint16_t num_handles_;
     bool owns_handles_;
+    const bool paged_;
+
+    // The data of a paged packet, in order.
+    list_node pages_;
+
+    // The vmo and offset that |pages_| were taken from, until the packet is
+    // queued.
+    mxtl::RefPtr<VmObject> page_source_;
+    uint64_t page_source_offset_ = 0u;
 };
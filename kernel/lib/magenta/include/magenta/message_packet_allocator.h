@@ -0,0 +1,39 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/syscalls/object.h>
+
+// Size-classed slab allocator for MessagePacket storage.
+//
+// Each size class is backed by its own mxtl::Arena, and every cpu keeps a
+// small magazine of free slots per class in front of it, so that the common
+// case of allocating and freeing small channel messages only disables
+// interrupts on the local cpu and never takes a lock. Magazines are refilled
+// from and drained to the arena in batches.
+//
+// Requests larger than the biggest size class fall back to the kernel heap.
+namespace MessagePacketAllocator {
+
+// Number of slab size classes.
+constexpr size_t kNumSizeClasses = MX_INFO_KMEM_CHANNEL_CLASSES;
+
+// Returns storage for |size| bytes, or nullptr if out of memory.
+void* Alloc(size_t size);
+
+// Returns storage obtained from Alloc().
+void Free(void* ptr);
+
+// Fills |classes| with the per size class statistics and |heap_bytes| with the
+// number of bytes currently held by messages too large for any class.
+void GetStats(mx_info_kmem_channel_class_t classes[kNumSizeClasses],
+              uint64_t* heap_bytes);
+
+} // namespace MessagePacketAllocator
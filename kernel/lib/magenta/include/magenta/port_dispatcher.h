@@ -15,6 +15,7 @@
 #include <magenta/types.h>
 #include <magenta/wait_event.h>
 
+#include <mxtl/atomic.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/unique_ptr.h>
@@ -86,6 +87,13 @@ struct PortPacket final : public mxtl::DoublyLinkedListable<PortPacket*> {
     mx_port_packet_t packet;
     PortObserver* observer;
 
+    // True from the moment a producer claims the packet in Queue() until a
+    // consumer has copied it out. Packets can be queued without holding the
+    // port lock, so this, and not InContainer(), tells if a packet is pending.
+    mxtl::atomic_int queued;
+    // Link in the port's lock-free |inbox_|.
+    PortPacket* inbox_next;
+
     PortPacket();
     PortPacket(const PortPacket&) = delete;
     void operator=(PortPacket) = delete;
@@ -146,6 +154,12 @@ public:
     mx_status_t QueueUser(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t deadline, mx_port_packet_t* packet);
 
+    // Dequeues up to |max| packets into |packets|, blocking until |deadline|
+    // for the first one. After that, keeps collecting packets as they arrive
+    // for up to |coalesce| nanoseconds, but never past |deadline|.
+    mx_status_t DeQueueMany(mx_time_t deadline, mx_duration_t coalesce,
+                            mx_port_packet_t* packets, size_t max, size_t* actual);
+
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
     bool CanReap(PortObserver* observer, PortPacket* port_packet);
@@ -164,6 +178,19 @@ private:
     PortDispatcher(uint32_t options);
     PortObserver* CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) TA_REQ(lock_);
 
+    // Moves everything pushed onto |inbox_| so far to the tail of |packets_|,
+    // in the order it was queued.
+    void DrainInboxLocked() TA_REQ(lock_);
+
+    // Dequeues the oldest packet, if any, without blocking. Returns false if
+    // the port is empty.
+    bool TryDeQueue(mx_port_packet_t* packet);
+
+    // Dequeues up to |max| packets without blocking, holding |lock_| once for
+    // all of them. Returns the number dequeued. |packets| may only be null if
+    // |max| is 1.
+    size_t TryDeQueueMany(mx_port_packet_t* packets, size_t max);
+
     // Adopts a RefPtr to |eport|, and adds it to |eports_|.
     // Called by ExceptionPort.
     void LinkExceptionPort(ExceptionPort* eport);
@@ -174,9 +201,16 @@ private:
     void UnlinkExceptionPort(ExceptionPort* eport);
 
     mxtl::Canary<mxtl::magic("POR2")> canary_;
+    // Queue() never takes |lock_|: producers push packets onto |inbox_|, a
+    // lock-free LIFO stack, and only wake |sema_| when a consumer has
+    // announced itself in |waiters_|. Consumers, serialized by |lock_|, move
+    // the inbox in FIFO order onto |packets_| before dequeuing from it.
     Mutex lock_;
     Semaphore sema_;
-    bool zero_handles_ TA_GUARDED(lock_);
+    mxtl::atomic_int zero_handles_;
+    // A PortPacket*, mxtl::atomic only supports integral types.
+    mxtl::atomic_uintptr_t inbox_;
+    mxtl::atomic_int waiters_;
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<mxtl::RefPtr<ExceptionPort>> eports_ TA_GUARDED(lock_);
 };
@@ -277,6 +277,11 @@ private:
     mx_status_t GetDispatcherInternal(mx_handle_t handle_value, mxtl::RefPtr<Dispatcher>* dispatcher,
                                       mx_rights_t* rights);
 
+    // Looks up |handle_value| without taking |handle_table_lock_|. Returns
+    // false if it is not a valid handle of this process.
+    bool GetDispatcherNoLock(mx_handle_t handle_value,
+                             mxtl::RefPtr<Dispatcher>* dispatcher, mx_rights_t* rights);
+
     mx_status_t GetDispatcherWithRightsInternal(mx_handle_t handle_value, mx_rights_t desired_rights,
                                                 mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                 mx_rights_t* out_rights);
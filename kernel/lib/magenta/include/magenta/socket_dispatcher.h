@@ -20,10 +20,13 @@
 #include <mxtl/intrusive_single_list.h>
 #include <mxtl/ref_counted.h>
 
+#include <list.h>
+
 class VmMapping;
 class VmObject;
+struct vm_page;
 
-constexpr int kMBufHeaderSize = 8 + (4 * 4);
+constexpr int kMBufHeaderSize = 8 + (4 * 4) + 8;
 
 constexpr int kMBufSize = 2048 - 16;
 
@@ -48,16 +51,48 @@ public:
     // Socket methods.
     mx_status_t Write(user_ptr<const void> src, size_t len, size_t* written);
 
+    // Writes the contents of |count| user buffers as if they were one. In
+    // datagram mode they form a single packet.
+    mx_status_t WriteVector(const mx_iovec_t* iov, size_t count, size_t* written);
+
     status_t HalfClose();
 
     mx_status_t Read(user_ptr<void> dst, size_t len, size_t* nread);
 
+    // Reads into |count| user buffers, filling each before moving on to the
+    // next. In datagram mode at most one packet is read.
+    mx_status_t ReadVector(const mx_iovec_t* iov, size_t count, size_t* nread);
+
     void OnPeerZeroHandles();
 
 private:
-    // An MBuf is a small fixed-size chainable memory buffer.
+    // Walks an array of user buffers as one run of bytes.
+    class IovecCursor {
+    public:
+        IovecCursor(const mx_iovec_t* iov, size_t count) : iov_(iov), count_(count) {}
+
+        // Copy |len| bytes from/to the user buffers at the current position
+        // and advance past them. On failure the position is left where it
+        // was, even if some of the bytes were copied.
+        mx_status_t CopyFrom(void* dst, size_t len);
+        mx_status_t CopyTo(const void* src, size_t len);
+
+    private:
+        const mx_iovec_t* const iov_;
+        const size_t count_;
+        size_t index_ = 0;
+        size_t offset_ = 0;
+    };
+
+    // An MBuf is a small fixed-size chainable memory buffer. Large stream
+    // writes instead point MBufs at whole pages, in which case |data_| is
+    // unused.
     struct MBuf : public mxtl::SinglyLinkedListable<MBuf*> {
+        ~MBuf();
+
         size_t rem() const;
+        size_t capacity() const;
+        char* buf();
 
         uint32_t off_ = 0u;
         uint32_t len_ = 0u;
@@ -68,20 +103,23 @@ private:
         // Always 0 in MX_SOCKET_STREAM mode.
         uint32_t pkt_len_ = 0u;
         uint32_t unused;
+        vm_page* page_ = nullptr;
         char data_[kMBufDataSize] = {0};
-        // TODO: maybe union data_ with char* blocks for large messages
     };
     static_assert(sizeof(MBuf) == kMBufSize, "");
 
     SocketDispatcher(uint32_t flags);
     mx_status_t Init(mxtl::RefPtr<SocketDispatcher> other);
-    mx_status_t WriteSelf(user_ptr<const void> src, size_t len, size_t* nwritten);
+    mx_status_t WriteSelf(IovecCursor* src, size_t len, size_t* nwritten);
+    mx_status_t ReadInternal(IovecCursor* dst, size_t len, size_t* nread);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     status_t HalfCloseOther();
 
-    mx_status_t WriteStreamMBufsLocked(user_ptr<const void> src, size_t len, size_t* written) TA_REQ(lock_);
-    mx_status_t WriteDgramMBufsLocked(user_ptr<const void> src, size_t len, size_t* written) TA_REQ(lock_);
-    size_t ReadMBufsLocked(user_ptr<void> dst, size_t len) TA_REQ(lock_);
+    size_t FillPages(IovecCursor* src, size_t len, list_node* pages);
+    size_t LinkPagesLocked(list_node* pages) TA_REQ(lock_);
+    mx_status_t WriteStreamMBufsLocked(IovecCursor* src, size_t len, size_t* written) TA_REQ(lock_);
+    mx_status_t WriteDgramMBufsLocked(IovecCursor* src, size_t len, size_t* written) TA_REQ(lock_);
+    size_t ReadMBufsLocked(IovecCursor* dst, size_t len) TA_REQ(lock_);
     MBuf* AllocMBuf() TA_REQ(lock_);
     void FreeMBuf(MBuf* buf) TA_REQ(lock_);
     bool is_full() const TA_REQ(lock_);
@@ -103,6 +103,14 @@ public:
     void get_name(char out_name[MX_MAX_NAME_LEN]);
     uint64_t runtime_ns() const { return thread_runtime(&thread_); }
 
+    // Deadline scheduling class, see thread_set_deadline().
+    status_t SetDeadline(mx_duration_t budget, mx_duration_t period) {
+        return thread_set_deadline(&thread_, budget, period);
+    }
+    void GetDeadline(mx_duration_t* budget, mx_duration_t* period) {
+        thread_get_deadline(&thread_, budget, period);
+    }
+
     status_t SetExceptionPort(ThreadDispatcher* td, mxtl::RefPtr<ExceptionPort> eport);
     // Returns true if a port had been set.
     bool ResetExceptionPort(bool quietly);
@@ -0,0 +1,126 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <kernel/mutex.h>
+
+#include <magenta/dispatcher.h>
+#include <magenta/state_observer.h>
+#include <magenta/types.h>
+#include <magenta/wait_event.h>
+
+#include <mxtl/canary.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/intrusive_wavl_tree.h>
+#include <mxtl/ref_ptr.h>
+#include <mxtl/unique_ptr.h>
+
+class Handle;
+class WaitSetDispatcher;
+
+// One handle watched by a wait set. Unlike a WaitStateObserver, which only
+// lives for the duration of a wait syscall, an entry stays on the state
+// tracker of the watched object from mx_waitset_add() until
+// mx_waitset_remove() or until the wait set loses its last handle, and keeps
+// the wait set's list of ready entries up to date as the object's signals
+// change.
+class WaitSetEntry final : public StateObserver,
+                           public mxtl::WAVLTreeContainable<mxtl::unique_ptr<WaitSetEntry>>,
+                           public mxtl::DoublyLinkedListable<WaitSetEntry*> {
+public:
+    WaitSetEntry(WaitSetDispatcher* wait_set, uint64_t cookie, mx_signals_t watched_signals);
+    ~WaitSetEntry();
+
+    uint64_t GetKey() const { return cookie_; }
+
+private:
+    friend class WaitSetDispatcher;
+
+    WaitSetEntry(const WaitSetEntry&) = delete;
+    WaitSetEntry& operator=(const WaitSetEntry&) = delete;
+
+    // StateObserver implementation:
+    Flags OnInitialize(mx_signals_t initial_state, const StateObserver::CountInfo* cinfo) final;
+    Flags OnStateChange(mx_signals_t new_state) final;
+    Flags OnCancel(Handle* handle) final;
+
+    mxtl::Canary<mxtl::magic("WSEN")> canary_;
+
+    WaitSetDispatcher* const wait_set_;
+    const uint64_t cookie_;
+    const mx_signals_t watched_signals_;
+
+    // Only compared against, and cleared once the handle goes away. Guarded
+    // by the watched object's state tracker lock.
+    Handle* handle_ = nullptr;
+
+    // Non-null while the entry is attached to the watched object.
+    mxtl::RefPtr<Dispatcher> dispatcher_;
+
+    // Guarded by the wait set's |lock_|.
+    mx_signals_t observed_ = 0u;
+    bool handle_closed_ = false;
+    bool ready_ = false;
+};
+
+class WaitSetDispatcher final : public Dispatcher {
+public:
+    static status_t Create(uint32_t options,
+                           mxtl::RefPtr<Dispatcher>* dispatcher,
+                           mx_rights_t* rights);
+
+    ~WaitSetDispatcher() final;
+    mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_WAIT_SET; }
+
+    void on_zero_handles() final;
+
+    // Starts watching |handle| for |signals|, reporting it as |cookie|.
+    // Called under the handle table lock.
+    mx_status_t AddEntry(Handle* handle, mx_signals_t signals, uint64_t cookie);
+
+    // Stops watching the handle added as |cookie|.
+    mx_status_t RemoveEntry(uint64_t cookie);
+
+    // Blocks until at least one entry is ready or |deadline| passes, then
+    // copies up to |max| ready entries into |results|. Entries that do not
+    // fit are returned first by the next call.
+    mx_status_t Wait(mx_time_t deadline, mx_waitset_result_t* results, uint32_t max,
+                     uint32_t* actual);
+
+private:
+    friend class WaitSetEntry;
+
+    WaitSetDispatcher();
+
+    // Called by entries with their state tracker lock held, so this must
+    // only take |lock_|.
+    StateObserver::Flags UpdateEntry(WaitSetEntry* entry, mx_signals_t state, bool handle_closed);
+
+    // Detaches |entry| from the object it watches and from |ready_|.
+    void DetachEntry(WaitSetEntry* entry);
+
+    mxtl::Canary<mxtl::magic("WSET")> canary_;
+
+    // Serializes adding and removing entries. Held while attaching entries
+    // to, and detaching them from, the state trackers of the watched
+    // objects, so it must never be taken by an entry's callbacks.
+    Mutex entries_lock_;
+    mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<WaitSetEntry>> entries_ TA_GUARDED(entries_lock_);
+    bool zero_handles_ TA_GUARDED(entries_lock_) = false;
+
+    // Guards the list of ready entries. Taken by the entries' callbacks with
+    // the state tracker locks of the watched objects held.
+    Mutex lock_;
+    mxtl::DoublyLinkedList<WaitSetEntry*> ready_ TA_GUARDED(lock_);
+    size_t num_ready_ TA_GUARDED(lock_) = 0u;
+    bool cancelled_ TA_GUARDED(lock_) = false;
+
+    // Signaled while |ready_| is not empty or the wait set is cancelled.
+    WaitEvent event_;
+};
@@ -9,15 +9,20 @@
 #include <pow2.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm/pmm.h>
 
 #include <lk/init.h>
 
 #include <lib/console.h>
+#include <lib/dpc.h>
 
 #include <magenta/dispatcher.h>
+#include <magenta/event_dispatcher.h>
 #include <magenta/excp_port.h>
 #include <magenta/job_dispatcher.h>
 #include <magenta/handle.h>
@@ -44,14 +49,77 @@ constexpr size_t kMaxHandleCount = 256 * 1024u;
 // there are this many outstanding handles.
 constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 
-// The handle arena and its mutex. It also guards Dispatcher::handle_count_.
+// Number of free handle slots each cpu may cache, and how many are moved
+// between a cache and the arena at a time.
+constexpr size_t kHandleCacheSize = 32u;
+constexpr size_t kHandleCacheBatch = kHandleCacheSize / 2;
+
+// Number of closed handles a cpu collects before it reclaims them itself.
+constexpr size_t kHandleRetireBatch = 32u;
+
+// The handle arena and its mutex.
 static Mutex handle_mutex;
 static mxtl::Arena TA_GUARDED(handle_mutex) handle_arena;
-static size_t outstanding_handles TA_GUARDED(handle_mutex) = 0u;
+// Slots handed out by the arena, whether they hold a live handle or sit in
+// a per-cpu cache.
+static size_t arena_handles TA_GUARDED(handle_mutex) = 0u;
+// One past the highest slot index the arena has ever handed out. The arena
+// never decommits data slots below it, so lock-free lookups may read any
+// slot under this bound. Written under |handle_mutex|, read without it.
+static uint32_t arena_slot_limit = 0u;
+
+// Per-cpu cache of free handle slots in front of |handle_arena|, so that
+// creating and destroying handles normally only disables interrupts on the
+// local cpu. Free slots keep their stashed base_value while cached, so the
+// generation scheme is unaffected.
+struct HandleCache {
+    void* slots[kHandleCacheSize];
+    size_t count;
+} __CPU_ALIGN;
+
+static HandleCache handle_caches[SMP_MAX_CPUS];
+
+// Per-cpu count of lock-free handle lookups, odd while one is in progress.
+struct HandleReadSeq {
+    uint32_t seq;
+} __CPU_ALIGN;
+
+static HandleReadSeq handle_read_seqs[SMP_MAX_CPUS];
+
+// Per-cpu list of closed handles whose slots cannot be torn down yet, since
+// a lock-free lookup may still be reading them. They are reclaimed in
+// batches, so that waiting out the lookups on every cpu is paid once per
+// batch rather than on every close. |handles| and |count| are protected by
+// |lock|.
+struct HandleRetireList {
+    SpinLock lock;
+    mxtl::DoublyLinkedList<Handle*> handles;
+    size_t count;
+} __CPU_ALIGN;
+
+static HandleRetireList handle_retire_lists[SMP_MAX_CPUS];
+
+// Reclaims what the cpus have collected when they go quiet before
+// filling a batch, so that closed handles do not keep their dispatchers
+// alive for long.
+static void HandleRetireRoutine(dpc_t* dpc);
+static dpc_t handle_retire_dpc = {
+    .node = LIST_INITIAL_CLEARED_VALUE,
+    .func = HandleRetireRoutine,
+    .arg = nullptr,
+};
 
 size_t internal::OutstandingHandles() {
-    AutoLock lock(&handle_mutex);
-    return outstanding_handles;
+    size_t handles;
+    {
+        AutoLock lock(&handle_mutex);
+        handles = arena_handles;
+    }
+    // Racy, but good enough for diagnostics.
+    size_t cached = 0u;
+    for (const auto& cache : handle_caches)
+        cached += cache.count;
+    return (handles > cached) ? handles - cached : 0u;
 }
 
 // The system exception port.
@@ -65,10 +133,47 @@ static mxtl::RefPtr<JobDispatcher> root_job;
 // a magenta internal class (not a dispatcher-derived).
 static PolicyManager* policy_manager;
 
+// Signaled while the memory pressure is at least warning and critical
+// respectively. Handed out without MX_RIGHT_WRITE, so only the kernel can
+// signal them.
+static mxtl::RefPtr<Dispatcher> memory_pressure_warning_event;
+static mxtl::RefPtr<Dispatcher> memory_pressure_critical_event;
+
+static void memory_pressure_callback(pmm_pressure_level level) {
+    memory_pressure_warning_event->user_signal(
+        level >= PMM_PRESSURE_WARNING ? 0u : MX_EVENT_SIGNALED,
+        level >= PMM_PRESSURE_WARNING ? MX_EVENT_SIGNALED : 0u, false);
+    memory_pressure_critical_event->user_signal(
+        level >= PMM_PRESSURE_CRITICAL ? 0u : MX_EVENT_SIGNALED,
+        level >= PMM_PRESSURE_CRITICAL ? MX_EVENT_SIGNALED : 0u, false);
+}
+
+static void memory_pressure_init() {
+    mx_rights_t rights;
+    mx_status_t status = EventDispatcher::Create(0u, &memory_pressure_warning_event, &rights);
+    ASSERT(status == MX_OK);
+    status = EventDispatcher::Create(0u, &memory_pressure_critical_event, &rights);
+    ASSERT(status == MX_OK);
+
+    pmm_set_pressure_callback(&memory_pressure_callback);
+}
+
+mxtl::RefPtr<Dispatcher> GetMemoryPressureEvent(uint32_t kind) {
+    switch (kind) {
+        case MX_SYSTEM_EVENT_MEMORY_PRESSURE_WARNING:
+            return memory_pressure_warning_event;
+        case MX_SYSTEM_EVENT_MEMORY_PRESSURE_CRITICAL:
+            return memory_pressure_critical_event;
+        default:
+            return nullptr;
+    }
+}
+
 void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
     handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
     root_job = JobDispatcher::CreateRootJob();
     policy_manager = PolicyManager::Create();
+    memory_pressure_init();
 }
 
 // Masks for building a Handle's base_value, which ProcessDispatcher
@@ -99,7 +204,9 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
 // Returns a new |base_value| based on the value stored in the free
 // |handle_arena| slot pointed to by |addr|. The new value will be different
 // from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
+// The arena's range is fixed after init, so it is safe to use without holding
+// |handle_mutex|.
+static uint32_t GetNewHandleBaseValue(void* addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     // Get the index of this slot within handle_arena.
     auto va = reinterpret_cast<Handle*>(addr) -
               reinterpret_cast<Handle*>(handle_arena.start());
@@ -147,36 +254,110 @@ void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
 }
 
 static void high_handle_count(size_t count) {
-    // TODO: Avoid calling this for every handle after kHighHandleCount;
+    // TODO: Avoid calling this for every batch after kHighHandleCount;
     // printfs are slow and |handle_mutex| is held by our caller.
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
-Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
-    uint32_t* handle_count = nullptr;
-    void* addr;
-    uint32_t base_value;
+// Fills |slots| with up to |count| slots from the arena, returning how many
+// were obtained.
+static size_t ArenaAllocHandles(void** slots, size_t count) {
+    AutoLock lock(&handle_mutex);
+    size_t i = 0;
+    uint32_t limit = arena_slot_limit;
+    for (; i < count; i++) {
+        slots[i] = handle_arena.Alloc();
+        if (slots[i] == nullptr)
+            break;
+        auto index = static_cast<uint32_t>(reinterpret_cast<Handle*>(slots[i]) -
+                                           reinterpret_cast<Handle*>(handle_arena.start()));
+        if (index >= limit)
+            limit = index + 1;
+    }
+    // Published after the slots are committed, so that a lookup which sees
+    // the new limit can read them.
+    __atomic_store_n(&arena_slot_limit, limit, __ATOMIC_RELEASE);
+    arena_handles += i;
+    if (i > 0 && arena_handles > kHighHandleCount)
+        high_handle_count(arena_handles);
+    return i;
+}
 
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-                   oh);
-            return nullptr;
-        }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
+static void ArenaFreeHandles(void** slots, size_t count) {
+    AutoLock lock(&handle_mutex);
+    for (size_t i = 0; i < count; i++)
+        handle_arena.Free(slots[i]);
+    arena_handles -= count;
+}
 
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
+// Returns a free handle slot, preferably from the local cpu's cache.
+static void* AllocHandleSlot() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache* cache = &handle_caches[arch_curr_cpu_num()];
+    if (likely(cache->count > 0)) {
+        void* addr = cache->slots[--cache->count];
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return addr;
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Refill from the arena. We may be on another cpu by the time the batch
+    // is stashed, in which case what does not fit goes back to the arena.
+    void* batch[kHandleCacheBatch];
+    size_t got = ArenaAllocHandles(batch, kHandleCacheBatch);
+    if (got == 0)
+        return nullptr;
+    void* addr = batch[--got];
 
-        base_value = GetNewHandleBaseValue(addr);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    cache = &handle_caches[arch_curr_cpu_num()];
+    while (got > 0 && cache->count < kHandleCacheSize)
+        cache->slots[cache->count++] = batch[--got];
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (got > 0)
+        ArenaFreeHandles(batch, got);
+    return addr;
+}
+
+// Returns a torn down handle slot to the local cpu's cache.
+static void FreeHandleSlot(void* addr) {
+    void* batch[kHandleCacheBatch];
+    size_t drained = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache* cache = &handle_caches[arch_curr_cpu_num()];
+    if (unlikely(cache->count == kHandleCacheSize)) {
+        while (drained < kHandleCacheBatch)
+            batch[drained++] = cache->slots[--cache->count];
     }
+    cache->slots[cache->count++] = addr;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (drained > 0)
+        ArenaFreeHandles(batch, drained);
+}
+
+// Counts a new handle to |dispatcher|. Returns the count pointer if the
+// MX_SIGNAL_LAST_HANDLE signal needs updating, nullptr otherwise.
+static uint32_t* IncrementHandleCount(Dispatcher* dispatcher) {
+    uint32_t* handle_count = dispatcher->get_handle_count_ptr();
+    if (__atomic_add_fetch(handle_count, 1u, __ATOMIC_RELAXED) != 2u)
+        return nullptr;
+    return handle_count;
+}
+
+Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
+    void* addr = AllocHandleSlot();
+    if (addr == nullptr) {
+        printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
+               internal::OutstandingHandles());
+        return nullptr;
+    }
+    uint32_t base_value = GetNewHandleBaseValue(addr);
+    uint32_t* handle_count = IncrementHandleCount(dispatcher.get());
 
     auto state_tracker = dispatcher->get_state_tracker();
     if (state_tracker != nullptr)
@@ -187,30 +368,15 @@ Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
 
 Handle* DupHandle(Handle* source, mx_rights_t rights, bool is_replace) {
     mxtl::RefPtr<Dispatcher> dispatcher(source->dispatcher());
-    uint32_t* handle_count;
-    void* addr;
-    uint32_t base_value;
-
-    {
-        AutoLock lock(&handle_mutex);
-        addr = handle_arena.Alloc();
-        if (addr == nullptr) {
-            const auto oh = outstanding_handles;
-            lock.release();
-            printf(
-                "WARNING: Could not allocate duplicate handle (%zu outstanding)\n", oh);
-            return nullptr;
-        }
-        if (++outstanding_handles > kHighHandleCount)
-            high_handle_count(outstanding_handles);
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)++;
-        if (*handle_count != 2u)
-            handle_count = nullptr;
 
-        base_value = GetNewHandleBaseValue(addr);
+    void* addr = AllocHandleSlot();
+    if (addr == nullptr) {
+        printf("WARNING: Could not allocate duplicate handle (%zu outstanding)\n",
+               internal::OutstandingHandles());
+        return nullptr;
     }
+    uint32_t base_value = GetNewHandleBaseValue(addr);
+    uint32_t* handle_count = IncrementHandleCount(dispatcher.get());
 
     auto state_tracker = dispatcher->get_state_tracker();
     if (!is_replace && (state_tracker != nullptr))
@@ -219,6 +385,97 @@ Handle* DupHandle(Handle* source, mx_rights_t rights, bool is_replace) {
     return new (addr) Handle(source, rights, base_value);
 }
 
+HandleReadState BeginHandleRead() {
+    HandleReadState state;
+    arch_interrupt_save(&state.irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
+    state.cpu = arch_curr_cpu_num();
+    uint32_t* seq = &handle_read_seqs[state.cpu].seq;
+    // Sequentially consistent so that the increment is visible before we
+    // read the handle's process_id.
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_SEQ_CST);
+    return state;
+}
+
+void EndHandleRead(HandleReadState state) {
+    // Close the section on the cpu it was opened on. Lookups never fault,
+    // but if one did and the thread moved, bumping the new cpu's count
+    // would leave both counts wrong.
+    DEBUG_ASSERT(state.cpu == arch_curr_cpu_num());
+    uint32_t* seq = &handle_read_seqs[state.cpu].seq;
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+    arch_interrupt_restore(state.irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+// Waits until every lock-free handle lookup that was in progress when this
+// was called has finished. Lookups that start later see the process_id
+// cleared by the handle's removal from its process and give up.
+static void WaitForHandleReaders() {
+    uint32_t snapshot[SMP_MAX_CPUS];
+
+    smp_mb();
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        snapshot[i] = __atomic_load_n(&handle_read_seqs[i].seq, __ATOMIC_ACQUIRE);
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if ((snapshot[i] & 1u) == 0u)
+            continue;
+        while (__atomic_load_n(&handle_read_seqs[i].seq, __ATOMIC_ACQUIRE) == snapshot[i])
+            arch_spinloop_pause();
+    }
+}
+
+// Tears down and frees closed handles once no lock-free lookup can be
+// reading them anymore.
+static void ReclaimHandles(mxtl::DoublyLinkedList<Handle*>* handles) {
+    if (handles->is_empty())
+        return;
+
+    WaitForHandleReaders();
+
+    Handle* handle;
+    while ((handle = handles->pop_front()) != nullptr) {
+        // Destroys, but does not free, the Handle, and fixes up its memory
+        // to protect against stale pointers to it. Also stashes the Handle's
+        // base_value for reuse the next time this slot is allocated.
+        internal::TearDownHandle(handle);
+        FreeHandleSlot(handle);
+    }
+}
+
+// Queues a closed handle for reclamation on the local cpu.
+static void RetireHandle(Handle* handle) {
+    mxtl::DoublyLinkedList<Handle*> batch;
+    bool first;
+    {
+        // Which cpu's list this lands on does not matter, only that the
+        // lists are normally not shared.
+        HandleRetireList* retire = &handle_retire_lists[arch_curr_cpu_num()];
+        AutoSpinLockIrqSave lock(retire->lock);
+        retire->handles.push_back(handle);
+        first = (++retire->count == 1u);
+        if (retire->count >= kHandleRetireBatch) {
+            batch.swap(retire->handles);
+            retire->count = 0u;
+        }
+    }
+
+    if (!batch.is_empty()) {
+        ReclaimHandles(&batch);
+    } else if (first) {
+        dpc_queue(&handle_retire_dpc, false);
+    }
+}
+
+static void HandleRetireRoutine(dpc_t* dpc) {
+    mxtl::DoublyLinkedList<Handle*> handles;
+    for (auto& retire : handle_retire_lists) {
+        AutoSpinLockIrqSave lock(retire.lock);
+        handles.splice(handles.end(), retire.handles);
+        retire.count = 0u;
+    }
+    ReclaimHandles(&handles);
+}
+
 void DeleteHandle(Handle* handle) {
     mxtl::RefPtr<Dispatcher> dispatcher(handle->dispatcher());
     auto state_tracker = dispatcher->get_state_tracker();
@@ -244,26 +501,17 @@ void DeleteHandle(Handle* handle) {
         }
     }
 
-    // Destroys, but does not free, the Handle, and fixes up its memory
-    // to protect against stale pointers to it. Also stashes the Handle's
-    // base_value for reuse the next time this slot is allocated.
-    internal::TearDownHandle(handle);
+    // A lock-free lookup might still be looking at this handle, so its slot
+    // is torn down and freed later. The handle already counts as closed.
+    RetireHandle(handle);
 
     bool zero_handles = false;
-    uint32_t* handle_count;
-    {
-        AutoLock lock(&handle_mutex);
-        --outstanding_handles;
-
-        handle_count = dispatcher->get_handle_count_ptr();
-        (*handle_count)--;
-        if (*handle_count == 0u)
-            zero_handles = true;
-        else if (*handle_count != 1u)
-            handle_count = nullptr;
-
-        handle_arena.Free(handle);
-    }
+    uint32_t* handle_count = dispatcher->get_handle_count_ptr();
+    uint32_t count = __atomic_sub_fetch(handle_count, 1u, __ATOMIC_RELAXED);
+    if (count == 0u)
+        zero_handles = true;
+    else if (count != 1u)
+        handle_count = nullptr;
 
     if (zero_handles) {
         dispatcher->on_zero_handles();
@@ -277,13 +525,18 @@ void DeleteHandle(Handle* handle) {
     // gets destroyed here.
 }
 
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
+// The arena's range is fixed after init, so it is safe to check without
+// holding |handle_mutex|.
+bool HandleInRange(void* addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     return handle_arena.in_range(addr);
 }
 
 Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
     auto index = value & kHandleIndexMask;
+    // Bound the index by the slots the arena has committed, so that a bogus
+    // value never touches an uncommitted page of the arena.
+    if (index >= __atomic_load_n(&arena_slot_limit, __ATOMIC_ACQUIRE))
+        return nullptr;
     auto va = &reinterpret_cast<Handle*>(handle_arena.start())[index];
     if (!HandleInRange(va))
         return nullptr;
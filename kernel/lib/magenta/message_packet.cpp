@@ -10,28 +10,66 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <kernel/auto_lock.h>
+#include <kernel/vm.h>
+#include <kernel/vm/pmm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
+#include <magenta/message_packet_allocator.h>
+#include <magenta/process_dispatcher.h>
 #include <mxcpp/new.h>
 
+namespace {
+
+// Looks up the vmo mapped writable over all of [ptr, ptr + len) in the
+// current process, and the offset into it that |ptr| corresponds to.
+mxtl::RefPtr<VmObject> FindUserVmo(vaddr_t ptr, size_t len, uint64_t* offset) {
+    auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+    auto region = aspace->FindRegion(ptr);
+    if (!region)
+        return nullptr;
+
+    auto mapping = region->as_vm_mapping();
+    if (!mapping)
+        return nullptr;
+
+    // The mapping may be changed or destroyed by another thread until we
+    // hold the aspace lock; a destroyed mapping has no vmo.
+    AutoLock guard(aspace->lock());
+    if (!mapping->vmo())
+        return nullptr;
+    if (!(mapping->arch_mmu_flags() & ARCH_MMU_FLAG_PERM_WRITE))
+        return nullptr;
+    if (ptr < mapping->base() || len > mapping->size() - (ptr - mapping->base()))
+        return nullptr;
+
+    *offset = mapping->object_offset() + (ptr - mapping->base());
+    return mapping->vmo();
+}
+
+} // namespace
+
 // static
-mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
+mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles, bool paged,
                                      mxtl::unique_ptr<MessagePacket>* msg) {
     // Although the API uses uint32_t, we pack the handle count into a smaller
     // field internally. Make sure it fits.
     static_assert(kMaxMessageHandles <= UINT16_MAX, "");
-    if (data_size > kMaxMessageSize || num_handles > kMaxMessageHandles) {
+    const uint32_t max_size = paged ? kMaxPagedMessageSize : kMaxMessageSize;
+    if (data_size > max_size || num_handles > kMaxMessageHandles) {
         return MX_ERR_OUT_OF_RANGE;
     }
 
     // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    // Handle*s followed by data_size bytes, unless the data lives in pages.
+    // Small packets come from the per-cpu message slabs, large ones from the
+    // heap.
+    const uint32_t inline_size = paged ? 0u : data_size;
+    char* ptr = static_cast<char*>(MessagePacketAllocator::Alloc(
+        sizeof(MessagePacket) + num_handles * sizeof(Handle*) + inline_size));
     if (ptr == nullptr) {
         return MX_ERR_NO_MEMORY;
     }
@@ -41,7 +79,7 @@ mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     // immediately after creation of the object.
     msg->reset(new (ptr) MessagePacket(
         data_size, num_handles,
-        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket)), paged));
     return MX_OK;
 }
 
@@ -49,7 +87,7 @@ mx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
 mx_status_t MessagePacket::Create(user_ptr<const void> data, uint32_t data_size,
                                   uint32_t num_handles,
                                   mxtl::unique_ptr<MessagePacket>* msg) {
-    mx_status_t status = NewPacket(data_size, num_handles, msg);
+    mx_status_t status = NewPacket(data_size, num_handles, false, msg);
     if (status != MX_OK) {
         return status;
     }
@@ -66,7 +104,7 @@ mx_status_t MessagePacket::Create(user_ptr<const void> data, uint32_t data_size,
 mx_status_t MessagePacket::Create(const void* data, uint32_t data_size,
                                   uint32_t num_handles,
                                   mxtl::unique_ptr<MessagePacket>* msg) {
-    mx_status_t status = NewPacket(data_size, num_handles, msg);
+    mx_status_t status = NewPacket(data_size, num_handles, false, msg);
     if (status != MX_OK) {
         return status;
     }
@@ -76,17 +114,124 @@ mx_status_t MessagePacket::Create(const void* data, uint32_t data_size,
     return MX_OK;
 }
 
+// static
+mx_status_t MessagePacket::CreatePaged(user_ptr<const void> data, uint32_t data_size,
+                                       uint32_t num_handles,
+                                       mxtl::unique_ptr<MessagePacket>* msg) {
+    vaddr_t ptr = reinterpret_cast<vaddr_t>(data.get());
+    if (!IS_PAGE_ALIGNED(ptr) || !IS_PAGE_ALIGNED(data_size)) {
+        return MX_ERR_INVALID_ARGS;
+    }
+
+    mx_status_t status = NewPacket(data_size, num_handles, true, msg);
+    if (status != MX_OK || data_size == 0u) {
+        return status;
+    }
+
+    // Take the pages straight out of the sender's vmo if we can.
+    list_node* pages = &(*msg)->pages_;
+    uint64_t offset;
+    auto vmo = FindUserVmo(ptr, data_size, &offset);
+    if (vmo && vmo->TakePages(offset, data_size, pages) == MX_OK) {
+        // Remembered until the packet is queued, so that ReturnPages() can
+        // undo the move if the write fails.
+        (*msg)->page_source_ = mxtl::move(vmo);
+        (*msg)->page_source_offset_ = offset;
+        return MX_OK;
+    }
+
+    // Otherwise copy the data into pages of our own.
+    for (uint32_t copied = 0; copied < data_size; copied += PAGE_SIZE) {
+        paddr_t pa;
+        vm_page_t* p = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP, &pa);
+        if (p == nullptr) {
+            msg->reset();
+            return MX_ERR_NO_MEMORY;
+        }
+        list_add_tail(pages, &p->free.node);
+
+        if (data.byte_offset(copied).copy_array_from_user(paddr_to_kvaddr(pa), PAGE_SIZE) != MX_OK) {
+            msg->reset();
+            return MX_ERR_INVALID_ARGS;
+        }
+    }
+    return MX_OK;
+}
+
+void MessagePacket::ReturnPages() {
+    if (page_source_ == nullptr) {
+        return;
+    }
+    // The pages go back where they came from, except where the sender has
+    // written since, which is newer. Pages that do not go back are freed with
+    // the packet.
+    page_source_->RestorePages(page_source_offset_, data_size_, &pages_);
+    page_source_.reset();
+}
+
+void MessagePacket::ClearPageSource() {
+    page_source_.reset();
+}
+
+mx_status_t MessagePacket::CopyPagesTo(user_ptr<void> buf) {
+    // Hand the pages over to the vmo backing |buf| if it covers the whole
+    // message. Running out of memory part way leaves some of the pages
+    // consumed, so there is nothing to fall back to in that case.
+    vaddr_t ptr = reinterpret_cast<vaddr_t>(buf.get());
+    if (IS_PAGE_ALIGNED(ptr)) {
+        uint64_t offset;
+        auto vmo = FindUserVmo(ptr, data_size_, &offset);
+        if (vmo) {
+            mx_status_t status = vmo->SupplyPages(offset, data_size_, &pages_);
+            if (status == MX_OK || status == MX_ERR_NO_MEMORY) {
+                return status;
+            }
+        }
+    }
+
+    uint32_t copied = 0;
+    vm_page_t* p;
+    list_for_every_entry (&pages_, p, vm_page_t, free.node) {
+        const void* src = paddr_to_kvaddr(vm_page_to_paddr(p));
+        if (buf.byte_offset(copied).copy_array_to_user(src, PAGE_SIZE) != MX_OK) {
+            return MX_ERR_INVALID_ARGS;
+        }
+        copied += PAGE_SIZE;
+    }
+    return MX_OK;
+}
+
+mx_txid_t MessagePacket::paged_txid() const {
+    // Peeking does not modify the list.
+    const vm_page_t* p = list_peek_head_type(const_cast<list_node*>(&pages_), vm_page_t,
+                                             free.node);
+    if (p == nullptr) {
+        return 0;
+    }
+    return *reinterpret_cast<const mx_txid_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         // Delete handles out-of-band to avoid the worst case recursive
         // destruction behavior.
         ReapHandles(handles_, num_handles_);
     }
+    if (paged_) {
+        pmm_free(&pages_);
+    }
+}
+
+// static
+void MessagePacket::operator delete(void* ptr) {
+    MessagePacketAllocator::Free(ptr);
 }
 
 MessagePacket::MessagePacket(uint32_t data_size,
-                             uint32_t num_handles, Handle** handles)
+                             uint32_t num_handles, Handle** handles, bool paged)
     : handles_(handles), data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
-      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
+      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false),
+      paged_(paged) {
+    list_initialize(&pages_);
 }
@@ -0,0 +1,265 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/message_packet_allocator.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <trace.h>
+
+#include <arch/ops.h>
+#include <kernel/auto_lock.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <lk/init.h>
+
+#include <mxtl/arena.h>
+#include <mxtl/atomic.h>
+
+#define LOCAL_TRACE 0
+
+namespace MessagePacketAllocator {
+namespace {
+
+// Object sizes of the slab classes, including the MessagePacket header and
+// handle array. The largest class holds a 256 byte message with 4 handles.
+constexpr size_t kClassSizes[kNumSizeClasses] = {128u, 256u, 384u};
+
+// Maximum number of objects in each class. Arena memory is reserved up front
+// but only committed as it is used.
+constexpr size_t kMaxObjectsPerClass = 64 * 1024u;
+
+// Number of free objects each cpu may cache per class, and how many are moved
+// between a magazine and its arena at a time.
+constexpr size_t kMagazineSize = 32u;
+constexpr size_t kMagazineBatch = kMagazineSize / 2;
+
+// Heap allocations carry a header recording their size, so that the bytes
+// used by large messages can be accounted for when they are freed.
+struct HeapHeader {
+    size_t size;
+    size_t reserved;
+};
+static_assert(sizeof(HeapHeader) % 16 == 0, "heap header must preserve alignment");
+
+struct SizeClass {
+    Mutex lock;
+    mxtl::Arena arena TA_GUARDED(lock);
+
+    // Objects handed out by the arena, whether in use or sitting in a magazine.
+    size_t arena_objects TA_GUARDED(lock) = 0;
+    bool initialized = false;
+};
+
+// Per-cpu cache of free objects for one class. Only touched by its own cpu
+// with interrupts disabled, so it needs no lock. The counters are read racily
+// by GetStats().
+struct Magazine {
+    void* objects[kMagazineSize];
+    size_t count;
+
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+struct PerCpuMagazines {
+    Magazine classes[kNumSizeClasses];
+} __CPU_ALIGN;
+
+SizeClass size_classes[kNumSizeClasses];
+PerCpuMagazines magazines[SMP_MAX_CPUS];
+mxtl::atomic<uint64_t> heap_bytes(0);
+
+int SizeToClass(size_t size) {
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        if (size <= kClassSizes[i])
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// The arena's range is fixed after init, so it is safe to check without
+// holding the class lock.
+int PtrToClass(void* ptr) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        if (size_classes[i].initialized && size_classes[i].arena.in_range(ptr))
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// Fills |objects| with up to |count| objects from the arena, returning how
+// many were obtained.
+size_t ArenaAllocBatch(SizeClass* sc, void** objects, size_t count) {
+    AutoLock lock(&sc->lock);
+    size_t i = 0;
+    for (; i < count; i++) {
+        objects[i] = sc->arena.Alloc();
+        if (objects[i] == nullptr)
+            break;
+    }
+    sc->arena_objects += i;
+    return i;
+}
+
+void ArenaFreeBatch(SizeClass* sc, void** objects, size_t count) {
+    AutoLock lock(&sc->lock);
+    for (size_t i = 0; i < count; i++) {
+        sc->arena.Free(objects[i]);
+    }
+    sc->arena_objects -= count;
+}
+
+void* SlabAlloc(size_t cls) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    Magazine* mag = &magazines[arch_curr_cpu_num()].classes[cls];
+    if (likely(mag->count > 0)) {
+        void* ptr = mag->objects[--mag->count];
+        mag->allocs++;
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return ptr;
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // The magazine is empty, refill it from the arena. We may have migrated
+    // to another cpu by the time we put the batch back, so leftovers that no
+    // longer fit go straight back to the arena.
+    void* batch[kMagazineBatch];
+    size_t got = ArenaAllocBatch(&size_classes[cls], batch, kMagazineBatch);
+    if (got == 0)
+        return nullptr;
+
+    void* ptr = batch[--got];
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    mag = &magazines[arch_curr_cpu_num()].classes[cls];
+    mag->allocs++;
+    while (got > 0 && mag->count < kMagazineSize) {
+        mag->objects[mag->count++] = batch[--got];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (got > 0)
+        ArenaFreeBatch(&size_classes[cls], batch, got);
+
+    return ptr;
+}
+
+void SlabFree(size_t cls, void* ptr) {
+    void* batch[kMagazineBatch];
+    size_t drained = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    Magazine* mag = &magazines[arch_curr_cpu_num()].classes[cls];
+    if (unlikely(mag->count == kMagazineSize)) {
+        // Full magazine, move half of it back to the arena so that a
+        // subsequent burst of frees does not immediately overflow again.
+        while (drained < kMagazineBatch) {
+            batch[drained++] = mag->objects[--mag->count];
+        }
+    }
+    mag->objects[mag->count++] = ptr;
+    mag->frees++;
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (drained > 0)
+        ArenaFreeBatch(&size_classes[cls], batch, drained);
+}
+
+void message_packet_allocator_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "msgpacket-%zu", kClassSizes[i]);
+        status_t status = size_classes[i].arena.Init(name, kClassSizes[i],
+                                                     kMaxObjectsPerClass);
+        if (status != MX_OK) {
+            // Leave the class uninitialized, its sizes are served by the heap.
+            printf("WARNING: message packet arena %s failed to init: %d\n", name, status);
+            continue;
+        }
+        size_classes[i].initialized = true;
+    }
+}
+
+} // namespace
+
+void* Alloc(size_t size) {
+    int cls = SizeToClass(size);
+    if (cls >= 0 && size_classes[cls].initialized) {
+        void* ptr = SlabAlloc(cls);
+        if (ptr != nullptr)
+            return ptr;
+        LTRACEF("class %d exhausted, falling back to heap\n", cls);
+    }
+
+    auto header = static_cast<HeapHeader*>(malloc(sizeof(HeapHeader) + size));
+    if (header == nullptr)
+        return nullptr;
+    header->size = size;
+    heap_bytes.fetch_add(size);
+    return header + 1;
+}
+
+void Free(void* ptr) {
+    if (ptr == nullptr)
+        return;
+
+    int cls = PtrToClass(ptr);
+    if (cls >= 0) {
+        SlabFree(cls, ptr);
+        return;
+    }
+
+    auto header = static_cast<HeapHeader*>(ptr) - 1;
+    heap_bytes.fetch_sub(header->size);
+    free(header);
+}
+
+void GetStats(mx_info_kmem_channel_class_t classes[kNumSizeClasses],
+              uint64_t* heap_bytes_out) {
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        uint64_t allocs = 0;
+        uint64_t frees = 0;
+        uint64_t cached = 0;
+
+        // Racy, but each field is word sized so the worst case is a slightly
+        // stale snapshot.
+        for (size_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const Magazine& mag = magazines[cpu].classes[i];
+            allocs += mag.allocs;
+            frees += mag.frees;
+            cached += mag.count;
+        }
+
+        size_t arena_objects;
+        {
+            AutoLock lock(&size_classes[i].lock);
+            arena_objects = size_classes[i].arena_objects;
+        }
+
+        classes[i].object_bytes = kClassSizes[i];
+        classes[i].total_allocs = allocs;
+        classes[i].in_use = (allocs > frees) ? allocs - frees : 0;
+        classes[i].cached = cached;
+        classes[i].arena_bytes = arena_objects * kClassSizes[i];
+    }
+
+    *heap_bytes_out = heap_bytes.load();
+}
+
+} // namespace MessagePacketAllocator
+
+// Before magenta_init(), which may create the first channels.
+LK_INIT_HOOK(message_packet_allocator,
+             MessagePacketAllocator::message_packet_allocator_init,
+             LK_INIT_LEVEL_THREADING - 1);
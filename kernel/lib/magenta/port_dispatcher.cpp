@@ -18,10 +18,11 @@
 #include <magenta/syscalls/port.h>
 
 #include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
 
 #include <kernel/auto_lock.h>
 
-PortPacket::PortPacket() : packet{}, observer(nullptr) {
+PortPacket::PortPacket() : packet{}, observer(nullptr), queued(0), inbox_next(nullptr) {
     // Note that packet is initialized to zeros.
 }
 
@@ -108,11 +109,12 @@ mx_status_t PortDispatcher::Create(uint32_t options,
 }
 
 PortDispatcher::PortDispatcher(uint32_t /*options*/)
-    : zero_handles_(false) {
+    : zero_handles_(0), inbox_(0u), waiters_(0) {
 }
 
 PortDispatcher::~PortDispatcher() {
-    DEBUG_ASSERT(zero_handles_);
+    DEBUG_ASSERT(zero_handles_.load());
+    DEBUG_ASSERT(inbox_.load() == 0u);
 }
 
 void PortDispatcher::on_zero_handles() {
@@ -120,7 +122,7 @@ void PortDispatcher::on_zero_handles() {
 
     {
         AutoLock al(&lock_);
-        zero_handles_ = true;
+        zero_handles_.store(1);
 
         // Unlink and unbind exception ports.
         while (!eports_.is_empty()) {
@@ -132,7 +134,7 @@ void PortDispatcher::on_zero_handles() {
             lock_.Acquire();
         }
     }
-    while (DeQueue(0ull, nullptr) == MX_OK) {}
+    while (TryDeQueue(nullptr)) {}
 }
 
 mx_status_t PortDispatcher::QueueUser(const mx_port_packet_t& packet) {
@@ -157,25 +159,43 @@ mx_status_t PortDispatcher::Queue(PortPacket* port_packet,
                                     uint64_t count) {
     canary_.Assert();
 
-    int wake_count = 0;
-    {
-        AutoLock al(&lock_);
-        if (zero_handles_)
-            return MX_ERR_BAD_STATE;
-
-        if (observed) {
-            if (port_packet->InContainer())
-                return MX_OK;
-            port_packet->packet.signal.observed = observed;
-            port_packet->packet.signal.count = count;
-        }
+    if (zero_handles_.load())
+        return MX_ERR_BAD_STATE;
+
+    if (observed) {
+        // Signal packets belong to their observer and are reused. If this one
+        // is still pending, it already reports the new state.
+        int expected = 0;
+        if (!port_packet->queued.compare_exchange_strong(
+                &expected, 1, mxtl::memory_order_acquire, mxtl::memory_order_relaxed))
+            return MX_OK;
+        port_packet->packet.signal.observed = observed;
+        port_packet->packet.signal.count = count;
+    } else {
+        port_packet->queued.store(1, mxtl::memory_order_relaxed);
+    }
 
-        packets_.push_back(port_packet);
-        wake_count = sema_.Post();
+    uintptr_t head = inbox_.load(mxtl::memory_order_relaxed);
+    do {
+        port_packet->inbox_next = reinterpret_cast<PortPacket*>(head);
+    } while (!inbox_.compare_exchange_weak(&head, reinterpret_cast<uintptr_t>(port_packet),
+                                           mxtl::memory_order_seq_cst,
+                                           mxtl::memory_order_relaxed));
+
+    // on_zero_handles() might have drained the port between our check above
+    // and the push. Both sides order the flag against the inbox, so at least
+    // one of them sees the other and the packet can not be stranded.
+    if (unlikely(zero_handles_.load())) {
+        while (TryDeQueue(nullptr)) {}
+        return MX_OK;
     }
 
-    if (wake_count)
-        thread_reschedule();
+    // Same reasoning against DeQueue(): a consumer registers in |waiters_|
+    // before its last look at the inbox.
+    if (waiters_.load() > 0) {
+        if (sema_.Post())
+            thread_reschedule();
+    }
 
     return MX_OK;
 }
@@ -183,32 +203,115 @@ mx_status_t PortDispatcher::Queue(PortPacket* port_packet,
 mx_status_t PortDispatcher::DeQueue(mx_time_t deadline, mx_port_packet_t* packet) {
     canary_.Assert();
 
-    PortPacket* port_packet = nullptr;
-    PortObserver* observer = nullptr;
-
     while (true) {
-        {
-            AutoLock al(&lock_);
-            if (packets_.is_empty())
-                goto wait;
-
-            port_packet = packets_.pop_front();
-            observer = CopyLocked(port_packet, packet);
+        if (TryDeQueue(packet))
+            return MX_OK;
+
+        waiters_.fetch_add(1);
+        if (TryDeQueue(packet)) {
+            // A producer may have posted |sema_| for us anyway. The extra
+            // count only costs a later waiter one spurious trip around here.
+            waiters_.fetch_sub(1);
+            return MX_OK;
         }
-
-        if (observer)
-            delete observer;
-        else if (packet && (packet->type & PKT_FLAG_EPHEMERAL))
-            delete port_packet;
-        return MX_OK;
-
-wait:
         status_t st = sema_.Wait(deadline);
+        waiters_.fetch_sub(1);
         if (st != MX_OK)
             return st;
     }
 }
 
+mx_status_t PortDispatcher::DeQueueMany(mx_time_t deadline, mx_duration_t coalesce,
+                                        mx_port_packet_t* packets, size_t max,
+                                        size_t* actual) {
+    canary_.Assert();
+    DEBUG_ASSERT(max > 0u);
+
+    mx_status_t st = DeQueue(deadline, &packets[0]);
+    if (st != MX_OK)
+        return st;
+
+    size_t count = 1u + TryDeQueueMany(&packets[1], max - 1u);
+
+    if (coalesce > 0u && count < max) {
+        mx_time_t now = current_time();
+        mx_time_t window_end =
+            (deadline > now && coalesce < deadline - now) ? now + coalesce : deadline;
+        while (count < max) {
+            // Any error here, typically MX_ERR_TIMED_OUT, just closes the
+            // window: we already have packets to return.
+            if (DeQueue(window_end, &packets[count]) != MX_OK)
+                break;
+            count++;
+            count += TryDeQueueMany(&packets[count], max - count);
+        }
+    }
+
+    *actual = count;
+    return MX_OK;
+}
+
+bool PortDispatcher::TryDeQueue(mx_port_packet_t* packet) {
+    return TryDeQueueMany(packet, 1u) != 0u;
+}
+
+size_t PortDispatcher::TryDeQueueMany(mx_port_packet_t* packets, size_t max) {
+    DEBUG_ASSERT(packets != nullptr || max == 1u);
+
+    // Observers and ephemeral packets are destroyed after dropping the lock.
+    constexpr size_t kMaxBatch = 16u;
+    PortObserver* observers[kMaxBatch];
+    PortPacket* ephemerals[kMaxBatch];
+    size_t num_observers = 0;
+    size_t num_ephemerals = 0;
+    size_t count = 0;
+
+    max = mxtl::min(max, kMaxBatch);
+
+    {
+        AutoLock al(&lock_);
+        DrainInboxLocked();
+        while (count < max && !packets_.is_empty()) {
+            PortPacket* port_packet = packets_.pop_front();
+            PortObserver* observer = CopyLocked(port_packet, packets ? &packets[count] : nullptr);
+            if (observer)
+                observers[num_observers++] = observer;
+            else if (port_packet->type() & PKT_FLAG_EPHEMERAL)
+                ephemerals[num_ephemerals++] = port_packet;
+            // From here on the observer is free to queue the packet again.
+            port_packet->queued.store(0, mxtl::memory_order_release);
+            count++;
+        }
+    }
+
+    for (size_t i = 0; i < num_observers; i++)
+        delete observers[i];
+    for (size_t i = 0; i < num_ephemerals; i++)
+        delete ephemerals[i];
+    return count;
+}
+
+void PortDispatcher::DrainInboxLocked() {
+    auto head = reinterpret_cast<PortPacket*>(inbox_.exchange(0u));
+    if (head == nullptr)
+        return;
+
+    // The inbox is a stack, reverse it to get the packets in arrival order.
+    PortPacket* oldest = nullptr;
+    while (head != nullptr) {
+        PortPacket* next = head->inbox_next;
+        head->inbox_next = oldest;
+        oldest = head;
+        head = next;
+    }
+    while (oldest != nullptr) {
+        PortPacket* next = oldest->inbox_next;
+        oldest->inbox_next = nullptr;
+        packets_.push_back(oldest);
+        oldest = next;
+    }
+}
+
 PortObserver* PortDispatcher::CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) {
     if (packet)
         *packet = port_packet->packet;
@@ -220,7 +323,9 @@ bool PortDispatcher::CanReap(PortObserver* observer, PortPacket* port_packet) {
     canary_.Assert();
 
     AutoLock al(&lock_);
-    if (!port_packet->InContainer())
+    // No producer can race with us: the observer has already been removed
+    // from its state tracker.
+    if (port_packet->queued.load() == 0)
         return true;
     // The destruction will happen when the packet is dequeued or in CancelQueued()
     DEBUG_ASSERT(port_packet->observer == nullptr);
@@ -255,6 +360,7 @@ bool PortDispatcher::CancelQueued(const void* handle, uint64_t key) {
     canary_.Assert();
 
     AutoLock al(&lock_);
+    DrainInboxLocked();
 
     // This loop can take a while if there are many items.
     // In practice, the number of pending signal packets is
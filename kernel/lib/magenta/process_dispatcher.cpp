@@ -447,9 +447,40 @@ mx_koid_t ProcessDispatcher::GetKoidForHandle(mx_handle_t handle_value) {
     return handle->dispatcher()->get_koid();
 }
 
+bool ProcessDispatcher::GetDispatcherNoLock(mx_handle_t handle_value,
+                                            mxtl::RefPtr<Dispatcher>* dispatcher,
+                                            mx_rights_t* rights) {
+    mxtl::RefPtr<Dispatcher> disp;
+    bool found = false;
+
+    HandleReadState state = BeginHandleRead();
+    auto handle = map_value_to_handle(handle_value, handle_rand_);
+    if (handle && handle->process_id() == get_koid()) {
+        disp = handle->dispatcher();
+        *rights = handle->rights();
+        found = true;
+    }
+    EndHandleRead(state);
+
+    // Assigned outside of the read section, dropping whatever |dispatcher|
+    // held before may destroy it.
+    if (found)
+        *dispatcher = mxtl::move(disp);
+    return found;
+}
+
 mx_status_t ProcessDispatcher::GetDispatcherInternal(mx_handle_t handle_value,
                                                      mxtl::RefPtr<Dispatcher>* dispatcher,
                                                      mx_rights_t* rights) {
+    mx_rights_t handle_rights;
+    if (GetDispatcherNoLock(handle_value, dispatcher, &handle_rights)) {
+        if (rights)
+            *rights = handle_rights;
+        return MX_OK;
+    }
+
+    // Not a valid handle, or it is being moved. Take the lock for a definitive
+    // answer and to apply the bad handle policy.
     AutoLock lock(&handle_table_lock_);
     Handle* handle = GetHandleLocked(handle_value);
     if (!handle)
@@ -465,6 +496,19 @@ mx_status_t ProcessDispatcher::GetDispatcherWithRightsInternal(mx_handle_t handl
                                                                mx_rights_t desired_rights,
                                                                mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                                mx_rights_t* out_rights) {
+    mx_rights_t rights;
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    if (GetDispatcherNoLock(handle_value, &dispatcher, &rights)) {
+        if ((rights & desired_rights) != desired_rights)
+            return MX_ERR_ACCESS_DENIED;
+        *dispatcher_out = mxtl::move(dispatcher);
+        if (out_rights)
+            *out_rights = rights;
+        return MX_OK;
+    }
+
+    // Not a valid handle, or it is being moved. Take the lock for a definitive
+    // answer and to apply the bad handle policy.
     AutoLock lock(&handle_table_lock_);
     Handle* handle = GetHandleLocked(handle_value);
     if (!handle)
@@ -524,6 +568,11 @@ status_t ProcessDispatcher::GetStats(mx_info_task_stats_t* stats) {
     stats->mem_private_bytes = usage.private_pages * PAGE_SIZE;
     stats->mem_shared_bytes = usage.shared_pages * PAGE_SIZE;
     stats->mem_scaled_shared_bytes = usage.scaled_shared_bytes;
+
+    VmAspace::vm_fault_stats_t faults;
+    aspace_->GetFaultStats(&faults);
+    stats->page_faults = faults.faults;
+    stats->page_faults_saved = faults.fault_around_pages + faults.read_ahead_pages;
     return MX_OK;
 }
 
@@ -16,6 +16,7 @@
 #include <lib/user_copy/user_ptr.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/vm/pmm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_object_paged.h>
@@ -26,8 +27,96 @@
 
 #define LOCAL_TRACE 0
 
+SocketDispatcher::MBuf::~MBuf() {
+    if (page_ != nullptr)
+        pmm_free_page(page_);
+}
+
+size_t SocketDispatcher::MBuf::capacity() const {
+    return (page_ != nullptr) ? PAGE_SIZE : kMBufDataSize;
+}
+
 size_t SocketDispatcher::MBuf::rem() const {
-    return kMBufDataSize - (off_ + len_);
+    return capacity() - (off_ + len_);
+}
+
+char* SocketDispatcher::MBuf::buf() {
+    if (page_ != nullptr)
+        return static_cast<char*>(paddr_to_kvaddr(vm_page_to_paddr(page_)));
+    return data_;
+}
+
+mx_status_t SocketDispatcher::IovecCursor::CopyFrom(void* dst, size_t len) {
+    char* out = static_cast<char*>(dst);
+    const size_t index = index_;
+    const size_t offset = offset_;
+    while (len > 0) {
+        if (index_ == count_) {
+            index_ = index;
+            offset_ = offset;
+            return MX_ERR_INVALID_ARGS;
+        }
+        size_t avail = iov_[index_].capacity - offset_;
+        size_t copy_len = MIN(avail, len);
+        user_ptr<const void> src(iov_[index_].buffer);
+        if (src.byte_offset(offset_).copy_array_from_user(out, copy_len) != MX_OK) {
+            index_ = index;
+            offset_ = offset;
+            return MX_ERR_INVALID_ARGS;
+        }
+        out += copy_len;
+        len -= copy_len;
+        offset_ += copy_len;
+        if (offset_ == iov_[index_].capacity) {
+            index_++;
+            offset_ = 0;
+        }
+    }
+    return MX_OK;
+}
+
+mx_status_t SocketDispatcher::IovecCursor::CopyTo(const void* src, size_t len) {
+    const char* in = static_cast<const char*>(src);
+    const size_t index = index_;
+    const size_t offset = offset_;
+    while (len > 0) {
+        if (index_ == count_) {
+            index_ = index;
+            offset_ = offset;
+            return MX_ERR_INVALID_ARGS;
+        }
+        size_t avail = iov_[index_].capacity - offset_;
+        size_t copy_len = MIN(avail, len);
+        user_ptr<void> dst(iov_[index_].buffer);
+        if (dst.byte_offset(offset_).copy_array_to_user(in, copy_len) != MX_OK) {
+            index_ = index;
+            offset_ = offset;
+            return MX_ERR_INVALID_ARGS;
+        }
+        in += copy_len;
+        len -= copy_len;
+        offset_ += copy_len;
+        if (offset_ == iov_[index_].capacity) {
+            index_++;
+            offset_ = 0;
+        }
+    }
+    return MX_OK;
+}
+
+// Sums the capacities of |count| buffers, failing if the total does not fit
+// in a uint32_t.
+static mx_status_t IovecTotal(const mx_iovec_t* iov, size_t count, size_t* total) {
+    size_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (iov[i].capacity > SIZE_MAX - sum)
+            return MX_ERR_INVALID_ARGS;
+        sum += iov[i].capacity;
+    }
+    if (sum != static_cast<size_t>(static_cast<uint32_t>(sum)))
+        return MX_ERR_INVALID_ARGS;
+    *total = sum;
+    return MX_OK;
 }
 
 bool SocketDispatcher::is_full() const {
@@ -171,6 +260,12 @@ status_t SocketDispatcher::HalfCloseOther() {
 
 mx_status_t SocketDispatcher::Write(user_ptr<const void> src, size_t len,
                                     size_t* nwritten) {
+    mx_iovec_t iov = {const_cast<void*>(src.get()), len};
+    return WriteVector(&iov, 1, nwritten);
+}
+
+mx_status_t SocketDispatcher::WriteVector(const mx_iovec_t* iov, size_t count,
+                                          size_t* nwritten) {
     canary_.Assert();
 
     mxtl::RefPtr<SocketDispatcher> other;
@@ -183,30 +278,108 @@ mx_status_t SocketDispatcher::Write(user_ptr<const void> src, size_t len,
         other = other_;
     }
 
+    size_t len;
+    mx_status_t status = IovecTotal(iov, count, &len);
+    if (status != MX_OK)
+        return status;
     if (len == 0) {
         *nwritten = 0;
         return MX_OK;
     }
-    if (len != static_cast<size_t>(static_cast<uint32_t>(len)))
-        return MX_ERR_INVALID_ARGS;
 
-    return other->WriteSelf(src, len, nwritten);
+    IovecCursor cursor(iov, count);
+    return other->WriteSelf(&cursor, len, nwritten);
+}
+
+// Copies as many whole pages of |src| as the socket currently has room for
+// into freshly allocated pages, appending them to |pages|. Called without
+// |lock_| held so that large copies do not stall the reader; the space may be
+// gone by the time the pages are linked, in which case the extra pages are
+// dropped. Returns the number of bytes copied, which |src| is left just past;
+// a page that could only be partly copied is not counted.
+size_t SocketDispatcher::FillPages(IovecCursor* src, size_t len, list_node* pages) {
+    size_t room;
+    {
+        AutoLock lock(&lock_);
+        room = kSocketSizeMax - MIN(size_, kSocketSizeMax);
+    }
+
+    size_t count = MIN(len, room) / PAGE_SIZE;
+    if (count == 0)
+        return 0;
+
+    count = pmm_alloc_pages(count, PMM_ALLOC_FLAG_KMAP, pages);
+
+    size_t copied = 0;
+    vm_page_t* p;
+    list_for_every_entry (pages, p, vm_page_t, free.node) {
+        if (src->CopyFrom(paddr_to_kvaddr(vm_page_to_paddr(p)), PAGE_SIZE) != MX_OK)
+            break;
+        copied += PAGE_SIZE;
+    }
+
+    // Give back whatever the copy did not reach.
+    while (list_length(pages) > copied / PAGE_SIZE) {
+        pmm_free_page(list_remove_tail_type(pages, vm_page_t, free.node));
+    }
+    return copied;
 }
 
-mx_status_t SocketDispatcher::WriteSelf(user_ptr<const void> src, size_t len,
+// Appends the pages filled by FillPages() to the socket, one MBuf each, and
+// frees the ones that no longer fit. Returns the number of bytes linked.
+size_t SocketDispatcher::LinkPagesLocked(list_node* pages) {
+    size_t linked = 0;
+    while (!list_is_empty(pages) && size_ + PAGE_SIZE <= kSocketSizeMax) {
+        auto next = AllocMBuf();
+        if (next == nullptr)
+            break;
+        next->page_ = list_remove_head_type(pages, vm_page_t, free.node);
+        next->len_ = PAGE_SIZE;
+        if (head_ == nullptr) {
+            tail_.push_front(next);
+        } else {
+            tail_.insert_after(tail_.make_iterator(*head_), next);
+        }
+        head_ = next;
+        size_ += PAGE_SIZE;
+        linked += PAGE_SIZE;
+    }
+    if (!list_is_empty(pages))
+        pmm_free(pages);
+    return linked;
+}
+
+mx_status_t SocketDispatcher::WriteSelf(IovecCursor* src, size_t len,
                                         size_t* written) {
     canary_.Assert();
 
-    AutoLock lock(&lock_);
+    // Large stream writes are copied a page at a time before taking the
+    // lock, rather than through the small MBufs with the lock held.
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    size_t filled = 0;
+    if (flags_ == MX_SOCKET_STREAM && len >= PAGE_SIZE)
+        filled = FillPages(src, len, &pages);
 
-    if (is_full())
-        return MX_ERR_SHOULD_WAIT;
+    AutoLock lock(&lock_);
 
     bool was_empty = is_empty();
 
     size_t st = 0u;
-    mx_status_t status;
-    if (flags_ == MX_SOCKET_DATAGRAM) {
+    mx_status_t status = MX_OK;
+    if (filled > 0) {
+        st = LinkPagesLocked(&pages);
+        // The cursor is past the pages that did not fit, so only carry on if
+        // all of them made it.
+        if (st < filled || st == len) {
+            status = (st == 0) ? MX_ERR_SHOULD_WAIT : MX_OK;
+        } else {
+            size_t rest = 0u;
+            if (!is_full() && WriteStreamMBufsLocked(src, len - st, &rest) == MX_OK)
+                st += rest;
+        }
+    } else if (is_full()) {
+        return MX_ERR_SHOULD_WAIT;
+    } else if (flags_ == MX_SOCKET_DATAGRAM) {
         status = WriteDgramMBufsLocked(src, len, &st);
     } else {
         status = WriteStreamMBufsLocked(src, len, &st);
@@ -226,7 +399,7 @@ mx_status_t SocketDispatcher::WriteSelf(user_ptr<const void> src, size_t len,
     return status;
 }
 
-mx_status_t SocketDispatcher::WriteDgramMBufsLocked(user_ptr<const void> src,
+mx_status_t SocketDispatcher::WriteDgramMBufsLocked(IovecCursor* src,
                                                     size_t len, size_t* written) {
     if (len + size_ > kSocketSizeMax)
         return MX_ERR_SHOULD_WAIT;
@@ -245,7 +418,7 @@ mx_status_t SocketDispatcher::WriteDgramMBufsLocked(user_ptr<const void> src,
     size_t pos = 0;
     for (auto& buf : bufs) {
         size_t copy_len = MIN(kMBufDataSize, len - pos);
-        if (src.byte_offset(pos).copy_array_from_user(buf.data_, copy_len) != MX_OK) {
+        if (src->CopyFrom(buf.data_, copy_len) != MX_OK) {
             while (!bufs.is_empty())
                 FreeMBuf(bufs.pop_front());
             return MX_ERR_INVALID_ARGS; // Bad user buffer.
@@ -272,7 +445,7 @@ mx_status_t SocketDispatcher::WriteDgramMBufsLocked(user_ptr<const void> src,
     return MX_OK;
 }
 
-mx_status_t SocketDispatcher::WriteStreamMBufsLocked(user_ptr<const void> src,
+mx_status_t SocketDispatcher::WriteStreamMBufsLocked(IovecCursor* src,
                                                      size_t len, size_t* written) {
     if (head_ == nullptr) {
         head_ = AllocMBuf();
@@ -290,14 +463,14 @@ mx_status_t SocketDispatcher::WriteStreamMBufsLocked(user_ptr<const void> src,
             tail_.insert_after(tail_.make_iterator(*head_), next);
             head_ = next;
         }
-        void* dst = head_->data_ + head_->off_ + head_->len_;
+        void* dst = head_->buf() + head_->off_ + head_->len_;
         size_t copy_len = MIN(head_->rem(), len - pos);
         if (size_ + copy_len > kSocketSizeMax) {
             copy_len = kSocketSizeMax - size_;
             if (copy_len == 0)
                 break;
         }
-        if (src.byte_offset(pos).copy_array_from_user(dst, copy_len) != MX_OK)
+        if (src->CopyFrom(dst, copy_len) != MX_OK)
             break;
         pos += copy_len;
         head_->len_ += static_cast<uint32_t>(copy_len);
@@ -315,10 +488,9 @@ mx_status_t SocketDispatcher::Read(user_ptr<void> dst, size_t len,
                                    size_t* nread) {
     canary_.Assert();
 
-    AutoLock lock(&lock_);
-
     // Just query for bytes outstanding.
     if (!dst && len == 0) {
+        AutoLock lock(&lock_);
         *nread = size_;
         return MX_OK;
     }
@@ -326,6 +498,28 @@ mx_status_t SocketDispatcher::Read(user_ptr<void> dst, size_t len,
     if (len != (size_t)((uint32_t)len))
         return MX_ERR_INVALID_ARGS;
 
+    mx_iovec_t iov = {dst.get(), len};
+    IovecCursor cursor(&iov, 1);
+    return ReadInternal(&cursor, len, nread);
+}
+
+mx_status_t SocketDispatcher::ReadVector(const mx_iovec_t* iov, size_t count,
+                                         size_t* nread) {
+    canary_.Assert();
+
+    size_t len;
+    mx_status_t status = IovecTotal(iov, count, &len);
+    if (status != MX_OK)
+        return status;
+
+    IovecCursor cursor(iov, count);
+    return ReadInternal(&cursor, len, nread);
+}
+
+mx_status_t SocketDispatcher::ReadInternal(IovecCursor* dst, size_t len,
+                                           size_t* nread) {
+    AutoLock lock(&lock_);
+
     bool closed = half_closed_[1] || !other_;
 
     if (is_empty())
@@ -348,13 +542,13 @@ mx_status_t SocketDispatcher::Read(user_ptr<void> dst, size_t len,
     return MX_OK;
 }
 
-size_t SocketDispatcher::ReadMBufsLocked(user_ptr<void> dst, size_t len) {
+size_t SocketDispatcher::ReadMBufsLocked(IovecCursor* dst, size_t len) {
     size_t pos = 0;
     while (pos < len && !tail_.is_empty()) {
         MBuf& cur = tail_.front();
-        char* src = cur.data_ + cur.off_;
+        char* src = cur.buf() + cur.off_;
         size_t copy_len = MIN(cur.len_, len - pos);
-        if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != MX_OK)
+        if (dst->CopyTo(src, copy_len) != MX_OK)
             return pos;
         pos += copy_len;
         cur.off_ += static_cast<uint32_t>(copy_len);
@@ -390,6 +584,10 @@ SocketDispatcher::MBuf* SocketDispatcher::AllocMBuf() {
 }
 
 void SocketDispatcher::FreeMBuf(SocketDispatcher::MBuf* buf) {
+    if (buf->page_ != nullptr) {
+        pmm_free_page(buf->page_);
+        buf->page_ = nullptr;
+    }
     buf->off_ = 0u;
     buf->len_ = 0u;
     freelist_.push_front(buf);
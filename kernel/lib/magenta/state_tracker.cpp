@@ -158,7 +158,7 @@ void StateTracker::UpdateLastHandleSignal(uint32_t* count) {
 
         // We assume here that the value pointed by |count| can mutate by
         // other threads.
-        signals_ = (*count == 1u) ?
+        signals_ = (__atomic_load_n(count, __ATOMIC_RELAXED) == 1u) ?
             signals_ | MX_SIGNAL_LAST_HANDLE : signals_ & ~MX_SIGNAL_LAST_HANDLE;
 
         if (previous_signals == signals_)
@@ -16,12 +16,15 @@
 #include <magenta/compiler.h>
 #include <magenta/rights.h>
 #include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
 
 #include <safeint/safe_math.h>
 
 constexpr mx_duration_t kMinTimerPeriod = MX_TIMER_MIN_PERIOD;
 constexpr mx_time_t     kMinTimerDeadline = MX_TIMER_MIN_DEADLINE;
 constexpr mx_duration_t kTimerCanceled = 1u;
+// A timer may be delayed by at most this much, and by at most half its period.
+constexpr mx_duration_t kMaxTimerSlack = MX_SEC(1);
 
 static handler_return timer_irq_callback(timer* timer, lk_time_t now, void* arg) {
     // We are in IRQ context and cannot touch the timer state_tracker, so we
@@ -49,7 +52,7 @@ mx_status_t TimerDispatcher::Create(uint32_t options,
 
 TimerDispatcher::TimerDispatcher(uint32_t /*options*/)
     : timer_dpc_({LIST_INITIAL_CLEARED_VALUE, &dpc_callback, this}),
-      deadline_(0u), period_(0u),
+      deadline_(0u), period_(0u), slack_(0u),
       timer_(TIMER_INITIAL_VALUE(timer_)) {
 }
 
@@ -63,7 +66,8 @@ void TimerDispatcher::on_zero_handles() {
     Cancel();
 }
 
-mx_status_t TimerDispatcher::Set(mx_time_t deadline, mx_duration_t period) {
+mx_status_t TimerDispatcher::Set(mx_time_t deadline, mx_duration_t period,
+                                 mx_duration_t slack) {
     canary_.Assert();
 
     // Deadline values 0 and 1 are special.
@@ -82,12 +86,15 @@ mx_status_t TimerDispatcher::Set(mx_time_t deadline, mx_duration_t period) {
     // is re-issued in the timer callback.
     deadline_ = deadline;
     period_ = period;
+    slack_ = mxtl::min(slack, kMaxTimerSlack);
+    if (period != 0u)
+        slack_ = mxtl::min(slack_, period / 2);
 
     // We need to ref-up because the timer and the dpc don't understand
     // refcounted objects. The Release() is called either in OnTimerFired()
     // or in the complicated cancelation path above.
     AddRef();
-    timer_set_oneshot(&timer_, deadline_, &timer_irq_callback, &timer_dpc_);
+    timer_set(&timer_, deadline_, slack_, &timer_irq_callback, &timer_dpc_);
     return MX_OK;
 }
 
@@ -161,7 +168,7 @@ void TimerDispatcher::OnTimerFired() {
             // this avoids a race with the timer callback that queued our dpc
             timer_cancel(&timer_);
 
-            timer_set_oneshot(&timer_, deadline_, &timer_irq_callback, &timer_dpc_);
+            timer_set(&timer_, deadline_, slack_, &timer_irq_callback, &timer_dpc_);
             return;
         } else {
             // The timer is a one-shot timer.
@@ -14,10 +14,12 @@
 #include <trace.h>
 
 #include <lib/dpc.h>
+#include <lk/init.h>
 
 #include <arch/debugger.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
@@ -43,6 +45,7 @@ UserThread::UserThread(mxtl::RefPtr<ProcessDispatcher> process,
       process_(mxtl::move(process)),
       state_tracker_(0u) {
     LTRACE_ENTRY_OBJ;
+    futex_node_.set_thread(&thread_);
 }
 
 // This is called during initialization after both us and our dispatcher
@@ -96,6 +99,14 @@ UserThread::~UserThread() {
 
 namespace {
 
+// Slack given to the timers of sleeps and waits with a deadline made by user
+// threads. Off by default, since a wait may then return up to this late.
+lk_time_t user_timer_slack = 0;
+
+void user_timer_slack_init(uint level) {
+    user_timer_slack = LK_USEC(cmdline_get_uint64("timer.user_slack_us", 0));
+}
+
 status_t allocate_stack(const mxtl::RefPtr<VmAddressRegion>& vmar, bool unsafe,
                         mxtl::RefPtr<VmMapping>* out_kstack_mapping,
                         mxtl::RefPtr<VmAddressRegion>* out_kstack_vmar) {
@@ -221,6 +232,8 @@ status_t UserThread::Initialize(const char* name, size_t len) {
     // set the per-thread pointer
     lkthread->user_thread = reinterpret_cast<void*>(this);
 
+    lkthread->timer_slack = user_timer_slack;
+
     // associate the proc's address space with this thread
     process_->aspace()->AttachToThread(lkthread);
 
@@ -968,3 +981,6 @@ const char* StateToString(UserThread::State state) {
     }
     return "unknown";
 }
+
+// Before any user threads are created.
+LK_INIT_HOOK(user_timer_slack, user_timer_slack_init, LK_INIT_LEVEL_THREADING);
@@ -104,10 +104,37 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             auto status = vmo_->DecommitRange(offset, size, nullptr);
             return status;
         }
-        case MX_VMO_OP_LOCK:
+        case MX_VMO_OP_LOCK: {
+            // locks cover the whole object
+            if (offset != 0 || size < vmo_->size())
+                return MX_ERR_INVALID_ARGS;
+            // check the buffer before taking the lock, so that the result
+            // is very unlikely to be lost after it
+            auto state_ptr = buffer.reinterpret<uint32_t>();
+            if (buffer) {
+                if (buffer_size < sizeof(uint32_t))
+                    return MX_ERR_BUFFER_TOO_SMALL;
+                if (state_ptr.copy_to_user(MX_VMO_LOCK_KEPT) != MX_OK)
+                    return MX_ERR_INVALID_ARGS;
+            }
+
+            bool discarded;
+            auto status = vmo_->LockDiscardable(&discarded);
+            if (status != MX_OK)
+                return status;
+
+            if (buffer && discarded) {
+                if (state_ptr.copy_to_user(MX_VMO_LOCK_DISCARDED) != MX_OK) {
+                    vmo_->UnlockDiscardable();
+                    return MX_ERR_INVALID_ARGS;
+                }
+            }
+            return MX_OK;
+        }
         case MX_VMO_OP_UNLOCK:
-            // TODO: handle
-            return MX_ERR_NOT_SUPPORTED;
+            if (offset != 0 || size < vmo_->size())
+                return MX_ERR_INVALID_ARGS;
+            return vmo_->UnlockDiscardable();
         case MX_VMO_OP_LOOKUP:
             // we will be using the user pointer
             if (!buffer)
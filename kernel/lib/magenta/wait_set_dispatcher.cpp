@@ -0,0 +1,229 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/wait_set_dispatcher.h>
+
+#include <assert.h>
+#include <err.h>
+
+#include <kernel/auto_lock.h>
+
+#include <magenta/handle.h>
+#include <magenta/rights.h>
+#include <magenta/state_tracker.h>
+
+#include <mxalloc/new.h>
+#include <mxtl/algorithm.h>
+
+// Upper bound on the number of entries in a wait set, so that a process can
+// not pin an unbounded amount of kernel memory through one.
+constexpr size_t kMaxWaitSetEntries = MX_WAITSET_MAX_ENTRIES;
+
+WaitSetEntry::WaitSetEntry(WaitSetDispatcher* wait_set, uint64_t cookie,
+                           mx_signals_t watched_signals)
+    : wait_set_(wait_set), cookie_(cookie), watched_signals_(watched_signals) {
+}
+
+WaitSetEntry::~WaitSetEntry() {
+    DEBUG_ASSERT(!dispatcher_);
+    DEBUG_ASSERT(!ready_);
+}
+
+StateObserver::Flags WaitSetEntry::OnInitialize(mx_signals_t initial_state,
+                                                const StateObserver::CountInfo* cinfo) {
+    canary_.Assert();
+    return wait_set_->UpdateEntry(this, initial_state, false);
+}
+
+StateObserver::Flags WaitSetEntry::OnStateChange(mx_signals_t new_state) {
+    canary_.Assert();
+    return wait_set_->UpdateEntry(this, new_state, false);
+}
+
+StateObserver::Flags WaitSetEntry::OnCancel(Handle* handle) {
+    canary_.Assert();
+
+    if (handle_ == nullptr || handle != handle_)
+        return 0;
+
+    // The entry stays on the tracker until it is removed from the wait set,
+    // reporting the closed handle until then.
+    handle_ = nullptr;
+    return wait_set_->UpdateEntry(this, 0u, true) | kHandled;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
+status_t WaitSetDispatcher::Create(uint32_t options,
+                                   mxtl::RefPtr<Dispatcher>* dispatcher,
+                                   mx_rights_t* rights) {
+    if (options != 0u)
+        return MX_ERR_INVALID_ARGS;
+
+    AllocChecker ac;
+    auto disp = new (&ac) WaitSetDispatcher();
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+
+    *rights = MX_DEFAULT_WAIT_SET_RIGHTS;
+    *dispatcher = mxtl::AdoptRef<Dispatcher>(disp);
+    return MX_OK;
+}
+
+WaitSetDispatcher::WaitSetDispatcher() {
+}
+
+WaitSetDispatcher::~WaitSetDispatcher() {
+    DEBUG_ASSERT(entries_.is_empty());
+    DEBUG_ASSERT(ready_.is_empty());
+}
+
+void WaitSetDispatcher::on_zero_handles() {
+    canary_.Assert();
+
+    AutoLock al(&entries_lock_);
+    zero_handles_ = true;
+
+    // Entries hold references to the objects they watch, drop them now
+    // rather than waiting for the last waiter to leave.
+    while (!entries_.is_empty()) {
+        auto entry = entries_.pop_front();
+        DetachEntry(entry.get());
+    }
+
+    {
+        AutoLock lock(&lock_);
+        cancelled_ = true;
+    }
+    event_.Signal(MX_ERR_CANCELED);
+}
+
+mx_status_t WaitSetDispatcher::AddEntry(Handle* handle, mx_signals_t signals, uint64_t cookie) {
+    canary_.Assert();
+
+    // Called under the handle table lock.
+
+    auto dispatcher = handle->dispatcher();
+    if (!dispatcher->get_state_tracker())
+        return MX_ERR_NOT_SUPPORTED;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<WaitSetEntry> entry(new (&ac) WaitSetEntry(this, cookie, signals));
+    if (!ac.check())
+        return MX_ERR_NO_MEMORY;
+    WaitSetEntry* raw_entry = entry.get();
+
+    AutoLock al(&entries_lock_);
+    if (zero_handles_)
+        return MX_ERR_BAD_STATE;
+    if (entries_.size() >= kMaxWaitSetEntries)
+        return MX_ERR_NO_RESOURCES;
+    if (!entries_.insert_or_find(mxtl::move(entry)))
+        return MX_ERR_ALREADY_EXISTS;
+
+    // The tracker calls back into UpdateEntry() right away with the
+    // current signals.
+    raw_entry->handle_ = handle;
+    raw_entry->dispatcher_ = mxtl::move(dispatcher);
+    mx_status_t status = raw_entry->dispatcher_->add_observer(raw_entry);
+    if (status != MX_OK) {
+        raw_entry->dispatcher_.reset();
+        entries_.erase(*raw_entry);
+        return status;
+    }
+    return MX_OK;
+}
+
+mx_status_t WaitSetDispatcher::RemoveEntry(uint64_t cookie) {
+    canary_.Assert();
+
+    mxtl::unique_ptr<WaitSetEntry> entry;
+    {
+        AutoLock al(&entries_lock_);
+        entry = entries_.erase(cookie);
+        if (!entry)
+            return MX_ERR_NOT_FOUND;
+        DetachEntry(entry.get());
+    }
+    return MX_OK;
+}
+
+void WaitSetDispatcher::DetachEntry(WaitSetEntry* entry) {
+    auto tracker = entry->dispatcher_->get_state_tracker();
+    DEBUG_ASSERT(tracker);
+    tracker->RemoveObserver(entry);
+    entry->dispatcher_.reset();
+
+    // No more callbacks can come in, take it off the ready list for good.
+    AutoLock lock(&lock_);
+    if (entry->ready_) {
+        ready_.erase(*entry);
+        entry->ready_ = false;
+        if (--num_ready_ == 0u && !cancelled_)
+            event_.Unsignal();
+    }
+}
+
+StateObserver::Flags WaitSetDispatcher::UpdateEntry(WaitSetEntry* entry, mx_signals_t state,
+                                                    bool handle_closed) {
+    AutoLock lock(&lock_);
+
+    if (handle_closed)
+        entry->handle_closed_ = true;
+    entry->observed_ = entry->handle_closed_ ? (entry->observed_ | MX_SIGNAL_HANDLE_CLOSED)
+                                             : state;
+
+    bool ready = entry->handle_closed_ || (state & entry->watched_signals_);
+    if (ready == entry->ready_)
+        return 0;
+
+    entry->ready_ = ready;
+    if (ready) {
+        ready_.push_back(entry);
+        if (num_ready_++ == 0u && event_.Signal() > 0)
+            return StateObserver::kWokeThreads;
+    } else {
+        ready_.erase(*entry);
+        if (--num_ready_ == 0u && !cancelled_)
+            event_.Unsignal();
+    }
+    return 0;
+}
+
+mx_status_t WaitSetDispatcher::Wait(mx_time_t deadline, mx_waitset_result_t* results,
+                                    uint32_t max, uint32_t* actual) {
+    canary_.Assert();
+    DEBUG_ASSERT(max > 0u);
+
+    for (;;) {
+        // The event is level triggered, this returns right away while
+        // entries are ready.
+        mx_status_t status = event_.Wait(deadline);
+        if (status != MX_OK)
+            return status;
+
+        AutoLock lock(&lock_);
+        if (cancelled_)
+            return MX_ERR_CANCELED;
+
+        // Entries may have stopped being ready since the event was seen.
+        if (num_ready_ == 0u)
+            continue;
+
+        // Report the oldest ready entries and move them to the back of the
+        // list, so that with a small |max| every entry gets its turn.
+        uint32_t count = static_cast<uint32_t>(mxtl::min<size_t>(max, num_ready_));
+        for (uint32_t i = 0; i < count; i++) {
+            WaitSetEntry* entry = ready_.pop_front();
+            results[i].cookie = entry->cookie_;
+            results[i].status = entry->handle_closed_ ? MX_ERR_CANCELED : MX_OK;
+            results[i].observed = entry->observed_;
+            ready_.push_back(entry);
+        }
+        *actual = count;
+        return MX_OK;
+    }
+}
@@ -40,6 +40,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/syscalls_timer.cpp \
     $(LOCAL_DIR)/syscalls_vmar.cpp \
     $(LOCAL_DIR)/syscalls_vmo.cpp \
+    $(LOCAL_DIR)/syscalls_waitset.cpp \
 
 # We need a header file generated by kernel/lib/vdso/rules.mk.
 MODULE_COMPILEFLAGS += -I$(BUILDDIR)/kernel/lib/vdso
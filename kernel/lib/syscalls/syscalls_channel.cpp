@@ -28,6 +28,9 @@
 
 #define LOCAL_TRACE 0
 
+constexpr uint32_t kMaxBatchMessages = MX_CHANNEL_MAX_BATCH_MSGS;
+constexpr uint32_t kMaxBatchHandles = MX_CHANNEL_MAX_BATCH_HANDLES;
+
 static mx_status_t channel_call_epilogue(ProcessDispatcher* up,
                                          mxtl::unique_ptr<MessagePacket> reply,
                                          mx_channel_call_args_t* args,
@@ -204,7 +207,7 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u options 0x%x\n",
             handle_value, _bytes.get(), num_bytes, _handles.get(), num_handles, options);
 
-    if (options)
+    if (options & ~MX_CHANNEL_WRITE_MOVE_PAGES)
         return MX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -216,7 +219,11 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
 
 
     mxtl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(_bytes, num_bytes, num_handles, &msg);
+    if (options & MX_CHANNEL_WRITE_MOVE_PAGES) {
+        result = MessagePacket::CreatePaged(_bytes, num_bytes, num_handles, &msg);
+    } else {
+        result = MessagePacket::Create(_bytes, num_bytes, num_handles, &msg);
+    }
     if (result != MX_OK)
         return result;
 
@@ -224,8 +231,10 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     if (num_handles > 0u) {
         result = msg_put_handles(up, msg.get(), handles, _handles, num_handles,
                                  static_cast<Dispatcher*>(channel.get()));
-        if (result)
+        if (result) {
+            msg->ReturnPages();
             return result;
+        }
     }
 
     result = channel->Write(mxtl::move(msg));
@@ -242,6 +251,223 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     return MX_OK;
 }
 
+mx_status_t sys_channel_read_many(mx_handle_t handle_value, uint32_t options,
+                                  user_ptr<const mx_channel_batch_args_t> _args,
+                                  user_ptr<uint32_t> _actual_msgs) {
+    LTRACEF("handle %d args %p\n", handle_value, _args.get());
+
+    if (options)
+        return MX_ERR_INVALID_ARGS;
+
+    mx_channel_batch_args_t args;
+    if (_args.copy_from_user(&args) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    if (args.num_msgs == 0u)
+        return MX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_READ, &channel);
+    if (result != MX_OK)
+        return result;
+
+    uint32_t max_msgs = mxtl::min(args.num_msgs, kMaxBatchMessages);
+    uint32_t max_handles = mxtl::min(args.num_handles, kMaxBatchHandles);
+
+    ChannelDispatcher::MessageList msgs;
+    mx_channel_msg_info_t infos[kMaxBatchMessages];
+    result = channel->ReadMany(max_msgs, args.num_bytes, max_handles, &msgs,
+                               &infos[0].num_bytes, &infos[0].num_handles);
+    if (result == MX_ERR_BUFFER_TOO_SMALL) {
+        // Report the size of the message that did not fit, like channel_read.
+        if (make_user_ptr(args.msgs).copy_array_to_user(infos, 1) != MX_OK)
+            return MX_ERR_INVALID_ARGS;
+        if (_actual_msgs && _actual_msgs.copy_to_user(0u) != MX_OK)
+            return MX_ERR_INVALID_ARGS;
+        return result;
+    }
+    if (result != MX_OK)
+        return result;
+
+    // Copy out the data of every message back to back, and gather the handles
+    // so that they can be copied out and installed in one go.
+    auto bytes = make_user_ptr(args.bytes);
+    uint32_t num_msgs = 0;
+    uint32_t total_bytes = 0;
+    uint32_t total_handles = 0;
+    Handle* handle_list[kMaxBatchHandles];
+    for (auto& msg : msgs) {
+        if (msg.data_size() > 0u) {
+            if (msg.CopyDataTo(bytes.byte_offset(total_bytes)) != MX_OK)
+                return MX_ERR_INVALID_ARGS;
+        }
+        for (uint32_t i = 0; i < msg.num_handles(); ++i)
+            handle_list[total_handles + i] = msg.handles()[i];
+
+        infos[num_msgs].num_bytes = msg.data_size();
+        infos[num_msgs].num_handles = msg.num_handles();
+        total_bytes += msg.data_size();
+        total_handles += msg.num_handles();
+        ++num_msgs;
+    }
+
+    if (make_user_ptr(args.msgs).copy_array_to_user(infos, num_msgs) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+    if (_actual_msgs && _actual_msgs.copy_to_user(num_msgs) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    // As with channel_read, the handles buffer is written after the data buffer.
+    if (total_handles > 0u) {
+        mx_handle_t hvs[kMaxBatchHandles];
+        for (uint32_t i = 0; i < total_handles; ++i)
+            hvs[i] = up->MapHandleToValue(handle_list[i]);
+        make_user_ptr(args.handles).copy_array_to_user(hvs, total_handles);
+
+        for (auto& msg : msgs)
+            msg.set_owns_handles(false);
+
+        for (uint32_t i = 0; i < total_handles; ++i) {
+            if (handle_list[i]->dispatcher()->get_state_tracker())
+                handle_list[i]->dispatcher()->get_state_tracker()->Cancel(handle_list[i]);
+        }
+
+        AutoLock lock(up->handle_table_lock());
+        for (uint32_t i = 0; i < total_handles; ++i)
+            up->AddHandleLocked(HandleOwner(handle_list[i]));
+    }
+
+    ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), total_bytes, total_handles, 0);
+    return MX_OK;
+}
+
+// Batched version of msg_put_handles(): moves the handles in |handles| out of
+// the process and into the packets of |msgs|, in order, taking the handle table
+// lock only once for the whole batch.
+static mx_status_t msgs_put_handles(ProcessDispatcher* up, ChannelDispatcher::MessageList* msgs,
+                                    const mx_handle_t* handles, uint32_t num_handles,
+                                    Dispatcher* channel) {
+    AutoLock lock(up->handle_table_lock());
+
+    size_t ix = 0;
+    for (auto& msg : *msgs) {
+        for (uint32_t i = 0; i < msg.num_handles(); ++i, ++ix) {
+            auto handle = up->GetHandleLocked(handles[ix]);
+            if (!handle)
+                return MX_ERR_BAD_HANDLE;
+
+            if (handle->dispatcher().get() == channel) {
+                // You may not write a channel endpoint handle
+                // into that channel endpoint
+                return MX_ERR_NOT_SUPPORTED;
+            }
+
+            if (!magenta_rights_check(handle, MX_RIGHT_TRANSFER))
+                return MX_ERR_ACCESS_DENIED;
+
+            msg.mutable_handles()[i] = handle;
+        }
+    }
+
+    for (ix = 0; ix != num_handles; ++ix) {
+        auto handle = up->RemoveHandleLocked(handles[ix]).release();
+        // Passing duplicate handles is not allowed, even across messages.
+        if (!handle) {
+            for (size_t idx = 0; idx < ix; ++idx) {
+                up->UndoRemoveHandleLocked(handles[idx]);
+            }
+            return MX_ERR_INVALID_ARGS;
+        }
+    }
+
+    // On success, the MessagePackets own the handles.
+    for (auto& msg : *msgs)
+        msg.set_owns_handles(true);
+    return MX_OK;
+}
+
+mx_status_t sys_channel_write_many(mx_handle_t handle_value, uint32_t options,
+                                   user_ptr<const mx_channel_batch_args_t> _args) {
+    LTRACEF("handle %d args %p\n", handle_value, _args.get());
+
+    if (options)
+        return MX_ERR_INVALID_ARGS;
+
+    mx_channel_batch_args_t args;
+    if (_args.copy_from_user(&args) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    if (args.num_msgs == 0u)
+        return MX_ERR_INVALID_ARGS;
+    if (args.num_msgs > kMaxBatchMessages || args.num_handles > kMaxBatchHandles)
+        return MX_ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_WRITE, &channel);
+    if (result != MX_OK)
+        return result;
+
+    mx_channel_msg_info_t infos[kMaxBatchMessages];
+    if (make_user_ptr(args.msgs).copy_array_from_user(infos, args.num_msgs) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    mx_handle_t handles[kMaxBatchHandles];
+    if (args.num_handles > 0u) {
+        if (make_user_ptr(args.handles).copy_array_from_user(handles, args.num_handles) != MX_OK)
+            return MX_ERR_INVALID_ARGS;
+    }
+
+    // Build all of the packets before touching the handle table, so that a bad
+    // message leaves the process untouched.
+    ChannelDispatcher::MessageList msgs;
+    auto bytes = make_user_ptr<const void>(args.bytes);
+    uint64_t total_bytes = 0;
+    uint64_t total_handles = 0;
+    for (uint32_t i = 0; i < args.num_msgs; ++i) {
+        if (total_bytes + infos[i].num_bytes > args.num_bytes ||
+            total_handles + infos[i].num_handles > args.num_handles)
+            return MX_ERR_INVALID_ARGS;
+
+        mxtl::unique_ptr<MessagePacket> msg;
+        result = MessagePacket::Create(bytes.byte_offset(total_bytes), infos[i].num_bytes,
+                                       infos[i].num_handles, &msg);
+        if (result != MX_OK)
+            return result;
+
+        total_bytes += infos[i].num_bytes;
+        total_handles += infos[i].num_handles;
+        msgs.push_back(mxtl::move(msg));
+    }
+    if (total_bytes != args.num_bytes || total_handles != args.num_handles)
+        return MX_ERR_INVALID_ARGS;
+
+    if (args.num_handles > 0u) {
+        result = msgs_put_handles(up, &msgs, handles, args.num_handles,
+                                  static_cast<Dispatcher*>(channel.get()));
+        if (result != MX_OK)
+            return result;
+    }
+
+    result = channel->WriteMany(&msgs);
+    if (result != MX_OK) {
+        // Write failed, put back the handles into this process.
+        for (auto& msg : msgs)
+            msg.set_owns_handles(false);
+        AutoLock lock(up->handle_table_lock());
+        for (size_t ix = 0; ix != args.num_handles; ++ix) {
+            up->UndoRemoveHandleLocked(handles[ix]);
+        }
+        return result;
+    }
+
+    ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), (uint32_t)total_bytes,
+           (uint32_t)total_handles, 0);
+    return MX_OK;
+}
+
 mx_status_t sys_channel_call_noretry(mx_handle_t handle_value, uint32_t options,
                                      mx_time_t deadline,
                                      user_ptr<const mx_channel_call_args_t> _args,
@@ -100,3 +100,41 @@ mx_status_t sys_fifo_read(mx_handle_t handle, user_ptr<void> entries, size_t len
 
     return MX_OK;
 }
+
+mx_status_t sys_fifo_get_ring(mx_handle_t handle, user_ptr<mx_handle_t> _vmo) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<FifoDispatcher> fifo;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_READ | MX_RIGHT_WRITE,
+                                                     &fifo);
+    if (status != MX_OK)
+        return status;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = fifo->GetRing(&dispatcher, &rights);
+    if (status != MX_OK)
+        return status;
+
+    HandleOwner vmo_handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!vmo_handle)
+        return MX_ERR_NO_MEMORY;
+
+    if (_vmo.copy_to_user(up->MapHandleToValue(vmo_handle)) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(vmo_handle));
+
+    return MX_OK;
+}
+
+mx_status_t sys_fifo_notify(mx_handle_t handle) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<FifoDispatcher> fifo;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &fifo);
+    if (status != MX_OK)
+        return status;
+
+    return fifo->Notify();
+}
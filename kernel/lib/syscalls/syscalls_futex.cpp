@@ -7,6 +7,7 @@
 #include <trace.h>
 
 #include <magenta/process_dispatcher.h>
+#include <magenta/thread_dispatcher.h>
 
 #include "syscalls_priv.h"
 
@@ -36,3 +37,33 @@ mx_status_t sys_futex_requeue(user_ptr<mx_futex_t> wake_ptr, uint32_t wake_count
         wake_ptr, wake_count, current_value,
         requeue_ptr, requeue_count);
 }
+
+mx_status_t sys_futex_wait_pi(user_ptr<mx_futex_t> value_ptr, int current_value,
+                              mx_handle_t owner, mx_time_t deadline) {
+    LTRACEF("futex %p current %d owner %x\n", value_ptr.get(), current_value, owner);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // Keep the owner alive while it borrows our priority. Only threads of
+    // this process that we could otherwise modify may be boosted.
+    mxtl::RefPtr<ThreadDispatcher> thread;
+    if (owner != MX_HANDLE_INVALID) {
+        mx_status_t status = up->GetDispatcherWithRights(owner, MX_RIGHT_WRITE, &thread);
+        if (status != MX_OK)
+            return status;
+        if (thread->thread()->process() != up)
+            return MX_ERR_ACCESS_DENIED;
+    }
+
+    return up->futex_context()->FutexWaitPi(
+        value_ptr, current_value, thread ? thread->thread() : nullptr, deadline);
+}
+
+mx_status_t sys_futex_wake_op(user_ptr<const mx_futex_t> wake_ptr, uint32_t wake_count,
+                              user_ptr<mx_futex_t> op_ptr, uint32_t op_count, uint32_t op) {
+    LTRACEF("futex %p wake_count %" PRIu32 " op_futex %p op_count %" PRIu32 " op %#x\n",
+            wake_ptr.get(), wake_count, op_ptr.get(), op_count, op);
+
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexWakeOp(
+        wake_ptr, wake_count, op_ptr, op_count, op);
+}
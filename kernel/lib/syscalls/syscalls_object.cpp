@@ -18,6 +18,7 @@
 #include <magenta/handle_owner.h>
 #include <magenta/job_dispatcher.h>
 #include <magenta/magenta.h>
+#include <magenta/message_packet_allocator.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/resource_dispatcher.h>
 #include <magenta/thread_dispatcher.h>
@@ -418,6 +419,12 @@ mx_status_t sys_object_get_info(mx_handle_t handle, uint32_t topic,
                 stats.syscalls = cpu->stats.syscalls;
                 stats.reschedule_ipis = cpu->stats.reschedule_ipis;
                 stats.generic_ipis = cpu->stats.generic_ipis;
+                stats.tlb_shootdowns = cpu->stats.tlb_shootdowns;
+                stats.tlb_shootdown_pages = cpu->stats.tlb_shootdown_pages;
+                stats.tlb_full_flushes = cpu->stats.tlb_full_flushes;
+                stats.timers_coalesced = cpu->stats.timers_coalesced;
+                stats.migrations = cpu->stats.migrations;
+                stats.cache_migrations = cpu->stats.cache_migrations;
 
                 // copy out one at a time
                 if (cpu_buf.copy_array_to_user(&stats, 1, i) != MX_OK)
@@ -479,6 +486,9 @@ mx_status_t sys_object_get_info(mx_handle_t handle, uint32_t topic,
             // All other VM_PAGE_STATE_* counts get lumped into other_bytes.
             stats.other_bytes = other_bytes;
 
+            MessagePacketAllocator::GetStats(stats.channel_classes,
+                                             &stats.channel_heap_bytes);
+
             return single_record_result(
                 _buffer, buffer_size, _actual, _avail, &stats, sizeof(stats));
         }
@@ -554,6 +564,19 @@ mx_status_t sys_object_get_property(mx_handle_t handle_value, uint32_t property,
             uintptr_t value = process->aspace()->vdso_base_address();
             return _value.reinterpret<uintptr_t>().copy_to_user(value);
         }
+        case MX_PROP_THREAD_DEADLINE: {
+            if (size < sizeof(mx_thread_deadline_t))
+                return MX_ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return MX_ERR_WRONG_TYPE;
+            mx_thread_deadline_t value = {};
+            value.resource = MX_HANDLE_INVALID;
+            thread->thread()->GetDeadline(&value.budget, &value.period);
+            if (_value.reinterpret<mx_thread_deadline_t>().copy_to_user(value) != MX_OK)
+                return MX_ERR_INVALID_ARGS;
+            return MX_OK;
+        }
         default:
             return MX_ERR_INVALID_ARGS;
     }
@@ -618,6 +641,23 @@ mx_status_t sys_object_set_property(mx_handle_t handle_value, uint32_t property,
                 return MX_ERR_INVALID_ARGS;
             return process->set_debug_addr(value);
         }
+        case MX_PROP_THREAD_DEADLINE: {
+            if (size < sizeof(mx_thread_deadline_t))
+                return MX_ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return MX_ERR_WRONG_TYPE;
+            mx_thread_deadline_t value;
+            if (_value.reinterpret<const mx_thread_deadline_t>().copy_from_user(&value) != MX_OK)
+                return MX_ERR_INVALID_ARGS;
+            // Reservations come out of cpu time every other thread in the
+            // system competes for, so only holders of the root resource may
+            // make them.
+            mx_status_t status = validate_resource_handle(value.resource);
+            if (status != MX_OK)
+                return status;
+            return thread->thread()->SetDeadline(value.budget, value.period);
+        }
     }
 
     return MX_ERR_INVALID_ARGS;
@@ -113,6 +113,45 @@ mx_status_t sys_port_wait(mx_handle_t handle, mx_time_t deadline,
     return MX_OK;
 }
 
+mx_status_t sys_port_wait_many(mx_handle_t handle, mx_time_t deadline, mx_duration_t coalesce,
+                               user_ptr<mx_port_packet_t> _packets, size_t count,
+                               user_ptr<size_t> _actual) {
+    LTRACEF("handle %d count %zu\n", handle, count);
+
+    if (count == 0u)
+        return MX_ERR_INVALID_ARGS;
+    count = mxtl::min(count, static_cast<size_t>(MX_PORT_WAIT_MANY_MAX));
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PortDispatcher> port;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_READ, &port);
+    if (status != MX_OK)
+        return status;
+
+    ktrace(TAG_PORT_WAIT, (uint32_t)port->get_koid(), 0, 0, 0);
+
+    mx_port_packet_t pp[MX_PORT_WAIT_MANY_MAX];
+    size_t actual = 0;
+    mx_status_t st = port->DeQueueMany(deadline, coalesce, pp, count, &actual);
+
+    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), st, (uint32_t)actual, 0);
+
+    if (st != MX_OK)
+        return st;
+
+    // remove internal flag bits
+    for (size_t i = 0; i < actual; i++)
+        pp[i].type &= PKT_FLAG_MASK;
+
+    if (_packets.copy_array_to_user(pp, actual) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+    if (_actual.copy_to_user(actual) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    return MX_OK;
+}
+
 mx_status_t sys_port_cancel(mx_handle_t handle, mx_handle_t source, uint64_t key) {
     auto up = ProcessDispatcher::GetCurrent();
 
@@ -126,3 +126,67 @@ mx_status_t sys_socket_read(mx_handle_t handle, uint32_t options,
 
     return status;
 }
+
+mx_status_t sys_socket_writev(mx_handle_t handle, uint32_t options,
+                              user_ptr<const mx_iovec_t> _vector, size_t count,
+                              user_ptr<size_t> _actual) {
+    LTRACEF("handle %d count %zu\n", handle, count);
+
+    if (options)
+        return MX_ERR_INVALID_ARGS;
+
+    if (count > MX_SOCKET_MAX_IOVECS || (count > 0u && !_vector))
+        return MX_ERR_INVALID_ARGS;
+
+    mx_iovec_t vector[MX_SOCKET_MAX_IOVECS];
+    if (count > 0u && _vector.copy_array_from_user(vector, count) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<SocketDispatcher> socket;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &socket);
+    if (status != MX_OK)
+        return status;
+
+    size_t nwritten;
+    status = socket->WriteVector(vector, count, &nwritten);
+
+    // Caller may ignore results if desired.
+    if (status == MX_OK && _actual)
+        status = _actual.copy_to_user(nwritten);
+
+    return status;
+}
+
+mx_status_t sys_socket_readv(mx_handle_t handle, uint32_t options,
+                             user_ptr<const mx_iovec_t> _vector, size_t count,
+                             user_ptr<size_t> _actual) {
+    LTRACEF("handle %d count %zu\n", handle, count);
+
+    if (options)
+        return MX_ERR_INVALID_ARGS;
+
+    if (count > MX_SOCKET_MAX_IOVECS || (count > 0u && !_vector))
+        return MX_ERR_INVALID_ARGS;
+
+    mx_iovec_t vector[MX_SOCKET_MAX_IOVECS];
+    if (count > 0u && _vector.copy_array_from_user(vector, count) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<SocketDispatcher> socket;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_READ, &socket);
+    if (status != MX_OK)
+        return status;
+
+    size_t nread;
+    status = socket->ReadVector(vector, count, &nread);
+
+    // Caller may ignore results if desired.
+    if (status == MX_OK && _actual)
+        status = _actual.copy_to_user(nread);
+
+    return status;
+}
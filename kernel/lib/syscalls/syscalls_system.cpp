@@ -14,7 +14,11 @@
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/pmm.h>
 #include <magenta/compiler.h>
+#include <magenta/handle_owner.h>
+#include <magenta/job_dispatcher.h>
+#include <magenta/magenta.h>
 #include <magenta/process_dispatcher.h>
+#include <magenta/rights.h>
 #include <magenta/types.h>
 #include <magenta/vm_object_dispatcher.h>
 #include <platform.h>
@@ -343,3 +347,31 @@ mx_status_t sys_system_mexec(mx_handle_t kernel_vmo,
     panic("Execution should never reach here\n");
     return MX_OK;
 }
+
+mx_status_t sys_system_get_event(mx_handle_t job_handle, uint32_t kind, user_ptr<mx_handle_t> _out) {
+    LTRACEF("job %d kind %u\n", job_handle, kind);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // any job can watch for memory pressure
+    mxtl::RefPtr<JobDispatcher> job;
+    mx_status_t status = up->GetDispatcherWithRights(job_handle, MX_RIGHT_READ, &job);
+    if (status != MX_OK)
+        return status;
+
+    mxtl::RefPtr<Dispatcher> event = GetMemoryPressureEvent(kind);
+    if (!event)
+        return MX_ERR_INVALID_ARGS;
+
+    // without MX_RIGHT_WRITE, so the event can't be signaled from userspace
+    HandleOwner handle(MakeHandle(mxtl::move(event),
+                                  MX_DEFAULT_EVENT_RIGHTS & ~MX_RIGHT_WRITE));
+    if (!handle)
+        return MX_ERR_NO_MEMORY;
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != MX_OK)
+        return MX_ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+    return MX_OK;
+}
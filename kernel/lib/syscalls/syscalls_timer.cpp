@@ -56,8 +56,6 @@ mx_status_t sys_timer_start(
     if (deadline == 0u)
         return MX_ERR_INVALID_ARGS;
 
-    // TODO(cpu): support timer coalescing (aka slack).
-
     auto up = ProcessDispatcher::GetCurrent();
 
     mxtl::RefPtr<TimerDispatcher> timer;
@@ -65,7 +63,7 @@ mx_status_t sys_timer_start(
     if (status != MX_OK)
         return status;
 
-    return timer->Set(deadline, period);
+    return timer->Set(deadline, period, slack);
 }
 
 mx_status_t sys_timer_cancel(mx_handle_t handle) {
@@ -29,7 +29,7 @@
 mx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("size %#" PRIx64 "\n", size);
 
-    if (options)
+    if (options & ~(MX_VMO_LARGE_PAGES | MX_VMO_DISCARDABLE))
         return MX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -37,9 +37,15 @@ mx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_ptr<mx_handle_t
     if (res < 0)
         return res;
 
+    uint32_t vmo_options = 0;
+    if (options & MX_VMO_LARGE_PAGES)
+        vmo_options |= VmObjectPaged::kLargePages;
+    if (options & MX_VMO_DISCARDABLE)
+        vmo_options |= VmObjectPaged::kDiscardable;
+
     // create a vm object
     mxtl::RefPtr<VmObject> vmo;
-    res = VmObjectPaged::Create(0, size, &vmo);
+    res = VmObjectPaged::Create(0, vmo_options, size, &vmo);
     if (res != MX_OK)
         return res;
 
@@ -194,10 +200,15 @@ mx_status_t sys_vmo_op_range(mx_handle_t handle, uint32_t op, uint64_t offset, u
 
     auto up = ProcessDispatcher::GetCurrent();
 
-    // lookup the dispatcher from handle
-    // TODO: test rights
+    // lookup the dispatcher from handle. Locking and unlocking decide
+    // whether the kernel may throw the contents away, so they need the
+    // right to modify them.
+    // TODO: test rights for the other ops
+    mx_rights_t rights = 0;
+    if (op == MX_VMO_OP_LOCK || op == MX_VMO_OP_UNLOCK)
+        rights = MX_RIGHT_WRITE;
     mxtl::RefPtr<VmObjectDispatcher> vmo;
-    mx_status_t status = up->GetDispatcher(handle, &vmo);
+    mx_status_t status = up->GetDispatcherWithRights(handle, rights, &vmo);
     if (status != MX_OK)
         return status;
 
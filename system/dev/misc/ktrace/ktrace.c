@@ -12,11 +12,139 @@
 
 #include <magenta/device/ktrace.h>
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 
+// Bytes drained from the kernel per read while streaming.
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+// How long the drain thread sleeps once the kernel buffers are empty. The
+// per-cpu buffers have to absorb this much tracing between drains.
+#define STREAM_DRAIN_INTERVAL MX_MSEC(10)
+
+// At most one stream is active. The drain thread owns the socket and tears
+// the stream down once the reader closes its end.
+static struct {
+    mtx_t lock;
+    bool active;
+    mx_handle_t socket;
+    thrd_t thread;
+} ktrace_stream = {
+    .lock = MTX_INIT,
+};
+
+// Writes all of |data| to the socket, waiting for the reader to make room.
+static mx_status_t ktrace_stream_write(mx_handle_t socket, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t actual;
+        mx_status_t status = mx_socket_write(socket, 0, data, len, &actual);
+        if (status == MX_ERR_SHOULD_WAIT) {
+            mx_signals_t pending;
+            status = mx_object_wait_one(socket, MX_SOCKET_WRITABLE | MX_SOCKET_PEER_CLOSED,
+                                        MX_TIME_INFINITE, &pending);
+            if (status != MX_OK) {
+                return status;
+            }
+            if (!(pending & MX_SOCKET_WRITABLE)) {
+                return MX_ERR_PEER_CLOSED;
+            }
+            continue;
+        }
+        if (status != MX_OK) {
+            return status;
+        }
+        data += actual;
+        len -= actual;
+    }
+    return MX_OK;
+}
+
+static int ktrace_stream_thread(void* arg) {
+    mx_handle_t socket = ktrace_stream.socket;
+    uint8_t* buf = malloc(STREAM_CHUNK_SIZE);
+    mx_status_t status = buf ? MX_OK : MX_ERR_NO_MEMORY;
+
+    while (status == MX_OK) {
+        uint32_t actual;
+        status = mx_ktrace_read(get_root_resource(), buf, 0, STREAM_CHUNK_SIZE, &actual);
+        if (status != MX_OK) {
+            break;
+        }
+        if (actual > 0) {
+            status = ktrace_stream_write(socket, buf, actual);
+            continue;
+        }
+
+        // Nothing to drain, wait a bit unless the reader has gone away.
+        mx_signals_t pending;
+        status = mx_object_wait_one(socket, MX_SOCKET_PEER_CLOSED,
+                                    mx_deadline_after(STREAM_DRAIN_INTERVAL), &pending);
+        if (status == MX_ERR_TIMED_OUT) {
+            status = MX_OK;
+        } else if (status == MX_OK) {
+            status = MX_ERR_PEER_CLOSED;
+        }
+    }
+
+    if (status != MX_ERR_PEER_CLOSED) {
+        printf("ktrace: stream stopped: %d\n", status);
+    }
+
+    mx_ktrace_control(get_root_resource(), KTRACE_ACTION_STOP, 0, NULL);
+    free(buf);
+
+    mtx_lock(&ktrace_stream.lock);
+    mx_handle_close(ktrace_stream.socket);
+    ktrace_stream.socket = MX_HANDLE_INVALID;
+    ktrace_stream.active = false;
+    mtx_unlock(&ktrace_stream.lock);
+    return 0;
+}
+
+static mx_status_t ktrace_start_stream(uint32_t grpmask, mx_handle_t* out) {
+    mtx_lock(&ktrace_stream.lock);
+    if (ktrace_stream.active) {
+        mtx_unlock(&ktrace_stream.lock);
+        return MX_ERR_ALREADY_BOUND;
+    }
+
+    mx_handle_t h0, h1;
+    mx_status_t status = mx_socket_create(0, &h0, &h1);
+    if (status != MX_OK) {
+        mtx_unlock(&ktrace_stream.lock);
+        return status;
+    }
+
+    status = mx_ktrace_control(get_root_resource(), KTRACE_ACTION_START_STREAMING, grpmask, NULL);
+    if (status != MX_OK) {
+        goto fail;
+    }
+
+    ktrace_stream.socket = h0;
+    if (thrd_create_with_name(&ktrace_stream.thread, ktrace_stream_thread, NULL,
+                              "ktrace-stream") != thrd_success) {
+        mx_ktrace_control(get_root_resource(), KTRACE_ACTION_STOP, 0, NULL);
+        ktrace_stream.socket = MX_HANDLE_INVALID;
+        status = MX_ERR_NO_RESOURCES;
+        goto fail;
+    }
+    thrd_detach(ktrace_stream.thread);
+    ktrace_stream.active = true;
+    mtx_unlock(&ktrace_stream.lock);
+
+    *out = h1;
+    return MX_OK;
+
+fail:
+    mtx_unlock(&ktrace_stream.lock);
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+    return status;
+}
+
 static mx_status_t ktrace_read(void* ctx, void* buf, size_t count, mx_off_t off, size_t* actual) {
     uint32_t length;
     mx_status_t status = mx_ktrace_read(get_root_resource(), buf, off, count, &length);
@@ -65,6 +193,19 @@ static mx_status_t ktrace_ioctl(void* ctx, uint32_t op,
         *out_actual = sizeof(uint32_t);
         return MX_OK;
     }
+    case IOCTL_KTRACE_STREAM: {
+        if ((cmdlen != sizeof(uint32_t)) || (max < sizeof(mx_handle_t))) {
+            return MX_ERR_INVALID_ARGS;
+        }
+        mx_handle_t h;
+        mx_status_t status = ktrace_start_stream(*((const uint32_t*) cmd), &h);
+        if (status != MX_OK) {
+            return status;
+        }
+        *((mx_handle_t*) reply) = h;
+        *out_actual = sizeof(mx_handle_t);
+        return MX_OK;
+    }
     default:
         return MX_ERR_INVALID_ARGS;
     }
@@ -22,7 +22,16 @@
 #define IOCTL_KTRACE_ADD_PROBE \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_KTRACE, 2)
 
+// start tracing in streaming mode, with the per-cpu trace buffers drained
+// continuously into a socket until its other end is closed, which stops
+// tracing. Only one stream can be active at a time.
+// input: uint32_t group mask, 0 for all groups
+// reply: socket handle the trace records can be read from
+#define IOCTL_KTRACE_STREAM \
+    IOCTL(IOCTL_KIND_GET_HANDLE, IOCTL_FAMILY_KTRACE, 3)
+
 IOCTL_WRAPPER_OUT(ioctl_ktrace_get_handle, IOCTL_KTRACE_GET_HANDLE, mx_handle_t);
+IOCTL_WRAPPER_INOUT(ioctl_ktrace_stream, IOCTL_KTRACE_STREAM, uint32_t, mx_handle_t);
 
 static inline mx_status_t ioctl_ktrace_add_probe(int fd, const char* name, uint32_t* probe_id) {
     return mxio_ioctl(fd, IOCTL_KTRACE_ADD_PROBE,
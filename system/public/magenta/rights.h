@@ -65,6 +65,9 @@
 #define MX_DEFAULT_TIMERS_RIGHTS \
   (MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE)
 
+#define MX_DEFAULT_WAIT_SET_RIGHTS \
+  (MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE)
+
 #define MX_DEFAULT_VMAR_RIGHTS (MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER)
 
 #define MX_DEFAULT_VMO_RIGHTS                                                \
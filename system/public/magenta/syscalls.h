@@ -9,6 +9,7 @@
 
 #include <magenta/syscalls/pci.h>
 #include <magenta/syscalls/object.h>
+#include <magenta/syscalls/port.h>
 
 __BEGIN_CDECLS
 
@@ -41,6 +41,7 @@ typedef enum {
     MX_OBJ_TYPE_CHANNEL             = 4,
     MX_OBJ_TYPE_EVENT               = 5,
     MX_OBJ_TYPE_IOPORT              = 6,
+    MX_OBJ_TYPE_WAIT_SET            = 7,
     MX_OBJ_TYPE_INTERRUPT           = 9,
     MX_OBJ_TYPE_IOMAP               = 10,
     MX_OBJ_TYPE_PCI_DEVICE          = 11,
@@ -141,6 +142,14 @@ typedef struct mx_info_task_stats {
     //
     // This number is strictly smaller than mem_shared_bytes.
     size_t mem_scaled_shared_bytes;
+
+    // The number of page faults taken on memory mapped into the task.
+    uint64_t page_faults;
+
+    // The number of pages mapped ahead of being touched, by fault-around or
+    // sequential read-ahead. Each of them would otherwise have cost a page
+    // fault of its own if it was touched.
+    uint64_t page_faults_saved;
 } mx_info_task_stats_t;
 
 typedef struct mx_info_vmar {
@@ -296,8 +305,46 @@ typedef struct mx_info_cpu_stats {
     // inter-processor interrupts
     uint64_t reschedule_ipis;
     uint64_t generic_ipis;
+
+    // tlb shootdowns issued by this cpu
+    uint64_t tlb_shootdowns;
+    uint64_t tlb_shootdown_pages;   // pages invalidated individually by a shootdown
+    uint64_t tlb_full_flushes;      // shootdowns that flushed the entire tlb instead
+
+    // timer callbacks that ran before their slack ran out, sharing the
+    // wakeup of another timer; a subset of |timers|
+    uint64_t timers_coalesced;
+
+    // threads that started running on this cpu after last running on
+    // another one, and the subset of those that came from a cpu not sharing
+    // this cpu's last level cache
+    uint64_t migrations;
+    uint64_t cache_migrations;
 } mx_info_cpu_stats_t;
 
+// Number of size classes in mx_info_kmem_stats_t.channel_classes.
+#define MX_INFO_KMEM_CHANNEL_CLASSES 3
+
+// Kernel memory used by channel messages in one allocator size class.
+typedef struct mx_info_kmem_channel_class {
+    // The size of each allocation in this class. Messages whose data,
+    // handles and kernel bookkeeping fit are allocated from this class.
+    uint64_t object_bytes;
+
+    // The number of messages ever allocated from this class.
+    uint64_t total_allocs;
+
+    // The number of messages from this class currently queued in channels.
+    uint64_t in_use;
+
+    // The number of free objects cached per-cpu for fast reuse.
+    uint64_t cached;
+
+    // The amount of memory handed out to this class, whether in use or
+    // cached.
+    uint64_t arena_bytes;
+} mx_info_kmem_channel_class_t;
+
 // Information about kernel memory usage.
 // Can be expensive to gather.
 typedef struct mx_info_kmem_stats {
@@ -333,6 +380,15 @@ typedef struct mx_info_kmem_stats {
 
     // Non-free memory that isn't accounted for in any other field.
     uint64_t other_bytes;
+
+    // Channel message memory, broken down by size class. This memory is not
+    // part of the kernel heap; it is backed by kernel VMOs and so is included
+    // in |vmo_bytes|.
+    mx_info_kmem_channel_class_t channel_classes[MX_INFO_KMEM_CHANNEL_CLASSES];
+
+    // The portion of the kernel heap held by channel messages too large for
+    // any of |channel_classes|.
+    uint64_t channel_heap_bytes;
 } mx_info_kmem_stats_t;
 
 typedef struct mx_info_resource {
@@ -365,6 +421,20 @@ typedef struct mx_info_resource {
 // Argument is the base address of the vDSO mapping (or zero), a uintptr_t.
 #define MX_PROP_PROCESS_VDSO_BASE_ADDRESS   6u
 
+// Argument is a mx_thread_deadline_t.
+#define MX_PROP_THREAD_DEADLINE             7u
+
+// Deadline scheduling parameters of a thread: the thread is guaranteed
+// |budget| nanoseconds of cpu time in every |period|, ahead of the threads
+// scheduled by priority. Both are zero for a thread scheduled by priority.
+// Setting them takes the root resource in |resource|; get leaves it invalid.
+typedef struct mx_thread_deadline {
+    mx_duration_t budget;
+    mx_duration_t period;
+    mx_handle_t resource;
+    uint32_t reserved;
+} mx_thread_deadline_t;
+
 // Values for mx_info_thread_t.state.
 #define MX_THREAD_STATE_NEW                 0u
 #define MX_THREAD_STATE_RUNNING             1u
@@ -15,6 +15,9 @@ typedef int MX_PORT_OPT_V2_DEPRECATED __attribute__((deprecated("use 0 instead")
 #define MX_WAIT_ASYNC_ONCE          0u
 #define MX_WAIT_ASYNC_REPEATING     1u
 
+// Maximum number of packets returned by one mx_port_wait_many() call.
+#define MX_PORT_WAIT_MANY_MAX       16u
+
 // packet types.
 #define MX_PKT_TYPE_USER            0x00u
 #define MX_PKT_TYPE_SIGNAL_ONE      0x01u
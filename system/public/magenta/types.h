@@ -162,6 +162,55 @@ typedef struct {
     uint32_t rd_num_handles;
 } mx_channel_call_args_t;
 
+// Argument types for mx_channel_read_many() and mx_channel_write_many().
+// A batch of messages is packed back to back into |bytes| and |handles|,
+// with the size of each message described by the matching |msgs| entry.
+typedef struct {
+    uint32_t num_bytes;
+    uint32_t num_handles;
+} mx_channel_msg_info_t;
+
+typedef struct {
+    void* bytes;
+    mx_handle_t* handles;
+    mx_channel_msg_info_t* msgs;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+    uint32_t num_msgs;
+} mx_channel_batch_args_t;
+
+// Buffer descriptor for mx_socket_readv() and mx_socket_writev().
+typedef struct {
+    void* buffer;
+    size_t capacity;
+} mx_iovec_t;
+
+// Indices of one direction of a MX_FIFO_SHARED_RING fifo. |head| counts the
+// entries written and |tail| the entries read, both wrapping at 2^32, so the
+// ring holds head - tail entries. Each half is only stored to by one side and
+// sits on its own cache line.
+typedef struct {
+    // Written by the producer.
+    uint32_t head;
+    uint32_t producer_waiting;
+    uint32_t reserved0[14];
+    // Written by the consumer.
+    uint32_t tail;
+    uint32_t consumer_waiting;
+    uint32_t reserved1[14];
+} mx_fifo_ring_index_t;
+
+// Header at the start of the vmo of a MX_FIFO_SHARED_RING fifo. Ring 0 holds
+// the entries read by the first handle returned by mx_fifo_create(), ring 1
+// those read by the second. Entry i of a ring is at
+// ring_offset + (i % elem_count) * elem_size.
+typedef struct {
+    mx_fifo_ring_index_t ring[2];
+    uint32_t elem_count;
+    uint32_t elem_size;
+    uint64_t ring_offset[2];
+} mx_fifo_ring_header_t;
+
 // Structure for mx_object_wait_many():
 typedef struct {
     mx_handle_t handle;
@@ -169,6 +218,16 @@ typedef struct {
     mx_signals_t pending;
 } mx_wait_item_t;
 
+// Structure for mx_waitset_wait():
+typedef struct {
+    uint64_t cookie;
+    mx_status_t status;
+    mx_signals_t observed;
+} mx_waitset_result_t;
+
+// Maximum number of handles a wait set can watch.
+#define MX_WAITSET_MAX_ENTRIES 4096u
+
 typedef uint32_t mx_rights_t;
 #define MX_RIGHT_NONE             ((mx_rights_t)0u)
 #define MX_RIGHT_DUPLICATE        ((mx_rights_t)1u << 0)
@@ -186,6 +245,10 @@ typedef uint32_t mx_rights_t;
 
 #define MX_RIGHT_SAME_RIGHTS      ((mx_rights_t)1u << 31)
 
+// VM Object creation options
+#define MX_VMO_LARGE_PAGES               1u
+#define MX_VMO_DISCARDABLE               2u
+
 // VM Object opcodes
 #define MX_VMO_OP_COMMIT                 1u
 #define MX_VMO_OP_DECOMMIT               2u
@@ -197,6 +260,10 @@ typedef uint32_t mx_rights_t;
 #define MX_VMO_OP_CACHE_CLEAN            8u
 #define MX_VMO_OP_CACHE_CLEAN_INVALIDATE 9u
 
+// Written by MX_VMO_OP_LOCK to its buffer, if one is passed
+#define MX_VMO_LOCK_KEPT                 0u
+#define MX_VMO_LOCK_DISCARDED            1u
+
 // VM Object clone flags
 #define MX_VMO_CLONE_COPY_ON_WRITE       1u
 
@@ -213,6 +280,11 @@ typedef uint32_t mx_rights_t;
 #define MX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define MX_VM_FLAG_MAP_RANGE          (1u << 10)
 
+// Kinds of event returned by mx_system_get_event(), asserting
+// MX_EVENT_SIGNALED while memory pressure is at or above the level
+#define MX_SYSTEM_EVENT_MEMORY_PRESSURE_WARNING  1u
+#define MX_SYSTEM_EVENT_MEMORY_PRESSURE_CRITICAL 2u
+
 // clock ids
 #define MX_CLOCK_MONOTONIC        (0u)
 #define MX_CLOCK_UTC              (1u)
@@ -240,15 +312,30 @@ typedef int64_t mx_rel_off_t;
 
 // Channel options and limits.
 #define MX_CHANNEL_READ_MAY_DISCARD         1u
+#define MX_CHANNEL_WRITE_MOVE_PAGES         1u
 
 #define MX_CHANNEL_MAX_MSG_BYTES            65536u
 #define MX_CHANNEL_MAX_MSG_HANDLES          64u
 
+// Limit for messages written with MX_CHANNEL_WRITE_MOVE_PAGES.
+#define MX_CHANNEL_MAX_PAGED_MSG_BYTES      (16u * 1024u * 1024u)
+
+// Limits for mx_channel_read_many() and mx_channel_write_many(). The handle
+// limit applies to the whole batch, not to each message.
+#define MX_CHANNEL_MAX_BATCH_MSGS           64u
+#define MX_CHANNEL_MAX_BATCH_HANDLES        MX_CHANNEL_MAX_MSG_HANDLES
+
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
 #define MX_SOCKET_STREAM                    0u
 #define MX_SOCKET_DATAGRAM                  1u
 
+// Limit on the number of buffers passed to mx_socket_readv()/writev().
+#define MX_SOCKET_MAX_IOVECS                16u
+
+// Fifo options.
+#define MX_FIFO_SHARED_RING                 1u
+
 // Flags which can be used to to control cache policy for APIs which map memory.
 typedef enum {
     MX_CACHE_POLICY_CACHED          = 0,
@@ -273,8 +360,9 @@ typedef enum {
 // be used in both C and C++. C++ <atomic> defines names which are equivalent
 // to those in <stdatomic.h>, but these are contained in the std namespace.
 //
-// In kernel, the only operation done is a user_copy (of sizeof(int)) inside a
-// lock; otherwise the futex address is treated as a key.
+// In kernel, the only operations done are a user_copy (of sizeof(int)) or a
+// compare and exchange inside a lock; otherwise the futex address is treated
+// as a key.
 typedef int mx_futex_t;
 #else
 #ifdef _KERNEL
@@ -284,4 +372,28 @@ typedef atomic_int mx_futex_t;
 #endif
 #endif
 
+// Operations applied to the value at op_ptr by mx_futex_wake_op().
+#define MX_FUTEX_OP_SET             0u  // *op_ptr = op_arg
+#define MX_FUTEX_OP_ADD             1u  // *op_ptr += op_arg
+#define MX_FUTEX_OP_OR              2u  // *op_ptr |= op_arg
+#define MX_FUTEX_OP_ANDN            3u  // *op_ptr &= ~op_arg
+#define MX_FUTEX_OP_XOR             4u  // *op_ptr ^= op_arg
+
+// Comparisons of the old value at op_ptr against cmp_arg, deciding whether
+// mx_futex_wake_op() also wakes waiters on op_ptr.
+#define MX_FUTEX_CMP_EQ             0u
+#define MX_FUTEX_CMP_NE             1u
+#define MX_FUTEX_CMP_LT             2u
+#define MX_FUTEX_CMP_LE             3u
+#define MX_FUTEX_CMP_GT             4u
+#define MX_FUTEX_CMP_GE             5u
+
+// Packs the op argument of mx_futex_wake_op(). op_arg and cmp_arg are signed
+// 12 bit values.
+#define MX_FUTEX_OP(op, op_arg, cmp, cmp_arg)           \
+    ((((uint32_t)(op) & 0xfu) << 28) |                  \
+     (((uint32_t)(cmp) & 0xfu) << 24) |                 \
+     (((uint32_t)(op_arg) & 0xfffu) << 12) |            \
+     ((uint32_t)(cmp_arg) & 0xfffu))
+
 __END_CDECLS
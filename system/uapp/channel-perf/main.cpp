@@ -11,6 +11,7 @@
 #include <stdlib.h>
 
 #include <magenta/compiler.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
@@ -32,8 +33,28 @@ struct TestArgs {
     uint32_t size;
     uint32_t handles;
     uint32_t queue;
+    // If nonzero, messages are written and read this many at a time using
+    // mx_channel_write_many()/mx_channel_read_many().
+    uint32_t batch;
+    // If set, messages are written with MX_CHANNEL_WRITE_MOVE_PAGES from a
+    // page aligned buffer, and read back into the same buffer.
+    bool move_pages;
 };
 
+// Maps a |size| byte vmo, so that move_pages messages have whole pages of their
+// own to move.
+uint8_t* map_buffer(uint32_t size) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(size, 0u, &vmo);
+    assert(status == MX_OK);
+    uintptr_t ptr = 0;
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ptr);
+    assert(status == MX_OK);
+    mx_handle_close(vmo);
+    return reinterpret_cast<uint8_t*>(ptr);
+}
+
 void do_test(uint32_t duration, const TestArgs& test_args) {
     __UNUSED mx_status_t status;
 
@@ -48,45 +69,75 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     mx_handle_t event;
     assert(mx_event_create(0u, &event) == MX_OK);
 
-    // Storage space for our messages' stuff.
-    mxtl::unique_ptr<uint8_t[]> data;
-    if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
-        for (uint32_t i = 0; i < test_args.size; i++)
+    // Storage space for our messages' stuff (enough for a whole batch).
+    const uint32_t batch = mxtl::max(test_args.batch, 1u);
+    const uint32_t total_size = test_args.size * batch;
+    const uint32_t total_handles = test_args.handles * batch;
+    const uint32_t write_options = test_args.move_pages ? MX_CHANNEL_WRITE_MOVE_PAGES : 0u;
+    mxtl::unique_ptr<uint8_t[]> heap_data;
+    uint8_t* data = nullptr;
+    if (total_size) {
+        if (test_args.move_pages) {
+            data = map_buffer(total_size);
+        } else {
+            heap_data.reset(new uint8_t[total_size]);
+            data = heap_data.get();
+        }
+        for (uint32_t i = 0; i < total_size; i++)
             data[i] = static_cast<uint8_t>(i);
     }
     mxtl::unique_ptr<mx_handle_t[]> handles;
-    if (test_args.handles)
-        handles.reset(new mx_handle_t[test_args.handles]);
+    if (total_handles)
+        handles.reset(new mx_handle_t[total_handles]);
+    mxtl::unique_ptr<mx_channel_msg_info_t[]> msgs(new mx_channel_msg_info_t[batch]);
 
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = mx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = mx_channel_write(mp[0], write_options, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == MX_OK);
     }
 
-    duplicate_handles(test_args.handles, event, handles.get());
+    duplicate_handles(total_handles, event, handles.get());
 
     static constexpr uint32_t big_it_size = 10000;
-    uint64_t big_its = 0;
+    uint64_t its = 0;
     uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
     uint64_t end_ns;
     for (;;) {
-        big_its++;
-        for (uint32_t i = 0; i < big_it_size; i++) {
-            status = mx_channel_write(mp[0], 0, data.get(), test_args.size,
-                                      handles.get(), test_args.handles);
-            assert(status == MX_OK);
-
-            uint32_t r_size = test_args.size;
-            uint32_t r_handles = test_args.handles;
-            status = mx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
-                                     r_handles, &r_size, &r_handles);
-            assert(status == MX_OK);
-            assert(r_size == test_args.size);
-            assert(r_handles == test_args.handles);
+        if (test_args.batch) {
+            for (uint32_t i = 0; i < big_it_size; i += batch) {
+                for (uint32_t j = 0; j < batch; j++)
+                    msgs[j] = {test_args.size, test_args.handles};
+                mx_channel_batch_args_t args = {
+                    data, handles.get(), msgs.get(), total_size, total_handles, batch};
+                status = mx_channel_write_many(mp[0], 0u, &args);
+                assert(status == MX_OK);
+
+                uint32_t r_msgs = 0;
+                status = mx_channel_read_many(mp[1], 0u, &args, &r_msgs);
+                assert(status == MX_OK);
+                assert(r_msgs == batch);
+                assert(msgs[batch - 1].num_bytes == test_args.size);
+                assert(msgs[batch - 1].num_handles == test_args.handles);
+                its += batch;
+            }
+        } else {
+            for (uint32_t i = 0; i < big_it_size; i++) {
+                status = mx_channel_write(mp[0], write_options, data, test_args.size,
+                                          handles.get(), test_args.handles);
+                assert(status == MX_OK);
+
+                uint32_t r_size = test_args.size;
+                uint32_t r_handles = test_args.handles;
+                status = mx_channel_read(mp[1], 0u, data, handles.get(), r_size,
+                                         r_handles, &r_size, &r_handles);
+                assert(status == MX_OK);
+                assert(r_size == test_args.size);
+                assert(r_handles == test_args.handles);
+            }
+            its += big_it_size;
         }
 
         end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
@@ -94,7 +145,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
             break;
     }
 
-    for (uint32_t i = 0; i < test_args.handles; i++) {
+    for (uint32_t i = 0; i < total_handles; i++) {
         status = mx_handle_close(handles[i]);
         assert(status == MX_OK);
     }
@@ -104,12 +155,27 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(status == MX_OK);
     status = mx_handle_close(mp[1]);
     assert(status == MX_OK);
+    if (test_args.move_pages && total_size) {
+        status = mx_vmar_unmap(mx_vmar_root_self(), reinterpret_cast<uintptr_t>(data), total_size);
+        assert(status == MX_OK);
+    }
 
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
-    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+    double its_per_second = static_cast<double>(its) / real_duration;
+    if (test_args.move_pages) {
+        printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued, "
+                   "moving pages): %.0f iterations/second, %.1f MB/second\n",
+               test_args.size, test_args.handles, test_args.queue, its_per_second,
+               its_per_second * test_args.size / (1024.0 * 1024.0));
+    } else if (test_args.batch) {
+        printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued, "
+                   "batches of %" PRIu32 "): %.0f messages/second\n",
+               test_args.size, test_args.handles, test_args.queue, batch, its_per_second);
+    } else {
+        printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
+                   "%.0f iterations/second\n",
+               test_args.size, test_args.handles, test_args.queue, its_per_second);
+    }
 }
 
 }  // namespace
@@ -121,12 +187,14 @@ int main(int argc, char** argv) {
         "Options:\n"
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
-        "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -s    run suite (ignores -S/-H/-Q/-B/-M)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -B N  write and read messages in batches of N (default: 0, unbatched)\n"
+        "  -M    write messages with MX_CHANNEL_WRITE_MOVE_PAGES (size must be page aligned)\n";
 
     bool run_suite = false;  // -o/-s
     uint32_t duration = 5;   // -d
@@ -135,11 +203,13 @@ int main(int argc, char** argv) {
     TestArgs test_args = {
         10,                  // -S (size)
         0,                   // -H (handles)
-        0                    // -Q (queue)
+        0,                   // -Q (queue)
+        0,                   // -B (batch)
+        false                // -M (move_pages)
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosMn:d:S:H:Q:B:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -181,6 +251,13 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 test_args.queue = value;
                 break;
+            case 'B':
+                assert(optarg);
+                test_args.batch = value;
+                break;
+            case 'M':
+                test_args.move_pages = true;
+                break;
             default:  // '?'
                 argument_error(argv[0], "invalid option");
                 break;
@@ -188,6 +265,8 @@ int main(int argc, char** argv) {
     }
     if (optind < argc)
         argument_error(argv[0], "unexpected positional argument");
+    if (test_args.move_pages && test_args.batch)
+        argument_error(argv[0], "-M cannot be combined with -B");
 
     for (uint32_t i = 0; i < repeats; i++) {
         if (repeats > 1u) {
@@ -214,6 +293,23 @@ int main(int argc, char** argv) {
                 {10, 0, 1},
                 {100, 0, 1},
                 {1000, 0, 1},
+                // Batched versions of the above, to compare against one
+                // syscall per message at increasing queue depths.
+                {10, 0, 0, 1},
+                {10, 0, 0, 8},
+                {10, 0, 0, 32},
+                {100, 0, 0, 8},
+                {1000, 0, 0, 8},
+                {10, 1, 0, 8},
+                {10, 0, 1, 8},
+                {10, 0, 32, 8},
+                {10, 0, 32, 32},
+                // Large messages, copied and with their pages moved. Only
+                // the latter can go past MX_CHANNEL_MAX_MSG_BYTES.
+                {65536, 0, 0, 0, false},
+                {65536, 0, 0, 0, true},
+                {1024 * 1024, 0, 0, 0, true},
+                {4 * 1024 * 1024, 0, 0, 0, true},
             };
             for (size_t i = 0; i < mxtl::count_of(suite); i++)
                 do_test(duration, suite[i]);
@@ -49,8 +49,10 @@ static mx_status_t cpustats(mx_handle_t root_resource, mx_time_t delay) {
            " excep"
            " pagef"
            "  sysc"
-           " ints (hw  tmr tmr_cb)"
-           " ipi (rs  gen)\n");
+           " ints (hw  tmr tmr_cb coal)"
+           " ipi (rs  gen)"
+           " tlb (sd  pgs full)"
+           " mig (all xllc)\n");
     for (size_t i = 0; i < actual; i++) {
         mx_time_t idle_time = stats[i].idle_time;
 
@@ -64,7 +66,9 @@ static mx_status_t cpustats(mx_handle_t root_resource, mx_time_t delay) {
                " %6lu"
                " %5lu"
                " %5lu"
-               " %8lu %4lu %6lu"
+               " %8lu %4lu %6lu %4lu"
+               " %8lu %4lu"
+               " %8lu %4lu %4lu"
                " %8lu %4lu"
                "\n",
                i,
@@ -79,8 +83,14 @@ static mx_status_t cpustats(mx_handle_t root_resource, mx_time_t delay) {
                stats[i].ints - old_stats[i].ints,
                stats[i].timer_ints - old_stats[i].timer_ints,
                stats[i].timers - old_stats[i].timers,
+               stats[i].timers_coalesced - old_stats[i].timers_coalesced,
                stats[i].reschedule_ipis - old_stats[i].reschedule_ipis,
-               stats[i].generic_ipis - old_stats[i].generic_ipis);
+               stats[i].generic_ipis - old_stats[i].generic_ipis,
+               stats[i].tlb_shootdowns - old_stats[i].tlb_shootdowns,
+               stats[i].tlb_shootdown_pages - old_stats[i].tlb_shootdown_pages,
+               stats[i].tlb_full_flushes - old_stats[i].tlb_full_flushes,
+               stats[i].migrations - old_stats[i].migrations,
+               stats[i].cache_migrations - old_stats[i].cache_migrations);
 
         old_stats[i] = stats[i];
         last_idle_time[i] = idle_time;
@@ -144,6 +154,19 @@ static mx_status_t memstats(mx_handle_t root_resource) {
         // Maybe have a few buckets like 1s, 10s, 1m.
     }
     printf("%s\n", line);
+
+    // Channel message memory lives outside of the kernel heap, except for
+    // the messages too large for any slab size class.
+    printf("channel msgs:");
+    for (unsigned int i = 0; i < countof(stats.channel_classes); i++) {
+        const mx_info_kmem_channel_class_t* c = &stats.channel_classes[i];
+        char buf[MAX_FORMAT_SIZE_LEN];
+        printf(" [%" PRIu64 "B: %" PRIu64 " in use, %" PRIu64 " cached, %s]",
+               c->object_bytes, c->in_use, c->cached,
+               format_size(buf, sizeof(buf), c->arena_bytes));
+    }
+    char buf[MAX_FORMAT_SIZE_LEN];
+    printf(" [heap: %s]\n", format_size(buf, sizeof(buf), stats.channel_heap_bytes));
     return MX_OK;
 }
 
@@ -167,13 +190,21 @@ static void print_help(FILE* f) {
     fprintf(f, "\texcep: exceptions (undefined instruction, bad memory access, etc)\n");
     fprintf(f, "\tpagef: page faults\n");
     fprintf(f, "\tsysc:  syscalls\n");
-    fprintf(f, "\tints (hw  tmr tmr_cb): interrupt statistics\n");
+    fprintf(f, "\tints (hw  tmr tmr_cb coal): interrupt statistics\n");
     fprintf(f, "\t\thw:     hardware interrupts\n");
     fprintf(f, "\t\ttmr:    timer interrupts\n");
     fprintf(f, "\t\ttmr_cb: kernel timer events\n");
+    fprintf(f, "\t\tcoal:   timer events that shared another timer's interrupt\n");
     fprintf(f, "\tipi (rs  gen): inter-processor-interrupts\n");
     fprintf(f, "\t\trs:     reschedule events\n");
     fprintf(f, "\t\tgen:    generic interprocessor interrupts\n");
+    fprintf(f, "\ttlb (sd  pgs full): tlb shootdowns sent by this cpu\n");
+    fprintf(f, "\t\tsd:     shootdowns\n");
+    fprintf(f, "\t\tpgs:    pages invalidated individually\n");
+    fprintf(f, "\t\tfull:   shootdowns that flushed the whole tlb\n");
+    fprintf(f, "\tmig (all xllc): threads migrated to this cpu\n");
+    fprintf(f, "\t\tall:    from any other cpu\n");
+    fprintf(f, "\t\txllc:   from a cpu not sharing the last level cache\n");
 }
 
 int main(int argc, char** argv) {
@@ -2,13 +2,19 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 
 #include <magenta/syscalls.h>
 
 #define NUM_THREADS 1000
 
+// Round trips each ping-pong pair performs per wakeup latency sample.
+#define WAKEUP_ITERATIONS 20000
+
 static int thread_func(void* arg) {
   return 0;
 }
@@ -27,7 +33,103 @@ static void thread_join(thrd_t thread) {
   }
 }
 
+// A pair of threads that wake each other up through a pair of futexes, so that
+// every round trip costs two blocking wakeups.
+typedef struct {
+    atomic_int ping;
+    atomic_int pong;
+    thrd_t pinger;
+    thrd_t ponger;
+} wakeup_pair_t;
+
+static void futex_wait_for(atomic_int* value) {
+    while (atomic_load(value) == 0) {
+        mx_futex_wait((mx_futex_t*)value, 0, MX_TIME_INFINITE);
+    }
+    atomic_store(value, 0);
+}
+
+static void futex_signal(atomic_int* value) {
+    atomic_store(value, 1);
+    mx_futex_wake((mx_futex_t*)value, 1);
+}
+
+static int pinger_func(void* arg) {
+  wakeup_pair_t* pair = arg;
+  for (int i = 0; i < WAKEUP_ITERATIONS; i++) {
+      futex_signal(&pair->ping);
+      futex_wait_for(&pair->pong);
+  }
+  return 0;
+}
+
+static int ponger_func(void* arg) {
+  wakeup_pair_t* pair = arg;
+  for (int i = 0; i < WAKEUP_ITERATIONS; i++) {
+      futex_wait_for(&pair->ping);
+      futex_signal(&pair->pong);
+  }
+  return 0;
+}
+
+// Run |num_pairs| ping-pong pairs concurrently and report the average wakeup
+// latency and the aggregate wakeup rate across all of them.
+static void wakeup_latency(uint32_t num_pairs) {
+    wakeup_pair_t* pairs = calloc(num_pairs, sizeof(wakeup_pair_t));
+    if (pairs == NULL) {
+        printf("Failed to allocate %u pairs\n", num_pairs);
+        return;
+    }
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        thrd_create_with_name(&pairs[i].ponger, ponger_func, &pairs[i], "ponger");
+        thrd_create_with_name(&pairs[i].pinger, pinger_func, &pairs[i], "pinger");
+    }
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        thread_join(pairs[i].pinger);
+        thread_join(pairs[i].ponger);
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+    // Every round trip is two wakeups, one in each direction.
+    uint64_t wakeups = 2ull * WAKEUP_ITERATIONS * num_pairs;
+    printf("%3u pairs: %8.0f ns/wakeup per pair, %10.0f wakeups/s total\n",
+           num_pairs,
+           (double)elapsed * num_pairs / (double)wakeups,
+           (double)wakeups / (elapsed / 1e9));
+
+    free(pairs);
+}
+
+static void wakeup_benchmark(void) {
+    uint32_t num_cpus = mx_system_get_num_cpus();
+    printf("Measuring wakeup latency on %u cpus...\n", num_cpus);
+
+    // Scale the number of concurrently ping-ponging pairs up to twice the
+    // number of cpus, so that both the idle and the oversubscribed placement
+    // paths of the scheduler get exercised.
+    for (uint32_t pairs = 1; pairs <= num_cpus * 2; pairs *= 2) {
+        wakeup_latency(pairs);
+    }
+}
+
+static void usage(const char* prog) {
+    printf("usage: %s [wakeup]\n", prog);
+    printf("  with no arguments, repeatedly create and join %d threads\n", NUM_THREADS);
+    printf("  wakeup: measure futex wakeup latency as the number of busy cpus grows\n");
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1) {
+        if (!strcmp(argv[1], "wakeup")) {
+            wakeup_benchmark();
+            return 0;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+
     printf("Running thread stress test...\n");
     thrd_t thread[NUM_THREADS];
     while (true) {
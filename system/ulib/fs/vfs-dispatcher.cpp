@@ -101,23 +101,42 @@ void VfsDispatcher::DisconnectHandler(Handler* handler, bool need_close_cb) {
 int VfsDispatcher::Loop() {
     mx_status_t r;
 
-    // when draining queue, limit the number of messages you take
-    // at once, so you don't dominate the cpu
-    constexpr unsigned kMaxMessageBatchSize = 4;
+    // limit the number of packets taken off the port at once, so that
+    // the other threads in the pool still get a share of a burst
+    constexpr size_t kMaxPacketBatchSize = 4;
     char tname[128];
     GetThreadName(tname, sizeof(tname));
 
     for (;;) {
-        mx_port_packet_t packet;
+        mx_port_packet_t packets[kMaxPacketBatchSize];
+        size_t count;
 
-        if ((r = ioport_.wait(MX_TIME_INFINITE, &packet, 0u)) < 0) {
+        if ((r = ioport_.wait_many(MX_TIME_INFINITE, 0u, packets, kMaxPacketBatchSize,
+                                   &count)) < 0) {
             xprintf("mxio_dispatcher: port wait failed %d, worker exiting\n", r);
             return MX_OK;
         }
 
-        xprintf("port_wait: thread %s \n", tname);
+        xprintf("port_wait: thread %s, %zu packets\n", tname, count);
+
+        // Handle every packet of the batch before acting on a shutdown
+        // request, no other thread will see them.
+        bool shutdown = false;
+        for (size_t i = 0; i < count; ++i) {
+            const mx_port_packet_t& packet = packets[i];
+
+            if ((packet.signal.observed & MX_EVENT_SIGNALED) != 0) {
+                shutdown = true;
+                continue;
+            }
+
+            xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
+                    (void*)packet.key, packet.signal.observed);
 
-        if ((packet.signal.observed & MX_EVENT_SIGNALED) != 0) {
+            HandlePacket(packet);
+        }
+
+        if (shutdown) {
             // reset for the next thread
             r = shutdown_event_.wait_async(ioport_, 0u, MX_EVENT_SIGNALED,
                                            MX_WAIT_ASYNC_ONCE);
@@ -128,39 +147,42 @@ int VfsDispatcher::Loop() {
             xprintf("%s: suicide\n", tname);
             return r;
         }
+    }
+
+    // fatal error -- exiting thread
+    return MX_OK;
+}
 
-        xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
-                (void*)packet.key, packet.signal.observed);
+void VfsDispatcher::HandlePacket(const mx_port_packet_t& packet) {
+    // when draining queue, limit the number of messages you take
+    // at once, so you don't dominate the cpu
+    constexpr unsigned kMaxMessageBatchSize = 4;
+    mx_status_t r;
 
-        Handler* handler = (Handler*)(uintptr_t)packet.key;
+    Handler* handler = (Handler*)(uintptr_t)packet.key;
 
-        if (packet.signal.observed & MX_CHANNEL_READABLE) {
-            // hit cb multiple times if we know multi packets available
-            for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
-                if ((r = handler->ExecuteCallback(cb_)) != MX_OK) {
-                    // error or close: invoke callback in case of error
-                    DisconnectHandler(handler, r != ERR_DISPATCHER_DONE);
-                    goto free_handler;
-                }
-            }
-            // maybe more work to do: re-arm handler to fire again
-            if ((r = handler->SetAsyncCallback(ioport_))!= MX_OK){
-                DisconnectHandler(handler, true);
+    if (packet.signal.observed & MX_CHANNEL_READABLE) {
+        // hit cb multiple times if we know multi packets available
+        for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
+            if ((r = handler->ExecuteCallback(cb_)) != MX_OK) {
+                // error or close: invoke callback in case of error
+                DisconnectHandler(handler, r != ERR_DISPATCHER_DONE);
                 goto free_handler;
             }
-        } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
+        }
+        // maybe more work to do: re-arm handler to fire again
+        if ((r = handler->SetAsyncCallback(ioport_))!= MX_OK){
             DisconnectHandler(handler, true);
-        free_handler:
-            {
-                mxtl::AutoLock md_lock(&lock_);
-                handlers_.erase(*handler);
-            }
+            goto free_handler;
+        }
+    } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
+        DisconnectHandler(handler, true);
+    free_handler:
+        {
+            mxtl::AutoLock md_lock(&lock_);
+            handlers_.erase(*handler);
         }
-
     }
-
-    // fatal error -- exiting thread
-    return MX_OK;
 }
 
 mx_status_t VfsDispatcher::Create(mxio_dispatcher_cb_t cb, uint32_t pool_size,
@@ -17,4 +17,11 @@ mx_status_t fifo::create(uint32_t elem_count, uint32_t elem_size,
     return result;
 }
 
+mx_status_t fifo::get_ring(vmo* result) const {
+    mx_handle_t h = MX_HANDLE_INVALID;
+    mx_status_t status = mx_fifo_get_ring(get(), &h);
+    result->reset(h);
+    return status;
+}
+
 } // namespace mx
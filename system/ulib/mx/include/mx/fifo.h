@@ -6,6 +6,7 @@
 
 #include <mx/handle.h>
 #include <mx/object.h>
+#include <mx/vmo.h>
 
 namespace mx {
 
@@ -36,6 +37,12 @@ public:
     mx_status_t read(void* buffer, size_t len, uint32_t* actual_entries) const {
         return mx_fifo_read(get(), buffer, len, actual_entries);
     }
+
+    mx_status_t get_ring(vmo* result) const;
+
+    mx_status_t notify() const {
+        return mx_fifo_notify(get());
+    }
 };
 
 using unowned_fifo = const unowned<fifo>;
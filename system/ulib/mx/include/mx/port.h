@@ -36,6 +36,11 @@ public:
         return mx_port_wait(get(), deadline, packet, size);
     }
 
+    mx_status_t wait_many(mx_time_t deadline, mx_duration_t coalesce,
+                          mx_port_packet_t* packets, size_t count, size_t* actual) const {
+        return mx_port_wait_many(get(), deadline, coalesce, packets, count, actual);
+    }
+
     mx_status_t cancel(mx_handle_t source, uint64_t key) const {
         return mx_port_cancel(get(), source, key);
     }
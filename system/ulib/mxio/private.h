@@ -162,6 +162,10 @@ void mxio_chdir(mxio_t* io, const char* path);
 // Takes ownership of handle unless shared_handle is true.
 mxio_t* mxio_waitable_create(mx_handle_t h, mx_signals_t signals_in, mx_signals_t signals_out, bool shared_handle);
 
+// Like mx_object_wait_many(), but backed by a wait set kept per thread across
+// calls, so waiting on the same handles again only costs the changes.
+mx_status_t mxio_wait_many(mx_wait_item_t* items, size_t count, mx_time_t deadline);
+
 void mxio_socket_set_stream_ops(mxio_t* io);
 void mxio_socket_set_dgram_ops(mxio_t* io);
 
@@ -27,6 +27,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/unistd.c \
     $(LOCAL_DIR)/vmofile.c \
     $(LOCAL_DIR)/waitable.c \
+    $(LOCAL_DIR)/waitset.c \
     $(LOCAL_DIR)/watcher.c \
 
 MODULE_EXPORT := so
@@ -1796,7 +1796,7 @@ int poll(struct pollfd* fds, nfds_t n, int timeout) {
     int nfds = 0;
     if (r == MX_OK && nvalid > 0) {
         mx_time_t tmo = (timeout >= 0) ? mx_deadline_after(MX_MSEC(timeout)) : MX_TIME_INFINITE;
-        r = mx_object_wait_many(items, nvalid, tmo);
+        r = mxio_wait_many(items, nvalid, tmo);
         // pending signals could be reported on MX_ERR_TIMED_OUT case as well
         if (r == MX_OK || r == MX_ERR_TIMED_OUT) {
             nfds_t j = 0; // j counts up on a valid entry
@@ -1885,7 +1885,7 @@ int select(int n, fd_set* restrict rfds, fd_set* restrict wfds, fd_set* restrict
     if (r == MX_OK && nvalid > 0) {
         mx_time_t tmo = (tv == NULL) ? MX_TIME_INFINITE :
             mx_deadline_after(MX_SEC(tv->tv_sec) + MX_USEC(tv->tv_usec));
-        r = mx_object_wait_many(items, nvalid, tmo);
+        r = mxio_wait_many(items, nvalid, tmo);
         // pending signals could be reported on MX_ERR_TIMED_OUT case as well
         if (r == MX_OK || r == MX_ERR_TIMED_OUT) {
             int j = 0; // j counts up on a valid entry
@@ -0,0 +1,272 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+
+#include "private.h"
+
+// poll() and select() are handed their whole fd set on every call, but
+// programs nearly always pass the same set again. Rather than registering
+// every handle with the kernel on each call, as mx_object_wait_many() does,
+// each thread keeps a wait set holding the handles of its previous call, and
+// only adds and removes the handles that changed.
+//
+// Entries are keyed by (handle, signals), which is also the cookie they are
+// registered with, so results map straight back to them.
+//
+// The wait set keeps a reference to the object of every entry, so the objects
+// of the previous call stay alive until the thread calls again or exits, even
+// if their handles are closed in between. Entries whose handles are reported
+// closed during a call are removed before it returns.
+
+// Results fetched per mx_waitset_wait() call.
+#define WAIT_RESULTS_CHUNK 64
+
+typedef struct {
+    uint64_t key;           // 0 if the slot is free
+    uint32_t gen;           // last call that used the entry
+    mx_signals_t observed;  // signals reported for it by the current call
+} wait_entry_t;
+
+typedef struct {
+    mx_handle_t waitset;
+    uint32_t gen;
+    size_t count;
+    size_t capacity;        // power of two, or 0
+    wait_entry_t* table;    // open addressing, linear probing
+} wait_cache_t;
+
+static once_flag wait_cache_once = ONCE_FLAG_INIT;
+static tss_t wait_cache_key;
+static bool wait_cache_key_valid;
+
+static void wait_cache_free(void* arg) {
+    wait_cache_t* cache = arg;
+    mx_handle_close(cache->waitset);
+    free(cache->table);
+    free(cache);
+}
+
+static void wait_cache_key_init(void) {
+    wait_cache_key_valid = (tss_create(&wait_cache_key, wait_cache_free) == thrd_success);
+}
+
+static wait_cache_t* wait_cache_get(void) {
+    call_once(&wait_cache_once, wait_cache_key_init);
+    if (!wait_cache_key_valid) {
+        return NULL;
+    }
+
+    wait_cache_t* cache = tss_get(wait_cache_key);
+    if (cache != NULL) {
+        return cache;
+    }
+    if ((cache = calloc(1, sizeof(*cache))) == NULL) {
+        return NULL;
+    }
+    if (mx_waitset_create(0, &cache->waitset) != MX_OK) {
+        free(cache);
+        return NULL;
+    }
+    if (tss_set(wait_cache_key, cache) != thrd_success) {
+        wait_cache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+static inline uint64_t wait_key(mx_handle_t h, mx_signals_t signals) {
+    // Handle values are never 0, so neither is a key.
+    return ((uint64_t)signals << 32) | (uint32_t)h;
+}
+
+static inline size_t wait_slot(const wait_cache_t* cache, uint64_t key) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (cache->capacity - 1);
+}
+
+static wait_entry_t* wait_lookup(wait_cache_t* cache, uint64_t key) {
+    if (cache->capacity == 0) {
+        return NULL;
+    }
+    for (size_t i = wait_slot(cache, key);; i = (i + 1) & (cache->capacity - 1)) {
+        if (cache->table[i].key == key) {
+            return &cache->table[i];
+        }
+        if (cache->table[i].key == 0) {
+            return NULL;
+        }
+    }
+}
+
+static wait_entry_t* wait_insert_slot(wait_cache_t* cache, uint64_t key) {
+    size_t i = wait_slot(cache, key);
+    while (cache->table[i].key != 0) {
+        i = (i + 1) & (cache->capacity - 1);
+    }
+    return &cache->table[i];
+}
+
+static bool wait_grow(wait_cache_t* cache) {
+    size_t capacity = cache->capacity ? cache->capacity * 2 : 16;
+    wait_entry_t* table = calloc(capacity, sizeof(wait_entry_t));
+    if (table == NULL) {
+        return false;
+    }
+
+    wait_entry_t* old = cache->table;
+    size_t old_capacity = cache->capacity;
+    cache->table = table;
+    cache->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key != 0) {
+            *wait_insert_slot(cache, old[i].key) = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+// Removes |e| from the table, shifting back the entries that probed past it.
+static void wait_delete(wait_cache_t* cache, wait_entry_t* e) {
+    size_t mask = cache->capacity - 1;
+    size_t hole = (size_t)(e - cache->table);
+    for (size_t i = (hole + 1) & mask; cache->table[i].key != 0; i = (i + 1) & mask) {
+        size_t home = wait_slot(cache, cache->table[i].key);
+        // move the entry into the hole unless its home lies in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            cache->table[hole] = cache->table[i];
+            hole = i;
+        }
+    }
+    cache->table[hole].key = 0;
+    cache->count--;
+}
+
+static void wait_drop(wait_cache_t* cache, wait_entry_t* e) {
+    mx_waitset_remove(cache->waitset, e->key);
+    wait_delete(cache, e);
+}
+
+// Makes the wait set hold exactly the handles of |items|. On failure it holds
+// only the handles of |items| that came before the one that failed.
+static mx_status_t wait_sync(wait_cache_t* cache, const mx_wait_item_t* items, size_t n) {
+    cache->gen++;
+    size_t used = 0;
+    mx_status_t status = MX_OK;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = wait_key(items[i].handle, items[i].waitfor);
+        wait_entry_t* e = wait_lookup(cache, key);
+        if (e == NULL) {
+            if ((cache->count + 1) * 2 > cache->capacity && !wait_grow(cache)) {
+                status = MX_ERR_NO_MEMORY;
+                break;
+            }
+            status = mx_waitset_add(cache->waitset, items[i].handle, items[i].waitfor, key);
+            if (status != MX_OK) {
+                break;
+            }
+            e = wait_insert_slot(cache, key);
+            e->key = key;
+            e->gen = cache->gen - 1;
+            cache->count++;
+        }
+        if (e->gen != cache->gen) {
+            e->gen = cache->gen;
+            used++;
+        }
+        e->observed = 0;
+    }
+
+    // Drop what the previous calls used and this one does not, so that a
+    // failed call does not keep objects alive that nothing asked for.
+    if (used < cache->count) {
+        for (size_t i = 0; i < cache->capacity;) {
+            wait_entry_t* e = &cache->table[i];
+            if (e->key != 0 && e->gen != cache->gen) {
+                // an entry may have been shifted into this slot, look again
+                wait_drop(cache, e);
+            } else {
+                i++;
+            }
+        }
+    }
+    return status;
+}
+
+mx_status_t mxio_wait_many(mx_wait_item_t* items, size_t n, mx_time_t deadline) {
+    wait_cache_t* cache = wait_cache_get();
+    if (cache == NULL) {
+        return mx_object_wait_many(items, n, deadline);
+    }
+
+    bool retried = false;
+    for (;;) {
+        mx_status_t r = wait_sync(cache, items, n);
+        if (r != MX_OK) {
+            // A handle that was closed during the wait fails to be added
+            // back, report it the way mx_object_wait_many() does.
+            return (retried && r == MX_ERR_BAD_HANDLE) ? MX_ERR_CANCELED : r;
+        }
+
+        mx_waitset_result_t results[WAIT_RESULTS_CHUNK];
+        uint32_t actual;
+        r = mx_waitset_wait(cache->waitset, deadline, results, WAIT_RESULTS_CHUNK, &actual);
+        if (r != MX_OK) {
+            for (size_t i = 0; i < n; i++) {
+                items[i].pending = 0;
+            }
+            return r;
+        }
+
+        // Each call returns the ready entries the previous one did not, so
+        // keep going while the chunks come back full.
+        bool closed = false;
+        size_t reported = 0;
+        for (;;) {
+            for (uint32_t i = 0; i < actual; i++) {
+                wait_entry_t* e = wait_lookup(cache, results[i].cookie);
+                if (e != NULL) {
+                    e->observed = results[i].observed;
+                    closed |= (results[i].status != MX_OK);
+                }
+            }
+            reported += actual;
+            if (actual < WAIT_RESULTS_CHUNK || reported >= cache->count) {
+                break;
+            }
+            if (mx_waitset_wait(cache->waitset, 0, results, WAIT_RESULTS_CHUNK,
+                                &actual) != MX_OK) {
+                break;
+            }
+        }
+
+        if (closed) {
+            // The handle an entry was added with went away, but its value
+            // may have been reused since. Drop the entry and go around again
+            // to register whatever the value refers to now.
+            for (size_t i = 0; i < cache->capacity;) {
+                wait_entry_t* e = &cache->table[i];
+                if (e->key != 0 && (e->observed & MX_SIGNAL_HANDLE_CLOSED)) {
+                    wait_drop(cache, e);
+                } else {
+                    i++;
+                }
+            }
+            retried = true;
+            continue;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            wait_entry_t* e = wait_lookup(cache, wait_key(items[i].handle, items[i].waitfor));
+            items[i].pending = (e != NULL) ? e->observed : 0;
+        }
+        return MX_OK;
+    }
+}
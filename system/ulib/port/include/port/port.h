@@ -5,6 +5,7 @@
 #pragma once
 
 #include <magenta/compiler.h>
+#include <magenta/syscalls/port.h>
 #include <magenta/types.h>
 
 __BEGIN_CDECLS
@@ -19,6 +20,12 @@ struct port_handler {
 
 typedef struct {
     mx_handle_t handle;
+
+    // Packets port_dispatch() has received but not handled yet, so that
+    // port_cancel() can drop the ones for a handler that goes away
+    // while they are in flight.
+    mx_port_packet_t* pending;
+    size_t pending_count;
 } port_t;
 
 // Initialize a port
@@ -36,6 +43,9 @@ mx_status_t port_wait_repeating(port_t* port, port_handler_t* ph);
 // If the port wait returns and error or timeout, returns that.
 // If once is true, returns MX_OK after handling a packet.
 //
+// Otherwise, packets are received in batches of up to
+// MX_PORT_WAIT_MANY_MAX per syscall.
+//
 // If a packet is received, the callback for the port handler
 // is invoked.  If that callback returns MX_OK, port_wait()
 // is invoked on that port handler again.
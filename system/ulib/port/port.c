@@ -21,6 +21,8 @@
 #endif
 
 mx_status_t port_init(port_t* port) {
+    port->pending = NULL;
+    port->pending_count = 0;
     mx_status_t r = mx_port_create(0, &port->handle);
     zprintf("port_init(%p) port=%x\n", port, port->handle);
     return r;
@@ -48,6 +50,18 @@ mx_status_t port_cancel(port_t* port, port_handler_t* ph) {
                                    (uint64_t)(uintptr_t)ph);
     zprintf("port_cancel(%p, %p) obj=%x port=%x: r = %d\n",
             port, ph, ph->handle, port->handle, r);
+
+    // The kernel can only cancel what is still queued, also drop any
+    // signal packets for |ph| that port_dispatch() is still holding.
+    for (size_t i = 0; i < port->pending_count; i++) {
+        mx_port_packet_t* pkt = &port->pending[i];
+        if ((pkt->key == (uintptr_t)ph) && (pkt->type != MX_PKT_TYPE_USER)) {
+            pkt->key = 0;
+            if (r == MX_ERR_NOT_FOUND) {
+                r = MX_OK;
+            }
+        }
+    }
     return r;
 }
 
@@ -61,28 +75,44 @@ mx_status_t port_queue(port_t* port, port_handler_t* ph, uint32_t evt) {
     return r;
 }
 
+static void port_handle_packet(port_t* port, mx_port_packet_t* pkt) {
+    port_handler_t* ph = (void*) (uintptr_t) pkt->key;
+    if (pkt->type == MX_PKT_TYPE_USER) {
+        zprintf("port_dispatch(%p) port=%x ph=%p func=%p: evt=%x\n",
+                port, port->handle, ph, ph->func, pkt->user.u32[0]);
+        ph->func(ph, 0, pkt->user.u32[0]);
+    } else {
+        zprintf("port_dispatch(%p) port=%x ph=%p func=%p: signals=%x\n",
+                port, port->handle, ph, ph->func, pkt->signal.observed);
+        if (ph->func(ph, pkt->signal.observed, 0) == MX_OK) {
+            port_wait(port, ph);
+        }
+    }
+}
+
 mx_status_t port_dispatch(port_t* port, mx_time_t deadline, bool once) {
+    mx_port_packet_t pkts[MX_PORT_WAIT_MANY_MAX];
     for (;;) {
-        mx_port_packet_t pkt;
+        size_t count;
         mx_status_t r;
-        if ((r = mx_port_wait(port->handle, deadline, &pkt, 0)) != MX_OK) {
+        if ((r = mx_port_wait_many(port->handle, deadline, 0, pkts,
+                                   once ? 1 : countof(pkts), &count)) != MX_OK) {
             if (r != MX_ERR_TIMED_OUT) {
                 printf("port_dispatch: port wait failed %d\n", r);
             }
             return r;
         }
-        port_handler_t* ph = (void*) (uintptr_t) pkt.key;
-        if (pkt.type == MX_PKT_TYPE_USER) {
-            zprintf("port_dispatch(%p) port=%x ph=%p func=%p: evt=%x\n",
-                    port, port->handle, ph, ph->func, pkt.user.u32[0]);
-            ph->func(ph, 0, pkt.user.u32[0]);
-        } else {
-            zprintf("port_dispatch(%p) port=%x ph=%p func=%p: signals=%x\n",
-                    port, port->handle, ph, ph->func, pkt.signal.observed);
-            if (ph->func(ph, pkt.signal.observed, 0) == MX_OK) {
-                port_wait(port, ph);
+        for (size_t i = 0; i < count; i++) {
+            // A handler may cancel another one whose packet is later
+            // in this batch, in which case port_cancel() zeroes its key.
+            port->pending = &pkts[i + 1];
+            port->pending_count = count - i - 1;
+            if (pkts[i].key != 0) {
+                port_handle_packet(port, &pkts[i]);
             }
         }
+        port->pending = NULL;
+        port->pending_count = 0;
         if (once) {
             return MX_OK;
         }
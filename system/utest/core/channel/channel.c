@@ -3,13 +3,16 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <magenta/compiler.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
 #include <unittest/unittest.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -861,6 +864,327 @@ static bool channel_disallow_write_to_self(void) {
     END_TEST;
 }
 
+static uint8_t* map_pages(size_t size) {
+    mx_handle_t vmo;
+    if (mx_vmo_create(size, 0u, &vmo) != MX_OK)
+        return NULL;
+    uintptr_t ptr = 0;
+    mx_status_t status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                                     MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ptr);
+    mx_handle_close(vmo);
+    return status == MX_OK ? (uint8_t*)ptr : NULL;
+}
+
+static bool channel_move_pages(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    const size_t size = 4 * PAGE_SIZE;
+    uint8_t* src = map_pages(size);
+    uint8_t* dst = map_pages(size);
+    ASSERT_NONNULL(src, "");
+    ASSERT_NONNULL(dst, "");
+
+    // The payload must be whole pages.
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, 10, NULL, 0),
+              MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src + 1, PAGE_SIZE,
+                               NULL, 0),
+              MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src,
+                               MX_CHANNEL_MAX_PAGED_MSG_BYTES + PAGE_SIZE, NULL, 0),
+              MX_ERR_OUT_OF_RANGE, "");
+
+    // Moving the pages out of the sender leaves zeros behind, and a page
+    // aligned reader gets them moved in.
+    for (size_t i = 0; i < size; i++)
+        src[i] = (uint8_t)i;
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0),
+              MX_OK, "");
+    for (size_t i = 0; i < size; i += PAGE_SIZE / 4)
+        EXPECT_EQ(src[i], 0u, "sender pages not moved");
+
+    uint32_t actual;
+    EXPECT_EQ(mx_channel_read(channel[1], 0u, dst, NULL, size, 0, &actual, NULL), MX_OK, "");
+    EXPECT_EQ(actual, size, "");
+    bool match = true;
+    for (size_t i = 0; i < size; i++)
+        match = match && dst[i] == (uint8_t)i;
+    EXPECT_TRUE(match, "moved data mismatch");
+
+    // An unaligned reader gets a copy.
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, dst, size, NULL, 0),
+              MX_OK, "");
+    EXPECT_EQ(mx_channel_read(channel[1], 0u, dst, NULL, size - PAGE_SIZE, 0, &actual, NULL),
+              MX_ERR_BUFFER_TOO_SMALL, "");
+    uint8_t* buf = malloc(size + 1);
+    ASSERT_NONNULL(buf, "");
+    EXPECT_EQ(mx_channel_read(channel[1], 0u, buf + 1, NULL, size, 0, &actual, NULL), MX_OK, "");
+    match = true;
+    for (size_t i = 0; i < size; i++)
+        match = match && buf[i + 1] == (uint8_t)i;
+    EXPECT_TRUE(match, "copied data mismatch");
+    free(buf);
+
+    // A write that fails leaves the sender's data in place.
+    for (size_t i = 0; i < size; i++)
+        src[i] = (uint8_t)(i + 1);
+    mx_handle_t bad_handle = MX_HANDLE_INVALID;
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size,
+                               &bad_handle, 1),
+              MX_ERR_BAD_HANDLE, "");
+    match = true;
+    for (size_t i = 0; i < size; i++)
+        match = match && src[i] == (uint8_t)(i + 1);
+    EXPECT_TRUE(match, "pages lost on bad handle");
+
+    EXPECT_EQ(mx_handle_close(channel[1]), MX_OK, "");
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0),
+              MX_ERR_PEER_CLOSED, "");
+    match = true;
+    for (size_t i = 0; i < size; i++)
+        match = match && src[i] == (uint8_t)(i + 1);
+    EXPECT_TRUE(match, "pages lost on closed peer");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)src, size), MX_OK, "");
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)dst, size), MX_OK, "");
+    EXPECT_EQ(mx_handle_close(channel[0]), MX_OK, "");
+
+    END_TEST;
+}
+
+static bool channel_paged_bytes_limit(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    const size_t size = MX_CHANNEL_MAX_PAGED_MSG_BYTES;
+    uint8_t* src = map_pages(size);
+    ASSERT_NONNULL(src, "");
+
+    // Up to 64MB of paged messages can be queued.
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0),
+                  MX_OK, "");
+    }
+
+    // The next one is refused and its pages are put back.
+    for (size_t i = 0; i < size; i += PAGE_SIZE)
+        src[i] = (uint8_t)(i / PAGE_SIZE + 1);
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0),
+              MX_ERR_NO_RESOURCES, "");
+    bool match = true;
+    for (size_t i = 0; i < size; i += PAGE_SIZE)
+        match = match && src[i] == (uint8_t)(i / PAGE_SIZE + 1);
+    EXPECT_TRUE(match, "pages lost on full channel");
+
+    // Reading makes room again.
+    uint32_t actual;
+    EXPECT_EQ(mx_channel_read(channel[1], MX_CHANNEL_READ_MAY_DISCARD, NULL, NULL, 0, 0,
+                              &actual, NULL),
+              MX_ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0),
+              MX_OK, "");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)src, size), MX_OK, "");
+    EXPECT_EQ(mx_handle_close(channel[0]), MX_OK, "");
+    EXPECT_EQ(mx_handle_close(channel[1]), MX_OK, "");
+
+    END_TEST;
+}
+
+static bool handle_is_valid(mx_handle_t handle) {
+    return mx_object_get_info(handle, MX_INFO_HANDLE_VALID, NULL, 0, NULL, NULL) == MX_OK;
+}
+
+static bool channel_write_read_many(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+
+    // Three messages packed back to back, the second carrying a handle.
+    const char data[] = "abcdefghijkl";
+    mx_channel_msg_info_t infos[3] = {{4u, 0u}, {8u, 1u}, {0u, 0u}};
+    mx_channel_batch_args_t args = {
+        (void*)data, &event, infos, 12u, 1u, 3u,
+    };
+    ASSERT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_OK, "");
+    EXPECT_FALSE(handle_is_valid(event), "handle not transferred");
+
+    char bytes[64];
+    mx_handle_t handles[4];
+    mx_channel_msg_info_t out[8];
+    memset(out, 0, sizeof(out));
+    mx_channel_batch_args_t rargs = {
+        bytes, handles, out, sizeof(bytes), countof(handles), countof(out),
+    };
+    uint32_t actual_msgs = 0;
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 3u, "");
+    EXPECT_EQ(out[0].num_bytes, 4u, "");
+    EXPECT_EQ(out[0].num_handles, 0u, "");
+    EXPECT_EQ(out[1].num_bytes, 8u, "");
+    EXPECT_EQ(out[1].num_handles, 1u, "");
+    EXPECT_EQ(out[2].num_bytes, 0u, "");
+    EXPECT_EQ(memcmp(bytes, data, 12u), 0, "data mismatch");
+    EXPECT_TRUE(handle_is_valid(handles[0]), "handle not received");
+    mx_handle_close(handles[0]);
+
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_ERR_SHOULD_WAIT, "");
+
+    mx_handle_close(channel[0]);
+    mx_handle_close(channel[1]);
+    END_TEST;
+}
+
+static bool channel_read_many_partial(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    char data[100];
+    memset(data, 'x', sizeof(data));
+    ASSERT_EQ(mx_channel_write(channel[0], 0u, data, 10u, NULL, 0u), MX_OK, "");
+    ASSERT_EQ(mx_channel_write(channel[0], 0u, data, 10u, NULL, 0u), MX_OK, "");
+    ASSERT_EQ(mx_channel_write(channel[0], 0u, data, 10u, NULL, 0u), MX_OK, "");
+    ASSERT_EQ(mx_channel_write(channel[0], 0u, data, 100u, NULL, 0u), MX_OK, "");
+
+    // No more messages than there are entries in |msgs|.
+    char bytes[64];
+    mx_channel_msg_info_t out[8];
+    mx_channel_batch_args_t args = {bytes, NULL, out, sizeof(bytes), 0u, 2u};
+    uint32_t actual_msgs = 0;
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &args, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 2u, "");
+
+    // The batch stops before the message that does not fit.
+    args.num_msgs = countof(out);
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &args, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 1u, "");
+    EXPECT_EQ(out[0].num_bytes, 10u, "");
+
+    // Which is then reported like channel_read does, and left in the channel.
+    out[0].num_bytes = 0u;
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, &args, &actual_msgs),
+              MX_ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(actual_msgs, 0u, "");
+    EXPECT_EQ(out[0].num_bytes, 100u, "");
+
+    char big[100];
+    args.bytes = big;
+    args.num_bytes = sizeof(big);
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &args, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 1u, "");
+    EXPECT_EQ(out[0].num_bytes, 100u, "");
+
+    mx_handle_close(channel[0]);
+    mx_handle_close(channel[1]);
+    END_TEST;
+}
+
+static bool channel_write_many_rollback(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+    mx_handle_t no_transfer;
+    ASSERT_EQ(mx_handle_duplicate(event, MX_RIGHT_READ, &no_transfer), MX_OK, "");
+
+    const char data[] = "abcdefgh";
+    mx_channel_msg_info_t infos[2] = {{4u, 1u}, {4u, 1u}};
+    mx_handle_t handles[2];
+    mx_channel_batch_args_t args = {(void*)data, handles, infos, 8u, 2u, 2u};
+
+    // A bad handle in the second message fails the whole batch, and the
+    // handle of the first message stays with the caller.
+    handles[0] = event;
+    handles[1] = MX_HANDLE_INVALID;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_ERR_BAD_HANDLE, "");
+    EXPECT_TRUE(handle_is_valid(event), "");
+
+    handles[1] = no_transfer;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_ERR_ACCESS_DENIED, "");
+    EXPECT_TRUE(handle_is_valid(event), "");
+    EXPECT_TRUE(handle_is_valid(no_transfer), "");
+
+    // Duplicates are caught across messages.
+    handles[1] = event;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_ERR_INVALID_ARGS, "");
+    EXPECT_TRUE(handle_is_valid(event), "");
+
+    // Sizes that do not add up.
+    infos[1].num_bytes = 5u;
+    handles[1] = MX_HANDLE_INVALID;
+    infos[1].num_handles = 0u;
+    args.num_handles = 1u;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_ERR_INVALID_ARGS, "");
+    EXPECT_TRUE(handle_is_valid(event), "");
+
+    // Nothing was written.
+    char bytes[16];
+    mx_channel_msg_info_t out[2];
+    mx_channel_batch_args_t rargs = {bytes, NULL, out, sizeof(bytes), 0u, 2u};
+    uint32_t actual_msgs;
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_ERR_SHOULD_WAIT, "");
+
+    mx_handle_close(no_transfer);
+    mx_handle_close(event);
+    mx_handle_close(channel[0]);
+    mx_handle_close(channel[1]);
+    END_TEST;
+}
+
+static bool channel_many_peer_closed(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), MX_OK, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+
+    const char data[] = "abcdefgh";
+    mx_channel_msg_info_t infos[2] = {{4u, 0u}, {4u, 0u}};
+    mx_channel_batch_args_t args = {(void*)data, NULL, infos, 8u, 0u, 2u};
+    ASSERT_EQ(mx_channel_write_many(channel[0], 0u, &args), MX_OK, "");
+    ASSERT_EQ(mx_handle_close(channel[0]), MX_OK, "");
+
+    // Messages written before the peer closed can still be read, one batch
+    // at a time, before the closed peer is reported.
+    char bytes[16];
+    mx_channel_msg_info_t out[2];
+    mx_channel_batch_args_t rargs = {bytes, NULL, out, sizeof(bytes), 0u, 1u};
+    uint32_t actual_msgs = 0;
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 1u, "");
+    ASSERT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_OK, "");
+    EXPECT_EQ(actual_msgs, 1u, "");
+    EXPECT_EQ(memcmp(bytes, data + 4, 4u), 0, "");
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, &rargs, &actual_msgs), MX_ERR_PEER_CLOSED, "");
+
+    // Writing to the closed peer fails and gives the handles back.
+    infos[1].num_handles = 1u;
+    args.handles = &event;
+    args.num_handles = 1u;
+    EXPECT_EQ(mx_channel_write_many(channel[1], 0u, &args), MX_ERR_PEER_CLOSED, "");
+    EXPECT_TRUE(handle_is_valid(event), "");
+
+    mx_handle_close(event);
+    mx_handle_close(channel[1]);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -874,6 +1198,12 @@ RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
+RUN_TEST(channel_move_pages)
+RUN_TEST(channel_paged_bytes_limit)
+RUN_TEST(channel_write_read_many)
+RUN_TEST(channel_read_many_partial)
+RUN_TEST(channel_write_many_rollback)
+RUN_TEST(channel_many_peer_closed)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,12 +3,15 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <unittest/unittest.h>
 
@@ -108,8 +111,191 @@ static bool basic_test(void) {
     END_TEST;
 }
 
+static bool shared_ring_test(void) {
+    BEGIN_TEST;
+    mx_handle_t a, b;
+    uint32_t actual;
+    uint64_t n = 0;
+
+    EXPECT_EQ(mx_fifo_create(8, 8, 2, &a, &b), MX_ERR_INVALID_ARGS, "");
+
+    // A plain fifo has no ring.
+    ASSERT_EQ(mx_fifo_create(8, 8, 0, &a, &b), MX_OK, "");
+    mx_handle_t vmo;
+    EXPECT_EQ(mx_fifo_get_ring(a, &vmo), MX_ERR_NOT_SUPPORTED, "");
+    EXPECT_EQ(mx_fifo_notify(a), MX_ERR_NOT_SUPPORTED, "");
+    mx_handle_close(a);
+    mx_handle_close(b);
+
+    ASSERT_EQ(mx_fifo_create(8, 8, MX_FIFO_SHARED_RING, &a, &b), MX_OK, "");
+    EXPECT_SIGNALS(a, MX_FIFO_WRITABLE | MX_SIGNAL_LAST_HANDLE);
+    EXPECT_EQ(mx_fifo_write(a, &n, sizeof(n), &actual), MX_ERR_NOT_SUPPORTED, "");
+    EXPECT_EQ(mx_fifo_read(b, &n, sizeof(n), &actual), MX_ERR_NOT_SUPPORTED, "");
+
+    ASSERT_EQ(mx_fifo_get_ring(a, &vmo), MX_OK, "");
+    mx_info_handle_basic_t info;
+    ASSERT_EQ(mx_object_get_info(vmo, MX_INFO_HANDLE_BASIC, &info, sizeof(info), NULL, NULL),
+              MX_OK, "");
+    EXPECT_EQ(info.rights, MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_MAP | MX_RIGHT_TRANSFER, "");
+    EXPECT_EQ(mx_vmo_set_size(vmo, PAGE_SIZE), MX_ERR_ACCESS_DENIED, "");
+
+    // Both ends hand out the same vmo.
+    mx_handle_t other_vmo;
+    ASSERT_EQ(mx_fifo_get_ring(b, &other_vmo), MX_OK, "");
+    mx_info_handle_basic_t other_info;
+    ASSERT_EQ(mx_object_get_info(other_vmo, MX_INFO_HANDLE_BASIC, &other_info,
+                                 sizeof(other_info), NULL, NULL), MX_OK, "");
+    EXPECT_EQ(info.koid, other_info.koid, "");
+    mx_handle_close(other_vmo);
+
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, 3 * PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr), MX_OK, "");
+    mx_handle_close(vmo);
+
+    mx_fifo_ring_header_t* header = (mx_fifo_ring_header_t*)addr;
+    ASSERT_EQ(header->elem_count, 8u, "");
+    ASSERT_EQ(header->elem_size, 8u, "");
+
+    // |a| writes the ring that |b| reads.
+    mx_fifo_ring_index_t* index = &header->ring[1];
+    uint64_t* entries = (uint64_t*)(addr + header->ring_offset[1]);
+
+    // Nothing changes until someone rings the doorbell.
+    entries[0] = 42u;
+    __atomic_store_n(&index->head, 1u, __ATOMIC_SEQ_CST);
+    EXPECT_SIGNALS(b, MX_FIFO_WRITABLE | MX_SIGNAL_LAST_HANDLE);
+    EXPECT_EQ(mx_fifo_notify(a), MX_OK, "");
+    EXPECT_SIGNALS(b, MX_FIFO_READABLE | MX_FIFO_WRITABLE | MX_SIGNAL_LAST_HANDLE);
+
+    // Fill the ring.
+    for (uint32_t i = 1; i < 8u; i++) {
+        entries[i] = 42u + i;
+    }
+    __atomic_store_n(&index->head, 8u, __ATOMIC_SEQ_CST);
+    EXPECT_EQ(mx_fifo_notify(a), MX_OK, "");
+    EXPECT_SIGNALS(a, MX_SIGNAL_LAST_HANDLE);
+
+    // Drain it from the other side.
+    for (uint32_t i = 0; i < 8u; i++) {
+        EXPECT_EQ(entries[i % header->elem_count], 42u + i, "");
+    }
+    __atomic_store_n(&index->tail, 8u, __ATOMIC_SEQ_CST);
+    EXPECT_EQ(mx_fifo_notify(b), MX_OK, "");
+    EXPECT_SIGNALS(a, MX_FIFO_WRITABLE | MX_SIGNAL_LAST_HANDLE);
+    EXPECT_SIGNALS(b, MX_FIFO_WRITABLE | MX_SIGNAL_LAST_HANDLE);
+
+    mx_handle_close(b);
+    EXPECT_SIGNALS(a, MX_FIFO_PEER_CLOSED | MX_SIGNAL_LAST_HANDLE);
+    EXPECT_EQ(mx_fifo_notify(a), MX_OK, "");
+    EXPECT_SIGNALS(a, MX_FIFO_PEER_CLOSED | MX_SIGNAL_LAST_HANDLE);
+
+    // Ringing the doorbell takes the right to write.
+    mx_handle_t read_only;
+    ASSERT_EQ(mx_handle_duplicate(a, MX_RIGHT_READ, &read_only), MX_OK, "");
+    EXPECT_EQ(mx_fifo_notify(read_only), MX_ERR_ACCESS_DENIED, "");
+    mx_handle_close(read_only);
+
+    mx_handle_close(a);
+    mx_vmar_unmap(mx_vmar_root_self(), addr, 3 * PAGE_SIZE);
+
+    END_TEST;
+}
+
+typedef struct {
+    mx_handle_t fifo;
+    mx_fifo_ring_header_t* header;
+    uint32_t count;
+} ring_consumer_args_t;
+
+// Consumes |count| entries from the ring read by |fifo| using the sleep
+// protocol described in docs/objects/fifo.md, returning their sum.
+static int ring_consumer(void* arg) {
+    ring_consumer_args_t* args = arg;
+    mx_fifo_ring_index_t* index = &args->header->ring[1];
+    const uint64_t* entries = (const uint64_t*)((uintptr_t)args->header +
+                                                args->header->ring_offset[1]);
+    uint64_t sum = 0;
+    uint32_t tail = 0;
+    while (tail < args->count) {
+        uint32_t head = __atomic_load_n(&index->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            __atomic_store_n(&index->consumer_waiting, 1u, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&index->head, __ATOMIC_SEQ_CST) == tail) {
+                mx_fifo_notify(args->fifo);
+                mx_object_wait_one(args->fifo, MX_FIFO_READABLE, MX_TIME_INFINITE, NULL);
+            }
+            __atomic_store_n(&index->consumer_waiting, 0u, __ATOMIC_RELAXED);
+            continue;
+        }
+        for (; tail != head; tail++) {
+            sum += entries[tail % args->header->elem_count];
+        }
+        __atomic_store_n(&index->tail, tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&index->producer_waiting, __ATOMIC_SEQ_CST))
+            mx_fifo_notify(args->fifo);
+    }
+    return (int)(sum % 1000003u);
+}
+
+static bool shared_ring_threads_test(void) {
+    BEGIN_TEST;
+    mx_handle_t a, b;
+    const uint32_t kCount = 100000u;
+
+    ASSERT_EQ(mx_fifo_create(16, 8, MX_FIFO_SHARED_RING, &a, &b), MX_OK, "");
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_fifo_get_ring(a, &vmo), MX_OK, "");
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, 3 * PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr), MX_OK, "");
+    mx_handle_close(vmo);
+
+    mx_fifo_ring_header_t* header = (mx_fifo_ring_header_t*)addr;
+    mx_fifo_ring_index_t* index = &header->ring[1];
+    uint64_t* entries = (uint64_t*)(addr + header->ring_offset[1]);
+
+    ring_consumer_args_t args = {b, header, kCount};
+    thrd_t consumer;
+    ASSERT_EQ(thrd_create(&consumer, ring_consumer, &args), thrd_success, "");
+
+    uint64_t sum = 0;
+    uint32_t head = 0;
+    while (head < kCount) {
+        uint32_t tail = __atomic_load_n(&index->tail, __ATOMIC_ACQUIRE);
+        if (head - tail == header->elem_count) {
+            __atomic_store_n(&index->producer_waiting, 1u, __ATOMIC_SEQ_CST);
+            if (head - __atomic_load_n(&index->tail, __ATOMIC_SEQ_CST) == header->elem_count) {
+                mx_fifo_notify(a);
+                mx_object_wait_one(a, MX_FIFO_WRITABLE, MX_TIME_INFINITE, NULL);
+            }
+            __atomic_store_n(&index->producer_waiting, 0u, __ATOMIC_RELAXED);
+            continue;
+        }
+        for (; head - tail < header->elem_count && head < kCount; head++) {
+            entries[head % header->elem_count] = head;
+            sum += head;
+        }
+        __atomic_store_n(&index->head, head, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&index->consumer_waiting, __ATOMIC_SEQ_CST))
+            mx_fifo_notify(a);
+    }
+
+    int result;
+    ASSERT_EQ(thrd_join(consumer, &result), thrd_success, "");
+    EXPECT_EQ((uint64_t)result, sum % 1000003u, "");
+
+    mx_handle_close(a);
+    mx_handle_close(b);
+    mx_vmar_unmap(mx_vmar_root_self(), addr, 3 * PAGE_SIZE);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(fifo_tests)
 RUN_TEST(basic_test)
+RUN_TEST(shared_ring_test)
+RUN_TEST(shared_ring_threads_test)
 END_TEST_CASE(fifo_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,10 +3,12 @@
 // found in the LICENSE file.
 
 #include <inttypes.h>
+#include <errno.h>
 #include <limits.h>
 #include <magenta/syscalls.h>
 #include <magenta/threads.h>
 #include <unittest/unittest.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -448,10 +450,191 @@ static bool test_futex_misaligned() {
     ASSERT_EQ(mx_futex_wait(futex, 0, MX_TIME_INFINITE), MX_ERR_INVALID_ARGS, "");
     ASSERT_EQ(mx_futex_wake(futex, 1), MX_ERR_INVALID_ARGS, "");
     ASSERT_EQ(mx_futex_requeue(futex, 1, 0, futex_2, 1), MX_ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_futex_wait_pi(futex, 0, MX_HANDLE_INVALID, MX_TIME_INFINITE),
+              MX_ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_futex_wake_op(futex, 1, futex_2, 1, MX_FUTEX_OP(MX_FUTEX_OP_SET, 0,
+                                                                 MX_FUTEX_CMP_EQ, 0)),
+              MX_ERR_INVALID_ARGS, "");
 
     END_TEST;
 }
 
+// Test that futex_wake_op() updates op_ptr, wakes wake_ptr waiters, and
+// only wakes op_ptr waiters when the comparison holds.
+static bool test_futex_wake_op() {
+    BEGIN_TEST;
+    volatile int wake_value = 1;
+    volatile int op_value = 1;
+
+    {
+        TestThread wake_thread(&wake_value);
+        TestThread op_thread(&op_value);
+        wake_value++;
+        ASSERT_EQ(mx_futex_wake_op(const_cast<int*>(&wake_value), 1,
+                                   const_cast<int*>(&op_value), 1,
+                                   MX_FUTEX_OP(MX_FUTEX_OP_ADD, 1, MX_FUTEX_CMP_EQ, 1)),
+                  MX_OK, "");
+        EXPECT_EQ(op_value, 2, "op was not applied");
+        wake_thread.assert_thread_woken();
+        op_thread.assert_thread_woken();
+    }
+
+    {
+        TestThread op_thread(&op_value);
+        ASSERT_EQ(mx_futex_wake_op(const_cast<int*>(&wake_value), 1,
+                                   const_cast<int*>(&op_value), 1,
+                                   MX_FUTEX_OP(MX_FUTEX_OP_SET, -3, MX_FUTEX_CMP_LT, 0)),
+                  MX_OK, "");
+        EXPECT_EQ(op_value, -3, "op was not applied");
+        op_thread.assert_thread_not_woken();
+        check_futex_wake(&op_value, 1);
+        op_thread.assert_thread_woken();
+    }
+
+    END_TEST;
+}
+
+// Test the bit operations and argument checks of futex_wake_op().
+static bool test_futex_wake_op_args() {
+    BEGIN_TEST;
+    mx_futex_t wake_value = 0;
+    mx_futex_t op_value = 0x0f;
+
+    const struct {
+        uint32_t op;
+        int arg;
+        int expected;
+    } ops[] = {
+        {MX_FUTEX_OP_OR, 0x30, 0x3f},
+        {MX_FUTEX_OP_ANDN, 0x0f, 0x30},
+        {MX_FUTEX_OP_XOR, 0x11, 0x21},
+        {MX_FUTEX_OP_ADD, -0x22, -0x01},
+    };
+    for (const auto& op : ops) {
+        ASSERT_EQ(mx_futex_wake_op(&wake_value, 0, &op_value, 0,
+                                   MX_FUTEX_OP(op.op, op.arg, MX_FUTEX_CMP_EQ, 0)),
+                  MX_OK, "");
+        EXPECT_EQ(op_value, op.expected, "");
+    }
+
+    EXPECT_EQ(mx_futex_wake_op(&wake_value, 1, &op_value, 1,
+                               MX_FUTEX_OP(15, 0, MX_FUTEX_CMP_EQ, 0)),
+              MX_ERR_INVALID_ARGS, "bad op");
+    EXPECT_EQ(mx_futex_wake_op(&wake_value, 1, &op_value, 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_SET, 0, 15, 0)),
+              MX_ERR_INVALID_ARGS, "bad comparison");
+    EXPECT_EQ(mx_futex_wake_op(&wake_value, 1, nullptr, 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_SET, 0, MX_FUTEX_CMP_EQ, 0)),
+              MX_ERR_INVALID_ARGS, "bad op_ptr");
+    EXPECT_EQ(op_value, -0x01, "failed calls modified op_ptr");
+
+    END_TEST;
+}
+
+struct PiWaiter {
+    mx_futex_t* futex;
+    mx_handle_t owner;
+    mx_status_t status;
+};
+
+static int pi_wait_thread(void* arg) {
+    auto waiter = static_cast<PiWaiter*>(arg);
+    waiter->status = mx_futex_wait_pi(waiter->futex, 1, waiter->owner, MX_TIME_INFINITE);
+    return 0;
+}
+
+// Test that futex_wait_pi() checks its owner and is woken like futex_wait().
+static bool test_futex_wait_pi() {
+    BEGIN_TEST;
+    mx_futex_t futex_value = 1;
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+
+    EXPECT_EQ(mx_futex_wait_pi(&futex_value, 1, self, MX_TIME_INFINITE),
+              MX_ERR_INVALID_ARGS, "owner is the caller");
+    EXPECT_EQ(mx_futex_wait_pi(&futex_value, 2, MX_HANDLE_INVALID, MX_TIME_INFINITE),
+              MX_ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_futex_wait_pi(&futex_value, 1, MX_HANDLE_INVALID, mx_deadline_after(MX_MSEC(1))),
+              MX_ERR_TIMED_OUT, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+    EXPECT_EQ(mx_futex_wait_pi(&futex_value, 1, event, MX_TIME_INFINITE),
+              MX_ERR_WRONG_TYPE, "owner is not a thread");
+    mx_handle_close(event);
+
+    mx_handle_t read_only;
+    ASSERT_EQ(mx_handle_duplicate(self, MX_RIGHT_READ, &read_only), MX_OK, "");
+    EXPECT_EQ(mx_futex_wait_pi(&futex_value, 1, read_only, MX_TIME_INFINITE),
+              MX_ERR_ACCESS_DENIED, "owner handle lacks MX_RIGHT_WRITE");
+    mx_handle_close(read_only);
+
+    // Several waiters lending their priority to this thread, which wakes
+    // them one at a time.
+    PiWaiter waiters[3];
+    thrd_t threads[3];
+    for (int i = 0; i < 3; i++) {
+        waiters[i] = {&futex_value, self, MX_ERR_INTERNAL};
+        ASSERT_EQ(thrd_create_with_name(&threads[i], pi_wait_thread, &waiters[i], "pi_waiter"),
+                  thrd_success, "");
+    }
+    mx_nanosleep(mx_deadline_after(MX_MSEC(100)));
+
+    futex_value = 2;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(mx_futex_wake(&futex_value, 1), MX_OK, "");
+    }
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(thrd_join(threads[i], NULL), thrd_success, "");
+        // A waiter that was slow to start sees the changed value instead.
+        EXPECT_TRUE(waiters[i].status == MX_OK || waiters[i].status == MX_ERR_BAD_STATE, "");
+    }
+
+    END_TEST;
+}
+
+// Test that a PTHREAD_PRIO_INHERIT mutex excludes, and tracks its owner.
+static pthread_mutex_t pi_mutex;
+static int pi_mutex_counter;
+
+static void* pi_mutex_thread(void* arg) {
+    for (int i = 0; i < 10000; i++) {
+        pthread_mutex_lock(&pi_mutex);
+        pi_mutex_counter++;
+        pthread_mutex_unlock(&pi_mutex);
+    }
+    return nullptr;
+}
+
+static bool test_pthread_mutex_pi() {
+    BEGIN_TEST;
+
+    pthread_mutexattr_t attr;
+    ASSERT_EQ(pthread_mutexattr_init(&attr), 0, "");
+    EXPECT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT), ENOTSUP, "");
+    ASSERT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT), 0, "");
+    int protocol;
+    ASSERT_EQ(pthread_mutexattr_getprotocol(&attr, &protocol), 0, "");
+    EXPECT_EQ(protocol, PTHREAD_PRIO_INHERIT, "");
+    ASSERT_EQ(pthread_mutex_init(&pi_mutex, &attr), 0, "");
+    pthread_mutexattr_destroy(&attr);
+
+    // Only the owner may unlock.
+    ASSERT_EQ(pthread_mutex_unlock(&pi_mutex), EPERM, "");
+
+    pi_mutex_counter = 0;
+    pthread_t threads[4];
+    for (auto& thread : threads) {
+        ASSERT_EQ(pthread_create(&thread, nullptr, pi_mutex_thread, nullptr), 0, "");
+    }
+    for (auto& thread : threads) {
+        ASSERT_EQ(pthread_join(thread, nullptr), 0, "");
+    }
+    EXPECT_EQ(pi_mutex_counter, 4 * 10000, "");
+
+    pthread_mutex_destroy(&pi_mutex);
+    END_TEST;
+}
+
 static void log(const char* str) {
     uint64_t now = mx_time_get(MX_CLOCK_MONOTONIC);
     unittest_printf("[%08" PRIu64 ".%08" PRIu64 "]: %s",
@@ -544,6 +727,10 @@ RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_thread_suspended);
 RUN_TEST(test_futex_misaligned);
+RUN_TEST(test_futex_wake_op);
+RUN_TEST(test_futex_wake_op_args);
+RUN_TEST(test_futex_wait_pi);
+RUN_TEST(test_pthread_mutex_pi);
 RUN_TEST(test_event_signaling);
 END_TEST_CASE(futex_tests)
 
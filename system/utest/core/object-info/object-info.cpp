@@ -68,6 +68,9 @@ bool task_stats_smoke() {
 
     ASSERT_GT(info.mem_scaled_shared_bytes, 0u, "");
     ASSERT_GT(info.mem_shared_bytes, info.mem_scaled_shared_bytes, "");
+
+    // Everything a process touches is faulted in on demand.
+    ASSERT_GT(info.page_faults, 0u, "");
     END_TEST;
 }
 
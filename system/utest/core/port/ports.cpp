@@ -543,6 +543,93 @@ static bool threads_event_repeat() {
     return threads_event(MX_WAIT_ASYNC_REPEATING);
 }
 
+static bool wait_many_test() {
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t port;
+    status = mx_port_create(0, &port);
+    EXPECT_EQ(status, MX_OK, "");
+
+    for (uint64_t ix = 0; ix != 5u; ++ix) {
+        mx_port_packet_t in = {ix, MX_PKT_TYPE_USER, 0, { {} }};
+        status = mx_port_queue(port, &in, 0u);
+        EXPECT_EQ(status, MX_OK, "");
+    }
+
+    mx_port_packet_t out[MX_PORT_WAIT_MANY_MAX] = {};
+    size_t actual = 0u;
+
+    status = mx_port_wait_many(port, 0ull, 0ull, out, 0u, &actual);
+    EXPECT_EQ(status, MX_ERR_INVALID_ARGS, "");
+
+    status = mx_port_wait_many(port, 0ull, 0ull, out, 3u, &actual);
+    EXPECT_EQ(status, MX_OK, "");
+    EXPECT_EQ(actual, 3u, "");
+    for (uint64_t ix = 0; ix != 3u; ++ix) {
+        EXPECT_EQ(out[ix].key, ix, "packets out of order");
+        EXPECT_EQ(out[ix].type, MX_PKT_TYPE_USER, "");
+    }
+
+    status = mx_port_wait_many(port, 0ull, 0ull, out, mxtl::count_of(out), &actual);
+    EXPECT_EQ(status, MX_OK, "");
+    EXPECT_EQ(actual, 2u, "");
+    EXPECT_EQ(out[0].key, 3u, "");
+    EXPECT_EQ(out[1].key, 4u, "");
+
+    status = mx_port_wait_many(port, 0ull, 0ull, out, mxtl::count_of(out), &actual);
+    EXPECT_EQ(status, MX_ERR_TIMED_OUT, "");
+
+    status = mx_handle_close(port);
+    EXPECT_EQ(status, MX_OK, "");
+
+    END_TEST;
+}
+
+static int wait_many_producer(void* arg) {
+    auto port = *reinterpret_cast<mx_handle_t*>(arg);
+    for (uint64_t ix = 0; ix != 4u; ++ix) {
+        mx_nanosleep(mx_deadline_after(MX_MSEC(1)));
+        mx_port_packet_t in = {ix, MX_PKT_TYPE_USER, 0, { {} }};
+        if (mx_port_queue(port, &in, 0u) != MX_OK)
+            return -1;
+    }
+    return 0;
+}
+
+static bool wait_many_coalesce_test() {
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t port;
+    status = mx_port_create(0, &port);
+    EXPECT_EQ(status, MX_OK, "");
+
+    thrd_t producer;
+    ASSERT_EQ(thrd_create(&producer, wait_many_producer, &port), thrd_success, "");
+
+    // Packets trickle in 1ms apart, a generous window collects all of them.
+    mx_port_packet_t out[MX_PORT_WAIT_MANY_MAX] = {};
+    size_t total = 0u;
+    while (total < 4u) {
+        size_t actual = 0u;
+        status = mx_port_wait_many(port, MX_TIME_INFINITE, MX_SEC(5), out, 4u - total, &actual);
+        EXPECT_EQ(status, MX_OK, "");
+        for (size_t ix = 0; ix != actual; ++ix)
+            EXPECT_EQ(out[ix].key, total + ix, "packets out of order");
+        total += actual;
+    }
+
+    int ret;
+    EXPECT_EQ(thrd_join(producer, &ret), thrd_success, "");
+    EXPECT_EQ(ret, 0, "");
+
+    status = mx_handle_close(port);
+    EXPECT_EQ(status, MX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
@@ -563,6 +650,8 @@ RUN_TEST(cancel_event_key_once_after)
 RUN_TEST(cancel_event_key_repeat_after)
 RUN_TEST(threads_event_once)
 RUN_TEST(threads_event_repeat)
+RUN_TEST(wait_many_test)
+RUN_TEST(wait_many_coalesce_test)
 END_TEST_CASE(port_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <magenta/syscalls.h>
 #include <unittest/unittest.h>
 #include <stdbool.h>
@@ -427,6 +428,161 @@ static bool socket_datagram_no_short_write(void) {
     END_TEST;
 }
 
+static bool socket_vectored(void) {
+    BEGIN_TEST;
+
+    size_t count;
+    mx_status_t status;
+    mx_handle_t h0, h1;
+
+    status = mx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, MX_OK, "");
+
+    mx_iovec_t wvec[3] = {
+        {"abc", 3u},
+        {"", 0u},
+        {"defgh", 5u},
+    };
+    status = mx_socket_writev(h0, 0u, wvec, 3u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 8u, "");
+
+    char r0[2], r1[4], r2[16];
+    mx_iovec_t rvec[3] = {
+        {r0, sizeof(r0)},
+        {r1, sizeof(r1)},
+        {r2, sizeof(r2)},
+    };
+    status = mx_socket_readv(h1, 0u, rvec, 3u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 8u, "");
+    EXPECT_EQ(memcmp(r0, "ab", 2), 0, "");
+    EXPECT_EQ(memcmp(r1, "cdef", 4), 0, "");
+    EXPECT_EQ(memcmp(r2, "gh", 2), 0, "");
+
+    mx_iovec_t too_many[MX_SOCKET_MAX_IOVECS + 1] = {};
+    status = mx_socket_writev(h0, 0u, too_many, countof(too_many), &count);
+    EXPECT_EQ(status, MX_ERR_INVALID_ARGS, "");
+
+    mx_iovec_t bad[2] = {
+        {"x", 1u},
+        {(void*)1, 4096u},
+    };
+    status = mx_socket_writev(h0, 0u, bad, 2u, &count);
+    EXPECT_EQ(status, MX_ERR_INVALID_ARGS, "");
+
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_datagram_vectored(void) {
+    BEGIN_TEST;
+
+    size_t count;
+    mx_status_t status;
+    mx_handle_t h0, h1;
+
+    status = mx_socket_create(MX_SOCKET_DATAGRAM, &h0, &h1);
+    ASSERT_EQ(status, MX_OK, "");
+
+    mx_iovec_t wvec[2] = {
+        {"pac", 3u},
+        {"ket1", 5u},
+    };
+    status = mx_socket_writev(h0, 0u, wvec, 2u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 8u, "");
+
+    status = mx_socket_write(h0, 0u, "pkt2", 5u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+
+    // Both buffers together hold less than the first packet, the rest of
+    // it is dropped.
+    char r0[2], r1[3];
+    mx_iovec_t rvec[2] = {
+        {r0, sizeof(r0)},
+        {r1, sizeof(r1)},
+    };
+    status = mx_socket_readv(h1, 0u, rvec, 2u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 5u, "");
+    EXPECT_EQ(memcmp(r0, "pa", 2), 0, "");
+    EXPECT_EQ(memcmp(r1, "cke", 3), 0, "");
+
+    char rbuf[16];
+    status = mx_socket_read(h1, 0u, rbuf, sizeof(rbuf), &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 5u, "");
+    EXPECT_EQ(memcmp(rbuf, "pkt2", 5), 0, "");
+
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
+// Writes of a page or more are carried in whole pages rather than small
+// buffers. Mix them with small writes and odd sized reads.
+static bool socket_large_write(void) {
+    BEGIN_TEST;
+
+    size_t count;
+    mx_status_t status;
+    mx_handle_t h0, h1;
+
+    status = mx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, MX_OK, "");
+
+    const size_t large_size = 5 * PAGE_SIZE + 123;
+    const size_t total = 3 + large_size + 3;
+    unsigned char* wbuf = malloc(total);
+    unsigned char* rbuf = malloc(total);
+    ASSERT_NONNULL(wbuf, "");
+    ASSERT_NONNULL(rbuf, "");
+    for (size_t i = 0; i < total; i++) {
+        wbuf[i] = (unsigned char)(i * 7);
+    }
+
+    status = mx_socket_write(h0, 0u, wbuf, 3u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 3u, "");
+
+    mx_iovec_t wvec[2] = {
+        {wbuf + 3, PAGE_SIZE + 1},
+        {wbuf + 3 + PAGE_SIZE + 1, large_size - PAGE_SIZE - 1},
+    };
+    status = mx_socket_writev(h0, 0u, wvec, 2u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, large_size, "");
+
+    status = mx_socket_write(h0, 0u, wbuf + 3 + large_size, 3u, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, 3u, "");
+
+    status = mx_socket_read(h1, 0u, NULL, 0, &count);
+    ASSERT_EQ(status, MX_OK, "");
+    ASSERT_EQ(count, total, "");
+
+    size_t pos = 0;
+    while (pos < total) {
+        status = mx_socket_read(h1, 0u, rbuf + pos, 1000u, &count);
+        ASSERT_EQ(status, MX_OK, "");
+        ASSERT_GT(count, 0u, "");
+        pos += count;
+    }
+    EXPECT_EQ(pos, total, "");
+    EXPECT_EQ(memcmp(rbuf, wbuf, total), 0, "");
+
+    free(wbuf);
+    free(rbuf);
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(socket_tests)
 RUN_TEST(socket_basic)
 RUN_TEST(socket_signals)
@@ -436,6 +592,9 @@ RUN_TEST(socket_bytes_outstanding_half_close)
 RUN_TEST(socket_short_write)
 RUN_TEST(socket_datagram)
 RUN_TEST(socket_datagram_no_short_write)
+RUN_TEST(socket_vectored)
+RUN_TEST(socket_datagram_vectored)
+RUN_TEST(socket_large_write)
 END_TEST_CASE(socket_tests)
 
 #ifndef BUILD_COMBINED_TESTS
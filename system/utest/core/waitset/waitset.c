@@ -0,0 +1,197 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/util.h>
+#include <unittest/unittest.h>
+
+static bool basic_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ws;
+    ASSERT_EQ(mx_waitset_create(0, &ws), MX_OK, "");
+    EXPECT_EQ(mx_waitset_create(1, &ws), MX_ERR_INVALID_ARGS, "");
+
+    mx_handle_t ev[2];
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(mx_event_create(0, &ev[i]), MX_OK, "");
+        ASSERT_EQ(mx_waitset_add(ws, ev[i], MX_EVENT_SIGNALED, 100 + i), MX_OK, "");
+    }
+    EXPECT_EQ(mx_waitset_add(ws, ev[0], MX_USER_SIGNAL_0, 100), MX_ERR_ALREADY_EXISTS, "");
+    EXPECT_EQ(mx_waitset_add(ws, ws, MX_USER_SIGNAL_0, 200), MX_ERR_NOT_SUPPORTED, "");
+
+    // nothing is ready yet
+    mx_waitset_result_t results[4];
+    uint32_t actual = 99;
+    EXPECT_EQ(mx_waitset_wait(ws, 0, results, 4, &actual), MX_ERR_TIMED_OUT, "");
+    EXPECT_EQ(mx_waitset_wait(ws, 0, results, 0, &actual), MX_ERR_INVALID_ARGS, "");
+
+    // only the signaled event is reported, as long as it stays signaled
+    ASSERT_EQ(mx_object_signal(ev[1], 0, MX_EVENT_SIGNALED), MX_OK, "");
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(mx_waitset_wait(ws, MX_TIME_INFINITE, results, 4, &actual), MX_OK, "");
+        ASSERT_EQ(actual, 1u, "");
+        EXPECT_EQ(results[0].cookie, 101u, "");
+        EXPECT_EQ(results[0].status, MX_OK, "");
+        EXPECT_TRUE(results[0].observed & MX_EVENT_SIGNALED, "");
+    }
+
+    // and drops out once cleared
+    ASSERT_EQ(mx_object_signal(ev[1], MX_EVENT_SIGNALED, 0), MX_OK, "");
+    EXPECT_EQ(mx_waitset_wait(ws, 0, results, 4, &actual), MX_ERR_TIMED_OUT, "");
+
+    // removed entries are not reported
+    ASSERT_EQ(mx_object_signal(ev[0], 0, MX_EVENT_SIGNALED), MX_OK, "");
+    ASSERT_EQ(mx_waitset_remove(ws, 100), MX_OK, "");
+    EXPECT_EQ(mx_waitset_remove(ws, 100), MX_ERR_NOT_FOUND, "");
+    EXPECT_EQ(mx_waitset_wait(ws, 0, results, 4, &actual), MX_ERR_TIMED_OUT, "");
+
+    // closing a watched handle reports the entry as canceled until removed
+    ASSERT_EQ(mx_handle_close(ev[1]), MX_OK, "");
+    ASSERT_EQ(mx_waitset_wait(ws, 0, results, 4, &actual), MX_OK, "");
+    ASSERT_EQ(actual, 1u, "");
+    EXPECT_EQ(results[0].cookie, 101u, "");
+    EXPECT_EQ(results[0].status, MX_ERR_CANCELED, "");
+    EXPECT_TRUE(results[0].observed & MX_SIGNAL_HANDLE_CLOSED, "");
+    ASSERT_EQ(mx_waitset_remove(ws, 101), MX_OK, "");
+
+    mx_handle_close(ev[0]);
+    EXPECT_EQ(mx_handle_close(ws), MX_OK, "");
+
+    END_TEST;
+}
+
+#define NUM_EVENTS 40
+
+static bool rotate_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ws;
+    ASSERT_EQ(mx_waitset_create(0, &ws), MX_OK, "");
+
+    mx_handle_t ev[NUM_EVENTS];
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        ASSERT_EQ(mx_event_create(0, &ev[i]), MX_OK, "");
+        ASSERT_EQ(mx_waitset_add(ws, ev[i], MX_EVENT_SIGNALED, i), MX_OK, "");
+        ASSERT_EQ(mx_object_signal(ev[i], 0, MX_EVENT_SIGNALED), MX_OK, "");
+    }
+
+    // small result buffers take turns through the ready entries
+    bool seen[NUM_EVENTS] = {};
+    mx_waitset_result_t results[8];
+    for (int i = 0; i < NUM_EVENTS / 8; i++) {
+        uint32_t actual;
+        ASSERT_EQ(mx_waitset_wait(ws, 0, results, 8, &actual), MX_OK, "");
+        ASSERT_EQ(actual, 8u, "");
+        for (uint32_t j = 0; j < actual; j++) {
+            ASSERT_LT(results[j].cookie, (uint64_t)NUM_EVENTS, "");
+            EXPECT_FALSE(seen[results[j].cookie], "reported twice");
+            seen[results[j].cookie] = true;
+        }
+    }
+
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        EXPECT_TRUE(seen[i], "");
+        mx_handle_close(ev[i]);
+    }
+    mx_handle_close(ws);
+
+    END_TEST;
+}
+
+static int signal_later(void* arg) {
+    mx_nanosleep(mx_deadline_after(MX_MSEC(10)));
+    mx_object_signal(*(mx_handle_t*)arg, 0, MX_EVENT_SIGNALED);
+    return 0;
+}
+
+static bool blocking_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ws, ev;
+    ASSERT_EQ(mx_waitset_create(0, &ws), MX_OK, "");
+    ASSERT_EQ(mx_event_create(0, &ev), MX_OK, "");
+    ASSERT_EQ(mx_waitset_add(ws, ev, MX_EVENT_SIGNALED, 7), MX_OK, "");
+
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, signal_later, &ev), thrd_success, "");
+
+    mx_waitset_result_t result;
+    uint32_t actual;
+    EXPECT_EQ(mx_waitset_wait(ws, mx_deadline_after(MX_SEC(10)), &result, 1, &actual), MX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(result.cookie, 7u, "");
+    thrd_join(thread, NULL);
+
+    mx_handle_close(ev);
+    mx_handle_close(ws);
+
+    END_TEST;
+}
+
+// poll() keeps a wait set of the handles it was last asked about, make sure
+// that it still notices fds coming and going between calls.
+static bool poll_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ev[3];
+    int fds[3];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(mx_event_create(0, &ev[i]), MX_OK, "");
+        fds[i] = mxio_handle_fd(ev[i], MX_USER_SIGNAL_0, 0, false);
+        ASSERT_GE(fds[i], 0, "");
+    }
+
+    struct pollfd pfds[3];
+    for (int i = 0; i < 3; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    EXPECT_EQ(poll(pfds, 3, 0), 0, "");
+
+    ASSERT_EQ(mx_object_signal(ev[1], 0, MX_USER_SIGNAL_0), MX_OK, "");
+    EXPECT_EQ(poll(pfds, 3, 0), 1, "");
+    EXPECT_EQ(pfds[1].revents, POLLIN, "");
+
+    // drop an fd from the set
+    EXPECT_EQ(poll(pfds, 1, 0), 0, "");
+
+    // reopen an fd, likely on the same handle value, with nothing pending
+    close(fds[1]);
+    ASSERT_EQ(mx_event_create(0, &ev[1]), MX_OK, "");
+    fds[1] = mxio_handle_fd(ev[1], MX_USER_SIGNAL_0, 0, false);
+    ASSERT_GE(fds[1], 0, "");
+    pfds[1].fd = fds[1];
+    EXPECT_EQ(poll(pfds, 3, 0), 0, "");
+
+    ASSERT_EQ(mx_object_signal(ev[2], 0, MX_USER_SIGNAL_0), MX_OK, "");
+    EXPECT_EQ(poll(pfds, 3, 1000), 1, "");
+    EXPECT_EQ(pfds[2].revents, POLLIN, "");
+
+    for (int i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(waitset_tests)
+RUN_TEST(basic_test)
+RUN_TEST(rotate_test)
+RUN_TEST(blocking_test)
+RUN_TEST(poll_test)
+END_TEST_CASE(waitset_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
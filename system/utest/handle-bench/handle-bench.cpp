@@ -0,0 +1,162 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
+
+#include <unittest/unittest.h>
+
+// Operations each thread performs per run.
+constexpr uint32_t kIterations = 100000u;
+
+// Handles each thread keeps open at a time, so that closes do not always
+// immediately follow the matching duplicate.
+constexpr uint32_t kBatch = 16u;
+
+struct Worker {
+    mx_handle_t source;
+    mx_futex_t* start;
+    mx_status_t status;
+};
+
+static void wait_for_start(Worker* worker) {
+    while (__atomic_load_n(worker->start, __ATOMIC_ACQUIRE) == 0) {
+        mx_futex_wait(worker->start, 0, MX_TIME_INFINITE);
+    }
+}
+
+static int dup_close_thread(void* arg) {
+    auto worker = static_cast<Worker*>(arg);
+    wait_for_start(worker);
+
+    mx_handle_t handles[kBatch];
+    for (uint32_t i = 0; i < kIterations; i += kBatch) {
+        for (uint32_t j = 0; j < kBatch; j++) {
+            mx_status_t status = mx_handle_duplicate(worker->source, MX_RIGHT_SAME_RIGHTS,
+                                                     &handles[j]);
+            if (status != MX_OK) {
+                worker->status = status;
+                return -1;
+            }
+        }
+        for (uint32_t j = 0; j < kBatch; j++) {
+            mx_status_t status = mx_handle_close(handles[j]);
+            if (status != MX_OK) {
+                worker->status = status;
+                return -1;
+            }
+        }
+    }
+    worker->status = MX_OK;
+    return 0;
+}
+
+// Issues a cheap syscall that only has to look its handle up, so that the
+// rate is bound by handle table lookups in the calling process.
+static int lookup_thread(void* arg) {
+    auto worker = static_cast<Worker*>(arg);
+    wait_for_start(worker);
+
+    for (uint32_t i = 0; i < kIterations; i++) {
+        mx_status_t status = mx_object_signal(worker->source, 0u, 0u);
+        if (status != MX_OK) {
+            worker->status = status;
+            return -1;
+        }
+    }
+    worker->status = MX_OK;
+    return 0;
+}
+
+// Runs |num_threads| threads running |func| and prints the aggregate rate. If |shared| is true all threads duplicate the same event,
+// otherwise each gets its own, separating handle table and arena contention
+// from contention on a single object.
+static bool run_threads(uint32_t num_threads, bool shared, thrd_start_t func, const char* what) {
+    BEGIN_HELPER;
+
+    Worker workers[64];
+    thrd_t threads[64];
+    ASSERT_LE(num_threads, mxtl::count_of(workers), "too many threads");
+
+    mx_futex_t start = 0;
+    mx_handle_t shared_event;
+    ASSERT_EQ(mx_event_create(0u, &shared_event), MX_OK, "");
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i] = {shared_event, &start, MX_OK};
+        if (!shared)
+            ASSERT_EQ(mx_event_create(0u, &workers[i].source), MX_OK, "");
+        ASSERT_EQ(thrd_create(&threads[i], func, &workers[i]), thrd_success, "");
+    }
+
+    mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
+    __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+    mx_futex_wake(&start, UINT32_MAX);
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(workers[i].status, MX_OK, "worker failed");
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - t0;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (!shared)
+            mx_handle_close(workers[i].source);
+    }
+    mx_handle_close(shared_event);
+
+    uint64_t ops = static_cast<uint64_t>(num_threads) * kIterations;
+    printf("%3u threads (%s event): %6.0f ns/%s per thread, %10.0f %s/s total\n",
+           num_threads, shared ? "shared" : "own   ",
+           static_cast<double>(elapsed) * num_threads / static_cast<double>(ops), what,
+           static_cast<double>(ops) / (static_cast<double>(elapsed) / 1e9), what);
+
+    END_HELPER;
+}
+
+static bool dup_close_scaling(void) {
+    BEGIN_TEST;
+    uint32_t max_threads = mxtl::min(mx_system_get_num_cpus() * 2, 64u);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_threads; n *= 2) {
+        ASSERT_TRUE(run_threads(n, false, dup_close_thread, "dup+close"), "");
+    }
+    END_TEST;
+}
+
+static bool dup_close_shared_scaling(void) {
+    BEGIN_TEST;
+    uint32_t max_threads = mxtl::min(mx_system_get_num_cpus() * 2, 64u);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_threads; n *= 2) {
+        ASSERT_TRUE(run_threads(n, true, dup_close_thread, "dup+close"), "");
+    }
+    END_TEST;
+}
+
+static bool lookup_scaling(void) {
+    BEGIN_TEST;
+    uint32_t max_threads = mxtl::min(mx_system_get_num_cpus() * 2, 64u);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_threads; n *= 2) {
+        ASSERT_TRUE(run_threads(n, false, lookup_thread, "lookup"), "");
+    }
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(handle_bench)
+RUN_TEST_LARGE(dup_close_scaling)
+RUN_TEST_LARGE(dup_close_shared_scaling)
+RUN_TEST_LARGE(lookup_scaling)
+END_TEST_CASE(handle_bench)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
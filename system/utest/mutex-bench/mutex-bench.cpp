@@ -0,0 +1,149 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
+
+#include <unittest/unittest.h>
+
+// Lock/unlock pairs each thread does per run.
+constexpr uint32_t kLocksPerThread = 50000u;
+
+constexpr uint32_t kMaxThreads = 64u;
+
+// Keeps each mutex on its own cache line, so that threads using different
+// mutexes only share whatever the kernel does.
+struct alignas(64) PaddedMutex {
+    pthread_mutex_t mutex;
+    uint64_t count;
+};
+
+struct Worker {
+    PaddedMutex* lock;
+    mx_futex_t* start;
+    int error;
+};
+
+static void wait_for_start(mx_futex_t* start) {
+    while (__atomic_load_n(start, __ATOMIC_ACQUIRE) == 0) {
+        mx_futex_wait(start, 0, MX_TIME_INFINITE);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    auto worker = static_cast<Worker*>(arg);
+    wait_for_start(worker->start);
+
+    for (uint32_t i = 0; i < kLocksPerThread; i++) {
+        int error = pthread_mutex_lock(&worker->lock->mutex);
+        if (error != 0) {
+            worker->error = error;
+            break;
+        }
+        worker->lock->count++;
+        pthread_mutex_unlock(&worker->lock->mutex);
+    }
+    return nullptr;
+}
+
+// Runs |num_threads| threads that each take a mutex kLocksPerThread times,
+// with every |threads_per_lock| consecutive threads sharing a mutex, and
+// prints the aggregate rate.
+static bool run_workers(uint32_t num_threads, uint32_t threads_per_lock, int protocol) {
+    BEGIN_HELPER;
+
+    ASSERT_LE(num_threads, kMaxThreads, "too many threads");
+
+    pthread_mutexattr_t attr;
+    ASSERT_EQ(pthread_mutexattr_init(&attr), 0, "");
+    ASSERT_EQ(pthread_mutexattr_setprotocol(&attr, protocol), 0, "");
+
+    static PaddedMutex locks[kMaxThreads];
+    uint32_t num_locks = (num_threads + threads_per_lock - 1) / threads_per_lock;
+    for (uint32_t i = 0; i < num_locks; i++) {
+        ASSERT_EQ(pthread_mutex_init(&locks[i].mutex, &attr), 0, "");
+        locks[i].count = 0u;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    Worker workers[kMaxThreads];
+    pthread_t threads[kMaxThreads];
+    mx_futex_t start = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i] = {&locks[i / threads_per_lock], &start, 0};
+        ASSERT_EQ(pthread_create(&threads[i], nullptr, worker_thread, &workers[i]), 0, "");
+    }
+
+    mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
+    __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+    mx_futex_wake(&start, UINT32_MAX);
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        ASSERT_EQ(pthread_join(threads[i], nullptr), 0, "");
+        EXPECT_EQ(workers[i].error, 0, "worker failed to lock");
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - t0;
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num_locks; i++) {
+        total += locks[i].count;
+        pthread_mutex_destroy(&locks[i].mutex);
+    }
+    EXPECT_EQ(total, static_cast<uint64_t>(num_threads) * kLocksPerThread, "lost updates");
+
+    printf("%3u threads, %3u mutexes, %s: %10.0f locks/s\n",
+           num_threads, num_locks,
+           protocol == PTHREAD_PRIO_INHERIT ? "pi   " : "plain",
+           static_cast<double>(total) / (static_cast<double>(elapsed) / 1e9));
+
+    END_HELPER;
+}
+
+// Without |shared|, threads contend in pairs.
+static bool scaling(bool shared, int protocol) {
+    BEGIN_HELPER;
+    uint32_t max_threads = mxtl::min(mx_system_get_num_cpus() * 2, kMaxThreads);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_threads; n *= 2) {
+        ASSERT_TRUE(run_workers(n, shared ? n : 2u, protocol), "");
+    }
+    END_HELPER;
+}
+
+// Every thread fights over one mutex, so most lock calls end up in the
+// kernel on the same futex.
+static bool shared_mutex_scaling(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(scaling(true, PTHREAD_PRIO_NONE), "");
+    END_TEST;
+}
+
+static bool shared_pi_mutex_scaling(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(scaling(true, PTHREAD_PRIO_INHERIT), "");
+    END_TEST;
+}
+
+// Threads contend in pairs on separate mutexes, so the kernel sees many
+// unrelated futexes in the same process at once.
+static bool paired_mutex_scaling(void) {
+    BEGIN_TEST;
+    ASSERT_TRUE(scaling(false, PTHREAD_PRIO_NONE), "");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mutex_bench)
+RUN_TEST_LARGE(shared_mutex_scaling)
+RUN_TEST_LARGE(shared_pi_mutex_scaling)
+RUN_TEST_LARGE(paired_mutex_scaling)
+END_TEST_CASE(mutex_bench)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,179 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+#include <mxtl/algorithm.h>
+
+#include <unittest/unittest.h>
+
+// Packets each producer queues per run. Kept modest since a port has no
+// backpressure and the queue can grow to the full amount.
+constexpr uint32_t kPacketsPerProducer = 20000u;
+
+// Packets each observer-driven producer generates by signaling its event.
+constexpr uint32_t kSignalsPerProducer = 20000u;
+
+struct Producer {
+    mx_handle_t port;
+    mx_handle_t event;
+    uint32_t index;
+    mx_futex_t* start;
+    mx_status_t status;
+    int finished;
+};
+
+static void wait_for_start(mx_futex_t* start) {
+    while (__atomic_load_n(start, __ATOMIC_ACQUIRE) == 0) {
+        mx_futex_wait(start, 0, MX_TIME_INFINITE);
+    }
+}
+
+static int user_producer(void* arg) {
+    auto producer = static_cast<Producer*>(arg);
+    wait_for_start(producer->start);
+
+    mx_port_packet_t packet = {};
+    packet.key = producer->index;
+    packet.type = MX_PKT_TYPE_USER;
+    for (uint32_t i = 0; i < kPacketsPerProducer; i++) {
+        packet.user.u32[0] = i;
+        mx_status_t status = mx_port_queue(producer->port, &packet, 0u);
+        if (status != MX_OK) {
+            producer->status = status;
+            break;
+        }
+    }
+    __atomic_store_n(&producer->finished, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Toggles an event that is watched with a repeating wait, so that every
+// assertion of the signal goes through the kernel observer path.
+static int signal_producer(void* arg) {
+    auto producer = static_cast<Producer*>(arg);
+    wait_for_start(producer->start);
+
+    for (uint32_t i = 0; i < kSignalsPerProducer; i++) {
+        mx_status_t status = mx_object_signal(producer->event, 0u, MX_USER_SIGNAL_0);
+        if (status == MX_OK)
+            status = mx_object_signal(producer->event, MX_USER_SIGNAL_0, 0u);
+        if (status != MX_OK) {
+            producer->status = status;
+            break;
+        }
+    }
+    __atomic_store_n(&producer->finished, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static bool all_finished(const Producer* producers, uint32_t num_producers) {
+    for (uint32_t i = 0; i < num_producers; i++) {
+        if (__atomic_load_n(&producers[i].finished, __ATOMIC_ACQUIRE) == 0)
+            return false;
+    }
+    return true;
+}
+
+// Runs |num_producers| threads against a single consumer draining |port| and
+// prints the rate at which the consumer received packets.
+static bool run_producers(uint32_t num_producers, bool use_signals) {
+    BEGIN_HELPER;
+
+    mx_handle_t port;
+    ASSERT_EQ(mx_port_create(0u, &port), MX_OK, "");
+
+    Producer producers[64];
+    thrd_t threads[64];
+    ASSERT_LE(num_producers, mxtl::count_of(producers), "too many producers");
+
+    mx_futex_t start = 0;
+    for (uint32_t i = 0; i < num_producers; i++) {
+        producers[i] = {port, MX_HANDLE_INVALID, i, &start, MX_OK, 0};
+        if (use_signals) {
+            ASSERT_EQ(mx_event_create(0u, &producers[i].event), MX_OK, "");
+            ASSERT_EQ(mx_object_wait_async(producers[i].event, port, i, MX_USER_SIGNAL_0,
+                                           MX_WAIT_ASYNC_REPEATING), MX_OK, "");
+        }
+        ASSERT_EQ(thrd_create(&threads[i], use_signals ? signal_producer : user_producer,
+                              &producers[i]), thrd_success, "");
+    }
+
+    mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
+    __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+    mx_futex_wake(&start, UINT32_MAX);
+
+    // Signal packets for an observer coalesce while one is pending, so the
+    // number received is not known up front. Stop once every producer is
+    // done and the port has gone quiet.
+    constexpr mx_time_t kQuiet = MX_MSEC(100);
+    uint64_t received = 0;
+    const uint64_t expected = static_cast<uint64_t>(num_producers) * kPacketsPerProducer;
+    mx_time_t t1;
+    for (;;) {
+        mx_port_packet_t packet;
+        mx_status_t status = mx_port_wait(port, mx_deadline_after(kQuiet), &packet, 0u);
+        if (status == MX_ERR_TIMED_OUT) {
+            if (!all_finished(producers, num_producers))
+                continue;
+            t1 = mx_time_get(MX_CLOCK_MONOTONIC) - kQuiet;
+            break;
+        }
+        ASSERT_EQ(status, MX_OK, "");
+        if (++received == expected && !use_signals) {
+            t1 = mx_time_get(MX_CLOCK_MONOTONIC);
+            break;
+        }
+    }
+    mx_time_t elapsed = t1 - t0;
+
+    for (uint32_t i = 0; i < num_producers; i++) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(producers[i].status, MX_OK, "producer failed");
+        if (use_signals)
+            mx_handle_close(producers[i].event);
+    }
+    mx_handle_close(port);
+
+    printf("%3u %s producers: %10" PRIu64 " packets, %10.0f packets/s\n",
+           num_producers, use_signals ? "signal" : "user  ",
+           received, static_cast<double>(received) / (static_cast<double>(elapsed) / 1e9));
+
+    END_HELPER;
+}
+
+static bool user_packet_scaling(void) {
+    BEGIN_TEST;
+    uint32_t max_producers = mxtl::min(mx_system_get_num_cpus() * 2, 64u);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_producers; n *= 2) {
+        ASSERT_TRUE(run_producers(n, false), "");
+    }
+    END_TEST;
+}
+
+static bool signal_packet_scaling(void) {
+    BEGIN_TEST;
+    uint32_t max_producers = mxtl::min(mx_system_get_num_cpus() * 2, 64u);
+    printf("\n");
+    for (uint32_t n = 1; n <= max_producers; n *= 2) {
+        ASSERT_TRUE(run_producers(n, true), "");
+    }
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(port_bench)
+RUN_TEST_LARGE(user_packet_scaling)
+RUN_TEST_LARGE(signal_packet_scaling)
+END_TEST_CASE(port_bench)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,217 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <magenta/device/sysinfo.h>
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <mxtl/algorithm.h>
+
+#include <unittest/unittest.h>
+
+// How often the measuring thread wakes up, and how many times.
+constexpr mx_duration_t kWakeInterval = MX_MSEC(1);
+constexpr uint32_t kWakeups = 2000u;
+
+// Deadline parameters used for the measuring thread.
+constexpr mx_duration_t kBudget = MX_USEC(200);
+constexpr mx_duration_t kPeriod = MX_MSEC(1);
+
+constexpr uint32_t kMaxSpinners = 64u;
+
+// Setting deadline parameters takes the root resource.
+static mx_handle_t root_resource = MX_HANDLE_INVALID;
+
+static bool get_root_resource() {
+    BEGIN_HELPER;
+    if (root_resource != MX_HANDLE_INVALID)
+        return true;
+    int fd = open("/dev/misc/sysinfo", O_RDWR);
+    ASSERT_GE(fd, 0, "Can't open sysinfo");
+    ssize_t n = ioctl_sysinfo_get_root_resource(fd, &root_resource);
+    close(fd);
+    ASSERT_EQ(n, static_cast<ssize_t>(sizeof(root_resource)), "ioctl failed");
+    END_HELPER;
+}
+
+struct Load {
+    volatile bool stop;
+    pthread_t threads[kMaxSpinners];
+    uint32_t count;
+};
+
+static void* spin_thread(void* arg) {
+    auto load = static_cast<Load*>(arg);
+    while (!load->stop) {
+    }
+    return nullptr;
+}
+
+// Keeps every cpu busy, twice over, with threads at the default priority.
+static bool start_load(Load* load) {
+    BEGIN_HELPER;
+    load->stop = false;
+    load->count = mxtl::min(mx_system_get_num_cpus() * 2, kMaxSpinners);
+    for (uint32_t i = 0; i < load->count; i++) {
+        ASSERT_EQ(pthread_create(&load->threads[i], nullptr, spin_thread, load), 0, "");
+    }
+    END_HELPER;
+}
+
+static void stop_load(Load* load) {
+    load->stop = true;
+    for (uint32_t i = 0; i < load->count; i++) {
+        pthread_join(load->threads[i], nullptr);
+    }
+    load->count = 0u;
+}
+
+static int compare_durations(const void* a, const void* b) {
+    mx_duration_t x = *static_cast<const mx_duration_t*>(a);
+    mx_duration_t y = *static_cast<const mx_duration_t*>(b);
+    return (x > y) - (x < y);
+}
+
+// Sleeps until each of kWakeups evenly spaced deadlines and records how late
+// the thread got to run, then prints the distribution.
+static bool measure_wakeups(const char* label) {
+    BEGIN_HELPER;
+
+    static mx_duration_t latency[kWakeups];
+
+    mx_time_t deadline = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < kWakeups; i++) {
+        deadline += kWakeInterval;
+        ASSERT_EQ(mx_nanosleep(deadline), MX_OK, "");
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        latency[i] = now - deadline;
+        // Don't let one long stall turn into a burst of late wakeups.
+        if (now > deadline + kWakeInterval)
+            deadline = now;
+    }
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < kWakeups; i++) {
+        sum += static_cast<double>(latency[i]);
+    }
+    double mean = sum / kWakeups;
+    double var = 0.0;
+    for (uint32_t i = 0; i < kWakeups; i++) {
+        double d = static_cast<double>(latency[i]) - mean;
+        var += d * d;
+    }
+
+    qsort(latency, kWakeups, sizeof(latency[0]), compare_durations);
+    printf("%-28s latency us: mean %8.1f  p50 %8.1f  p99 %8.1f  max %8.1f  jitter(sd) %8.1f\n",
+           label, mean / 1000.0,
+           static_cast<double>(latency[kWakeups / 2]) / 1000.0,
+           static_cast<double>(latency[kWakeups * 99 / 100]) / 1000.0,
+           static_cast<double>(latency[kWakeups - 1]) / 1000.0,
+           sqrt(var / kWakeups) / 1000.0);
+
+    END_HELPER;
+}
+
+static bool set_deadline(mx_duration_t budget, mx_duration_t period) {
+    BEGIN_HELPER;
+    mx_thread_deadline_t params = {budget, period, root_resource, 0u};
+    ASSERT_EQ(mx_object_set_property(mx_thread_self(), MX_PROP_THREAD_DEADLINE,
+                                     &params, sizeof(params)), MX_OK, "");
+    END_HELPER;
+}
+
+static bool deadline_property(void) {
+    BEGIN_TEST;
+
+    ASSERT_TRUE(get_root_resource(), "");
+
+    mx_handle_t self = mx_thread_self();
+    mx_thread_deadline_t params;
+    ASSERT_EQ(mx_object_get_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_OK, "");
+    EXPECT_EQ(params.budget, 0u, "");
+    EXPECT_EQ(params.period, 0u, "");
+    EXPECT_EQ(params.resource, MX_HANDLE_INVALID, "");
+
+    // Making a reservation takes the root resource.
+    params = {kBudget, kPeriod, MX_HANDLE_INVALID, 0u};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_ERR_BAD_HANDLE, "");
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), MX_OK, "");
+    params.resource = event;
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_ERR_WRONG_TYPE, "");
+    mx_handle_close(event);
+
+    ASSERT_TRUE(set_deadline(kBudget, kPeriod), "");
+    ASSERT_EQ(mx_object_get_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_OK, "");
+    EXPECT_EQ(params.budget, kBudget, "");
+    EXPECT_EQ(params.period, kPeriod, "");
+
+    // A reservation has to fit on a single cpu, no matter how many there are.
+    params = {kPeriod, kPeriod, root_resource, 0u};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_ERR_NO_RESOURCES, "");
+
+    // The budget can not exceed the period, and only both can be zero.
+    params = {kPeriod * 2, kPeriod, root_resource, 0u};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_ERR_INVALID_ARGS, "");
+    params = {0u, kPeriod, root_resource, 0u};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params) - 1),
+              MX_ERR_BUFFER_TOO_SMALL, "");
+
+    ASSERT_TRUE(set_deadline(0u, 0u), "");
+    ASSERT_EQ(mx_object_get_property(self, MX_PROP_THREAD_DEADLINE, &params, sizeof(params)),
+              MX_OK, "");
+    EXPECT_EQ(params.budget, 0u, "");
+
+    END_TEST;
+}
+
+// Wakeup latency of a periodic thread, alone and competing with cpu bound
+// threads at the same priority, scheduled by priority and by deadline.
+static bool wakeup_jitter(void) {
+    BEGIN_TEST;
+
+    printf("\n");
+    ASSERT_TRUE(get_root_resource(), "");
+    ASSERT_TRUE(measure_wakeups("idle, priority"), "");
+
+    Load load;
+    ASSERT_TRUE(start_load(&load), "");
+    bool ok = measure_wakeups("loaded, priority");
+    if (ok) {
+        ok = set_deadline(kBudget, kPeriod);
+        if (ok)
+            ok = measure_wakeups("loaded, deadline 200us/1ms");
+        set_deadline(0u, 0u);
+    }
+    stop_load(&load);
+    ASSERT_TRUE(ok, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(sched_bench)
+RUN_TEST(deadline_property)
+RUN_TEST_LARGE(wakeup_jitter)
+END_TEST_CASE(sched_bench)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
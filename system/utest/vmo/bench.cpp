@@ -33,6 +33,135 @@ inline mx_time_t time_it(T func) {
     return mx_time_get(MX_CLOCK_MONOTONIC) - t;
 }
 
+// Time random 8 byte reads over a committed 1GB vmo created with |options|,
+// mapped at a 2MB aligned address so large pages can be used if the vmo has
+// them.
+static void random_access_benchmark(uint32_t options, const char* what) {
+    const size_t size = 1024 * 1024 * 1024;
+    const size_t align = 2 * 1024 * 1024;
+    const size_t accesses = 16 * 1024 * 1024;
+
+    mx_handle_t vmo;
+    if (mx_vmo_create(size, options, &vmo) != MX_OK) {
+        printf("\tfailed to create %s vmo of size %zu\n", what, size);
+        return;
+    }
+
+    mx_status_t status;
+    mx_time_t t = time_it([&](){
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0);
+    });
+    if (status != MX_OK) {
+        printf("\tfailed to commit %s vmo of size %zu: %d\n", what, size, status);
+        mx_handle_close(vmo);
+        return;
+    }
+    printf("\ttook %" PRIu64 " nsecs to commit %s vmo of size %zu\n", t, what, size);
+
+    // carve out a region with room to align the mapping within it
+    mx_handle_t vmar;
+    uintptr_t vmar_base;
+    status = mx_vmar_allocate(mx_vmar_root_self(), 0, size + align,
+                              MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_WRITE |
+                              MX_VM_FLAG_CAN_MAP_SPECIFIC, &vmar, &vmar_base);
+    if (status != MX_OK) {
+        printf("\tfailed to allocate vmar: %d\n", status);
+        mx_handle_close(vmo);
+        return;
+    }
+
+    uintptr_t ptr;
+    size_t offset = ((vmar_base + align - 1) & ~(align - 1)) - vmar_base;
+    status = mx_vmar_map(vmar, offset, vmo, 0, size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE | MX_VM_FLAG_SPECIFIC,
+                         &ptr);
+    if (status != MX_OK) {
+        printf("\tfailed to map %s vmo: %d\n", what, status);
+        mx_vmar_destroy(vmar);
+        mx_handle_close(vmar);
+        mx_handle_close(vmo);
+        return;
+    }
+
+    // fault the whole thing in so only tlb misses are measured
+    for (size_t i = 0; i < size; i += PAGE_SIZE) {
+        __UNUSED uint64_t a = ((volatile uint64_t *)ptr)[i / sizeof(uint64_t)];
+    }
+
+    uint64_t sum = 0;
+    t = time_it([&](){
+        // xorshift64, so the addresses defeat the prefetchers
+        uint64_t x = 88172645463325252ull;
+        const size_t mask = size / sizeof(uint64_t) - 1;
+        for (size_t i = 0; i < accesses; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += ((volatile uint64_t *)ptr)[x & mask];
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs for %zu random reads of %s vmo of size %zu "
+           "(%.1f ns/read, %.1f MB/s)\n",
+           t, accesses, what, size, (double)t / (double)accesses,
+           (double)(accesses * sizeof(uint64_t)) / ((double)t / 1e9) / (1024 * 1024));
+
+    mx_vmar_destroy(vmar);
+    mx_handle_close(vmar);
+    mx_handle_close(vmo);
+}
+
+// Time committing and decommitting a 4GB vmo with mx_vmo_op_range, both fully
+// populated and with a single page every 2MB, to measure the cost of walking
+// and updating the vmo's page list across a large range.
+static void large_range_benchmark() {
+    const uint64_t size = 4ull * 1024 * 1024 * 1024;
+    const uint64_t stride = 2 * 1024 * 1024;
+
+    mx_handle_t vmo;
+    if (mx_vmo_create(size, 0, &vmo) != MX_OK) {
+        printf("\tfailed to create vmo of size %" PRIu64 "\n", size);
+        return;
+    }
+
+    mx_status_t status;
+    mx_time_t t = time_it([&](){
+        for (uint64_t off = 0; off < size; off += stride) {
+            mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, off, PAGE_SIZE, nullptr, 0);
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs to sparsely commit %" PRIu64 " pages of vmo of size %" PRIu64
+           "\n", t, size / stride, size);
+
+    t = time_it([&](){
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, size, nullptr, 0);
+    });
+    printf("\ttook %" PRIu64 " nsecs to decommit sparse vmo of size %" PRIu64 "\n", t, size);
+
+    // the full commit needs 4GB of free memory, skip the rest if we don't have it
+    t = time_it([&](){
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0);
+    });
+    if (status != MX_OK) {
+        printf("\tfailed to commit vmo of size %" PRIu64 ": %d\n", size, status);
+        mx_handle_close(vmo);
+        return;
+    }
+    printf("\ttook %" PRIu64 " nsecs to commit vmo of size %" PRIu64 "\n", t, size);
+
+    t = time_it([&](){
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0);
+    });
+    printf("\ttook %" PRIu64 " nsecs to commit already committed vmo of size %" PRIu64 "\n",
+           t, size);
+
+    t = time_it([&](){
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, size, nullptr, 0);
+    });
+    printf("\ttook %" PRIu64 " nsecs to decommit vmo of size %" PRIu64 "\n", t, size);
+
+    mx_handle_close(vmo);
+}
+
 int vmo_run_benchmark() {
     mx_time_t t;
     //mx_handle_t vmo;
@@ -175,6 +304,14 @@ int vmo_run_benchmark() {
 
     mx_handle_close(vmo);
 
+    // random access over a large vmo, which is bound by tlb misses unless
+    // large pages are used
+    random_access_benchmark(0, "small page");
+    random_access_benchmark(MX_VMO_LARGE_PAGES, "large page");
+
+    // commit and decommit over ranges far larger than the ones above
+    large_range_benchmark();
+
     printf("done with benchmark\n");
 
     return 0;
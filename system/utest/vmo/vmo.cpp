@@ -956,6 +956,220 @@ bool vmo_cache_test() {
     END_TEST;
 }
 
+// Tests that a large page vmo behaves like any other when mapped at an aligned
+// address, including when parts of the large pages are unmapped or protected.
+bool vmo_large_pages_test() {
+    BEGIN_TEST;
+
+    const size_t large = 2 * 1024 * 1024;
+    const size_t size = 2 * large;
+
+    mx_handle_t vmo;
+    EXPECT_EQ(MX_ERR_INVALID_ARGS, mx_vmo_create(size, ~MX_VMO_LARGE_PAGES, &vmo),
+              "bad options");
+    ASSERT_EQ(MX_OK, mx_vmo_create(size, MX_VMO_LARGE_PAGES, &vmo), "vm_object_create");
+
+    // the contiguous allocation may fail, which only means small pages are used
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0),
+              "vm commit");
+
+    // map it at a large page aligned address
+    mx_handle_t vmar;
+    uintptr_t vmar_base;
+    ASSERT_EQ(MX_OK, mx_vmar_allocate(mx_vmar_root_self(), 0, size + large,
+                                      MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_WRITE |
+                                      MX_VM_FLAG_CAN_MAP_SPECIFIC, &vmar, &vmar_base),
+              "vmar allocate");
+    uintptr_t ptr;
+    size_t offset = ((vmar_base + large - 1) & ~(large - 1)) - vmar_base;
+    ASSERT_EQ(MX_OK, mx_vmar_map(vmar, offset, vmo, 0, size,
+                                 MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE |
+                                 MX_VM_FLAG_SPECIFIC, &ptr),
+              "map");
+
+    // see whether the commit got a physically contiguous first large page
+    static mx_paddr_t paddrs[large / PAGE_SIZE];
+    ASSERT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_LOOKUP, 0, large, paddrs, sizeof(paddrs)),
+              "lookup");
+    bool contiguous = (paddrs[0] & (large - 1)) == 0;
+    for (size_t i = 1; i < large / PAGE_SIZE; i++) {
+        if (paddrs[i] != paddrs[0] + i * PAGE_SIZE)
+            contiguous = false;
+    }
+
+    mx_info_task_stats_t before, after;
+    ASSERT_EQ(MX_OK, mx_object_get_info(mx_process_self(), MX_INFO_TASK_STATS,
+                                        &before, sizeof(before), nullptr, nullptr),
+              "task stats");
+
+    volatile uint32_t* words = reinterpret_cast<volatile uint32_t*>(ptr);
+    const size_t words_per_page = PAGE_SIZE / sizeof(uint32_t);
+    for (size_t i = 0; i < large / PAGE_SIZE; i++) {
+        words[i * words_per_page] = static_cast<uint32_t>(i);
+    }
+
+    ASSERT_EQ(MX_OK, mx_object_get_info(mx_process_self(), MX_INFO_TASK_STATS,
+                                        &after, sizeof(after), nullptr, nullptr),
+              "task stats");
+
+    // a large mapping takes a single fault for the whole first large page,
+    // where small pages would have taken one per page or fault-around window
+    if (contiguous) {
+        EXPECT_LE(after.page_faults - before.page_faults, 2u, "large page mapped");
+    } else {
+        unittest_printf("large page not contiguous, skipping the mapping check\n");
+    }
+
+    for (size_t i = large / PAGE_SIZE; i < size / PAGE_SIZE; i++) {
+        words[i * words_per_page] = static_cast<uint32_t>(i);
+    }
+
+    // punch a hole into the first large page and make part of the second one
+    // read-only, splitting both
+    EXPECT_EQ(MX_OK, mx_vmar_unmap(vmar, ptr + PAGE_SIZE, PAGE_SIZE), "unmap");
+    EXPECT_EQ(MX_OK, mx_vmar_protect(vmar, ptr + large + PAGE_SIZE, PAGE_SIZE,
+                                     MX_VM_FLAG_PERM_READ),
+              "protect");
+
+    for (size_t i = 0; i < size / PAGE_SIZE; i++) {
+        if (i == 1)
+            continue;
+        EXPECT_EQ(static_cast<uint32_t>(i), words[i * words_per_page], "read back");
+    }
+
+    // the rest of the first large page is still writable
+    words[0] = 1234;
+    EXPECT_EQ(1234u, words[0], "write after split");
+
+    uint32_t value;
+    size_t actual;
+    EXPECT_EQ(MX_OK, mx_vmo_read(vmo, &value, PAGE_SIZE, sizeof(value), &actual), "vmo read");
+    EXPECT_EQ(1u, value, "vmo contents under the hole");
+
+    EXPECT_EQ(MX_OK, mx_vmar_destroy(vmar), "vmar destroy");
+    EXPECT_EQ(MX_OK, mx_handle_close(vmar), "handle_close");
+    EXPECT_EQ(MX_OK, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
+// Tests the lock bookkeeping of discardable vmos. Whether the contents are
+// discarded depends on the memory pressure, so only the unpressured case is
+// checked.
+bool vmo_discardable_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+
+    // lock and unlock are only for discardable vmos
+    mx_handle_t vmo;
+    ASSERT_EQ(MX_OK, mx_vmo_create(size, 0, &vmo), "vm_object_create");
+    EXPECT_EQ(MX_ERR_NOT_SUPPORTED, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, nullptr, 0),
+              "lock plain vmo");
+    EXPECT_EQ(MX_ERR_NOT_SUPPORTED, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock plain vmo");
+    EXPECT_EQ(MX_OK, mx_handle_close(vmo), "handle_close");
+
+    ASSERT_EQ(MX_OK, mx_vmo_create(size, MX_VMO_DISCARDABLE, &vmo), "vm_object_create");
+
+    // starts out unlocked
+    EXPECT_EQ(MX_ERR_BAD_STATE, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock unlocked vmo");
+
+    // locks cover the whole vmo
+    EXPECT_EQ(MX_ERR_INVALID_ARGS,
+              mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, PAGE_SIZE, size - PAGE_SIZE, nullptr, 0),
+              "lock part of vmo");
+
+    uint32_t state = 1234;
+    EXPECT_EQ(MX_ERR_BUFFER_TOO_SMALL,
+              mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &state, sizeof(state) - 1),
+              "lock with short buffer");
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &state, sizeof(state)),
+              "lock");
+    EXPECT_EQ(MX_VMO_LOCK_KEPT, state, "fresh vmo not discarded");
+
+    // locks nest
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, nullptr, 0), "lock again");
+
+    char buf[PAGE_SIZE];
+    memset(buf, 0x5a, sizeof(buf));
+    size_t actual;
+    EXPECT_EQ(MX_OK, mx_vmo_write(vmo, buf, 0, sizeof(buf), &actual), "write");
+
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0), "unlock");
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0), "unlock");
+    EXPECT_EQ(MX_ERR_BAD_STATE, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock too often");
+
+    // whatever happened while it was unlocked, the contents match the state
+    EXPECT_EQ(MX_OK, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &state, sizeof(state)),
+              "relock");
+    char readback[PAGE_SIZE];
+    EXPECT_EQ(MX_OK, mx_vmo_read(vmo, readback, 0, sizeof(readback), &actual), "read");
+    if (state == MX_VMO_LOCK_DISCARDED) {
+        memset(buf, 0, sizeof(buf));
+    } else {
+        EXPECT_EQ(MX_VMO_LOCK_KEPT, state, "lock state");
+    }
+    EXPECT_EQ(0, memcmp(buf, readback, sizeof(buf)), "contents");
+
+    // locking and unlocking need the right to write
+    mx_handle_t read_only;
+    ASSERT_EQ(MX_OK, mx_handle_duplicate(vmo, MX_RIGHT_READ, &read_only), "duplicate");
+    EXPECT_EQ(MX_ERR_ACCESS_DENIED,
+              mx_vmo_op_range(read_only, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock without write right");
+    EXPECT_EQ(MX_ERR_ACCESS_DENIED,
+              mx_vmo_op_range(read_only, MX_VMO_OP_LOCK, 0, size, nullptr, 0),
+              "lock without write right");
+    EXPECT_EQ(MX_OK, mx_handle_close(read_only), "handle_close");
+
+    // discardable vmos can't be cloned
+    mx_handle_t clone;
+    EXPECT_EQ(MX_ERR_NOT_SUPPORTED,
+              mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone), "clone");
+
+    EXPECT_EQ(MX_OK, mx_handle_close(vmo), "handle_close");
+    END_TEST;
+}
+
+bool vmo_memory_pressure_event_test() {
+    BEGIN_TEST;
+
+    mx_handle_t event;
+    EXPECT_EQ(MX_ERR_INVALID_ARGS, mx_system_get_event(mx_job_default(), 0u, &event),
+              "bad kind");
+    EXPECT_EQ(MX_ERR_WRONG_TYPE,
+              mx_system_get_event(mx_process_self(), MX_SYSTEM_EVENT_MEMORY_PRESSURE_WARNING,
+                                  &event),
+              "not a job");
+
+    uint32_t kinds[] = {
+        MX_SYSTEM_EVENT_MEMORY_PRESSURE_WARNING,
+        MX_SYSTEM_EVENT_MEMORY_PRESSURE_CRITICAL,
+    };
+    for (uint32_t kind : kinds) {
+        ASSERT_EQ(MX_OK, mx_system_get_event(mx_job_default(), kind, &event), "get event");
+
+        // only the kernel can signal it
+        mx_rights_t rights = get_handle_rights(event);
+        EXPECT_EQ(0u, rights & MX_RIGHT_WRITE, "no write right");
+        EXPECT_EQ(MX_RIGHT_READ, rights & MX_RIGHT_READ, "read right");
+        EXPECT_EQ(MX_ERR_ACCESS_DENIED, mx_object_signal(event, 0u, MX_EVENT_SIGNALED),
+                  "signal");
+
+        // it can be waited on, whatever the current level
+        mx_signals_t pending;
+        mx_status_t status = mx_object_wait_one(event, MX_EVENT_SIGNALED, 0u, &pending);
+        EXPECT_TRUE(status == MX_OK || status == MX_ERR_TIMED_OUT, "wait");
+
+        EXPECT_EQ(MX_OK, mx_handle_close(event), "handle_close");
+    }
+
+    END_TEST;
+}
+
 bool vmo_decommit_misaligned_test() {
     BEGIN_TEST;
 
@@ -1140,6 +1354,9 @@ RUN_TEST(vmo_resize_test);
 RUN_TEST(vmo_rights_test);
 RUN_TEST(vmo_lookup_test);
 RUN_TEST(vmo_commit_test);
+RUN_TEST(vmo_large_pages_test);
+RUN_TEST(vmo_discardable_test);
+RUN_TEST(vmo_memory_pressure_event_test);
 RUN_TEST(vmo_decommit_misaligned_test);
 RUN_TEST(vmo_cache_test);
 RUN_TEST(vmo_zero_page_test);
@@ -50,7 +50,10 @@ int pthread_condattr_getclock(const pthread_condattr_t* restrict a, clockid_t* r
 }
 
 int pthread_mutexattr_getprotocol(const pthread_mutexattr_t* restrict a, int* restrict protocol) {
-    *protocol = PTHREAD_PRIO_NONE;
+    if (a->__attr & PTHREAD_MUTEX_PRIO_INHERIT_BIT)
+        *protocol = PTHREAD_PRIO_INHERIT;
+    else
+        *protocol = PTHREAD_PRIO_NONE;
     return 0;
 }
 int pthread_mutexattr_getrobust(const pthread_mutexattr_t* restrict a, int* restrict robust) {
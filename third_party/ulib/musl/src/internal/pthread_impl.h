@@ -126,6 +126,9 @@ static inline struct pthread* tp_to_pthread(void* tp) {
 // The bit used in the recursive and errorchecking cases, which track thread owners.
 #define PTHREAD_MUTEX_OWNED_LOCK_BIT 0x80000000
 #define PTHREAD_MUTEX_OWNED_LOCK_MASK 0x7fffffff
+// Set in the type of PTHREAD_PRIO_INHERIT mutexes. These track their owner
+// whatever their type, so that waiters can lend it their priority.
+#define PTHREAD_MUTEX_PRIO_INHERIT_BIT 8
 
 extern void* __pthread_tsd_main[];
 extern volatile size_t __pthread_tsd_size;
@@ -155,6 +158,11 @@ int __libc_sigprocmask(int, const sigset_t*, sigset_t*);
 int __timedwait(atomic_int*, int, clockid_t, const struct timespec*)
     ATTR_LIBC_VISIBILITY;
 
+// Like __timedwait, but lends the caller's priority to the thread |owner|
+// while waiting.
+int __timedwait_pi(atomic_int*, int, mx_handle_t owner, clockid_t, const struct timespec*)
+    ATTR_LIBC_VISIBILITY;
+
 // Loading a library can introduce more thread_local variables. Thread
 // allocation bases bookkeeping decisions based on the current state
 // of thread_locals in the program, so thread creation needs to be
@@ -8,9 +8,9 @@ int __clock_gettime(clockid_t, struct timespec*);
 
 #define NS_PER_S (1000000000ull)
 
-int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+static int __timedwait_deadline(clockid_t clk, const struct timespec* at, mx_time_t* deadline) {
     struct timespec to;
-    mx_time_t deadline = MX_TIME_INFINITE;
+    *deadline = MX_TIME_INFINITE;
 
     if (at) {
         if (at->tv_nsec >= NS_PER_S)
@@ -24,14 +24,17 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
         }
         if (to.tv_sec < 0)
             return ETIMEDOUT;
-        deadline = _mx_deadline_after(to.tv_sec * NS_PER_S + to.tv_nsec);
+        *deadline = _mx_deadline_after(to.tv_sec * NS_PER_S + to.tv_nsec);
     }
+    return 0;
+}
 
+static int __timedwait_result(mx_status_t status) {
     // mx_futex_wait will return MX_ERR_BAD_STATE if someone modifying *addr
     // races with this call. But this is indistinguishable from
     // otherwise being woken up just before someone else changes the
     // value. Therefore this functions returns 0 in that case.
-    switch (_mx_futex_wait(futex, val, deadline)) {
+    switch (status) {
     case MX_OK:
     case MX_ERR_BAD_STATE:
         return 0;
@@ -42,3 +45,32 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
         __builtin_trap();
     }
 }
+
+int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+    mx_time_t deadline;
+    int r = __timedwait_deadline(clk, at, &deadline);
+    if (r)
+        return r;
+
+    return __timedwait_result(_mx_futex_wait(futex, val, deadline));
+}
+
+int __timedwait_pi(atomic_int* futex, int val, mx_handle_t owner, clockid_t clk,
+                   const struct timespec* at) {
+    mx_time_t deadline;
+    int r = __timedwait_deadline(clk, at, &deadline);
+    if (r)
+        return r;
+
+    // Relocking a normal mutex we own is a deadlock, not an error.
+    if (owner == __thread_get_tid())
+        owner = MX_HANDLE_INVALID;
+
+    mx_status_t status = _mx_futex_wait_pi(futex, val, owner, deadline);
+    if (status == MX_ERR_BAD_HANDLE || status == MX_ERR_WRONG_TYPE) {
+        // The owner exited, and its handle is gone or was reused, since we
+        // read the lock word. There is nobody left to lend our priority to.
+        status = _mx_futex_wait(futex, val, deadline);
+    }
+    return __timedwait_result(status);
+}